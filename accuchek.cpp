@@ -0,0 +1,1541 @@
+
+/*
+
+     libaccuchek: download samples from a Roche accuchek device using libusb
+
+     see accuchek.h for the public API
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <loop.h>
+#include <lock.h>
+#include <buffers.h>
+#include <devcache.h>
+#include <schedule.h>
+#include <cache.h>
+#include <journal.h>
+#include <capture.h>
+#include <poll.h>
+#include <memory>
+#include <string>
+#include <time.h>
+#include <meter.h>
+#include <vector>
+#include <pipeline.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <inttypes.h>
+#include <accuchek.h>
+#include <unordered_map>
+#include <libusb-1.0/libusb.h>
+
+// config key value pair map
+using Config = std::unordered_map<
+    std::string,
+    std::string
+>;
+
+// globals
+static Config g_config;
+static DescriptorCache g_descriptors;
+static DurationHistory g_durations;
+
+// transfer buffers mapped from device memory per open device, more come from the heap
+static constexpr size_t kMappedBuffers = 16;
+
+// load config file
+static auto loadConfig(
+  const char *path
+) {
+  auto fp = fopen(path, "r");
+  if(0!=fp) {
+    size_t len = 0;
+    char *line = 0;
+    while(1) {
+
+      auto nbRead = getline(&line, &len, fp);
+      if(nbRead<0) {
+        break;
+      }
+      if(0==nbRead) {
+        continue;
+      }
+
+      auto p = line;
+      char *firstSep = 0;
+      char *secondSep = 0;
+      char *secondFirst = 0;
+      auto end = (nbRead + p);
+      while(p<end) {
+        auto c = p[0];
+        auto validChar = (
+          ('0'<=c && c<='9')  ||
+          ('A'<=c && c<='Z')  ||
+          ('a'<=c && c<='z')  ||
+          ('_'==c)
+        );
+        if(false==validChar) {
+          if(0==firstSep) {
+            firstSep = p;
+          } else {
+            if(0==secondSep && 0!=secondFirst) {
+              secondSep = p;
+            }
+          }
+        } else {
+          if(0!=firstSep) {
+            if(0==secondFirst) {
+              secondFirst = p;
+            }
+          }
+        }
+        ++p;
+      }
+      if(0==firstSep || 0==secondFirst || 0==secondSep) {
+        continue;
+      }
+
+      auto key = std::string(line, firstSep);
+      auto val = std::string(secondFirst, secondSep);
+      g_config[key] = val;
+    }
+    if(0!=line) {
+      free(line);
+    }
+    fclose(fp);
+  }
+}
+
+
+// a usb device (only things about the device we actually need)
+struct USBDevice {
+
+    // data
+    libusb_device *dev;
+    uint16_t vendorId;
+    uint16_t productId;
+    uint16_t release;
+    std::string vendor;
+    std::string product;
+    uint8_t sndEndPoint;
+    uint8_t rcvEndPoint;
+    uint8_t configValue;
+    uint8_t interfaceNumber;
+    uint8_t alternateSetting;
+    std::string busPath;
+    std::shared_ptr<DeviceLock> lock;
+    libusb_device_handle *devHandle;
+
+    // constructor, from descriptors read off the device or remembered (see devcache.h)
+    USBDevice(
+        libusb_device *_dev,
+        const DeviceDescriptors &descriptors
+    )
+        :   dev(_dev),
+            vendorId(descriptors.vendorId),
+            productId(descriptors.productId),
+            release(descriptors.release),
+            vendor(descriptors.vendor),
+            product(descriptors.product),
+            sndEndPoint(descriptors.sndEndPoint),
+            rcvEndPoint(descriptors.rcvEndPoint),
+            configValue(descriptors.configValue),
+            interfaceNumber(descriptors.interfaceNumber),
+            alternateSetting(descriptors.alternateSetting),
+            busPath(descriptors.busPath),
+            lock(new DeviceLock),
+            devHandle(0)
+    {
+        // increase refcount on libusb device handle
+        libusb_ref_device(dev);
+    }
+
+    // copy constructor
+    USBDevice(
+        const USBDevice &rhs
+    )
+        :   dev(rhs.dev),
+            vendorId(rhs.vendorId),
+            productId(rhs.productId),
+            release(rhs.release),
+            vendor(rhs.vendor),
+            product(rhs.product),
+            sndEndPoint(rhs.sndEndPoint),
+            rcvEndPoint(rhs.rcvEndPoint),
+            configValue(rhs.configValue),
+            interfaceNumber(rhs.interfaceNumber),
+            alternateSetting(rhs.alternateSetting),
+            busPath(rhs.busPath),
+            lock(rhs.lock),
+            devHandle(rhs.devHandle)
+    {
+        // increase refcount on libusb device handle
+        libusb_ref_device(dev);
+    }
+
+    // destructor
+    ~USBDevice() {
+        // decrease refcount on libusb device handle
+        libusb_unref_device(dev);
+    }
+
+    // show device specs
+    auto show(
+        const char *msg
+    ) {
+        LOG_NFO(
+            "%s:\n"
+            "\n"
+            "    bus number:    %d\n"
+            "    bus path:      %s\n"
+            "    dev address:   %d\n"
+            "    cfg value:     %d\n"
+            "    alt setting:   %d\n"
+            "    alt interface number: %d\n"
+            "    vendor:        (0x%04x) %s\n"
+            "    product:       (0x%04x) %s\n"
+            "    sndEndPnt:     %d\n"
+            "    rcvEndPnt:     %d\n"
+            ,
+            msg,
+            libusb_get_bus_number(dev),
+            busPath.c_str(),
+            libusb_get_device_address(dev),
+            (int)configValue,
+            (int)alternateSetting,
+            (int)interfaceNumber,
+            (int)vendorId,
+            vendor.c_str(),
+            (int)productId,
+            product.c_str(),
+            sndEndPoint,
+            rcvEndPoint
+        );
+    }
+};
+
+/*
+
+
+    syslog excerpt from an actual accuchek connecting:
+
+        May 26 14:35:34 machine kernel: [598051.987118] usb 3-1: new full-speed USB device number 59 using xhci_hcd
+        May 26 14:35:34 machine kernel: [598052.141001] usb 3-1: New USB device found, idVendor=173a, idProduct=21d5, bcdDevice= 1.00
+        May 26 14:35:34 machine kernel: [598052.141005] usb 3-1: New USB device strings: Mfr=1, Product=2, SerialNumber=0
+        May 26 14:35:34 machine kernel: [598052.141007] usb 3-1: Product: ACCU-CHEK Guide
+        May 26 14:35:34 machine kernel: [598052.141008] usb 3-1: Manufacturer: Roche
+        May 26 14:35:34 machine mtp-probe: checking bus 3, device 59: "/sys/devices/pci0000:00/0000:00:14.0/usb3/3-1"
+        May 26 14:35:34 machine mtp-probe: bus: 3, device: 59 was not an MTP device
+        May 26 14:35:34 machine mtp-probe: checking bus 3, device 59: "/sys/devices/pci0000:00/0000:00:14.0/usb3/3-1"
+        May 26 14:35:34 machine mtp-probe: bus: 3, device: 59 was not an MTP device
+
+    dump from a generic usb prober on the accuchek:
+
+        /dev/char/189:314
+        /dev/bus/usb/003/059
+        idVendor=173a
+        idProduct=21d5
+
+        examining USB device
+            device has 1 configs
+                examining config 0
+                config has 1 interfaces
+                    examining interface 0
+                    interface has 1 altSettings
+                        examining altsetting 0
+                        altSetting has 2 endpoints
+                            examining endpoint 0
+                            endpoint has packet size 64
+                            endpoint isInterruptType=0
+                            examining endpoint 1
+                            endpoint has packet size 64
+                            endpoint isInterruptType=0
+
+        ==> found valid accuchek device:
+            bus number:    3
+            dev address:   60
+            cfg value:     1
+            alt setting:   0
+            alt interface number: 0
+            vendor:        (0x173a) Roche
+            product:       (0x21d5) ACCU-CHEK Guide
+            sndEndPnt:     1
+            rcvEndPnt:     129
+
+    lsusb -v excerpt:
+
+        Bus 003Device 118: ID 173a:21d5 Roche
+        Device Descriptor:
+          bLength                18
+          bDescriptorType         1
+          bcdUSB               2.00
+          bDeviceClass            0
+          bDeviceSubClass         0
+          bDeviceProtocol         0
+          bMaxPacketSize0        64
+          idVendor           0x173a Roche
+          idProduct          0x21d5
+          bcdDevice            1.00
+          iManufacturer           1 Roche
+          iProduct                2 ACCU-CHEK Guide
+          iSerial                 0
+          bNumConfigurations      1
+          Configuration Descriptor:
+            bLength                 9
+            bDescriptorType         2
+            wTotalLength       0x0052
+            bNumInterfaces          1
+            bConfigurationValue     1
+            iConfiguration          3 FS configuration
+            bmAttributes         0x80
+              (Bus Powered)
+            MaxPower              100mA
+            Interface Descriptor:
+              bLength                 9
+              bDescriptorType         4
+              bInterfaceNumber        0
+              bAlternateSetting       0
+              bNumEndpoints           2
+              bInterfaceClass        15
+              bInterfaceSubClass      0
+              bInterfaceProtocol      0
+              iInterface              4 Personal Healthcare Device Class
+              ** UNRECOGNIZED:  04 20 02 00
+              ** UNRECOGNIZED:  06 30 00 01 11 10
+              Endpoint Descriptor:
+                bLength                 7
+                bDescriptorType         5
+                bEndpointAddress     0x81  EP 1 IN
+                bmAttributes            2
+                  Transfer Type            Bulk
+                  Synch Type               None
+                  Usage Type               Data
+                wMaxPacketSize     0x0040  1x 64 bytes
+                bInterval               0
+                DEVICE CLASS:  04 21 01 08
+                ** UNRECOGNIZED:  10 22 52 6f 63 68 65 20 50 48 44 43 20 54 78 00
+              Endpoint Descriptor:
+                bLength                 7
+                bDescriptorType         5
+                bEndpointAddress     0x01  EP 1 OUT
+                bmAttributes            2
+                  Transfer Type            Bulk
+                  Synch Type               None
+                  Usage Type               Data
+                wMaxPacketSize     0x0040  1x 64 bytes
+                bInterval               0
+                DEVICE CLASS:  04 21 01 08
+                ** UNRECOGNIZED:  10 22 52 6f 63 68 65 20 50 48 44 43 20 52 78 00
+
+    endpoints:
+
+        bEndpointAddress     0x81  EP 1 IN      (device to host)
+        bEndpointAddress     0x01  EP 1 OUT     (host to device)
+        rcvEndPnt:     129
+        sndEndPnt:     1
+
+
+*/
+
+// open the device chosen during detection phase and get it ready to talk
+static int openDevice(
+    USBDevice &usbDevice,
+    const char *lockDir
+) {
+    // keep other processes off it, or leave it to the one already there
+    auto &lock = *usbDevice.lock;
+    if(false==lock.acquire(lockDir, usbDevice.busPath.c_str())) {
+        return (lock.busy() ? ACCUCHEK_ERR_BUSY : ACCUCHEK_ERR_OPEN);
+    }
+
+    // open device
+    auto dev = usbDevice.dev;
+    libusb_device_handle *devHandle = 0;
+    auto fail0 = libusb_open(dev, &devHandle);
+    if(fail0) {
+        LOG_WRN("libusb_open failed on selected device -- giving up");
+        lock.release();
+        return ACCUCHEK_ERR_OPEN;
+    }
+
+    // detach whatever kernel driver may have been attached to it
+    libusb_detach_kernel_driver(
+        devHandle,
+        usbDevice.interfaceNumber
+    );
+
+    // load the configuration chosen during detection phase, claim
+    // interface and set alt setting chosen during detection phase on it
+    const char *failure = 0;
+    if(libusb_set_configuration(devHandle, usbDevice.configValue)<0) {
+        failure = "failed to configure selected device -- giving up";
+    } else if(libusb_claim_interface(devHandle, usbDevice.interfaceNumber)<0) {
+        failure = "failed to claim interface -- giving up";
+    } else if(libusb_set_interface_alt_setting(devHandle, usbDevice.interfaceNumber, usbDevice.alternateSetting)<0) {
+        failure = "failed to set alt setting -- giving up";
+    }
+    if(0!=failure) {
+        LOG_WRN("%s", failure);
+        libusb_close(devHandle);
+        lock.release();
+
+        // what we remembered about it may well be what's wrong, next scan takes a fresh look
+        g_descriptors.drop(usbDevice.vendorId, usbDevice.productId, usbDevice.release, usbDevice.busPath);
+        return ACCUCHEK_ERR_OPEN;
+    }
+    usbDevice.devHandle = devHandle;
+
+    // make some noise
+    LOG_NFO("using device snd endpoint = %d", usbDevice.sndEndPoint);
+    LOG_NFO("using device rcv endpoint = %d\n", usbDevice.rcvEndPoint);
+    return ACCUCHEK_OK;
+}
+
+// done talking to the device
+static void closeDevice(
+    USBDevice &usbDevice
+) {
+    LOG_NFO("closing usb device");
+    libusb_close(usbDevice.devHandle);
+    usbDevice.devHandle = 0;
+    usbDevice.lock->release();
+}
+
+// protocol step 1, before the meter says anything: a control transfer in
+#define PHASE_1 "initial control transfer in"
+
+// keep a copy of what went over the wire, before the meter session moves on
+static void recordTransfer(
+    CaptureWriter *capture,
+    uint32_t stream,
+    MeterSession &meter,
+    int transferred
+) {
+    if(0==capture || transferred<0) {
+        return;
+    }
+    capture->record(
+        stream,
+        (MeterSession::kReceive==meter.step()),
+        meter.buffer(),
+        transferred
+    );
+}
+
+// open an accuchek USB device and download data from it, one blocking transfer at a time
+static int operateDevice(
+    USBDevice &usbDevice,
+    const char *lockDir,
+    const AccuChekCallbacks *callbacks,
+    SegmentPipeline *pipeline,
+    SegmentCache *cache,
+    SegmentJournal *journal,
+    CaptureWriter *capture,
+    uint32_t stream
+) {
+    auto err = openDevice(usbDevice, lockDir);
+    if(ACCUCHEK_OK!=err) {
+        return err;
+    }
+    auto devHandle = usbDevice.devHandle;
+
+    // make sure the device gets closed whichever way we bail out
+    struct DeviceCloser {
+        USBDevice &usbDevice;
+        ~DeviceCloser() {
+            closeDevice(usbDevice);
+        }
+    } deviceCloser = { usbDevice };
+
+    // protocol step: do a control transfer in
+    {
+        LOG_NFO("phase 1: " PHASE_1);
+
+        uint8_t buffer[2];
+        auto bytesRead = libusb_control_transfer(
+            devHandle,
+            (
+                LIBUSB_REQUEST_TYPE_STANDARD |
+                LIBUSB_RECIPIENT_DEVICE      |
+                LIBUSB_ENDPOINT_IN
+            ),
+            LIBUSB_REQUEST_GET_STATUS,
+            0,
+            0,
+            buffer,
+            2,
+            5000
+        );
+        if(bytesRead<=0) {
+            LOG_WRN("failed " PHASE_1 " -- giving up");
+            LOG_WRN("libusb error was :%s", libusb_strerror(bytesRead));
+            return ACCUCHEK_ERR_TRANSFER;
+        }
+        LOG_NFO(PHASE_1 " succeeded");
+    }
+
+    // protocol steps: the meter session says what goes in or out next,
+    // through buffers that go back before the device gets closed
+    TransferBuffers buffers(devHandle, kMappedBuffers);
+    MeterSession meter(callbacks, pipeline, cache, &buffers, journal);
+    while(MeterSession::kDone!=meter.step()) {
+        auto receiving = (MeterSession::kReceive==meter.step());
+        int transferred = 0;
+        auto fail = libusb_bulk_transfer(
+            devHandle,              // device
+            (                       // endpoint
+                receiving           ?
+                usbDevice.rcvEndPoint :
+                usbDevice.sndEndPoint
+            ),
+            meter.buffer(),         // content
+            meter.size(),           // content size, or max content length
+            &transferred,           // actual number of bytes moved
+            5000                    // timeout in ms
+        );
+        if(0!=fail) {
+            LOG_WRN("libusb error was :%s", libusb_strerror(fail));
+            transferred = -1;
+        }
+        recordTransfer(capture, stream, meter, transferred);
+        meter.advance(transferred);
+    }
+
+    // segments still down the pipe hold buffers
+    if(0!=pipeline) {
+        pipeline->finish();
+    }
+
+    // protocol step: device gets closed by deviceCloser
+    return meter.result();
+}
+
+// is vendorId:deviceId in the list of known devices
+static auto isDeviceValid(
+    uint32_t vendorId,
+    uint32_t deviceId
+) {
+    char key[1024];
+    snprintf(
+        key,
+        sizeof(key),
+        "vendor_0x%04x_device_0x%04x",
+        vendorId,
+        deviceId
+    );
+    static const auto valid = std::string("1");
+    return (0!=g_config.count(key) && valid==g_config[key]);
+}
+
+// where a device is plugged in, kernel style (see lock.h)
+static auto busPathOf(
+    libusb_device *dev
+) {
+    uint8_t ports[8];
+    auto nbPorts = libusb_get_port_numbers(dev, ports, sizeof(ports));
+    return DeviceLock::busPath(libusb_get_bus_number(dev), ports, std::max(0, nbPorts));
+}
+
+// process one USB device and add it to the list if it matches requirements
+static auto addDeviceIfAccuChek(
+    std::vector<USBDevice> &validDevices,
+    libusb_device *dev
+) {
+
+    // get USB device description (libusb has it at hand, no transfer involved)
+    libusb_device_descriptor dsc;
+    auto fail = libusb_get_device_descriptor(dev, &dsc);
+    if(0!=fail) {
+        LOG_WRN("libusb_get_device_descriptor failed");
+        return;
+    }
+
+    // a meter we already know, at the same place: no need to read the rest off the bus
+    auto busPath = busPathOf(dev);
+    DeviceDescriptors descriptors;
+    if(g_descriptors.find(dsc.idVendor, dsc.idProduct, dsc.bcdDevice, busPath, descriptors)) {
+        if(isDeviceValid(dsc.idVendor, dsc.idProduct)) {
+            LOG_NFO("========> found a known USB device at %s", busPath.c_str());
+            validDevices.emplace_back(dev, descriptors);
+        }
+        return;
+    }
+
+    // ugly trick to "goto done" over declarations using a break
+    struct libusb_config_descriptor *cfg = 0;
+    do {
+
+        // accuchek has one config, anything with more or less is a bust
+        if(1!=dsc.bNumConfigurations) {
+            LOG_NFO("not a match, too many configs to be an accuchek");
+            break;
+        }
+
+        // load first config
+        auto confIndex = 0;
+        auto fail0 = libusb_get_config_descriptor(dev, confIndex, &cfg);
+        if(0!=fail0) {
+            LOG_WRN("libusb_get_device_descriptor failed");
+            break;
+        }
+
+        // accuchek single config has one interface, anything with more or less is a bust
+        if(1!=cfg->bNumInterfaces) {
+            LOG_NFO("not a match, too many interfaces to be an accuchek");
+            break;
+        }
+
+        // look at all "alt settings" for first interface
+        auto interfaceIndex = 0;
+        auto interface = &(cfg->interface[interfaceIndex]);
+
+        // accuchek single config has one alt setting, anything with more or less is a bust
+        if(1!=interface->num_altsetting) {
+            LOG_NFO("not a match, too many alt settings to be an accuchek");
+            break;
+        }
+
+        // accuchek has two endpoints, anything with more or less is a bust
+        int altSettingIndex = 0;
+        auto altSetting = &(interface->altsetting[altSettingIndex]);
+        if(2!=altSetting->bNumEndpoints) {
+            LOG_NFO("not a match, too many endpoints to be an accuchek");
+            break;
+        }
+
+        // look for endpoints on altsetting that match our criteria
+        auto in = 0;    // 0 is an invalid endpoint
+        auto out = 0;   // 0 is an invalid endpoint
+        for(auto endPointIndex=0; endPointIndex<altSetting->bNumEndpoints; ++endPointIndex) {
+            // accuchek endpoints should both have a max packet size of 64
+            auto endPoint = &(altSetting->endpoint[endPointIndex]);
+            if(64==endPoint->wMaxPacketSize) {
+                // device must be non-interrupt type
+                auto attributes = (endPoint->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK);
+                auto isInterrupt = (LIBUSB_TRANSFER_TYPE_INTERRUPT==attributes);
+                if(false==isInterrupt) {
+                    // LIBUSB_ENDPOINT_IN means endpoint is used to transfer date from the device to the host
+                    auto isInput = (LIBUSB_ENDPOINT_IN & endPoint->bEndpointAddress);
+                    if(isInput) {
+                        in = endPoint->bEndpointAddress;
+                    } else {
+                        out = endPoint->bEndpointAddress;
+                    }
+                }
+            }
+        }
+
+        // skip devices that dont have at least one input and one output
+        auto ok = (0!=in && 0!=out);
+        if(false==ok) {
+            LOG_NFO("not a match, need at least one input endpoint and one output endpoint");
+            break;
+        }
+
+        // we found a device seems to fit the bill, open it
+        LOG_NFO("found a usb device that looks good, checking further by opening it");
+        libusb_device_handle *devHandle = 0;
+        auto fail1 = libusb_open(dev, &devHandle);
+        if(fail1) {
+            LOG_WRN("libusb_open failed, giving up");
+            break;
+        }
+
+        // get device vendor
+        char vendor[512];
+        memset(vendor, 0, sizeof(vendor));
+        auto r0 = libusb_get_string_descriptor_ascii(
+            devHandle,
+            dsc.iManufacturer,
+            (uint8_t*)vendor,
+            (-1+sizeof(vendor))
+        );
+        if(r0<0) {
+            LOG_NFO("not a match, vendorId unreadable");
+            libusb_close(devHandle);
+            break;
+        }
+
+        // get product id
+        char product[512];
+        memset(product, 0, sizeof(product));
+        auto r1 = libusb_get_string_descriptor_ascii(
+            devHandle,
+            dsc.iProduct,
+            (uint8_t*)product,
+            (-1+sizeof(product))
+        );
+        if(r1<0) {
+            LOG_NFO("not a match, productId unreadable");
+            libusb_close(devHandle);
+            break;
+        }
+
+        // check that device and vendor is in list of known devices
+        if(isDeviceValid(dsc.idVendor, dsc.idProduct)) {
+            // we have a new valid device, add it to the list, and remember it for next time
+            LOG_NFO("========> found a matching USB device");
+            descriptors.vendorId = dsc.idVendor;
+            descriptors.productId = dsc.idProduct;
+            descriptors.release = dsc.bcdDevice;
+            descriptors.busPath = busPath;
+            descriptors.sndEndPoint = out;
+            descriptors.rcvEndPoint = in;
+            descriptors.configValue = cfg->bConfigurationValue;
+            descriptors.interfaceNumber = altSetting->bInterfaceNumber;
+            descriptors.alternateSetting = altSetting->bAlternateSetting;
+            descriptors.vendor = vendor;
+            descriptors.product = product;
+            g_descriptors.add(descriptors);
+            validDevices.emplace_back(dev, descriptors);
+        } else {
+            LOG_NFO(
+                "nope: looks like it, but thats not the one. this device has mfgr=%s device=%s\n",
+                vendor,
+                product
+            );
+        }
+        libusb_close(devHandle);
+    } while(0);
+
+    // free config data structure
+done:
+    libusb_free_config_descriptor(cfg);
+}
+
+// find all possible accuchek devices
+static auto findAccuCheks(
+    libusb_context *libUSBContext,
+    std::vector<USBDevice> &validDevices
+) {
+
+    // obtain a list of all USB devices in the system
+    libusb_device **devices = 0;
+    LOG_NFO("getting list of all USB devices in system from libusb");
+    auto count = libusb_get_device_list(libUSBContext, &devices);
+    LOG_NFO("found %d USB devices in system", (int)count);
+
+    // check them one by one and add to the list if specs are a match
+    LOG_NFO("searching for valid accuchek devices");
+    for(int i=0; i<count; ++i) {
+        LOG_NFO("checking if device %d is an accuchek", (int)i);
+        addDeviceIfAccuChek(validDevices, devices[i]);
+    }
+
+    // clean up device list
+    libusb_free_device_list(devices, 1);
+
+    // make some noise
+    LOG_NFO(
+        "found altogether %d accuchek devices",
+        (int)validDevices.size()
+    );
+}
+
+// open libusb, return handle
+static auto openLibUSB() {
+
+    LOG_NFO("opening libusb");
+
+    // init libusb
+    libusb_context *libUSBContext = 0;
+    auto fail = libusb_init(&libUSBContext);
+    if(0!=fail || 0==libUSBContext) {
+        LOG_WRN("libusb init failure");
+        return (libusb_context *)0;
+    }
+    // turn libusb debug on
+    #if 0
+        #if 0
+            enum libusb_log_level {
+                LIBUSB_LOG_LEVEL_NONE = 0,
+                LIBUSB_LOG_LEVEL_ERROR = 1,
+                LIBUSB_LOG_LEVEL_WARNING = 2,
+                LIBUSB_LOG_LEVEL_INFO = 3,
+                LIBUSB_LOG_LEVEL_DEBUG = 4,
+            };
+            enum libusb_option {
+                    LIBUSB_OPTION_LOG_LEVEL = 0,
+                    LIBUSB_OPTION_USE_USBDK = 1,
+            };
+        #endif
+        libusb_set_option(
+            libUSBContext,
+            LIBUSB_OPTION_LOG_LEVEL,
+            LIBUSB_LOG_LEVEL_DEBUG
+        );
+    #endif
+
+    LOG_NFO("libusb opened OK");
+    return libUSBContext;
+}
+
+// close libusb
+static auto closeLibUSB(
+    libusb_context *libUSBContext
+) {
+    LOG_NFO("closing libusb");
+    libusb_exit(libUSBContext);
+}
+
+// a library session: libusb context and the devices found when it was opened
+struct AccuChekSession {
+    libusb_context *libUSBContext;
+    std::vector<USBDevice> devices;
+    EventLoop *loop;        // driving async downloads, if any
+    uint64_t usbTimer;      // when libusb next needs to handle events
+    int64_t usbDue;
+    int pipelineDepth;      // raw segments queued by pipelined downloads, 0 if not pipelined
+    bool pipelined;         // pipelineStats hold something
+    AccuChekPipelineStats pipelineStats;
+    std::string cacheDir;   // where segment digest caches go, empty if not caching
+    CaptureWriter capture;  // recording transfers, if open
+    std::string lockDir;    // where per-device lock files go
+    int perHub;             // downloads at once behind any one hub when downloading from all, 0: no limit
+    std::string journalDir; // where segment journals go, empty if not journaling
+    JournalDigests recovered;               // segments handed out of journals already
+    std::vector<std::string> retired;       // journals to remove once the session closes
+    std::unordered_map<int, std::unique_ptr<SegmentCache>> staged;  // per device, of downloads that went through
+};
+
+// where to record transfers, if anywhere
+static CaptureWriter *captureOf(
+    AccuChekSession *session
+) {
+    return (session->capture.isOpen() ? &session->capture : 0);
+}
+
+// segment digest cache for one download, if the session keeps them
+static SegmentCache *newCache(
+    const AccuChekSession *session
+) {
+    return (session->cacheDir.empty() ? 0 : new SegmentCache(session->cacheDir.c_str()));
+}
+
+// a download is over: the digests of one that went through wait for the caller to have
+// dealt with its samples (see accuchek_commit_segment_cache), one that didn't are dropped
+static void stageCache(
+    AccuChekSession *session,
+    int index,
+    std::unique_ptr<SegmentCache> cache,
+    int result
+) {
+    if(ACCUCHEK_OK==result && cache) {
+        session->staged[index] = std::move(cache);
+    }
+}
+
+// segment journal for one download, if the session keeps them
+static SegmentJournal *newJournal(
+    const AccuChekSession *session
+) {
+    return (session->journalDir.empty() ? 0 : new SegmentJournal(session->journalDir.c_str(), &session->recovered));
+}
+
+// a download is over: a journal that went through gets removed with the session, one that
+// didn't stays for the next run to recover from
+static void finishJournal(
+    AccuChekSession *session,
+    SegmentJournal *journal,
+    int result
+) {
+    if(0==journal || journal->path().empty()) {
+        return;
+    }
+    auto &retired = session->retired;
+    auto known = std::find(retired.begin(), retired.end(), journal->path());
+    if(ACCUCHEK_OK==result && journal->complete()) {
+        if(retired.end()==known) {
+            retired.push_back(journal->path());
+        }
+        return;
+    }
+    journal->commit();
+    if(retired.end()!=known) {
+        retired.erase(known);
+    }
+}
+
+AccuChekSession *accuchek_open(
+    const char *configPath,
+    int verbose
+) {
+    // be silent unless asked to talk
+    gQuiet = (0==verbose);
+
+    // load config file
+    loadConfig(configPath ? configPath : "config.txt");
+
+    // open libusb
+    auto libUSBContext = openLibUSB();
+    if(0==libUSBContext) {
+        return 0;
+    }
+
+    // scan for devices
+    auto session = new AccuChekSession;
+    session->libUSBContext = libUSBContext;
+    session->loop = 0;
+    session->usbTimer = 0;
+    session->usbDue = 0;
+    session->pipelineDepth = 0;
+    session->pipelined = false;
+    memset(&session->pipelineStats, 0, sizeof(session->pipelineStats));
+    session->lockDir = DeviceLock::defaultDir();
+    session->perHub = 0;
+    findAccuCheks(libUSBContext, session->devices);
+    return session;
+}
+
+int accuchek_device_count(
+    const AccuChekSession *session
+) {
+    return int(session->devices.size());
+}
+
+int accuchek_device_info(
+    const AccuChekSession *session,
+    int index,
+    AccuChekDeviceInfo *info
+) {
+    if(index<0 || accuchek_device_count(session)<=index) {
+        return ACCUCHEK_ERR_NO_DEVICE;
+    }
+
+    auto &device = session->devices[index];
+    info->vendorId = device.vendorId;
+    info->productId = device.productId;
+    info->busNumber = libusb_get_bus_number(device.dev);
+    info->deviceAddress = libusb_get_device_address(device.dev);
+    info->vendor = device.vendor.c_str();
+    info->product = device.product.c_str();
+    info->busPath = device.busPath.c_str();
+    return ACCUCHEK_OK;
+}
+
+int accuchek_download(
+    AccuChekSession *session,
+    int index,
+    const AccuChekCallbacks *callbacks
+) {
+    if(index<0 || accuchek_device_count(session)<=index) {
+        return ACCUCHEK_ERR_NO_DEVICE;
+    }
+
+    // show details of selected device as gathered from libusb
+    char buf[256];
+    sprintf(
+        buf,
+        "selecting accuchek device #%d:",
+        (int)index
+    );
+    auto &selectedDevice = session->devices[index];
+    selectedDevice.show(buf);
+
+    // talk to device to download data from it, decoding and calling back in line
+    std::unique_ptr<SegmentCache> cache(newCache(session));
+    std::unique_ptr<SegmentJournal> journal(newJournal(session));
+    auto started = EventLoop::now();
+    auto result = int(ACCUCHEK_OK);
+    if(0==session->pipelineDepth) {
+        result = operateDevice(selectedDevice, session->lockDir.c_str(), callbacks, 0, cache.get(), journal.get(), captureOf(session), index);
+    } else {
+
+        // or leave decoding and callbacks to other threads, and wait for them once done
+        SegmentPipeline pipeline(callbacks, session->pipelineDepth);
+        result = operateDevice(selectedDevice, session->lockDir.c_str(), callbacks, &pipeline, cache.get(), journal.get(), captureOf(session), index);
+        pipeline.finish();
+        pipeline.stats(session->pipelineStats);
+        session->pipelined = true;
+    }
+
+    // everything went through, next download can skip it once committed, and the next schedule knows how long it takes
+    finishJournal(session, journal.get(), result);
+    stageCache(session, index, std::move(cache), result);
+    if(ACCUCHEK_OK==result) {
+        g_durations.record(selectedDevice.busPath, 1e-3*(EventLoop::now() - started));
+    }
+    return result;
+}
+
+int accuchek_set_capture(
+    AccuChekSession *session,
+    const char *path
+) {
+    if(0==path) {
+        session->capture.close();
+        return ACCUCHEK_OK;
+    }
+    return (session->capture.open(path) ? ACCUCHEK_OK : ACCUCHEK_ERR_OPEN);
+}
+
+void accuchek_set_descriptor_cache(
+    const char *path
+) {
+    g_descriptors.open(path);
+}
+
+void accuchek_set_durations(
+    const char *path
+) {
+    g_durations.open(path);
+}
+
+void accuchek_set_per_hub(
+    AccuChekSession *session,
+    int perHub
+) {
+    session->perHub = std::max(0, perHub);
+}
+
+void accuchek_set_lock_dir(
+    AccuChekSession *session,
+    const char *dir
+) {
+    session->lockDir = (0==dir ? DeviceLock::defaultDir() : dir);
+}
+
+void accuchek_set_segment_cache(
+    AccuChekSession *session,
+    const char *dir
+) {
+    session->cacheDir = (0==dir ? "" : dir);
+}
+
+int accuchek_commit_segment_cache(
+    AccuChekSession *session,
+    int index
+) {
+    // what the caller kept of those downloads is safe: the next ones can skip it
+    auto ok = true;
+    for(auto staged=session->staged.begin(); staged!=session->staged.end();) {
+        if(0<=index && index!=staged->first) {
+            ++staged;
+            continue;
+        }
+        ok = staged->second->save() && ok;
+        staged = session->staged.erase(staged);
+    }
+    return (ok ? ACCUCHEK_OK : ACCUCHEK_ERR_OPEN);
+}
+
+void accuchek_set_journal(
+    AccuChekSession *session,
+    const char *dir
+) {
+    session->journalDir = (0==dir ? "" : dir);
+}
+
+int accuchek_recover(
+    AccuChekSession *session,
+    const AccuChekCallbacks *callbacks
+) {
+    if(session->journalDir.empty()) {
+        return 0;
+    }
+    std::vector<std::string> paths;
+    auto nbSamples = SegmentJournal::recover(session->journalDir.c_str(), callbacks, session->recovered, paths);
+    for(auto &path:paths) {
+        if(session->retired.end()==std::find(session->retired.begin(), session->retired.end(), path)) {
+            session->retired.push_back(path);
+        }
+    }
+    return int(nbSamples);
+}
+
+void accuchek_set_pipeline(
+    AccuChekSession *session,
+    int depth
+) {
+    session->pipelineDepth = std::max(0, depth);
+}
+
+int accuchek_pipeline_stats(
+    const AccuChekSession *session,
+    AccuChekPipelineStats *stats
+) {
+    if(false==session->pipelined) {
+        return ACCUCHEK_ERR_NO_DEVICE;
+    }
+    *stats = session->pipelineStats;
+    return ACCUCHEK_OK;
+}
+
+/*
+
+    downloads driven by an event loop
+
+    libusb's fds join the loop's epoll set, and its timeouts become loop
+    timers (unless libusb handles them through a timerfd of its own).
+    each download keeps a single asynchronous transfer in flight, and
+    moves its meter session along from the transfer callback. dozens of
+    meters, sockets and timers all share the one thread running the loop.
+
+*/
+
+static void handleUSBEvents(AccuChekSession *session);
+
+// have libusb handle events ms from now, or sooner if that was the plan already
+static void scheduleUSBEvents(
+    AccuChekSession *session,
+    int64_t ms
+) {
+    auto due = (EventLoop::now() + ms);
+    if(0!=session->usbTimer && session->usbDue<=due) {
+        return;
+    }
+    session->loop->cancel(session->usbTimer);
+    session->usbDue = due;
+    session->usbTimer = session->loop->after(
+        ms,
+        [session]() {
+            session->usbTimer = 0;
+            handleUSBEvents(session);
+        }
+    );
+}
+
+// wake libusb up when its next transfer times out
+static void armUSBTimeouts(
+    AccuChekSession *session
+) {
+    if(libusb_pollfds_handle_timeouts(session->libUSBContext)) {
+        return;
+    }
+    struct timeval tv;
+    if(1==libusb_get_next_timeout(session->libUSBContext, &tv)) {
+        scheduleUSBEvents(session, tv.tv_sec*1000ll + (tv.tv_usec + 999)/1000);
+    }
+}
+
+// let libusb complete transfers and run their callbacks, without blocking
+static void handleUSBEvents(
+    AccuChekSession *session
+) {
+    struct timeval zero = { 0, 0 };
+    libusb_handle_events_timeout_completed(session->libUSBContext, &zero, 0);
+    armUSBTimeouts(session);
+}
+
+// libusb opened an fd: watch it, all of them wake up the same handler once per round
+static void LIBUSB_CALL onPollfdAdded(
+    int fd,
+    short events,
+    void *user
+) {
+    auto session = (AccuChekSession *)user;
+    session->loop->watch(
+        fd,
+        (
+            ((POLLIN & events) ? uint32_t(EPOLLIN) : uint32_t(0)) |
+            ((POLLOUT & events) ? uint32_t(EPOLLOUT) : uint32_t(0))
+        ),
+        [session](uint32_t) {
+            scheduleUSBEvents(session, 0);
+        }
+    );
+}
+
+// libusb closed an fd
+static void LIBUSB_CALL onPollfdRemoved(
+    int fd,
+    void *user
+) {
+    auto session = (AccuChekSession *)user;
+    session->loop->unwatch(fd);
+}
+
+// make loop the one driving the session's libusb context
+static int attachLoop(
+    AccuChekSession *session,
+    EventLoop &loop
+) {
+    if(&loop==session->loop) {
+        return ACCUCHEK_OK;
+    }
+    if(0!=session->loop) {
+        LOG_WRN("session already runs on another event loop");
+        return ACCUCHEK_ERR_LIBUSB;
+    }
+    auto pollfds = libusb_get_pollfds(session->libUSBContext);
+    if(0==pollfds) {
+        LOG_WRN("libusb can't hand out its fds on this platform");
+        return ACCUCHEK_ERR_LIBUSB;
+    }
+    session->loop = &loop;
+    for(auto p=pollfds; 0!=*p; ++p) {
+        onPollfdAdded((*p)->fd, (*p)->events, session);
+    }
+    libusb_free_pollfds(pollfds);
+    libusb_set_pollfd_notifiers(session->libUSBContext, onPollfdAdded, onPollfdRemoved, session);
+    return ACCUCHEK_OK;
+}
+
+// hand the session's libusb context back
+static void detachLoop(
+    AccuChekSession *session
+) {
+    if(0==session->loop) {
+        return;
+    }
+    libusb_set_pollfd_notifiers(session->libUSBContext, 0, 0, 0);
+    auto pollfds = libusb_get_pollfds(session->libUSBContext);
+    for(auto p=pollfds; 0!=p && 0!=*p; ++p) {
+        session->loop->unwatch((*p)->fd);
+    }
+    libusb_free_pollfds(pollfds);
+    session->loop->cancel(session->usbTimer);
+    session->usbTimer = 0;
+    session->loop = 0;
+}
+
+// one download in flight
+struct AsyncDownload {
+    AccuChekSession *session;
+    USBDevice *device;
+    int index;
+    const AccuChekCallbacks *callbacks;
+    std::function<void(int result)> done;
+    std::unique_ptr<SegmentCache> cache;
+    std::unique_ptr<SegmentJournal> journal;
+    std::unique_ptr<TransferBuffers> buffers;
+    std::unique_ptr<MeterSession> meter;
+    libusb_transfer *transfer;
+    int64_t started;
+    uint8_t control[LIBUSB_CONTROL_SETUP_SIZE + 2];
+};
+
+// wrap up, outside of libusb's event handling: done may well close the session
+static void finishDownload(
+    AsyncDownload *download,
+    int result
+) {
+    download->session->loop->after(
+        0,
+        [download, result]() {
+            download->meter.reset();
+            download->buffers.reset();
+            closeDevice(*download->device);
+            finishJournal(download->session, download->journal.get(), result);
+            if(ACCUCHEK_OK==result) {
+                g_durations.record(download->device->busPath, 1e-3*(EventLoop::now() - download->started));
+            }
+            stageCache(download->session, download->index, std::move(download->cache), result);
+            libusb_free_transfer(download->transfer);
+            auto done = std::move(download->done);
+            delete download;
+            done(result);
+        }
+    );
+}
+
+static void LIBUSB_CALL onTransfer(libusb_transfer *transfer);
+
+// submit the transfer the meter session waits for
+static void submitNext(
+    AsyncDownload *download
+) {
+    auto &meter = *download->meter;
+    if(MeterSession::kDone==meter.step()) {
+        finishDownload(download, meter.result());
+        return;
+    }
+    auto &usbDevice = *download->device;
+    libusb_fill_bulk_transfer(
+        download->transfer,
+        usbDevice.devHandle,
+        (
+            MeterSession::kReceive==meter.step() ?
+            usbDevice.rcvEndPoint :
+            usbDevice.sndEndPoint
+        ),
+        meter.buffer(),
+        int(meter.size()),
+        onTransfer,
+        download,
+        5000
+    );
+    auto fail = libusb_submit_transfer(download->transfer);
+    if(0!=fail) {
+        LOG_WRN("libusb error was :%s", libusb_strerror(fail));
+        meter.advance(-1);
+        finishDownload(download, meter.result());
+        return;
+    }
+    armUSBTimeouts(download->session);
+}
+
+// a transfer is over, move on
+static void LIBUSB_CALL onTransfer(
+    libusb_transfer *transfer
+) {
+    auto download = (AsyncDownload *)transfer->user_data;
+    auto ok = (LIBUSB_TRANSFER_COMPLETED==transfer->status);
+    if(false==ok) {
+        LOG_WRN("libusb transfer status was %d", (int)transfer->status);
+    }
+
+    // protocol step 1 done, the meter session takes it from here
+    if(0==download->meter) {
+        if(false==ok || transfer->actual_length<=0) {
+            LOG_WRN("failed " PHASE_1 " -- giving up");
+            finishDownload(download, ACCUCHEK_ERR_TRANSFER);
+            return;
+        }
+        LOG_NFO(PHASE_1 " succeeded");
+        download->meter.reset(new MeterSession(download->callbacks, 0, download->cache.get(), download->buffers.get(), download->journal.get()));
+        submitNext(download);
+        return;
+    }
+    auto transferred = (ok ? transfer->actual_length : -1);
+    recordTransfer(captureOf(download->session), download->index, *download->meter, transferred);
+    download->meter->advance(transferred);
+    submitNext(download);
+}
+
+int accuchek_download_start(
+    AccuChekSession *session,
+    int index,
+    const AccuChekCallbacks *callbacks,
+    EventLoop &loop,
+    std::function<void(int result)> done
+) {
+    if(index<0 || accuchek_device_count(session)<=index) {
+        return ACCUCHEK_ERR_NO_DEVICE;
+    }
+    auto &selectedDevice = session->devices[index];
+    if(0!=selectedDevice.devHandle) {
+        LOG_WRN("accuchek device #%d is busy", index);
+        return ACCUCHEK_ERR_OPEN;
+    }
+    auto err = attachLoop(session, loop);
+    if(ACCUCHEK_OK!=err) {
+        return err;
+    }
+
+    // show details of selected device as gathered from libusb
+    char buf[256];
+    sprintf(
+        buf,
+        "selecting accuchek device #%d:",
+        (int)index
+    );
+    selectedDevice.show(buf);
+
+    // opening is synchronous, libusb has nothing else for it
+    err = openDevice(selectedDevice, session->lockDir.c_str());
+    if(ACCUCHEK_OK!=err) {
+        return err;
+    }
+
+    // protocol step: do a control transfer in, the rest follows from its callback
+    LOG_NFO("phase 1: " PHASE_1);
+    auto download = new AsyncDownload;
+    download->session = session;
+    download->device = &selectedDevice;
+    download->index = index;
+    download->callbacks = callbacks;
+    download->done = std::move(done);
+    download->cache.reset(newCache(session));
+    download->journal.reset(newJournal(session));
+    download->buffers.reset(new TransferBuffers(selectedDevice.devHandle, kMappedBuffers));
+    download->transfer = libusb_alloc_transfer(0);
+    download->started = EventLoop::now();
+    libusb_fill_control_setup(
+        download->control,
+        (
+            LIBUSB_REQUEST_TYPE_STANDARD |
+            LIBUSB_RECIPIENT_DEVICE      |
+            LIBUSB_ENDPOINT_IN
+        ),
+        LIBUSB_REQUEST_GET_STATUS,
+        0,
+        0,
+        2
+    );
+    libusb_fill_control_transfer(
+        download->transfer,
+        selectedDevice.devHandle,
+        download->control,
+        onTransfer,
+        download,
+        5000
+    );
+    auto fail = libusb_submit_transfer(download->transfer);
+    if(0!=fail) {
+        LOG_WRN("failed " PHASE_1 " -- giving up");
+        LOG_WRN("libusb error was :%s", libusb_strerror(fail));
+        download->buffers.reset();
+        closeDevice(selectedDevice);
+        libusb_free_transfer(download->transfer);
+        delete download;
+        return ACCUCHEK_ERR_TRANSFER;
+    }
+    armUSBTimeouts(session);
+    return ACCUCHEK_OK;
+}
+
+// downloads from every device of a session, as many at once as hubs allow
+struct ScheduledDownloads {
+    AccuChekSession *session;
+    const AccuChekCallbacks *callbacks;
+    EventLoop *loop;
+    DownloadScheduler scheduler;
+    int running;
+    std::function<void(int index, int result)> each;
+    std::function<void()> done;
+};
+
+// start whatever may start, wrap up once everything is over
+static void startScheduled(
+    ScheduledDownloads *round
+) {
+    auto &scheduler = round->scheduler;
+    for(auto i=scheduler.next(); 0<=i; i=scheduler.next()) {
+        LOG_NFO(
+            "starting download #%d at %s, %d others running, %d waiting",
+            i,
+            round->session->devices[i].busPath.c_str(),
+            round->running,
+            (int)scheduler.waiting()
+        );
+        ++round->running;
+        auto err = accuchek_download_start(
+            round->session,
+            i,
+            (0==round->callbacks ? 0 : i + round->callbacks),
+            *round->loop,
+            [round, i](int result) {
+                --round->running;
+                round->scheduler.finish(i);
+                round->each(i, result);
+                startScheduled(round);
+            }
+        );
+        if(ACCUCHEK_OK!=err) {
+            --round->running;
+            scheduler.finish(i);
+            round->each(i, err);
+        }
+    }
+
+    // nothing running means nothing waiting either: with every hub idle, anything can start
+    if(0==round->running) {
+        auto done = std::move(round->done);
+        delete round;
+        done();
+    }
+}
+
+int accuchek_download_all_start(
+    AccuChekSession *session,
+    const AccuChekCallbacks *callbacks,
+    EventLoop &loop,
+    std::function<void(int index, int result)> each,
+    std::function<void()> done
+) {
+    auto round = new ScheduledDownloads{
+        session,
+        callbacks,
+        &loop,
+        DownloadScheduler(session->perHub),
+        0,
+        std::move(each),
+        std::move(done)
+    };
+    for(int i=0; i<accuchek_device_count(session); ++i) {
+        auto &busPath = session->devices[i].busPath;
+        round->scheduler.add(i, busPath, g_durations.expected(busPath));
+    }
+
+    // from the loop, so done never runs before this returns
+    loop.after(
+        0,
+        [round]() {
+            startScheduled(round);
+        }
+    );
+    return ACCUCHEK_OK;
+}
+
+int accuchek_download_all(
+    AccuChekSession *session,
+    const AccuChekCallbacks *callbacks,
+    int *results
+) {
+    // everything, on a loop of our own
+    EventLoop loop;
+    auto count = accuchek_device_count(session);
+    std::vector<int> outcomes(count, ACCUCHEK_OK);
+    accuchek_download_all_start(
+        session,
+        callbacks,
+        loop,
+        [&](int index, int result) {
+            outcomes[index] = result;
+        },
+        [&]() {
+            loop.stop();
+        }
+    );
+    loop.run();
+    detachLoop(session);
+
+    // first failure, if any
+    auto result = int(ACCUCHEK_OK);
+    for(int i=0; i<count; ++i) {
+        if(results) {
+            results[i] = outcomes[i];
+        }
+        if(ACCUCHEK_OK==result) {
+            result = outcomes[i];
+        }
+    }
+    return result;
+}
+
+void accuchek_close(
+    AccuChekSession *session
+) {
+    if(0==session) {
+        return;
+    }
+    detachLoop(session);
+    session->devices.clear();
+    closeLibUSB(session->libUSBContext);
+
+    // whatever the journals held was handed out and dealt with by now
+    for(auto &path:session->retired) {
+        SegmentJournal::retire(path);
+    }
+
+    // digests never committed are of downloads whose samples may not have made it anywhere
+    if(false==session->staged.empty()) {
+        LOG_NFO("dropping %d uncommitted segment caches", (int)session->staged.size());
+    }
+    delete session;
+}
+
+const char *accuchek_strerror(
+    int error
+) {
+    switch(error) {
+        case ACCUCHEK_OK:               return "success";
+        case ACCUCHEK_ERR_LIBUSB:       return "libusb init failure";
+        case ACCUCHEK_ERR_NO_DEVICE:    return "no such accuchek device";
+        case ACCUCHEK_ERR_OPEN:         return "failed to open or claim device";
+        case ACCUCHEK_ERR_TRANSFER:     return "USB transfer failed";
+        case ACCUCHEK_ERR_PROTOCOL:     return "unexpected answer from device";
+        case ACCUCHEK_ERR_ABORTED:      return "device aborted association";
+        case ACCUCHEK_ERR_EMPTY:        return "device has no data";
+        case ACCUCHEK_ERR_BUSY:         return "device in use by another process";
+    }
+    return "unknown error";
+}
+
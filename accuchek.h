@@ -0,0 +1,238 @@
+#ifndef __ACCUCHEK_H__
+    #define __ACCUCHEK_H__
+
+    /*
+
+         libaccuchek: download samples from Roche accuchek devices in-process
+
+         typical use:
+
+             auto session = accuchek_open("config.txt", 0);
+             for(int i=0; i<accuchek_device_count(session); ++i) {
+                 AccuChekCallbacks cb = { user, onSample, onBatch };
+                 accuchek_download(session, i, &cb);
+             }
+             accuchek_close(session);
+
+         the API is plain C so it can be used from any language that can
+         call into a shared library, C++ code can use it as is.
+
+         several meters can be downloaded from at once without a thread
+         each: accuchek_download_all() does it from the calling thread, and
+         from C++ accuchek_download_start() runs downloads on an event loop
+         shared with sockets and timers (see loop.h). downloading from all
+         of them can be kept from crowding a hub, see accuchek_set_per_hub().
+
+         a blocking download can also keep its USB round trips clear of
+         decoding and slow callbacks, see accuchek_set_pipeline() and
+         pipeline.h.
+
+     */
+
+    #include <stddef.h>
+    #include <stdint.h>
+
+    #ifdef __cplusplus
+    extern "C" {
+    #endif
+
+    // error codes returned by the library (always <0)
+    enum AccuChekError {
+        ACCUCHEK_OK              =  0,
+        ACCUCHEK_ERR_LIBUSB      = -1,  // libusb could not be initialized
+        ACCUCHEK_ERR_NO_DEVICE   = -2,  // no such accuchek device
+        ACCUCHEK_ERR_OPEN        = -3,  // device could not be opened / claimed
+        ACCUCHEK_ERR_TRANSFER    = -4,  // a USB transfer failed or timed out
+        ACCUCHEK_ERR_PROTOCOL    = -5,  // device sent something we don't understand
+        ACCUCHEK_ERR_ABORTED     = -6,  // device aborted the association
+        ACCUCHEK_ERR_EMPTY       = -7,  // device has no data to send
+        ACCUCHEK_ERR_BUSY        = -8,  // another process is downloading from the device
+    };
+
+    // one decoded sample, packed so batches can be handed out as raw arrays
+    struct __attribute__((packed)) AccuChekSample {
+        int64_t  epoch;     // seconds since 1970, device local time interpreted in local timezone
+        uint16_t mgdl;      // glucose level in mg/dL
+        uint16_t status;    // sample status as reported by the device, 0 means valid
+        uint16_t year;      // device local time, as displayed on the device
+        uint8_t  month;
+        uint8_t  day;
+        uint8_t  hour;
+        uint8_t  minute;
+    };
+
+    // what we know about a detected device before talking to it
+    struct AccuChekDeviceInfo {
+        uint16_t   vendorId;
+        uint16_t   productId;
+        uint8_t    busNumber;
+        uint8_t    deviceAddress;
+        const char *vendor;     // owned by the session
+        const char *product;    // owned by the session
+        const char *busPath;    // where it's plugged in, kernel style ("3-1.2"), owned by the session
+    };
+
+    // sample delivery: per sample, and/or per batch (one batch per data segment)
+    typedef void (*AccuChekSampleFn)(void *user, const struct AccuChekSample *sample);
+    typedef void (*AccuChekBatchFn)(void *user, const struct AccuChekSample *samples, size_t count);
+
+    // device identification: the EUI-64 system id the device announces when associating
+    typedef void (*AccuChekAssociationFn)(void *user, uint64_t systemId);
+
+    // transfer progress, reported once before the first segment and after each one
+    struct AccuChekProgress {
+        uint32_t received;  // samples handed out so far
+        uint32_t expected;  // samples the device says it holds, 0 if it didn't say
+        uint32_t capacity;  // samples the device can hold, 0 if it didn't say
+        uint32_t segments;  // segments received so far
+        double   elapsed;   // seconds since the transfer started
+        double   rate;      // samples per second so far
+        double   eta;       // seconds left, <0 if unknown
+        uint32_t skipped;   // samples in segments already seen last time (see accuchek_set_segment_cache)
+    };
+    typedef void (*AccuChekProgressFn)(void *user, const struct AccuChekProgress *progress);
+
+    // callbacks invoked while downloading, any of them may be null
+    struct AccuChekCallbacks {
+        void                  *user;
+        AccuChekSampleFn      onSample;
+        AccuChekBatchFn       onBatch;
+        AccuChekAssociationFn onAssociation;
+        AccuChekProgressFn    onProgress;
+    };
+
+    // one stage of a pipelined download (see accuchek_set_pipeline)
+    struct AccuChekStageStats {
+        uint64_t segments;  // segments through the stage
+        uint32_t queued;    // segments waiting in front of the stage right now
+        uint32_t maxQueued; // most segments ever waiting in front of it
+        double   idle;      // seconds spent waiting for something to do
+        double   stalled;   // seconds spent waiting for room in the next stage's queue
+    };
+    struct AccuChekPipelineStats {
+        struct AccuChekStageStats usb;      // moves bytes, queues raw segments
+        struct AccuChekStageStats decode;   // turns raw segments into samples
+        struct AccuChekStageStats sink;     // runs sample, batch and progress callbacks
+    };
+
+    typedef struct AccuChekSession AccuChekSession;
+
+    // open libusb, load config file (null means "config.txt") and scan for devices
+    AccuChekSession *accuchek_open(const char *configPath, int verbose);
+
+    // remember meters found by accuchek_open() in the file at path (null: in memory only),
+    // for this process and the next ones: a known meter plugged in at the same place then
+    // gets found without reading its descriptors off the bus (see devcache.h). call it
+    // before accuchek_open(), it holds for every session
+    void accuchek_set_descriptor_cache(const char *path);
+
+    // number of accuchek devices found when the session was opened
+    int accuchek_device_count(const AccuChekSession *session);
+
+    // describe device #index, returns ACCUCHEK_OK or an error code
+    int accuchek_device_info(const AccuChekSession *session, int index, struct AccuChekDeviceInfo *info);
+
+    // download all samples from device #index, streaming them through callbacks
+    int accuchek_download(AccuChekSession *session, int index, const struct AccuChekCallbacks *callbacks);
+
+    // download from every device at once, from the calling thread: callbacks (may be null)
+    // and results (may be null) hold one entry per device. returns ACCUCHEK_OK or the first error
+    int accuchek_download_all(AccuChekSession *session, const struct AccuChekCallbacks *callbacks, int *results);
+
+    // when downloading from every device, run at most perHub downloads at once behind any
+    // one USB hub (0, the default: no limit), starting those expected to take longest first
+    // (see schedule.h)
+    void accuchek_set_per_hub(AccuChekSession *session, int perHub);
+
+    // remember how long each meter's downloads take in the file at path (null: in memory
+    // only), so downloads from every device can be ordered by it. like the descriptor
+    // cache it holds for every session
+    void accuchek_set_durations(const char *path);
+
+    // record every USB transfer of the session's downloads to a capture file at path (null:
+    // stop), for accuchek-dissect (see capture.h). returns ACCUCHEK_OK or ACCUCHEK_ERR_OPEN
+    int accuchek_set_capture(AccuChekSession *session, const char *path);
+
+    // where per-device lock files go (null: ACCUCHEK_LOCK_DIR, or /tmp). downloads lock
+    // their device by bus path there first, and fail with ACCUCHEK_ERR_BUSY right away
+    // if another process has it, so processes sharing a dir can split meters between
+    // them (see lock.h)
+    void accuchek_set_lock_dir(AccuChekSession *session, const char *dir);
+
+    // keep a digest of each meter's data segments in dir (null: don't), and skip decoding
+    // and calling back for segments the meter sent in its previous complete download:
+    // only samples new since then get handed out. digests of a download that went through
+    // are held until accuchek_commit_segment_cache(), those never committed are dropped
+    // by accuchek_close()
+    void accuchek_set_segment_cache(AccuChekSession *session, const char *dir);
+
+    // what callbacks got from device #index's download (-1: from every download) is safe:
+    // write its segment digests, so the next download skips those segments. call it once
+    // the samples are archived, published or queued, whatever the caller does with them.
+    // returns ACCUCHEK_OK or ACCUCHEK_ERR_OPEN if a digest file couldn't be written
+    int accuchek_commit_segment_cache(AccuChekSession *session, int index);
+
+    // journal every data segment downloads receive to dir/<system id>.wal (null: don't),
+    // synced in batches, so a download cut short by a crash or an unplugged meter loses
+    // nothing it got (see journal.h). a journal stays until the session that completed
+    // or recovered it gets closed: publish what callbacks got before accuchek_close()
+    void accuchek_set_journal(AccuChekSession *session, const char *dir);
+
+    // hand out the samples journals in the journal dir hold, left by sessions that never got
+    // to close, through callbacks (onAssociation, onSample and onBatch). segments recovered
+    // are skipped by the session's downloads. returns the number of samples handed out
+    int accuchek_recover(AccuChekSession *session, const struct AccuChekCallbacks *callbacks);
+
+    // pipeline blocking downloads: the USB thread queues up to depth raw segments for a
+    // decoding thread, sample, batch and progress callbacks then run on a thread of their
+    // own. 0 (the default) decodes and calls back in line, between USB transfers
+    void accuchek_set_pipeline(AccuChekSession *session, int depth);
+
+    // how the last pipelined download went: ACCUCHEK_OK, or ACCUCHEK_ERR_NO_DEVICE if none ran yet
+    int accuchek_pipeline_stats(const AccuChekSession *session, struct AccuChekPipelineStats *stats);
+
+    // release everything held by the session, downloads in flight must be done
+    void accuchek_close(AccuChekSession *session);
+
+    // human readable version of an error code
+    const char *accuchek_strerror(int error);
+
+    #ifdef __cplusplus
+    }
+    #endif
+
+    #ifdef __cplusplus
+
+        #include <functional>
+
+        struct EventLoop;
+
+        // start downloading from device #index on loop (see loop.h) and return right away.
+        // callbacks (which must outlive the download) and done run on the loop's thread,
+        // done gets what accuchek_download would have returned. returns ACCUCHEK_OK once
+        // started, or an error code and done never runs. a session sticks to the first
+        // loop it runs on, and blocking downloads should not be mixed in
+        int accuchek_download_start(
+            AccuChekSession *session,
+            int index,
+            const AccuChekCallbacks *callbacks,
+            EventLoop &loop,
+            std::function<void(int result)> done
+        );
+
+        // start downloading from every device on loop, as accuchek_download_all would, and
+        // return right away. each gets every device's result as its download is over, done
+        // runs once all are (on the loop, never before this returns). callbacks may be null
+        // or hold one entry per device, which must outlive the downloads
+        int accuchek_download_all_start(
+            AccuChekSession *session,
+            const AccuChekCallbacks *callbacks,
+            EventLoop &loop,
+            std::function<void(int index, int result)> each,
+            std::function<void()> done
+        );
+
+    #endif
+
+#endif // __ACCUCHEK_H__
+
@@ -0,0 +1,282 @@
+/*
+
+     glucose alert rules, see alert.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <time.h>
+#include <alert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <inttypes.h>
+
+// rules used when none are given
+static const char *kDefaultRules[] = {
+    "severe-hypo  below    54",
+    "hypo         below    70",
+    "hyper        above    250",
+    "falling-fast falling  2 15",
+    "rising-fast  rising   3 15",
+    "repeated-low count below 70 3 1440",
+};
+
+AlertEngine::AlertEngine()
+    :   deviceId(0),
+        lastEpoch(INT64_MIN),
+        silencedUntil(INT64_MIN)
+{
+}
+
+bool AlertEngine::load(
+    const char *rulesPath
+) {
+    rules.clear();
+    reset();
+
+    // built-in
+    if(0==rulesPath) {
+        auto lineNumber = 0;
+        for(auto line:kDefaultRules) {
+            compile(line, ++lineNumber);
+        }
+        return true;
+    }
+
+    // from file
+    auto fp = fopen(rulesPath, "r");
+    if(0==fp) {
+        LOG_WRN("failed to open alert rules %s", rulesPath);
+        return false;
+    }
+    char line[512];
+    auto ok = true;
+    auto lineNumber = 0;
+    while(fgets(line, sizeof(line), fp)) {
+        auto hash = strchr(line, '#');
+        if(hash) {
+            *hash = 0;
+        }
+        ok = compile(line, ++lineNumber) && ok;
+    }
+    fclose(fp);
+    LOG_NFO("loaded %d alert rules from %s", (int)rules.size(), rulesPath);
+    return ok;
+}
+
+bool AlertEngine::compile(
+    const char *line,
+    int lineNumber
+) {
+    char name[128];
+    char kind[32];
+    char side[32];
+    double a = 0;
+    double b = 0;
+    double c = 0;
+    auto n = sscanf(line, "%127s %31s", name, kind);
+    if(n<=0) {
+        return true;    // blank
+    }
+
+    Rule rule;
+    rule.name = name;
+    rule.threshold = 0;
+    rule.windowSeconds = 0;
+    rule.count = 0;
+    rule.active = false;
+
+    auto ok = false;
+    if(2==n && 0==strcmp(kind, "below")) {
+        rule.kind = kBelow;
+        ok = (1==sscanf(line, "%*s %*s %lf", &a));
+    } else if(2==n && 0==strcmp(kind, "above")) {
+        rule.kind = kAbove;
+        ok = (1==sscanf(line, "%*s %*s %lf", &a));
+    } else if(2==n && (0==strcmp(kind, "falling") || 0==strcmp(kind, "rising"))) {
+        rule.kind = ('f'==kind[0] ? kFalling : kRising);
+        ok = (2==sscanf(line, "%*s %*s %lf %lf", &a, &b) && 0<a && 0<b);
+        rule.windowSeconds = int64_t(60*b);
+    } else if(2==n && 0==strcmp(kind, "count")) {
+        ok = (
+            4==sscanf(line, "%*s %*s %31s %lf %lf %lf", side, &a, &b, &c)   &&
+            (0==strcmp(side, "below") || 0==strcmp(side, "above"))         &&
+            1<=b                                                            &&
+            0<c
+        );
+        rule.kind = ('b'==side[0] ? kCountBelow : kCountAbove);
+        rule.count = size_t(b);
+        rule.windowSeconds = int64_t(60*c);
+    }
+    if(false==ok) {
+        LOG_WRN("bad alert rule on line %d: %s", lineNumber, line);
+        return false;
+    }
+    rule.threshold = a;
+    rules.push_back(std::move(rule));
+    return true;
+}
+
+void AlertEngine::reset() {
+    for(auto &rule:rules) {
+        rule.active = false;
+        rule.window.clear();
+    }
+    lastEpoch = INT64_MIN;
+}
+
+void AlertEngine::feed(
+    const ArchiveRecord &record,
+    std::vector<AlertEvent> &events
+) {
+    // only valid readings, each device on its own
+    if(0!=record.status) {
+        return;
+    }
+    if(record.deviceId!=deviceId) {
+        reset();
+        deviceId = record.deviceId;
+    }
+    auto inOrder = (lastEpoch<=record.epoch);
+    if(inOrder) {
+        lastEpoch = record.epoch;
+    }
+    auto fresh = (
+        silencedUntil<record.epoch              &&
+        time(0) - record.epoch<=kStaleSeconds
+    );
+    auto mgdl = double(record.mgdl);
+
+    for(auto &rule:rules) {
+
+        // windowed rules only make sense oldest first
+        auto windowed = (0<rule.windowSeconds);
+        if(windowed && false==inOrder) {
+            continue;
+        }
+
+        // slide window: newest in, expired out
+        if(windowed) {
+            auto counted = (
+                (kCountBelow==rule.kind && mgdl<rule.threshold) ||
+                (kCountAbove==rule.kind && rule.threshold<mgdl) ||
+                kFalling==rule.kind                             ||
+                kRising==rule.kind
+            );
+            if(counted) {
+                rule.window.push_back(record);
+            }
+            auto oldest = (record.epoch - rule.windowSeconds);
+            while(0<rule.window.size() && rule.window.front().epoch<oldest) {
+                rule.window.pop_front();
+            }
+        }
+
+        // evaluate
+        auto hit = false;
+        auto value = mgdl;
+        switch(rule.kind) {
+            case kBelow:
+                hit = (mgdl<rule.threshold);
+                break;
+            case kAbove:
+                hit = (rule.threshold<mgdl);
+                break;
+            case kFalling:
+            case kRising: {
+
+                // need the window at least half covered to call it a trend
+                auto &first = rule.window.front();
+                auto minutes = (record.epoch - first.epoch) / 60.0;
+                value = (minutes<=0 ? 0 : (mgdl - first.mgdl) / minutes);
+                hit = (
+                    rule.windowSeconds/120.0<=minutes &&
+                    (kFalling==rule.kind ? value<=-rule.threshold : rule.threshold<=value)
+                );
+                break;
+            }
+            case kCountBelow:
+            case kCountAbove:
+                value = rule.window.size();
+                hit = (rule.count<=rule.window.size());
+                break;
+        }
+
+        // edge trigger
+        if(hit && false==rule.active && fresh) {
+            events.push_back({
+                rule.name.c_str(),
+                record.deviceId,
+                record.epoch,
+                record.mgdl,
+                value
+            });
+        }
+        rule.active = hit;
+    }
+}
+
+AlertSink::AlertSink()
+    :   fd(-1)
+{
+}
+
+AlertSink::~AlertSink() {
+    close();
+}
+
+bool AlertSink::open(
+    const char *path
+) {
+    close();
+    fd = ::open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if(fd<0) {
+        LOG_WRN("failed to open alert sink %s", path);
+        return false;
+    }
+    return true;
+}
+
+void AlertSink::close() {
+    if(0<=fd) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+void AlertSink::write(
+    const AlertEvent &event
+) {
+    if(fd<0) {
+        return;
+    }
+    struct tm t;
+    time_t epoch = event.epoch;
+    localtime_r(&epoch, &t);
+    char line[512];
+    auto n = snprintf(
+        line,
+        sizeof(line),
+        "{ \"rule\":\"%s\", \"device\":\"0x%08x\", \"epoch\":%" PRId64 ", \"timestamp\":\"%04d/%02d/%02d %02d:%02d\", \"mg/dL\":%d, \"value\":%.2f }\n",
+        event.rule,
+        event.deviceId,
+        event.epoch,
+        1900 + t.tm_year,
+        1 + t.tm_mon,
+        t.tm_mday,
+        t.tm_hour,
+        t.tm_min,
+        (int)event.mgdl,
+        event.value
+    );
+    n = std::min(n, int(sizeof(line)) - 1);
+    if(n!=::write(fd, line, n)) {
+        LOG_WRN("failed to write alert %s", event.rule);
+    }
+    LOG_NFO("alert: %.*s", n-1, line);
+}
+
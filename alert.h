@@ -0,0 +1,110 @@
+#ifndef __ALERT_H__
+    #define __ALERT_H__
+
+    /*
+
+         glucose alert rules, evaluated on readings as they are decoded
+
+         a rules file holds one rule per line, # starts a comment:
+
+             NAME below  MGDL                         reading under MGDL
+             NAME above  MGDL                         reading over MGDL
+             NAME falling RATE MINUTES                dropping RATE mg/dL per minute or faster over MINUTES
+             NAME rising  RATE MINUTES                climbing RATE mg/dL per minute or faster over MINUTES
+             NAME count below|above MGDL N MINUTES    N readings under / over MGDL within MINUTES
+
+         rules are parsed once into a flat table. each windowed rule keeps a
+         queue of the readings inside its window: a reading enters once and
+         leaves once, so evaluation is constant time per reading and rule.
+
+         rules are edge triggered, an alert fires when its condition becomes
+         true and re-arms once it turns false. readings older than
+         kStaleSeconds, or already seen by an earlier run (see silence()),
+         still feed windows since a download replays history, but never fire.
+
+         events go to a sink file as JSON lines, one write each, so a FIFO
+         works too:
+
+             { "rule":"hypo", "device":"0x1234abcd", "epoch":1700000000, "timestamp":"2023/11/14 22:13", "mg/dL":62, "value":62.00 }
+
+     */
+
+    #include <deque>
+    #include <string>
+    #include <vector>
+    #include <stddef.h>
+    #include <algorithm>
+    #include <stdint.h>
+    #include <archive.h>
+
+    struct AlertEvent {
+        const char *rule;
+        uint32_t   deviceId;
+        int64_t    epoch;
+        uint16_t   mgdl;
+        double     value;   // reading, rate (mg/dL per minute) or count, depending on rule
+    };
+
+    struct AlertEngine {
+
+        static constexpr int64_t kStaleSeconds = (6*3600);
+
+        AlertEngine();
+
+        // compile rules file, null means the built-in defaults
+        bool load(const char *rulesPath);
+
+        // evaluate one reading, appending any alert it raises to events
+        // readings should come oldest first, older ones than the last seen only go through thresholds
+        void feed(const ArchiveRecord &record, std::vector<AlertEvent> &events);
+
+        // forget windows and alert states
+        void reset();
+
+        // readings at or before epoch never fire
+        void silence(int64_t epoch) { silencedUntil = std::max(silencedUntil, epoch); }
+
+    private:
+        enum Kind {
+            kBelow,
+            kAbove,
+            kFalling,
+            kRising,
+            kCountBelow,
+            kCountAbove
+        };
+        struct Rule {
+            std::string name;
+            Kind kind;
+            double threshold;       // mg/dL or mg/dL per minute
+            int64_t windowSeconds;
+            size_t count;
+            bool active;
+            std::deque<ArchiveRecord> window;
+        };
+
+        bool compile(const char *line, int lineNumber);
+
+        std::vector<Rule> rules;
+        uint32_t deviceId;
+        int64_t lastEpoch;
+        int64_t silencedUntil;
+    };
+
+    struct AlertSink {
+
+        AlertSink();
+        ~AlertSink();
+
+        // append to (or write into, for a FIFO) path
+        bool open(const char *path);
+        void close();
+
+        void write(const AlertEvent &event);
+
+    private:
+        int fd;
+    };
+
+#endif // __ALERT_H__
+
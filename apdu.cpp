@@ -0,0 +1,69 @@
+/*
+
+     accuchek protocol vocabulary, see apdu.h
+
+ */
+
+// stuff we need
+#include <apdu.h>
+#include <string.h>
+#include <vector>
+
+// per byte: its hex column "XX ", and what shows in the character column
+static constexpr struct HexTables {
+    char hex[256][4];
+    char text[256];
+    constexpr HexTables() : hex(), text() {
+        constexpr char digits[] = "0123456789ABCDEF";
+        for(int i=0; i<256; ++i) {
+            hex[i][0] = digits[i >> 4];
+            hex[i][1] = digits[i & 15];
+            hex[i][2] = ' ';
+            hex[i][3] = ' ';
+            text[i] = ((0x20<=i && i<0x7F) ? char(i) : '.');
+        }
+    }
+} kHexTables;
+
+size_t hexRender(
+    const uint8_t *data,
+    size_t size,
+    char *out
+) {
+    auto start = out;
+    for(size_t i=0; i<size; i+=16) {
+        auto n = std::min(size_t(16), size - i);
+        auto line = (i + data);
+
+        // hex columns: 4 bytes copied per input byte, the 4th gets overwritten by the next
+        for(size_t j=0; j<n; ++j) {
+            memcpy(out + 3*j, kHexTables.hex[line[j]], 4);
+        }
+        memset(out + 3*n, ' ', 3*(16 - n) + 3);
+        out += (16*3 + 3);
+
+        // character column
+        for(size_t j=0; j<n; ++j) {
+            out[j] = kHexTables.text[line[j]];
+        }
+        out += n;
+        *(out++) = '\n';
+    }
+    return (out - start);
+}
+
+void hexDump(
+    FILE *out,
+    const uint8_t *data,
+    size_t size
+) {
+    // small dumps on the stack, big ones on the heap
+    char stack[16*kHexLineSize];
+    std::vector<char> heap;
+    auto buffer = stack;
+    if(sizeof(stack)<hexRenderSize(size)) {
+        heap.resize(hexRenderSize(size));
+        buffer = heap.data();
+    }
+    fwrite(buffer, 1, hexRender(data, size, buffer), out);
+}
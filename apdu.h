@@ -0,0 +1,264 @@
+#ifndef __APDU_H__
+    #define __APDU_H__
+
+    /*
+
+         accuchek protocol vocabulary: APDU constants, MDC_* names, big endian
+         byte helpers and hex rendering, shared by the protocol code (see
+         meter.h) and the offline dissector (accuchek-dissect)
+
+         MDC_* names come out of a table generated from the MDC_LIST X-macro
+         and sorted by value at compile time, so naming a code is a binary
+         search. hex dumps are rendered into a buffer from per-byte tables
+         and written out in one go.
+
+     */
+
+    #include <array>
+    #include <stdio.h>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <algorithm>
+
+    /*
+        proprietary roche protocol constants, copied from:
+
+            https://github.com/tidepool-org/uploader/tree/master/lib/drivers/roche
+
+        these seem to be from the "Continua Health Alliance standard (ISO/IEEE 11073)"
+
+        for the morbidly curious, see:
+            https://en.wikipedia.org/wiki/Continua_Health_Alliance
+            https://github.com/signove/antidote
+            http://11073.org
+
+     */
+
+    static constexpr uint16_t kAPDU_TYPE_ASSOCIATION_REQUEST =             0xE200;
+    static constexpr uint16_t kAPDU_TYPE_ASSOCIATION_RESPONSE =            0xE300;
+    static constexpr uint16_t kAPDU_TYPE_ASSOCIATION_RELEASE_REQUEST =     0xE400;
+    static constexpr uint16_t kAPDU_TYPE_ASSOCIATION_RELEASE_RESPONSE =    0xE500;
+    static constexpr uint16_t kAPDU_TYPE_ASSOCIATION_ABORT =               0xE600;
+    static constexpr uint16_t kAPDU_TYPE_PRESENTATION_APDU =               0xE700;
+
+    static constexpr uint16_t kDATA_ADPU_INVOKE_CONFIRMED_EVENT_REPORT =   0x0101;
+    static constexpr uint16_t kDATA_ADPU_INVOKE_GET =                      0x0103;
+    static constexpr uint16_t kDATA_ADPU_INVOKE_CONFIRMED_ACTION =         0x0107;
+    static constexpr uint16_t kDATA_ADPU_RESPONSE_CONFIRMED_EVENT_REPORT = 0x0201;
+    static constexpr uint16_t kDATA_ADPU_RESPONSE_GET =                    0x0203;
+    static constexpr uint16_t kDATA_ADPU_RESPONSE_CONFIRMED_ACTION =       0x0207;
+
+    static constexpr uint16_t kEVENT_TYPE_MDC_NOTI_CONFIG =                0x0D1C;
+    static constexpr uint16_t kEVENT_TYPE_MDC_NOTI_SEGMENT_DATA =          0x0D21;
+
+    static constexpr uint16_t kACTION_TYPE_MDC_ACT_SEG_GET_INFO =          0x0C0D;
+    static constexpr uint16_t kACTION_TYPE_MDC_ACT_SEG_GET_ID_LIST =       0x0C1E;
+    static constexpr uint16_t kACTION_TYPE_MDC_ACT_SEG_TRIG_XFER =         0x0C1C;
+    static constexpr uint16_t kACTION_TYPE_MDC_ACT_SEG_SET_TIME =          0x0C17;
+
+    #define MDC_LIST                                \
+      x(MDC_MOC_VMO_METRIC, 4)                      \
+      x(MDC_MOC_VMO_METRIC_ENUM, 5)                 \
+      x(MDC_MOC_VMO_METRIC_NU, 6)                   \
+      x(MDC_MOC_VMO_METRIC_SA_RT, 9)                \
+      x(MDC_MOC_SCAN, 16)                           \
+      x(MDC_MOC_SCAN_CFG, 17)                       \
+      x(MDC_MOC_SCAN_CFG_EPI, 18)                   \
+      x(MDC_MOC_SCAN_CFG_PERI, 19)                  \
+      x(MDC_MOC_VMS_MDS_SIMP, 37)                   \
+      x(MDC_MOC_VMO_PMSTORE, 61)                    \
+      x(MDC_MOC_PM_SEGMENT, 62)                     \
+      x(MDC_ATTR_CONFIRM_MODE, 2323)                \
+      x(MDC_ATTR_CONFIRM_TIMEOUT, 2324)             \
+      x(MDC_ATTR_TRANSPORT_TIMEOUT, 2694)           \
+      x(MDC_ATTR_ID_HANDLE, 2337)                   \
+      x(MDC_ATTR_ID_INSTNO, 2338)                   \
+      x(MDC_ATTR_ID_LABEL_STRING, 2343)             \
+      x(MDC_ATTR_ID_MODEL, 2344)                    \
+      x(MDC_ATTR_ID_PHYSIO, 2347)                   \
+      x(MDC_ATTR_ID_PROD_SPECN, 2349)               \
+      x(MDC_ATTR_ID_TYPE, 2351)                     \
+      x(MDC_ATTR_METRIC_STORE_CAPAC_CNT, 2369)      \
+      x(MDC_ATTR_METRIC_STORE_SAMPLE_ALG, 2371)     \
+      x(MDC_ATTR_METRIC_STORE_USAGE_CNT, 2372)      \
+      x(MDC_ATTR_MSMT_STAT, 2375)                   \
+      x(MDC_ATTR_NU_ACCUR_MSMT, 2378)               \
+      x(MDC_ATTR_NU_CMPD_VAL_OBS, 2379)             \
+      x(MDC_ATTR_NU_VAL_OBS, 2384)                  \
+      x(MDC_ATTR_NUM_SEG, 2385)                     \
+      x(MDC_ATTR_OP_STAT, 2387)                     \
+      x(MDC_ATTR_POWER_STAT, 2389)                  \
+      x(MDC_ATTR_SA_SPECN, 2413)                    \
+      x(MDC_ATTR_SCALE_SPECN_I16, 2415)             \
+      x(MDC_ATTR_SCALE_SPECN_I32, 2416)             \
+      x(MDC_ATTR_SCALE_SPECN_I8, 2417)              \
+      x(MDC_ATTR_SCAN_REP_PD, 2421)                 \
+      x(MDC_ATTR_SEG_USAGE_CNT, 2427)               \
+      x(MDC_ATTR_SYS_ID, 2436)                      \
+      x(MDC_ATTR_SYS_TYPE, 2438)                    \
+      x(MDC_ATTR_TIME_ABS, 2439)                    \
+      x(MDC_ATTR_TIME_BATT_REMAIN, 2440)            \
+      x(MDC_ATTR_TIME_END_SEG, 2442)                \
+      x(MDC_ATTR_TIME_PD_SAMP, 2445)                \
+      x(MDC_ATTR_TIME_REL, 2447)                    \
+      x(MDC_ATTR_TIME_STAMP_ABS, 2448)              \
+      x(MDC_ATTR_TIME_STAMP_REL, 2449)              \
+      x(MDC_ATTR_TIME_START_SEG, 2450)              \
+      x(MDC_ATTR_TX_WIND, 2453)                     \
+      x(MDC_ATTR_UNIT_CODE, 2454)                   \
+      x(MDC_ATTR_UNIT_LABEL_STRING, 2457)           \
+      x(MDC_ATTR_VAL_BATT_CHARGE, 2460)             \
+      x(MDC_ATTR_VAL_ENUM_OBS, 2462)                \
+      x(MDC_ATTR_TIME_REL_HI_RES, 2536)             \
+      x(MDC_ATTR_TIME_STAMP_REL_HI_RES, 2537)       \
+      x(MDC_ATTR_DEV_CONFIG_ID, 2628)               \
+      x(MDC_ATTR_MDS_TIME_INFO, 2629)               \
+      x(MDC_ATTR_METRIC_SPEC_SMALL, 2630)           \
+      x(MDC_ATTR_SOURCE_HANDLE_REF, 2631)           \
+      x(MDC_ATTR_SIMP_SA_OBS_VAL, 2632)             \
+      x(MDC_ATTR_ENUM_OBS_VAL_SIMP_OID, 2633)       \
+      x(MDC_ATTR_ENUM_OBS_VAL_SIMP_STR, 2634)       \
+      x(MDC_REG_CERT_DATA_LIST, 2635)               \
+      x(MDC_ATTR_NU_VAL_OBS_BASIC, 2636)            \
+      x(MDC_ATTR_PM_STORE_CAPAB, 2637)              \
+      x(MDC_ATTR_PM_SEG_MAP, 2638)                  \
+      x(MDC_ATTR_PM_SEG_PERSON_ID, 2639)            \
+      x(MDC_ATTR_SEG_STATS, 2640)                   \
+      x(MDC_ATTR_SEG_FIXED_DATA, 2641)              \
+      x(MDC_ATTR_SCAN_HANDLE_ATTR_VAL_MAP, 2643)    \
+      x(MDC_ATTR_SCAN_REP_PD_MIN, 2644)             \
+      x(MDC_ATTR_ATTRIBUTE_VAL_MAP, 2645)           \
+      x(MDC_ATTR_NU_VAL_OBS_SIMP, 2646)             \
+      x(MDC_ATTR_PM_STORE_LABEL_STRING, 2647)       \
+      x(MDC_ATTR_PM_SEG_LABEL_STRING, 2648)         \
+      x(MDC_ATTR_TIME_PD_MSMT_ACTIVE, 2649)         \
+      x(MDC_ATTR_SYS_TYPE_SPEC_LIST, 2650)          \
+      x(MDC_ATTR_METRIC_ID_PART, 2655)              \
+      x(MDC_ATTR_ENUM_OBS_VAL_PART, 2656)           \
+      x(MDC_ATTR_SUPPLEMENTAL_TYPES, 2657)          \
+      x(MDC_ATTR_TIME_ABS_ADJUST, 2658)             \
+      x(MDC_ATTR_CLEAR_TIMEOUT, 2659)               \
+      x(MDC_ATTR_TRANSFER_TIMEOUT, 2660)            \
+      x(MDC_ATTR_ENUM_OBS_VAL_SIMP_BIT_STR, 2661)   \
+      x(MDC_ATTR_ENUM_OBS_VAL_BASIC_BIT_STR, 2662)  \
+      x(MDC_ATTR_METRIC_STRUCT_SMALL, 2675)         \
+      x(MDC_ATTR_NU_CMPD_VAL_OBS_SIMP, 2676)        \
+      x(MDC_ATTR_NU_CMPD_VAL_OBS_BASIC, 2677)       \
+      x(MDC_ATTR_ID_PHYSIO_LIST, 2678)              \
+      x(MDC_ATTR_SCAN_HANDLE_LIST, 2679)            \
+      x(MDC_ATTR_TIME_BO, 2689)                     \
+      x(MDC_ATTR_TIME_STAMP_BO, 2690)               \
+      x(MDC_ATTR_TIME_START_SEG_BO, 2691)           \
+      x(MDC_ATTR_TIME_END_SEG_BO, 2692)             \
+
+
+    // all the MDC_* constants in one big enum
+    enum MDC_ENUM {
+        #define x(a, b) k##a = b,
+            MDC_LIST
+        #undef x
+    };
+
+
+    // every MDC_* constant and its name, sorted by value at compile time
+    struct MDCName {
+        uint16_t value;
+        const char *name;
+    };
+    static constexpr size_t kNbMDCNames = (
+        0
+        #define x(a, b) + 1
+            MDC_LIST
+        #undef x
+    );
+    static constexpr auto kMDCNames = []() {
+        std::array<MDCName, kNbMDCNames> names = {{
+            #define x(a, b) { b, #a },
+                MDC_LIST
+            #undef x
+        }};
+        std::sort(
+            names.begin(),
+            names.end(),
+            [](const MDCName &l, const MDCName &r) { return l.value<r.value; }
+        );
+        return names;
+    }();
+
+    // name of a specific MDC_* constant, null if there's no such constant
+    inline const char *mdcName(
+        uint16_t value
+    ) {
+        auto it = std::lower_bound(
+            kMDCNames.begin(),
+            kMDCNames.end(),
+            value,
+            [](const MDCName &l, uint16_t v) { return l.value<v; }
+        );
+        return ((kMDCNames.end()!=it && value==it->value) ? it->name : 0);
+    }
+
+    // write big endian 16bit int to buffer and shift ptr
+    inline auto be16(
+        uint8_t *&p,
+        uint16_t v
+    ) {
+        p[0] = (v >> 8) & 0xFF;
+        p[1] = (v >> 0) & 0xFF;
+        p += 2;
+    }
+
+    // read big endian 16bit int to buffer and shift ptr
+    inline auto be16r(
+        const uint8_t *p,
+        size_t &offset
+    ) {
+        auto hi = p[0 + offset];
+        auto lo = p[1 + offset];
+        offset += 2;
+        return (((uint16_t)hi)<<8) | lo;
+    }
+
+    // write big endian 32bit int to buffer and shift ptr
+    inline auto be32(
+        uint8_t *&p,
+        uint32_t v
+    ) {
+        p[0] = (v >> 24) & 0xFF;
+        p[1] = (v >> 16) & 0xFF;
+        p[2] = (v >>  8) & 0xFF;
+        p[3] = (v >>  0) & 0xFF;
+        p += 4;
+    }
+
+    // read big endian 32bit int to buffer and shift ptr
+    inline auto be32r(
+        const uint8_t *p,
+        size_t &offset
+    ) {
+        uint32_t p0 = p[0 + offset];
+        uint32_t p1 = p[1 + offset];
+        uint32_t p2 = p[2 + offset];
+        uint32_t p3 = p[3 + offset];
+        offset += 4;
+
+        return (
+            (p0 << 24)  |
+            (p1 << 16)  |
+            (p2 <<  8)  |
+            (p3 <<  0)
+        );
+    }
+
+
+    // canonical hexdump, 16 bytes a line: hex columns, then printable characters
+    static constexpr size_t kHexLineSize = (16*3 + 3 + 16 + 1);
+    inline constexpr size_t hexRenderSize(size_t size) { return kHexLineSize * ((size + 15) / 16); }
+
+    // render size bytes of data into out (hexRenderSize(size) bytes at least), returns bytes used
+    size_t hexRender(const uint8_t *data, size_t size, char *out);
+
+    // render and write in one go
+    void hexDump(FILE *out, const uint8_t *data, size_t size);
+
+#endif // __APDU_H__
@@ -0,0 +1,325 @@
+/*
+
+     native sample archive, see archive.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <string>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <rollup.h>
+#include <sketch.h>
+#include <query.h>
+#include <archive.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// archive file magic
+static const char kMagic[8] = { 'A', 'C', 'C', 'U', 'A', 'R', 'C', 'H' };
+
+ArchiveReader::ArchiveReader()
+    :   fd(-1),
+        map(0),
+        mapSize(0),
+        validBytes(0)
+{
+}
+
+ArchiveReader::~ArchiveReader() {
+    close();
+}
+
+void ArchiveReader::close() {
+    if(0!=map) {
+        munmap(map, mapSize);
+        map = 0;
+    }
+    if(0<=fd) {
+        ::close(fd);
+        fd = -1;
+    }
+    mapSize = 0;
+    validBytes = 0;
+    index.clear();
+}
+
+bool ArchiveReader::open(
+    const char *path
+) {
+    close();
+
+    // open and size file
+    fd = ::open(path, O_RDONLY);
+    if(fd<0) {
+        return false;
+    }
+    struct stat st;
+    if(0!=fstat(fd, &st) || st.st_size<(off_t)sizeof(ArchiveFileHeader)) {
+        LOG_WRN("%s is not an archive", path);
+        close();
+        return false;
+    }
+
+    // map it
+    mapSize = st.st_size;
+    map = mmap(0, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+    if(MAP_FAILED==map) {
+        LOG_WRN("failed to mmap archive %s", path);
+        map = 0;
+        close();
+        return false;
+    }
+
+    // check file header
+    auto base = (const uint8_t *)map;
+    auto header = (const ArchiveFileHeader *)base;
+    auto ok = (
+        0==memcmp(header->magic, kMagic, sizeof(kMagic))    &&
+        Archive::kVersion==header->version                   &&
+        sizeof(ArchiveRecord)==header->recordSize
+    );
+    if(false==ok) {
+        LOG_WRN("%s is not an archive or has an unsupported version", path);
+        close();
+        return false;
+    }
+
+    // hop from block header to block header to build the sparse index
+    auto offset = sizeof(ArchiveFileHeader);
+    while(offset + sizeof(ArchiveBlockHeader)<=mapSize) {
+        auto block = (const ArchiveBlockHeader *)(offset + base);
+        auto end = offset + sizeof(ArchiveBlockHeader) + block->count*sizeof(ArchiveRecord);
+        if(Archive::kBlockMagic!=block->magic || mapSize<end) {
+            LOG_WRN("torn block at offset %zu in archive %s, ignoring tail", offset, path);
+            break;
+        }
+        index.push_back({
+            block->minEpoch,
+            block->maxEpoch,
+            (const ArchiveRecord *)(offset + sizeof(ArchiveBlockHeader) + base),
+            block->count
+        });
+        offset = end;
+    }
+    validBytes = offset;
+    return true;
+}
+
+size_t ArchiveReader::size() const {
+    size_t n = 0;
+    for(auto &block:index) {
+        n += block.count;
+    }
+    return n;
+}
+
+ArchiveCoverage ArchiveCoverage::of(
+    const ArchiveReader &reader
+) {
+    auto &blocks = reader.blocks();
+    return {
+        uint64_t(reader.validSize()),
+        uint64_t(reader.size()),
+        (blocks.empty() ? INT64_MIN : blocks.back().maxEpoch)
+    };
+}
+
+// write a full buffer, retrying on short writes
+static auto writeAll(
+    int fd,
+    const void *data,
+    size_t size,
+    off_t offset
+) {
+    auto p = (const uint8_t *)data;
+    while(0<size) {
+        auto n = pwrite(fd, p, size, offset);
+        if(n<=0) {
+            return false;
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// write header for a fresh archive
+static auto writeHeader(
+    int fd
+) {
+    ArchiveFileHeader header;
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = Archive::kVersion;
+    header.recordSize = sizeof(ArchiveRecord);
+    return writeAll(fd, &header, sizeof(header), 0);
+}
+
+// write sorted records as blocks of kBlockRecords starting at offset
+static auto writeBlocks(
+    int fd,
+    const ArchiveRecord *records,
+    size_t nbRecords,
+    off_t offset
+) {
+    std::vector<uint8_t> block;
+    for(size_t i=0; i<nbRecords; i+=Archive::kBlockRecords) {
+        auto count = std::min(size_t(Archive::kBlockRecords), nbRecords-i);
+        auto first = (i + records);
+
+        ArchiveBlockHeader header;
+        header.magic = Archive::kBlockMagic;
+        header.count = count;
+        header.minEpoch = first[0].epoch;
+        header.maxEpoch = first[count-1].epoch;
+
+        block.resize(sizeof(header) + count*sizeof(ArchiveRecord));
+        memcpy(block.data(), &header, sizeof(header));
+        memcpy(sizeof(header) + block.data(), first, count*sizeof(ArchiveRecord));
+        if(false==writeAll(fd, block.data(), block.size(), offset)) {
+            return false;
+        }
+        offset += block.size();
+    }
+    return true;
+}
+
+bool Archive::append(
+    const char *path,
+    std::vector<ArchiveRecord> &records,
+    const std::function<bool(const std::vector<ArchiveRecord> &records)> &fresh
+) {
+    // sort and drop duplicates among what we were handed
+    std::sort(records.begin(), records.end());
+    records.erase(
+        std::unique(records.begin(), records.end()),
+        records.end()
+    );
+
+    // open archive and keep other writers out while we work
+    auto fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd<0) {
+        LOG_WRN("failed to open archive %s", path);
+        return false;
+    }
+    if(0!=flock(fd, LOCK_EX)) {
+        LOG_WRN("failed to lock archive %s", path);
+        close(fd);
+        return false;
+    }
+
+    // fresh file: write header
+    struct stat st;
+    fstat(fd, &st);
+    off_t end = st.st_size;
+    ArchiveCoverage before = { sizeof(ArchiveFileHeader), 0, INT64_MIN };
+    if(0==end) {
+        if(false==writeHeader(fd)) {
+            LOG_WRN("failed to write archive header to %s", path);
+            close(fd);
+            return false;
+        }
+        end = sizeof(ArchiveFileHeader);
+    } else {
+
+        // existing file: drop records we already have
+        ArchiveReader reader;
+        if(false==reader.open(path)) {
+            close(fd);
+            return false;
+        }
+        before = ArchiveCoverage::of(reader);
+        std::vector<ArchiveRecord> existing;
+        reader.query(
+            (records.empty() ? 0 : records.front().epoch),
+            (records.empty() ? -1 : records.back().epoch),
+            [&](const ArchiveRecord *r, size_t n) {
+                existing.insert(existing.end(), r, n + r);
+            }
+        );
+        std::sort(existing.begin(), existing.end());
+        auto last = std::remove_if(
+            records.begin(),
+            records.end(),
+            [&](const ArchiveRecord &r) {
+                return std::binary_search(existing.begin(), existing.end(), r);
+            }
+        );
+        records.erase(last, records.end());
+
+        // cut off whatever a previous crash may have left half-written
+        if(reader.validSize()<size_t(end)) {
+            LOG_WRN("truncating torn tail of archive %s", path);
+            end = reader.validSize();
+            if(0!=ftruncate(fd, end)) {
+                LOG_WRN("failed to truncate archive %s", path);
+                close(fd);
+                return false;
+            }
+        }
+    }
+
+    // whoever needs to know what's new hears it before the archive stops telling
+    if(fresh && 0<records.size() && false==fresh(records)) {
+        LOG_WRN("new records for archive %s were turned down, not appending them", path);
+        close(fd);
+        return false;
+    }
+
+    // write new records as sorted blocks
+    if(false==writeBlocks(fd, records.data(), records.size(), end)) {
+        LOG_WRN("failed to append to archive %s", path);
+        close(fd);
+        return false;
+    }
+
+    // make it stick
+    auto ok = (0==fdatasync(fd));
+    if(false==ok) {
+        LOG_WRN("failed to sync archive %s", path);
+    }
+    LOG_NFO("appended %d new records to archive %s", (int)records.size(), path);
+
+    // keep rollups and sketches in step, while we still hold the lock
+    ok = Rollups::update(path, records, before) && ok;
+    ok = QuantileSketches::update(path, records, before) && ok;
+    ok = ZoneMaps::update(path) && ok;
+    close(fd);
+    return ok;
+}
+
+bool Archive::write(
+    const char *path,
+    const std::vector<ArchiveRecord> &records
+) {
+    // build new archive next to the old one
+    auto tmpPath = std::string(path) + ".tmp";
+    auto fd = open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd<0) {
+        LOG_WRN("failed to create archive %s", tmpPath.c_str());
+        return false;
+    }
+    auto ok = (
+        writeHeader(fd)                                                                 &&
+        writeBlocks(fd, records.data(), records.size(), sizeof(ArchiveFileHeader))     &&
+        0==fdatasync(fd)
+    );
+    close(fd);
+
+    // and swap it in
+    ok = ok && (0==rename(tmpPath.c_str(), path));
+    if(false==ok) {
+        LOG_WRN("failed to write archive %s", path);
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    // contents changed wholesale, so do rollups and sketches
+    return Rollups::rebuild(path) && QuantileSketches::rebuild(path) && ZoneMaps::update(path);
+}
+
@@ -0,0 +1,193 @@
+#ifndef __ARCHIVE_H__
+    #define __ARCHIVE_H__
+
+    /*
+
+         native sample archive
+
+         file layout:
+
+             ArchiveFileHeader
+             ArchiveBlockHeader + count ArchiveRecord   (sorted by epoch)
+             ArchiveBlockHeader + count ArchiveRecord   (sorted by epoch)
+             ...
+
+         each append writes new blocks at the end of the file, so blocks
+         are individually sorted but may overlap in time. the reader
+         mmaps the file and builds a sparse index (one entry per block)
+         by hopping from block header to block header, range queries
+         then hand out spans of records that point straight into the
+         mapping.
+
+         rollups (see rollup.h), quantile sketches (see sketch.h) and
+         per-block zone maps (see query.h) are kept up to date by every
+         write. rollups and sketches say which state of the archive they
+         were computed from (ArchiveCoverage), so one that is missing, or
+         fell behind because a crash hit between the archive and it, gets
+         rebuilt rather than trusted.
+
+     */
+
+    #include <vector>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <algorithm>
+    #include <functional>
+
+    // one archived sample, fixed size
+    struct ArchiveRecord {
+        int64_t  epoch;     // seconds since 1970
+        uint32_t deviceId;  // see Archive::deviceId
+        uint16_t mgdl;      // glucose level in mg/dL
+        uint16_t status;    // sample status as reported by the device, 0 means valid
+    };
+    static_assert(16==sizeof(ArchiveRecord), "archive records must be 16 bytes");
+
+    // archive sort order: time first, then device, then value
+    static inline bool operator<(
+        const ArchiveRecord &a,
+        const ArchiveRecord &b
+    ) {
+        if(a.epoch!=b.epoch) return (a.epoch<b.epoch);
+        if(a.deviceId!=b.deviceId) return (a.deviceId<b.deviceId);
+        if(a.mgdl!=b.mgdl) return (a.mgdl<b.mgdl);
+        return (a.status<b.status);
+    }
+
+    // two records are the same sample if all fields match
+    static inline bool operator==(
+        const ArchiveRecord &a,
+        const ArchiveRecord &b
+    ) {
+        return (
+            a.epoch==b.epoch        &&
+            a.deviceId==b.deviceId  &&
+            a.mgdl==b.mgdl          &&
+            a.status==b.status
+        );
+    }
+
+    // on-disk headers
+    struct ArchiveFileHeader {
+        char     magic[8];      // "ACCUARCH"
+        uint32_t version;
+        uint32_t recordSize;
+    };
+    struct ArchiveBlockHeader {
+        uint32_t magic;         // kBlockMagic
+        uint32_t count;         // number of records that follow
+        int64_t  minEpoch;
+        int64_t  maxEpoch;
+    };
+
+    // one entry of the sparse block index
+    struct ArchiveBlock {
+        int64_t             minEpoch;
+        int64_t             maxEpoch;
+        const ArchiveRecord *records;   // points into the mapping
+        uint32_t            count;
+    };
+
+    // mmap based, read-only view of an archive
+    struct ArchiveReader {
+
+        ArchiveReader();
+        ~ArchiveReader();
+
+        // map an archive, false if missing or not an archive
+        bool open(const char *path);
+        void close();
+
+        // sparse block index
+        const std::vector<ArchiveBlock> &blocks() const { return index; }
+
+        // number of records in the archive
+        size_t size() const;
+
+        // size of the well-formed part of the file (a crash may leave a torn block at the end)
+        size_t validSize() const { return validBytes; }
+
+        // call fn(const ArchiveRecord *first, size_t count) for each run of records in [from, to]
+        template<typename Fn> void query(
+            int64_t from,
+            int64_t to,
+            Fn &&fn
+        ) const {
+            for(auto &block:index) {
+                if(block.maxEpoch<from || to<block.minEpoch) {
+                    continue;
+                }
+                auto end = (block.count + block.records);
+                auto b = std::lower_bound(
+                    block.records,
+                    end,
+                    from,
+                    [](const ArchiveRecord &r, int64_t t) { return r.epoch<t; }
+                );
+                auto e = std::upper_bound(
+                    b,
+                    end,
+                    to,
+                    [](int64_t t, const ArchiveRecord &r) { return t<r.epoch; }
+                );
+                if(b<e) {
+                    fn(b, size_t(e-b));
+                }
+            }
+        }
+
+    private:
+        int fd;
+        void *map;
+        size_t mapSize;
+        size_t validBytes;
+        std::vector<ArchiveBlock> index;
+    };
+
+    // which state of an archive something was computed from
+    struct ArchiveCoverage {
+        uint64_t bytes;         // well-formed size of the file
+        uint64_t records;
+        int64_t  maxEpoch;      // of the last block, INT64_MIN if none
+
+        // what reader has mapped
+        static ArchiveCoverage of(const ArchiveReader &reader);
+
+        bool operator==(const ArchiveCoverage &o) const {
+            return (bytes==o.bytes && records==o.records && maxEpoch==o.maxEpoch);
+        }
+    };
+    static_assert(24==sizeof(ArchiveCoverage), "archive coverage must be 24 bytes");
+
+    // archive writer
+    struct Archive {
+
+        static constexpr uint32_t kVersion = 1;
+        static constexpr uint32_t kBlockMagic = 0x4B4C4241; // "ABLK"
+        static constexpr uint32_t kBlockRecords = 4096;
+
+        // fold a 64bit device system id into the 32bit id stored in records
+        static uint32_t deviceId(uint64_t systemId) {
+            return uint32_t(systemId ^ (systemId >> 32));
+        }
+
+        // append records not already present in the archive (creating it if need be)
+        // on return, records only holds the ones that were actually appended. fresh, if
+        // given, sees those before they are written, with the archive locked: whatever it
+        // does with them is done by the time they stop being new. false from it fails
+        // the append
+        static bool append(
+            const char *path,
+            std::vector<ArchiveRecord> &records,
+            const std::function<bool(const std::vector<ArchiveRecord> &records)> &fresh = nullptr
+        );
+
+        // atomically replace the archive at path with sorted records
+        static bool write(
+            const char *path,
+            const std::vector<ArchiveRecord> &records
+        );
+    };
+
+#endif // __ARCHIVE_H__
+
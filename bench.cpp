@@ -0,0 +1,389 @@
+/*
+
+     micro benchmarks for the hot paths of accuchek
+
+     usage:
+
+         accuchek-bench [benchmark name]
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <loop.h>
+#include <codec.h>
+#include <errno.h>
+#include <meter.h>
+#include <stdio.h>
+#include <memory>
+#include <string.h>
+#include <unistd.h>
+#include <pipeline.h>
+#include <algorithm>
+#include <inttypes.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+// wall clock in seconds
+static double now() {
+    struct timeval t;
+    gettimeofday(&t, 0);
+    return t.tv_sec + 1e-6*t.tv_usec;
+}
+
+// a few years of readings: roughly every 5 minutes with jitter, slowly varying levels
+static auto makeRecords(
+    size_t count
+) {
+    std::vector<ArchiveRecord> records(count);
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+    auto rnd = [&]() {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        return seed;
+    };
+    int64_t epoch = 1600000000;
+    int level = 120;
+    for(size_t i=0; i<count; ++i) {
+        epoch += 300 + int(rnd() % 5) - 2;
+        level += int(rnd() % 11) - 5;
+        level = std::max(40, std::min(400, level));
+        records[i].epoch = epoch;
+        records[i].deviceId = 0x12345678;
+        records[i].mgdl = level;
+        records[i].status = (0==(rnd() % 1000) ? 1 : 0);
+    }
+    return records;
+}
+
+// encode / decode throughput of the compressed block codec
+static void benchCodec() {
+
+    auto records = makeRecords(1<<22);
+    auto rawBytes = records.size() * sizeof(ArchiveRecord);
+
+    // encode
+    std::vector<uint8_t> encoded;
+    encoded.reserve(rawBytes);
+    auto nbRounds = 8;
+    auto t0 = now();
+    for(int round=0; round<nbRounds; ++round) {
+        encoded.clear();
+        for(size_t i=0; i<records.size(); i+=Codec::kBlockRecords) {
+            auto count = std::min(size_t(Codec::kBlockRecords), records.size()-i);
+            Codec::encode(i + records.data(), count, encoded);
+        }
+    }
+    auto t1 = now();
+
+    // decode
+    std::vector<ArchiveRecord> decoded;
+    decoded.reserve(records.size());
+    for(int round=0; round<nbRounds; ++round) {
+        decoded.clear();
+        const uint8_t *p = encoded.data();
+        auto end = (encoded.size() + p);
+        while(p<end) {
+            if(false==Codec::decode(p, end, decoded)) {
+                printf("codec: decode failed\n");
+                exit(1);
+            }
+        }
+    }
+    auto t2 = now();
+
+    // check round trip
+    auto same = (
+        decoded.size()==records.size() &&
+        0==memcmp(decoded.data(), records.data(), rawBytes)
+    );
+
+    auto gb = (nbRounds * rawBytes / 1e9);
+    printf("codec: %d records, %.2f bytes/record (JSON ~120, raw %d)\n",
+        (int)records.size(),
+        encoded.size() / double(records.size()),
+        (int)sizeof(ArchiveRecord)
+    );
+    printf("codec: encode %.2f GB/s, decode %.2f GB/s (of raw records), round trip %s\n",
+        gb / (t1-t0),
+        gb / (t2-t1),
+        same ? "ok" : "MISMATCH"
+    );
+}
+
+// samples handed out by meter sessions
+static void countSamples(
+    void *user,
+    const AccuChekSample *,
+    size_t count
+) {
+    *(size_t *)user += count;
+}
+
+// a meter session talking to a simulated meter over a socket pair, both
+// ends driven by one event loop the way USB transfers would be
+struct BenchSession {
+
+    BenchSession(
+        EventLoop &_loop,
+        uint64_t systemId,
+        uint32_t nbSamples,
+        size_t &samples,
+        int &_pending
+    )
+        :   loop(_loop),
+            callbacks({ &samples, 0, countSamples, 0, 0 }),
+            host(&callbacks),
+            device(systemId, nbSamples, 1599999960),
+            fds{ -1, -1 },
+            pending(_pending)
+    {
+        socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds);
+        loop.watch(fds[0], 0, [this](uint32_t) { pumpHost(); });
+        loop.watch(fds[1], EPOLLIN, [this](uint32_t) { pumpDevice(); });
+        ++pending;
+        pumpDevice();
+        pumpHost();
+    }
+
+    ~BenchSession() {
+        for(auto fd:fds) {
+            if(0<=fd) {
+                loop.unwatch(fd);
+                close(fd);
+            }
+        }
+    }
+
+    // host side: move packets until the socket says wait
+    void pumpHost() {
+        while(MeterSession::kDone!=host.step()) {
+            auto receiving = (MeterSession::kReceive==host.step());
+            auto n = (
+                receiving                                                   ?
+                recv(fds[0], host.buffer(), host.size(), 0)                 :
+                send(fds[0], host.buffer(), host.size(), MSG_NOSIGNAL)
+            );
+            if(n<0 && EAGAIN==errno) {
+                loop.modify(fds[0], (receiving ? EPOLLIN : EPOLLOUT));
+                return;
+            }
+            host.advance((0<n || false==receiving) ? int(n) : -1);
+        }
+        loop.modify(fds[0], 0);
+        if(0==--pending) {
+            loop.stop();
+        }
+    }
+
+    // device side: answer whatever came in
+    void pumpDevice() {
+        uint8_t buffer[MeterSession::kBufferSize];
+        while(true) {
+            auto n = recv(fds[1], buffer, sizeof(buffer), 0);
+            if(n<=0) {
+                break;
+            }
+            device.receive(buffer, n);
+        }
+        while(true) {
+            auto n = device.send(buffer, sizeof(buffer));
+            if(0==n) {
+                break;
+            }
+            send(fds[1], buffer, n, MSG_NOSIGNAL);
+        }
+    }
+
+    EventLoop &loop;
+    AccuChekCallbacks callbacks;
+    MeterSession host;
+    SimulatedMeter device;
+    int fds[2];
+    int &pending;
+};
+
+// per-session cost of running downloads on the event loop, against a simulated meter
+static void benchSessions() {
+
+    auto nbSamples = 200;
+    auto nbTotal = 1024;
+
+    // protocol alone: host and meter handing packets to each other in memory
+    auto baseline = 0.0;
+    {
+        size_t samples = 0;
+        auto t0 = now();
+        for(int i=0; i<nbTotal; ++i) {
+            AccuChekCallbacks callbacks = { &samples, 0, countSamples, 0, 0 };
+            MeterSession host(&callbacks);
+            SimulatedMeter device(i, nbSamples, 1599999960);
+            while(MeterSession::kDone!=host.step()) {
+                if(MeterSession::kSend==host.step()) {
+                    device.receive(host.buffer(), host.size());
+                    host.advance(int(host.size()));
+                } else {
+                    host.advance(int(device.send(host.buffer(), host.size())));
+                }
+            }
+        }
+        auto t1 = now();
+        baseline = 1e6 * (t1-t0) / nbTotal;
+        printf("sessions: in memory, %d sessions of %d samples, %.1f us/session, %.1f M samples/s\n",
+            nbTotal,
+            nbSamples,
+            baseline,
+            samples / (t1-t0) / 1e6
+        );
+    }
+
+    // the same on the loop, with more and more meters at once
+    for(auto concurrent:{ 1, 16, 64, 256 }) {
+        EventLoop loop;
+        size_t samples = 0;
+        auto t0 = now();
+        for(int round=0; round<nbTotal/concurrent; ++round) {
+            auto pending = 0;
+            std::vector<std::unique_ptr<BenchSession>> sessions;
+            for(int i=0; i<concurrent; ++i) {
+                sessions.emplace_back(new BenchSession(loop, i, nbSamples, samples, pending));
+            }
+            if(0<pending) {
+                loop.run();
+            }
+        }
+        auto t1 = now();
+        auto ok = (samples==size_t(nbTotal)*nbSamples);
+        auto perSession = 1e6 * (t1-t0) / nbTotal;
+        printf("sessions: event loop, %3d at once, %.1f us/session (%+.1f over in memory), %.1f M samples/s, %s\n",
+            concurrent,
+            perSession,
+            perSession - baseline,
+            samples / (t1-t0) / 1e6,
+            ok ? "ok" : "SAMPLES MISSING"
+        );
+    }
+}
+
+// a sink with some formatting to do, the way JSON output would, that every few
+// batches stalls the way a busy disk, a full pipe or a far away server does
+struct SlowSink {
+    FILE *out;
+    int stallEvery;     // batches
+    int stallUs;
+    int nbBatches;
+};
+
+static void formatSamples(
+    void *user,
+    const AccuChekSample *samples,
+    size_t count
+) {
+    auto sink = (SlowSink *)user;
+    for(size_t i=0; i<count; ++i) {
+        fprintf(sink->out, "{ \"epoch\":%" PRId64 ", \"mg/dL\":%d, \"mmol/L\":%.3f }\n",
+            int64_t(samples[i].epoch),
+            int(samples[i].mgdl),
+            samples[i].mgdl / 18.0
+        );
+    }
+    if(0==(++sink->nbBatches % sink->stallEvery)) {
+        usleep(sink->stallUs);
+    }
+}
+
+// downloads with decoding and output in line with USB round trips, then pipelined
+static void benchPipeline() {
+
+    auto nbSamples = 1000;
+    auto nbSessions = 50;
+    auto roundTrip = 1000;  // us per simulated USB transfer, a full speed frame
+
+    // the sink takes about a round trip per segment on average, in bursts of four
+    SlowSink sink = { fopen("/dev/null", "w"), 4, 4*roundTrip, 0 };
+
+    for(auto depth:{ 0, 16 }) {
+        AccuChekPipelineStats stats;
+        memset(&stats, 0, sizeof(stats));
+        auto t0 = now();
+        for(int i=0; i<nbSessions; ++i) {
+            AccuChekCallbacks callbacks = { &sink, 0, formatSamples, 0, 0 };
+            std::unique_ptr<SegmentPipeline> pipeline(0==depth ? 0 : new SegmentPipeline(&callbacks, depth));
+            MeterSession host(&callbacks, pipeline.get());
+            SimulatedMeter device(i, nbSamples, 1599999960);
+            while(MeterSession::kDone!=host.step()) {
+                usleep(roundTrip);
+                if(MeterSession::kSend==host.step()) {
+                    device.receive(host.buffer(), host.size());
+                    host.advance(int(host.size()));
+                } else {
+                    host.advance(int(device.send(host.buffer(), host.size())));
+                }
+            }
+            if(pipeline) {
+                pipeline->finish();
+                AccuChekPipelineStats one;
+                pipeline->stats(one);
+                stats.usb.stalled += one.usb.stalled;
+                stats.decode.idle += one.decode.idle;
+                stats.decode.stalled += one.decode.stalled;
+                stats.decode.maxQueued = std::max(stats.decode.maxQueued, one.decode.maxQueued);
+                stats.sink.idle += one.sink.idle;
+                stats.sink.maxQueued = std::max(stats.sink.maxQueued, one.sink.maxQueued);
+            }
+        }
+        auto t1 = now();
+        printf("pipeline: depth %2d, %d sessions of %d samples, %dus round trips, %dus sink stall every %d batches, %.2f ms/session\n",
+            depth,
+            nbSessions,
+            nbSamples,
+            roundTrip,
+            sink.stallUs,
+            sink.stallEvery,
+            1e3 * (t1-t0) / nbSessions
+        );
+        if(0<depth) {
+            printf("pipeline: usb stalled %.1f ms, decode idle %.1f ms stalled %.1f ms max queued %u, sink idle %.1f ms max queued %u\n",
+                1e3 * stats.usb.stalled,
+                1e3 * stats.decode.idle,
+                1e3 * stats.decode.stalled,
+                stats.decode.maxQueued,
+                1e3 * stats.sink.idle,
+                stats.sink.maxQueued
+            );
+        }
+    }
+
+    // segments travel down the pipeline in their transfer buffers, which come back for reuse
+    printf("pipeline: %d transfer buffers allocated for all %d sessions\n",
+        (int)TransferBuffers::heapAllocated(),
+        2*nbSessions
+    );
+    fclose(sink.out);
+}
+
+// all known benchmarks
+static const struct {
+    const char *name;
+    void (*fn)();
+} kBenchmarks[] = {
+    { "codec",    benchCodec    },
+    { "sessions", benchSessions },
+    { "pipeline", benchPipeline },
+};
+
+// entry point
+int main(
+    int argc,
+    char *argv[]
+) {
+    gQuiet = true;
+    for(auto &bench:kBenchmarks) {
+        if(argc<2 || 0==strcmp(argv[1], bench.name)) {
+            bench.fn();
+        }
+    }
+    return 0;
+}
+
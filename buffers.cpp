@@ -0,0 +1,111 @@
+/*
+
+     pool of USB transfer buffers, see buffers.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <atomic>
+#include <stdlib.h>
+#include <buffers.h>
+#include <libusb-1.0/libusb.h>
+
+// libusb_dev_mem_alloc showed up in libusb 1.0.21
+#if defined(LIBUSB_API_VERSION) && 0x01000105<=LIBUSB_API_VERSION
+    #define HAVE_DEV_MEM 1
+#else
+    #define HAVE_DEV_MEM 0
+#endif
+
+static std::atomic<size_t> g_heapAllocated(0);
+
+TransferBuffers::TransferBuffers()
+    :   devHandle(0),
+        mapped(0),
+        mappedSize(0)
+{
+}
+
+TransferBuffers::TransferBuffers(
+    libusb_device_handle *_devHandle,
+    size_t count
+)
+    :   devHandle(_devHandle),
+        mapped(0),
+        mappedSize(0)
+{
+    #if HAVE_DEV_MEM
+        mapped = libusb_dev_mem_alloc(devHandle, count * kSize);
+    #endif
+    if(0==mapped) {
+        LOG_NFO("no device memory to be had, transfer buffers come from the heap");
+        return;
+    }
+    mappedSize = (count * kSize);
+    spare.reserve(count);
+    for(size_t i=count; 0<i; --i) {
+        spare.push_back(mapped + (i - 1)*kSize);
+    }
+    LOG_NFO("mapped %d transfer buffers of device memory", (int)count);
+}
+
+TransferBuffers::~TransferBuffers() {
+    for(auto buffer:spare) {
+        if(false==isMapped(buffer)) {
+            free(buffer);
+        }
+    }
+    #if HAVE_DEV_MEM
+        if(0!=mapped) {
+            libusb_dev_mem_free(devHandle, mapped, mappedSize);
+        }
+    #endif
+}
+
+uint8_t *TransferBuffers::get() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if(0<spare.size()) {
+            auto buffer = spare.back();
+            spare.pop_back();
+            return buffer;
+        }
+    }
+
+    // device memory ran out (or there never was any)
+    if(this!=&heap()) {
+        return heap().get();
+    }
+    g_heapAllocated.fetch_add(1, std::memory_order_relaxed);
+    return (uint8_t *)aligned_alloc(64, kSize);
+}
+
+void TransferBuffers::put(
+    uint8_t *buffer
+) {
+    if(0==buffer) {
+        return;
+    }
+    if(this!=&heap() && false==isMapped(buffer)) {
+        heap().put(buffer);
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    spare.push_back(buffer);
+}
+
+bool TransferBuffers::isMapped(
+    const uint8_t *buffer
+) const {
+    return (mapped<=buffer && buffer<mapped + mappedSize);
+}
+
+size_t TransferBuffers::heapAllocated() {
+    return g_heapAllocated.load(std::memory_order_relaxed);
+}
+
+TransferBuffers &TransferBuffers::heap() {
+    static TransferBuffers buffers;
+    return buffers;
+}
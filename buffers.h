@@ -0,0 +1,75 @@
+#ifndef __BUFFERS_H__
+    #define __BUFFERS_H__
+
+    /*
+
+         pool of USB transfer buffers, in device memory where libusb has it
+
+         every transfer of a download lands in, or leaves from, one of these.
+         where the kernel lets libusb map usbfs memory for a device
+         (libusb_dev_mem_alloc), the pool carves its buffers out of that, and
+         bulk transfers then go straight between the device and that memory,
+         with no copy in or out of a kernel URB. anywhere else, or once those
+         run out, buffers come from the heap, cache line aligned.
+
+         buffers get recycled rather than freed: a meter session keeps one,
+         and hands it down the pipeline as is when a data segment arrives
+         (see pipeline.h), taking another one for the next transfer. the
+         decoder reads the segment in place and puts the buffer back. heap
+         buffers go to a process-wide free list, so they outlive sessions
+         and get reused by the next download, device memory stays with the
+         pool that mapped it.
+
+         get() and put() may be called from any thread.
+
+     */
+
+    #include <mutex>
+    #include <vector>
+    #include <stddef.h>
+    #include <stdint.h>
+
+    struct libusb_device_handle;
+
+    struct TransferBuffers {
+
+        static constexpr size_t kSize = 1024;
+
+        // heap only
+        TransferBuffers();
+
+        // try and map count buffers worth of devHandle's memory, heap if that fails
+        TransferBuffers(libusb_device_handle *devHandle, size_t count);
+
+        // every buffer must be back, and devHandle still open
+        ~TransferBuffers();
+
+        TransferBuffers(const TransferBuffers &) = delete;
+        TransferBuffers &operator=(const TransferBuffers &) = delete;
+
+        // kSize bytes, device memory first
+        uint8_t *get();
+
+        // done with a buffer get() returned
+        void put(uint8_t *buffer);
+
+        // transfers go to and from device memory
+        bool zeroCopy() const { return 0!=mapped; }
+
+        // buffers allocated on the heap, by every pool, since the process started
+        static size_t heapAllocated();
+
+        // what sessions with no pool of their own draw from
+        static TransferBuffers &heap();
+
+    private:
+        bool isMapped(const uint8_t *buffer) const;
+
+        std::mutex lock;
+        libusb_device_handle *devHandle;
+        uint8_t *mapped;
+        size_t mappedSize;
+        std::vector<uint8_t *> spare;
+    };
+
+#endif // __BUFFERS_H__
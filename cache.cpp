@@ -0,0 +1,132 @@
+/*
+
+     per-meter segment digest cache, see cache.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <cache.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+SegmentCache::SegmentCache(
+    const char *_dir
+)
+    :   dir(_dir),
+        nbHits(0),
+        nbMisses(0)
+{
+}
+
+void SegmentCache::open(
+    uint64_t systemId
+) {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016" PRIx64 ".seg", systemId);
+    path = dir + name;
+    previous.clear();
+    current.clear();
+
+    // no file yet is a meter we never downloaded in full
+    auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd<0) {
+        LOG_NFO("no segment cache at %s yet", path.c_str());
+        return;
+    }
+    struct stat st;
+    std::vector<uint64_t> digests;
+    if(0==fstat(fd, &st)) {
+        digests.resize(st.st_size / sizeof(uint64_t));
+    }
+    auto size = digests.size() * sizeof(uint64_t);
+    if(size_t(pread(fd, digests.data(), size, 0))!=size) {
+        LOG_WRN("failed to read segment cache %s, ignoring it", path.c_str());
+        digests.clear();
+    }
+    close(fd);
+    previous.insert(digests.begin(), digests.end());
+    LOG_NFO("segment cache %s knows %d segments", path.c_str(), (int)previous.size());
+}
+
+bool SegmentCache::seen(
+    const uint8_t *payload,
+    size_t size
+) {
+    auto digest = hash(payload, size);
+    current.push_back(digest);
+    if(0!=previous.count(digest)) {
+        ++nbHits;
+        return true;
+    }
+    ++nbMisses;
+    return false;
+}
+
+bool SegmentCache::save() {
+    if(path.empty()) {
+        return false;
+    }
+
+    // write new digests next to the old ones, and swap them in
+    mkdir(dir.c_str(), 0755);
+    auto tmpPath = path + ".tmp";
+    auto fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd<0) {
+        LOG_WRN("failed to create segment cache %s", tmpPath.c_str());
+        return false;
+    }
+    auto size = current.size() * sizeof(uint64_t);
+    auto ok = (size_t(write(fd, current.data(), size))==size && 0==fdatasync(fd));
+    close(fd);
+    ok = ok && (0==rename(tmpPath.c_str(), path.c_str()));
+    if(false==ok) {
+        LOG_WRN("failed to write segment cache %s", path.c_str());
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    LOG_NFO(
+        "segment cache %s: %d segments skipped, %d new",
+        path.c_str(),
+        (int)nbHits,
+        (int)nbMisses
+    );
+    return true;
+}
+
+uint64_t SegmentCache::hash(
+    const uint8_t *data,
+    size_t size
+) {
+    // 8 bytes at a time: multiply, rotate, fold in
+    static constexpr uint64_t k1 = 0x9E3779B97F4A7C15ull;
+    static constexpr uint64_t k2 = 0xC2B2AE3D27D4EB4Full;
+    auto h = (k1 * (1 + size));
+    size_t i = 0;
+    for(; i+8<=size; i+=8) {
+        uint64_t w;
+        memcpy(&w, i + data, sizeof(w));
+        w *= k2;
+        w = ((w << 31) | (w >> 33));
+        h ^= (w * k1);
+        h = ((h << 27) | (h >> 37)) * k1 + k2;
+    }
+
+    // what's left, a byte at a time
+    for(; i<size; ++i) {
+        h ^= (data[i] * k1);
+        h = ((h << 11) | (h >> 53)) * k2;
+    }
+
+    // final avalanche, so every input bit reaches every output bit
+    h ^= (h >> 33);
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= (h >> 33);
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= (h >> 33);
+    return h;
+}
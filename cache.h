@@ -0,0 +1,60 @@
+#ifndef __CACHE_H__
+    #define __CACHE_H__
+
+    /*
+
+         per-meter cache of data segment digests, to skip what a meter resends
+
+         meters send their whole store on every download, and between two
+         downloads most of it doesn't change: the same segments come back
+         byte for byte. each segment's payload (entry count and entries,
+         not the invoke id or ACK words around it) is hashed, and a segment
+         whose digest was in the meter's previous download is ACKed but
+         neither decoded nor handed to callbacks. decoding and output then
+         cost in proportion to what's new.
+
+         one file per meter, DIR/<system id>.seg, holding the 64-bit digests
+         of its last complete download as raw little endian words. a file
+         only gets replaced once a download went through and whatever it
+         handed out is safe (see accuchek_commit_segment_cache), so an
+         interrupted download, or one whose samples didn't make it to the
+         archive or the outputs, is simply done again in full next time.
+
+     */
+
+    #include <string>
+    #include <vector>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <unordered_set>
+
+    struct SegmentCache {
+
+        SegmentCache(const char *dir);
+
+        // meter systemId is talking: load the digests of its previous download
+        void open(uint64_t systemId);
+
+        // true if payload was in the previous download, remembered for the next one either way
+        bool seen(const uint8_t *payload, size_t size);
+
+        // download went through: what was seen this time is what the next one compares to
+        bool save();
+
+        // segments skipped and segments that were new, so far
+        size_t hits() const { return nbHits; }
+        size_t misses() const { return nbMisses; }
+
+        // fast, non-cryptographic 64-bit hash
+        static uint64_t hash(const uint8_t *data, size_t size);
+
+    private:
+        std::string dir;
+        std::string path;
+        std::unordered_set<uint64_t> previous;
+        std::vector<uint64_t> current;
+        size_t nbHits;
+        size_t nbMisses;
+    };
+
+#endif // __CACHE_H__
@@ -0,0 +1,145 @@
+/*
+
+     recordings of meter sessions, see capture.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <capture.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <algorithm>
+
+static const char kMagic[4] = { 'A', 'C', 'A', 'P' };
+
+CaptureWriter::CaptureWriter()
+    :   file(0)
+{
+}
+
+CaptureWriter::~CaptureWriter() {
+    close();
+}
+
+bool CaptureWriter::open(
+    const char *path
+) {
+    close();
+    file = fopen(path, "wb");
+    if(0==file) {
+        LOG_WRN("failed to create capture %s", path);
+        return false;
+    }
+    CaptureFileHeader header;
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    if(1!=fwrite(&header, sizeof(header), 1, file)) {
+        LOG_WRN("failed to write capture %s", path);
+        close();
+        return false;
+    }
+    return true;
+}
+
+void CaptureWriter::close() {
+    if(0!=file) {
+        fclose(file);
+        file = 0;
+    }
+}
+
+void CaptureWriter::record(
+    uint32_t stream,
+    bool fromDevice,
+    const uint8_t *data,
+    size_t size
+) {
+    if(0==file) {
+        return;
+    }
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    CaptureRecordHeader header;
+    header.usec = tv.tv_sec*1000000ll + tv.tv_usec;
+    header.stream = stream;
+    header.size = uint16_t(std::min(size, size_t(UINT16_MAX)));
+    header.fromDevice = (fromDevice ? 1 : 0);
+    header.reserved = 0;
+
+    // header and payload stay together, whichever thread records
+    std::lock_guard<std::mutex> guard(lock);
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(data, 1, header.size, file);
+    fflush(file);
+}
+
+CaptureReader::CaptureReader()
+    :   base(0),
+        length(0),
+        offset(0)
+{
+}
+
+CaptureReader::~CaptureReader() {
+    if(0!=base) {
+        munmap((void *)base, length);
+    }
+}
+
+bool CaptureReader::open(
+    const char *path
+) {
+    auto fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if(fd<0) {
+        LOG_WRN("failed to open capture %s", path);
+        return false;
+    }
+    struct stat st;
+    if(0!=fstat(fd, &st) || st.st_size<(off_t)sizeof(CaptureFileHeader)) {
+        LOG_WRN("%s is not a capture", path);
+        ::close(fd);
+        return false;
+    }
+    length = st.st_size;
+    auto map = mmap(0, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(MAP_FAILED==map) {
+        LOG_WRN("failed to map capture %s", path);
+        length = 0;
+        return false;
+    }
+    base = (const uint8_t *)map;
+
+    // read front to back, once
+    madvise(map, length, MADV_SEQUENTIAL);
+    auto header = (const CaptureFileHeader *)base;
+    if(0!=memcmp(header->magic, kMagic, sizeof(kMagic)) || CaptureWriter::kVersion!=header->version) {
+        LOG_WRN("%s is not a capture, or of an unknown version", path);
+        return false;
+    }
+    offset = sizeof(CaptureFileHeader);
+    return true;
+}
+
+bool CaptureReader::next(
+    const CaptureRecordHeader *&header,
+    const uint8_t *&payload
+) {
+    if(length<offset + sizeof(CaptureRecordHeader)) {
+        return false;
+    }
+    header = (const CaptureRecordHeader *)(offset + base);
+    auto end = (offset + sizeof(CaptureRecordHeader) + header->size);
+    if(length<end) {
+        LOG_WRN("capture ends with a truncated record");
+        return false;
+    }
+    payload = (offset + sizeof(CaptureRecordHeader) + base);
+    offset = end;
+    return true;
+}
@@ -0,0 +1,78 @@
+#ifndef __CAPTURE_H__
+    #define __CAPTURE_H__
+
+    /*
+
+         recordings of meter sessions, for offline analysis (accuchek-dissect)
+
+         a capture file is a CaptureFileHeader followed by one record per
+         bulk transfer that went through, in the order they completed:
+
+             CaptureRecordHeader   16 bytes: when, which stream, which way, how long
+             payload               size bytes, as they went over the wire
+
+         a stream is one meter session (the device index in the session
+         that recorded it), so downloads from several meters at once can
+         share a file. everything is little endian.
+
+     */
+
+    #include <mutex>
+    #include <stdio.h>
+    #include <stddef.h>
+    #include <stdint.h>
+
+    struct __attribute__((packed)) CaptureFileHeader {
+        char     magic[4];      // "ACAP"
+        uint32_t version;
+    };
+
+    struct __attribute__((packed)) CaptureRecordHeader {
+        int64_t  usec;          // wall clock, microseconds since 1970
+        uint32_t stream;        // session it belongs to
+        uint16_t size;          // payload bytes that follow
+        uint8_t  fromDevice;    // 1: device to host, 0: host to device
+        uint8_t  reserved;
+    };
+
+    struct CaptureWriter {
+
+        static constexpr uint32_t kVersion = 1;
+
+        CaptureWriter();
+        ~CaptureWriter();
+
+        // create (or truncate) path and write the file header
+        bool open(const char *path);
+        void close();
+        bool isOpen() const { return 0!=file; }
+
+        // record a transfer, from any thread
+        void record(uint32_t stream, bool fromDevice, const uint8_t *data, size_t size);
+
+    private:
+        std::mutex lock;
+        FILE *file;
+    };
+
+    struct CaptureReader {
+
+        CaptureReader();
+        ~CaptureReader();
+
+        // map path and check its header
+        bool open(const char *path);
+
+        // next record, false at end of file (or on a truncated record)
+        bool next(const CaptureRecordHeader *&header, const uint8_t *&payload);
+
+        // bytes mapped
+        size_t size() const { return length; }
+
+    private:
+        const uint8_t *base;
+        size_t length;
+        size_t offset;
+    };
+
+#endif // __CAPTURE_H__
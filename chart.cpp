@@ -0,0 +1,323 @@
+/*
+
+     bounded size series for charting, see chart.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <chart.h>
+#include <fcntl.h>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// rollup file order: resolution, device, start
+static bool before(
+    const RollupBucket &b,
+    uint32_t resolution,
+    uint32_t deviceId,
+    int64_t start
+) {
+    if(b.resolution!=resolution) return (b.resolution<resolution);
+    if(b.deviceId!=deviceId) return (b.deviceId<deviceId);
+    return (b.start<start);
+}
+
+// last second of the bucket starting at start
+static int64_t bucketEnd(
+    int64_t start,
+    RollupResolution resolution
+) {
+    // days and weeks are an hour shorter or longer across DST changes: land well inside the next one
+    switch(resolution) {
+        case kRollupHour:   return (start + 3600 - 1);
+        case kRollupDay:    return Rollups::bucketStart(start + 86400 + 3*3600, resolution) - 1;
+        case kRollupWeek:   return Rollups::bucketStart(start + 7*86400 + 3*3600, resolution) - 1;
+        default:            return start;
+    }
+}
+
+ChartReader::ChartReader()
+    :   fd(-1),
+        map(0),
+        mapSize(0),
+        buckets(0),
+        nbBuckets(0)
+{
+}
+
+ChartReader::~ChartReader() {
+    close();
+}
+
+void ChartReader::close() {
+    if(0!=map) {
+        munmap(map, mapSize);
+        map = 0;
+    }
+    if(0<=fd) {
+        ::close(fd);
+        fd = -1;
+    }
+    archive.close();
+    held.clear();
+    mapSize = 0;
+    buckets = 0;
+    nbBuckets = 0;
+}
+
+bool ChartReader::open(
+    const char *archivePath
+) {
+    close();
+    if(false==archive.open(archivePath)) {
+        LOG_WRN("failed to open archive %s", archivePath);
+        return false;
+    }
+
+    // rollups in step with the archive get mapped, anything else gets rebuilt and held in memory
+    if(mapRollups(std::string(archivePath) + ".rollup")) {
+        return true;
+    }
+    Rollups rollups;
+    if(false==rollups.load(archivePath)) {
+        LOG_WRN("failed to rebuild rollups of %s", archivePath);
+        close();
+        return false;
+    }
+    for(int r=0; r<kNbRollupResolutions; ++r) {
+        auto all = rollups.buckets(RollupResolution(r));
+        held.insert(held.end(), all.begin(), all.end());
+    }
+    buckets = held.data();
+    nbBuckets = held.size();
+    return true;
+}
+
+bool ChartReader::mapRollups(
+    const std::string &path
+) {
+    fd = ::open(path.c_str(), O_RDONLY);
+    if(fd<0) {
+        return false;
+    }
+    struct stat st;
+    auto ok = (0==fstat(fd, &st) && (off_t)sizeof(RollupFileHeader)<=st.st_size);
+    if(ok) {
+        mapSize = st.st_size;
+        map = mmap(0, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+        if(MAP_FAILED==map) {
+            LOG_WRN("failed to mmap %s", path.c_str());
+            map = 0;
+            ok = false;
+        }
+    }
+    ok = ok && Rollups::current(*(const RollupFileHeader *)map, ArchiveCoverage::of(archive));
+    if(false==ok) {
+        if(0!=map) {
+            munmap(map, mapSize);
+            map = 0;
+        }
+        ::close(fd);
+        fd = -1;
+        mapSize = 0;
+        return false;
+    }
+    buckets = (const RollupBucket *)(sizeof(RollupFileHeader) + (const uint8_t *)map);
+    nbBuckets = (mapSize - sizeof(RollupFileHeader)) / sizeof(RollupBucket);
+    return true;
+}
+
+ChartReader::Span ChartReader::span(
+    RollupResolution resolution,
+    uint32_t deviceId,
+    int64_t from,
+    int64_t to
+) const {
+    auto end = (nbBuckets + buckets);
+    auto first = std::lower_bound(
+        buckets,
+        end,
+        Rollups::bucketStart(from, resolution),
+        [&](const RollupBucket &b, int64_t start) { return before(b, resolution, deviceId, start); }
+    );
+    auto last = std::upper_bound(
+        first,
+        end,
+        to,
+        [&](int64_t start, const RollupBucket &b) { return false==before(b, resolution, deviceId, start + 1); }
+    );
+    return { first, last };
+}
+
+std::vector<uint32_t> ChartReader::devices(
+    RollupResolution resolution
+) const {
+    std::vector<uint32_t> ids;
+    auto end = (nbBuckets + buckets);
+    auto p = std::lower_bound(
+        buckets,
+        end,
+        0,
+        [&](const RollupBucket &b, int) { return before(b, resolution, 0, INT64_MIN); }
+    );
+
+    // hop from device to device
+    while(p<end && uint32_t(resolution)==p->resolution) {
+        auto id = p->deviceId;
+        ids.push_back(id);
+        p = std::lower_bound(
+            p,
+            end,
+            0,
+            [&](const RollupBucket &b, int) { return (b.resolution==uint32_t(resolution) && b.deviceId<=id); }
+        );
+    }
+    return ids;
+}
+
+void ChartReader::bucketPoints(
+    RollupResolution resolution,
+    const std::vector<uint32_t> &ids,
+    int64_t from,
+    int64_t to,
+    std::vector<ChartPoint> &out
+) const {
+    out.clear();
+    for(auto id:ids) {
+        auto s = span(resolution, id, from, to);
+        for(auto b=s.first; b<s.last; ++b) {
+            out.push_back({
+                b->start,
+                bucketEnd(b->start, resolution),
+                b->stats.count,
+                b->stats.min,
+                b->stats.max,
+                b->stats.mean()
+            });
+        }
+    }
+    if(ids.size()<2) {
+        return;
+    }
+
+    // several devices: one point per bucket for all of them
+    std::stable_sort(
+        out.begin(),
+        out.end(),
+        [](const ChartPoint &a, const ChartPoint &b) { return (a.start<b.start); }
+    );
+    size_t n = 0;
+    for(size_t i=0; i<out.size(); ++i) {
+        auto &p = out[i];
+        if(0<n && out[n-1].start==p.start) {
+            auto &q = out[n-1];
+            auto count = (q.count + p.count);
+            q.mean = (q.mean*q.count + p.mean*p.count) / std::max(1u, count);
+            q.count = count;
+            q.min = std::min(q.min, p.min);
+            q.max = std::max(q.max, p.max);
+        } else {
+            out[n++] = p;
+        }
+    }
+    out.resize(n);
+}
+
+void ChartReader::points(
+    bool allDevices,
+    uint32_t deviceId,
+    int64_t from,
+    int64_t to,
+    size_t maxPoints,
+    std::vector<ChartPoint> &out,
+    const char *&level
+) const {
+    out.clear();
+    level = "raw";
+    maxPoints = std::max(size_t(1), maxPoints);
+
+    // "since forever" and "until whenever" in terms bucket arithmetic doesn't overflow on
+    from = std::max(from, int64_t(0));
+    to = std::min(to, int64_t(1) << 40);
+    auto ids = (allDevices ? devices(kRollupWeek) : std::vector<uint32_t>(1, deviceId));
+
+    // how many buckets each level has in range, finest first
+    size_t sizes[kNbRollupResolutions];
+    for(int r=0; r<kNbRollupResolutions; ++r) {
+        sizes[r] = 0;
+        for(auto id:ids) {
+            sizes[r] += span(RollupResolution(r), id, from, to).size();
+        }
+    }
+
+    // few enough readings: the readings themselves. the finest level that fits
+    // bounds how many there are, its buckets covering the whole range
+    auto fits = 0;
+    while(fits<kNbRollupResolutions && maxPoints<sizes[fits]) {
+        ++fits;
+    }
+    size_t nbReadings = 0;
+    for(auto id:ids) {
+        if(fits<kNbRollupResolutions) {
+            auto s = span(RollupResolution(fits), id, from, to);
+            for(auto b=s.first; b<s.last; ++b) {
+                nbReadings += b->stats.count;
+            }
+        }
+    }
+    if(fits<kNbRollupResolutions && 0==nbReadings) {
+        return;
+    }
+    if(fits<kNbRollupResolutions && nbReadings<=maxPoints) {
+        archive.query(
+            from,
+            to,
+            [&](const ArchiveRecord *r, size_t n) {
+                for(size_t i=0; i<n; ++i) {
+                    if(0==r[i].status && (allDevices || deviceId==r[i].deviceId)) {
+                        out.push_back({ r[i].epoch, r[i].epoch, 1, r[i].mgdl, r[i].mgdl, double(r[i].mgdl) });
+                    }
+                }
+            }
+        );
+        std::stable_sort(
+            out.begin(),
+            out.end(),
+            [](const ChartPoint &a, const ChartPoint &b) { return (a.start<b.start); }
+        );
+        return;
+    }
+
+    // the finest level that fits
+    static const char *kLevels[kNbRollupResolutions] = { "hour", "day", "week" };
+    if(fits<kNbRollupResolutions) {
+        level = kLevels[fits];
+        bucketPoints(RollupResolution(fits), ids, from, to, out);
+        return;
+    }
+
+    // even weeks are too many: merge runs of them
+    level = "weeks";
+    std::vector<ChartPoint> weeks;
+    bucketPoints(kRollupWeek, ids, from, to, weeks);
+    auto group = ((weeks.size() + maxPoints - 1) / maxPoints);
+    for(size_t i=0; i<weeks.size(); i+=group) {
+        auto p = weeks[i];
+        auto sum = (p.mean * p.count);
+        for(size_t j=i+1; j<std::min(weeks.size(), i+group); ++j) {
+            auto &w = weeks[j];
+            p.end = w.end;
+            p.count += w.count;
+            p.min = std::min(p.min, w.min);
+            p.max = std::max(p.max, w.max);
+            sum += (w.mean * w.count);
+        }
+        p.mean = sum / std::max(1u, p.count);
+        out.push_back(p);
+    }
+}
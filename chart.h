@@ -0,0 +1,96 @@
+#ifndef __CHART_H__
+    #define __CHART_H__
+
+    /*
+
+         bounded size series for charting, off the rollup pyramid
+
+         an archive's rollups (see rollup.h) already hold min, max, sum and
+         count per device per hour, day and week, kept up to date by every
+         write: a downsampling pyramid. ChartReader maps the rollup file,
+         which is sorted by resolution, device and time, and answers "at
+         most N points between these dates" from whichever level fits:
+
+             raw readings       if there are no more than N of them
+             hours, days, weeks the finest level with no more than N buckets
+             n weeks at a time  when even weeks are too many
+
+         how many buckets or readings a level holds in the range comes from
+         binary searches on the mapping, and only the level picked gets
+         read: a chart costs O(log buckets + points), however many years the
+         archive spans. all devices at once merges each device's buckets,
+         and costs that many times more.
+
+         rollups that are missing, or not in step with the archive (see
+         rollup.h), get rebuilt when opening, so every level always covers
+         the whole range asked for.
+
+     */
+
+    #include <string>
+    #include <vector>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <rollup.h>
+    #include <archive.h>
+
+    // one point of a chart: what the readings between start and end looked like
+    struct ChartPoint {
+        int64_t  start;
+        int64_t  end;       // last second covered (start, for a raw reading)
+        uint32_t count;
+        uint16_t min;
+        uint16_t max;
+        double   mean;
+    };
+
+    struct ChartReader {
+
+        ChartReader();
+        ~ChartReader();
+
+        // map an archive and its rollups, rebuilding them if missing or not in step with it
+        bool open(const char *archivePath);
+        void close();
+
+        // at most maxPoints points covering [from, to], for deviceId or every device,
+        // oldest first. level says what they are: "raw", "hour", "day", "week" or "weeks"
+        void points(
+            bool allDevices,
+            uint32_t deviceId,
+            int64_t from,
+            int64_t to,
+            size_t maxPoints,
+            std::vector<ChartPoint> &out,
+            const char *&level
+        ) const;
+
+    private:
+        // map a rollup file, false unless it is in step with the archive
+        bool mapRollups(const std::string &path);
+
+        struct Span {
+            const RollupBucket *first;
+            const RollupBucket *last;
+            size_t size() const { return size_t(last - first); }
+        };
+
+        // buckets of one resolution and device starting in [from, to]
+        Span span(RollupResolution resolution, uint32_t deviceId, int64_t from, int64_t to) const;
+
+        // devices with buckets of a resolution
+        std::vector<uint32_t> devices(RollupResolution resolution) const;
+
+        // buckets of a resolution for the devices asked for, merged by start
+        void bucketPoints(RollupResolution resolution, const std::vector<uint32_t> &ids, int64_t from, int64_t to, std::vector<ChartPoint> &out) const;
+
+        ArchiveReader archive;
+        int fd;
+        void *map;
+        size_t mapSize;
+        std::vector<RollupBucket> held;     // rebuilt rollups, when there was no file to map
+        const RollupBucket *buckets;
+        size_t nbBuckets;
+    };
+
+#endif // __CHART_H__
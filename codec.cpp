@@ -0,0 +1,327 @@
+/*
+
+     compressed columnar encoding of archive records, see codec.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <codec.h>
+#include <stdio.h>
+#include <string.h>
+
+// packed file magic
+static const char kMagic[8] = { 'A', 'C', 'C', 'U', 'P', 'A', 'C', 'K' };
+
+// zig-zag: map signed to unsigned so small magnitudes stay small
+static inline uint64_t zz(
+    int64_t v
+) {
+    return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+}
+
+// inverse zig-zag
+static inline int64_t unzz(
+    uint64_t v
+) {
+    return int64_t(v >> 1) ^ -int64_t(v & 1);
+}
+
+// append LEB128 varint
+static inline void putVarint(
+    std::vector<uint8_t> &out,
+    uint64_t v
+) {
+    while(0x80<=v) {
+        out.push_back(uint8_t(v) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(uint8_t(v));
+}
+
+// read LEB128 varint, single byte values take the fast path
+static inline bool getVarint(
+    const uint8_t *&p,
+    const uint8_t *end,
+    uint64_t &v
+) {
+    if(p<end && 0==(0x80 & p[0])) {
+        v = *p++;
+        return true;
+    }
+    v = 0;
+    for(int shift=0; shift<64; shift+=7) {
+        if(end<=p) {
+            return false;
+        }
+        auto b = *p++;
+        v |= (uint64_t(b & 0x7F) << shift);
+        if(0==(0x80 & b)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// append a column as (byte length, bytes)
+static void putColumn(
+    std::vector<uint8_t> &out,
+    const std::vector<uint8_t> &column
+) {
+    putVarint(out, column.size());
+    out.insert(out.end(), column.begin(), column.end());
+}
+
+// run length encode one 32bit field
+template<typename Get> static void putRLE(
+    std::vector<uint8_t> &column,
+    size_t count,
+    Get &&get
+) {
+    size_t i = 0;
+    while(i<count) {
+        auto v = get(i);
+        size_t j = (1 + i);
+        while(j<count && get(j)==v) {
+            ++j;
+        }
+        putVarint(column, v);
+        putVarint(column, j-i);
+        i = j;
+    }
+}
+
+// run length decode one field into [first, first+count)
+template<typename Set> static bool getRLE(
+    const uint8_t *p,
+    const uint8_t *end,
+    size_t count,
+    Set &&set
+) {
+    size_t i = 0;
+    while(i<count) {
+        uint64_t v, n;
+        if(false==getVarint(p, end, v) || false==getVarint(p, end, n) || count-i<n) {
+            return false;
+        }
+        for(size_t j=0; j<n; ++j) {
+            set(i++, v);
+        }
+    }
+    return true;
+}
+
+void Codec::encode(
+    const ArchiveRecord *records,
+    size_t count,
+    std::vector<uint8_t> &out
+) {
+    // header
+    for(int i=0; i<4; ++i) {
+        out.push_back(uint8_t(kBlockMagic >> (8*i)));
+    }
+    putVarint(out, count);
+    if(0==count) {
+        return;
+    }
+
+    // epochs: first value, first delta, then delta-of-deltas
+    std::vector<uint8_t> column;
+    column.reserve(2*count + 16);
+    putVarint(column, zz(records[0].epoch));
+    int64_t prevDelta = 0;
+    for(size_t i=1; i<count; ++i) {
+        auto delta = (records[i].epoch - records[i-1].epoch);
+        putVarint(column, zz(delta - prevDelta));
+        prevDelta = delta;
+    }
+    putColumn(out, column);
+
+    // mg/dL: first value, then deltas
+    column.clear();
+    putVarint(column, records[0].mgdl);
+    for(size_t i=1; i<count; ++i) {
+        putVarint(column, zz(int64_t(records[i].mgdl) - records[i-1].mgdl));
+    }
+    putColumn(out, column);
+
+    // status and device id: runs
+    column.clear();
+    putRLE(column, count, [&](size_t i) { return uint32_t(records[i].status); });
+    putColumn(out, column);
+
+    column.clear();
+    putRLE(column, count, [&](size_t i) { return records[i].deviceId; });
+    putColumn(out, column);
+}
+
+bool Codec::decode(
+    const uint8_t *&p,
+    const uint8_t *end,
+    std::vector<ArchiveRecord> &out
+) {
+    // header
+    if(end-p<4) {
+        return false;
+    }
+    uint32_t magic = (p[0] | (p[1]<<8) | (p[2]<<16) | (uint32_t(p[3])<<24));
+    p += 4;
+    uint64_t count = 0;
+    if(kBlockMagic!=magic || false==getVarint(p, end, count) || (1<<24)<count) {
+        return false;
+    }
+    if(0==count) {
+        return true;
+    }
+
+    // locate columns
+    const uint8_t *columns[4];
+    const uint8_t *ends[4];
+    for(int c=0; c<4; ++c) {
+        uint64_t len = 0;
+        if(false==getVarint(p, end, len) || uint64_t(end-p)<len) {
+            return false;
+        }
+        columns[c] = p;
+        ends[c] = (len + p);
+        p += len;
+    }
+
+    // make room, columns are then decoded straight into place
+    auto base = out.size();
+    out.resize(base + count);
+    auto r = (base + out.data());
+
+    // epochs
+    auto decodeEpochs = [&]() {
+        auto q = columns[0];
+        uint64_t v = 0;
+        if(false==getVarint(q, ends[0], v)) {
+            return false;
+        }
+        int64_t epoch = unzz(v);
+        int64_t delta = 0;
+        r[0].epoch = epoch;
+        for(size_t i=1; i<count; ++i) {
+            if(false==getVarint(q, ends[0], v)) {
+                return false;
+            }
+            delta += unzz(v);
+            epoch += delta;
+            r[i].epoch = epoch;
+        }
+        return true;
+    };
+
+    // mg/dL
+    auto decodeValues = [&]() {
+        auto q = columns[1];
+        uint64_t v = 0;
+        if(false==getVarint(q, ends[1], v)) {
+            return false;
+        }
+        int64_t mgdl = v;
+        r[0].mgdl = uint16_t(mgdl);
+        for(size_t i=1; i<count; ++i) {
+            if(false==getVarint(q, ends[1], v)) {
+                return false;
+            }
+            mgdl += unzz(v);
+            r[i].mgdl = uint16_t(mgdl);
+        }
+        return true;
+    };
+
+    // all columns, status and device id being runs
+    auto ok = (
+        decodeEpochs()  &&
+        decodeValues()  &&
+        getRLE(
+            columns[2],
+            ends[2],
+            count,
+            [&](size_t i, uint64_t v) { r[i].status = uint16_t(v); }
+        )               &&
+        getRLE(
+            columns[3],
+            ends[3],
+            count,
+            [&](size_t i, uint64_t v) { r[i].deviceId = uint32_t(v); }
+        )
+    );
+
+    // don't leave half-decoded records behind
+    if(false==ok) {
+        out.resize(base);
+    }
+    return ok;
+}
+
+bool Codec::writeFile(
+    const char *path,
+    const std::vector<ArchiveRecord> &records
+) {
+    // encode everything
+    std::vector<uint8_t> data(kMagic, sizeof(kMagic) + kMagic);
+    for(size_t i=0; i<records.size(); i+=kBlockRecords) {
+        auto count = std::min(size_t(kBlockRecords), records.size()-i);
+        encode(i + records.data(), count, data);
+    }
+
+    // write it out
+    auto fp = fopen(path, "wb");
+    if(0==fp) {
+        LOG_WRN("failed to create packed file %s", path);
+        return false;
+    }
+    auto ok = (data.size()==fwrite(data.data(), 1, data.size(), fp));
+    ok = (0==fclose(fp)) && ok;
+    if(false==ok) {
+        LOG_WRN("failed to write packed file %s", path);
+    }
+    LOG_NFO(
+        "packed %d records into %d bytes (%.2f bytes per record)",
+        (int)records.size(),
+        (int)data.size(),
+        data.size() / std::max(1.0, double(records.size()))
+    );
+    return ok;
+}
+
+bool Codec::readFile(
+    const char *path,
+    std::vector<ArchiveRecord> &records
+) {
+    // slurp file
+    auto fp = fopen(path, "rb");
+    if(0==fp) {
+        LOG_WRN("failed to open packed file %s", path);
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t chunk[65536];
+    while(true) {
+        auto n = fread(chunk, 1, sizeof(chunk), fp);
+        if(0==n) {
+            break;
+        }
+        data.insert(data.end(), chunk, n + chunk);
+    }
+    fclose(fp);
+
+    // check header, then decode blocks one after the other
+    if(data.size()<sizeof(kMagic) || 0!=memcmp(data.data(), kMagic, sizeof(kMagic))) {
+        LOG_WRN("%s is not a packed file", path);
+        return false;
+    }
+    const uint8_t *p = (sizeof(kMagic) + data.data());
+    auto end = (data.size() + data.data());
+    while(p<end) {
+        if(false==decode(p, end, records)) {
+            LOG_WRN("corrupt block in packed file %s", path);
+            return false;
+        }
+    }
+    return true;
+}
+
@@ -0,0 +1,66 @@
+#ifndef __CODEC_H__
+    #define __CODEC_H__
+
+    /*
+
+         compressed columnar encoding of archive records
+
+         a block holds up to a few thousand records, stored column by column:
+
+             magic      u32 little endian "ACZB"
+             count      varint
+             epochs     varint byte length, then zig-zag varints:
+                            first epoch, first delta, then delta-of-deltas
+             mg/dL      varint byte length, then first value as varint,
+                            then zig-zag varint deltas
+             status     varint byte length, then RLE (value, run length) varint pairs
+             device id  varint byte length, then RLE (value, run length) varint pairs
+
+         readings are small integers taken at roughly regular intervals,
+         so most values encode to one byte each, and status / device id
+         columns usually collapse to a single run.
+
+         a packed file is a "ACCUPACK" header followed by blocks.
+
+     */
+
+    #include <vector>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <archive.h>
+
+    struct Codec {
+
+        static constexpr uint32_t kBlockMagic = 0x425A4341; // "ACZB"
+        static constexpr uint32_t kBlockRecords = 4096;
+
+        // encode records (ideally sorted by epoch) as one block appended to out
+        static void encode(
+            const ArchiveRecord *records,
+            size_t count,
+            std::vector<uint8_t> &out
+        );
+
+        // decode the block at p, appending its records to out and moving p past it
+        // returns false if the block is corrupt
+        static bool decode(
+            const uint8_t *&p,
+            const uint8_t *end,
+            std::vector<ArchiveRecord> &out
+        );
+
+        // write records to a packed file (in blocks of kBlockRecords)
+        static bool writeFile(
+            const char *path,
+            const std::vector<ArchiveRecord> &records
+        );
+
+        // read all records of a packed file
+        static bool readFile(
+            const char *path,
+            std::vector<ArchiveRecord> &records
+        );
+    };
+
+#endif // __CODEC_H__
+
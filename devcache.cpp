@@ -0,0 +1,165 @@
+/*
+
+     descriptors of meters seen before, see devcache.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <devcache.h>
+
+DescriptorCache::DescriptorCache()
+    :   nbHits(0),
+        nbMisses(0)
+{
+}
+
+void DescriptorCache::open(
+    const char *_path
+) {
+    std::lock_guard<std::mutex> guard(lock);
+    path = (0==_path ? "" : _path);
+    if(path.empty()) {
+        return;
+    }
+    auto fp = fopen(path.c_str(), "r");
+    if(0==fp) {
+        LOG_NFO("no descriptor cache at %s yet", path.c_str());
+        return;
+    }
+
+    // vendor product release busPath snd rcv cfg interface alt vendorString productString
+    char line[1024];
+    while(0!=fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = 0;
+        char *fields[11];
+        int nbFields = 0;
+        for(auto p=line; nbFields<11; ++nbFields) {
+            fields[nbFields] = p;
+            p = strchr(p, '\t');
+            if(0==p) {
+                ++nbFields;
+                break;
+            }
+            *(p++) = 0;
+        }
+        if(11!=nbFields) {
+            LOG_WRN("ignoring malformed line in descriptor cache %s", path.c_str());
+            continue;
+        }
+        DeviceDescriptors d;
+        d.vendorId = uint16_t(strtoul(fields[0], 0, 16));
+        d.productId = uint16_t(strtoul(fields[1], 0, 16));
+        d.release = uint16_t(strtoul(fields[2], 0, 16));
+        d.busPath = fields[3];
+        d.sndEndPoint = uint8_t(atoi(fields[4]));
+        d.rcvEndPoint = uint8_t(atoi(fields[5]));
+        d.configValue = uint8_t(atoi(fields[6]));
+        d.interfaceNumber = uint8_t(atoi(fields[7]));
+        d.alternateSetting = uint8_t(atoi(fields[8]));
+        d.vendor = fields[9];
+        d.product = fields[10];
+        entries[keyOf(d.vendorId, d.productId, d.release, d.busPath)] = d;
+    }
+    fclose(fp);
+    LOG_NFO("descriptor cache %s knows %d devices", path.c_str(), (int)entries.size());
+}
+
+bool DescriptorCache::find(
+    uint16_t vendorId,
+    uint16_t productId,
+    uint16_t release,
+    const std::string &busPath,
+    DeviceDescriptors &descriptors
+) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto i = entries.find(keyOf(vendorId, productId, release, busPath));
+    if(entries.end()==i) {
+        ++nbMisses;
+        return false;
+    }
+    ++nbHits;
+    descriptors = i->second;
+    return true;
+}
+
+void DescriptorCache::add(
+    const DeviceDescriptors &descriptors
+) {
+    // strings come off the device, keep them from breaking lines up
+    auto d = descriptors;
+    for(auto s:{ &d.vendor, &d.product }) {
+        for(auto &c:*s) {
+            c = (('\t'==c || '\n'==c || '\r'==c) ? ' ' : c);
+        }
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    entries[keyOf(d.vendorId, d.productId, d.release, d.busPath)] = d;
+    save();
+}
+
+void DescriptorCache::drop(
+    uint16_t vendorId,
+    uint16_t productId,
+    uint16_t release,
+    const std::string &busPath
+) {
+    std::lock_guard<std::mutex> guard(lock);
+    if(0!=entries.erase(keyOf(vendorId, productId, release, busPath))) {
+        LOG_NFO("forgetting descriptors of device at %s", busPath.c_str());
+        save();
+    }
+}
+
+std::string DescriptorCache::keyOf(
+    uint16_t vendorId,
+    uint16_t productId,
+    uint16_t release,
+    const std::string &busPath
+) {
+    char key[64];
+    snprintf(key, sizeof(key), "%04x:%04x:%04x@", vendorId, productId, release);
+    return (key + busPath);
+}
+
+void DescriptorCache::save() {
+    if(path.empty()) {
+        return;
+    }
+
+    // new entries next to the old ones, and swap them in
+    auto tmpPath = path + ".tmp";
+    auto fp = fopen(tmpPath.c_str(), "w");
+    if(0==fp) {
+        LOG_WRN("failed to create descriptor cache %s", tmpPath.c_str());
+        return;
+    }
+    for(auto &entry:entries) {
+        auto &d = entry.second;
+        fprintf(
+            fp,
+            "%04x\t%04x\t%04x\t%s\t%d\t%d\t%d\t%d\t%d\t%s\t%s\n",
+            d.vendorId,
+            d.productId,
+            d.release,
+            d.busPath.c_str(),
+            d.sndEndPoint,
+            d.rcvEndPoint,
+            d.configValue,
+            d.interfaceNumber,
+            d.alternateSetting,
+            d.vendor.c_str(),
+            d.product.c_str()
+        );
+    }
+    auto ok = (0==ferror(fp));
+    ok = (0==fclose(fp)) && ok;
+    ok = ok && (0==rename(tmpPath.c_str(), path.c_str()));
+    if(false==ok) {
+        LOG_WRN("failed to write descriptor cache %s", path.c_str());
+        remove(tmpPath.c_str());
+    }
+}
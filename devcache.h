@@ -0,0 +1,77 @@
+#ifndef __DEVCACHE_H__
+    #define __DEVCACHE_H__
+
+    /*
+
+         what we know about meters seen before, so rescans skip the bus
+
+         telling an accuchek from anything else on the bus takes its config
+         descriptor, opening it, and reading its vendor and product strings
+         off the device: a handful of control transfers per device per scan,
+         and `accuchek serve` scans again every poll. once a device passed
+         all that, its endpoints, config, interface and strings get
+         remembered, keyed by vendor id, product id, device release and
+         where it's plugged in (its bus path, see lock.h). the next scan that
+         finds the same device descriptor at the same place (the device
+         descriptor itself libusb keeps in memory, no transfer needed) takes
+         them from here, and the meter is ready to open straight away.
+
+         entries live in memory for the whole process, and in a file if
+         given one, so they survive replugs and restarts: one line per
+         device, tab separated, rewritten whole (tmp + rename) when
+         something new shows up. a device that fails to open gets dropped,
+         and is looked at from scratch on the next scan.
+
+     */
+
+    #include <mutex>
+    #include <string>
+    #include <stdint.h>
+    #include <unordered_map>
+
+    struct DeviceDescriptors {
+        uint16_t vendorId;
+        uint16_t productId;
+        uint16_t release;           // bcdDevice
+        std::string busPath;
+        uint8_t sndEndPoint;        // host to device
+        uint8_t rcvEndPoint;        // device to host
+        uint8_t configValue;
+        uint8_t interfaceNumber;
+        uint8_t alternateSetting;
+        std::string vendor;
+        std::string product;
+    };
+
+    struct DescriptorCache {
+
+        DescriptorCache();
+
+        // load entries from path, and save new ones there from now on (null: memory only)
+        void open(const char *path);
+
+        // descriptors of a known device, false if it needs a look
+        bool find(uint16_t vendorId, uint16_t productId, uint16_t release, const std::string &busPath, DeviceDescriptors &descriptors);
+
+        // remember a device that checked out
+        void add(const DeviceDescriptors &descriptors);
+
+        // forget a device that didn't work out as remembered
+        void drop(uint16_t vendorId, uint16_t productId, uint16_t release, const std::string &busPath);
+
+        // lookups answered from the cache, and those that weren't, so far
+        size_t hits() const { return nbHits; }
+        size_t misses() const { return nbMisses; }
+
+    private:
+        static std::string keyOf(uint16_t vendorId, uint16_t productId, uint16_t release, const std::string &busPath);
+        void save();
+
+        std::mutex lock;
+        std::string path;
+        std::unordered_map<std::string, DeviceDescriptors> entries;
+        size_t nbHits;
+        size_t nbMisses;
+    };
+
+#endif // __DEVCACHE_H__
@@ -0,0 +1,612 @@
+/*
+
+     offline dissector for recorded meter sessions
+
+     usage:
+
+         accuchek-dissect [--hex] [--summary] CAPTURE...
+
+     captures come from `accuchek --capture=FILE` (see capture.h). every
+     recorded transfer is printed as an annotated APDU tree: association,
+     presentation and data APDU headers, config objects and attributes by
+     MDC_* name, segment info, and data segments down to each entry. --hex
+     adds a hexdump of each transfer, --summary only counts APDUs per kind
+     and stream. malformed packets are flagged where they stop making sense
+     rather than ending the run, so captures of misbehaving meters can be
+     read as far as they go.
+
+     output is built in a large buffer and written in big chunks, and files
+     are mapped rather than read, so gigabytes of field captures take
+     seconds.
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <map>
+#include <apdu.h>
+#include <stdio.h>
+#include <vector>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <capture.h>
+#include <inttypes.h>
+
+// buffered output: everything goes through here, and out in large writes
+struct Output {
+
+    Output()
+        :   used(0)
+    {
+        buffer.resize(kSize);
+    }
+
+    ~Output() {
+        flush();
+    }
+
+    // room for at least n more bytes
+    char *reserve(size_t n) {
+        if(buffer.size()<used + n) {
+            flush();
+            if(buffer.size()<n) {
+                buffer.resize(n);
+            }
+        }
+        return (used + buffer.data());
+    }
+
+    void print(int depth, const char *fmt, ...) __attribute__((format(printf, 3, 4))) {
+        va_list args;
+        va_start(args, fmt);
+        auto p = reserve(kLineMax);
+        auto n = size_t(2*depth);
+        memset(p, ' ', n);
+        auto m = vsnprintf(n + p, kLineMax - n - 1, fmt, args);
+        va_end(args);
+        n += std::min(size_t(std::max(m, 0)), kLineMax - n - 2);
+        p[n++] = '\n';
+        used += n;
+    }
+
+    void hex(const uint8_t *data, size_t size) {
+        auto p = reserve(hexRenderSize(size));
+        used += hexRender(data, size, p);
+    }
+
+    void flush() {
+        fwrite(buffer.data(), 1, used, stdout);
+        used = 0;
+    }
+
+private:
+    static constexpr size_t kSize = (4 << 20);
+    static constexpr size_t kLineMax = 512;
+    std::vector<char> buffer;
+    size_t used;
+};
+
+// bounds checked big endian reads over one packet
+struct Cursor {
+
+    Cursor(const uint8_t *_data, size_t _size)
+        :   data(_data),
+            size(_size),
+            offset(0),
+            ok(true)
+    {
+    }
+
+    bool has(size_t n) const { return ok && offset + n<=size; }
+    size_t left() const { return (offset<=size ? size - offset : 0); }
+
+    uint8_t u8() {
+        if(false==has(1)) {
+            ok = false;
+            return 0;
+        }
+        return data[offset++];
+    }
+    uint16_t u16() {
+        if(false==has(2)) {
+            ok = false;
+            return 0;
+        }
+        return be16r(data, offset);
+    }
+    uint32_t u32() {
+        if(false==has(4)) {
+            ok = false;
+            return 0;
+        }
+        return be32r(data, offset);
+    }
+
+    // the next n bytes as a cursor of their own
+    Cursor sub(size_t n) {
+        if(false==has(n)) {
+            ok = false;
+            n = left();
+        }
+        Cursor c(offset + data, n);
+        offset += n;
+        return c;
+    }
+
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+    bool ok;
+};
+
+// a name for a code, or its number
+static const char *named(
+    uint16_t code,
+    char (&buf)[16]
+) {
+    auto name = mdcName(code);
+    if(name) {
+        return name;
+    }
+    snprintf(buf, sizeof(buf), "%u", (unsigned)code);
+    return buf;
+}
+
+// short values inline, as hex
+static void printValue(
+    Output &out,
+    int depth,
+    const char *label,
+    Cursor value
+) {
+    char text[3*24 + 8];
+    auto n = std::min(value.size, size_t(24));
+    auto p = text;
+    for(size_t i=0; i<n; ++i) {
+        p += sprintf(p, "%02X ", value.data[i]);
+    }
+    if(n<value.size) {
+        p += sprintf(p, "...");
+    }
+    *p = 0;
+    out.print(depth, "%s, %u bytes: %s", label, (unsigned)value.size, text);
+}
+
+// attribute list: count, length, then id / length / value
+static void dissectAttributes(
+    Output &out,
+    int depth,
+    Cursor &c
+) {
+    auto count = c.u16();
+    auto length = c.u16();
+    out.print(depth, "attributes: %u, %u bytes", (unsigned)count, (unsigned)length);
+    auto list = c.sub(length);
+    for(int i=0; i<count && list.ok; ++i) {
+        char buf[16];
+        char label[96];
+        auto id = list.u16();
+        auto size = list.u16();
+        snprintf(label, sizeof(label), "%s (%u)", named(id, buf), (unsigned)id);
+        printValue(out, 1 + depth, label, list.sub(size));
+    }
+    if(false==list.ok) {
+        out.print(1 + depth, "!! attribute list cut short");
+    }
+}
+
+// BCD byte as a number
+static int bcd(
+    uint8_t v
+) {
+    return (10*(v >> 4) + (v & 15));
+}
+
+// what the meter reports about a data segment (segm-data-event-descr)
+static void dissectSegmentDescr(
+    Output &out,
+    int depth,
+    Cursor &c
+) {
+    auto instance = c.u16();
+    auto index = c.u32();
+    auto count = c.u32();
+    auto status = c.u16();
+    out.print(
+        depth,
+        "segment %u, entries %u..%u, status 0x%04X%s%s",
+        (unsigned)instance,
+        (unsigned)index,
+        (unsigned)(index + count),
+        (unsigned)status,
+        ((0x8000 & status) ? " first" : ""),
+        ((0x4000 & status) ? " last" : "")
+    );
+}
+
+// event report payloads: config, or data segments
+static void dissectEvent(
+    Output &out,
+    int depth,
+    bool invoke,
+    uint16_t type,
+    Cursor c
+) {
+    char buf[16];
+
+    // config report from the meter, or our answer to it
+    if(kEVENT_TYPE_MDC_NOTI_CONFIG==type) {
+        auto reportId = c.u16();
+        if(false==invoke) {
+            auto result = c.u16();
+            out.print(depth, "config-report-id 0x%04X, config-result %u", (unsigned)reportId, (unsigned)result);
+            return;
+        }
+        auto count = c.u16();
+        auto length = c.u16();
+        out.print(depth, "config-report-id 0x%04X, %u objects, %u bytes", (unsigned)reportId, (unsigned)count, (unsigned)length);
+        auto list = c.sub(length);
+        for(int i=0; i<count && list.ok; ++i) {
+            auto objClass = list.u16();
+            auto handle = list.u16();
+            out.print(1 + depth, "object %s (%u), handle %u", named(objClass, buf), (unsigned)objClass, (unsigned)handle);
+            dissectAttributes(out, 2 + depth, list);
+        }
+        if(false==list.ok) {
+            out.print(1 + depth, "!! object list cut short");
+        }
+        return;
+    }
+
+    // data segment from the meter, or our ACK of it
+    if(kEVENT_TYPE_MDC_NOTI_SEGMENT_DATA==type) {
+        dissectSegmentDescr(out, depth, c);
+        if(false==invoke) {
+            return;
+        }
+        auto length = c.u16();
+        auto entries = c.sub(length);
+        out.print(depth, "entries: %u bytes", (unsigned)length);
+        for(int i=0; 12<=entries.left(); ++i) {
+            auto t = entries.sub(8);
+            auto value = entries.u16();
+            auto status = entries.u16();
+            out.print(
+                1 + depth,
+                "#%d %02d%02d-%02d-%02d %02d:%02d:%02d mg/dL=%u status=0x%04X",
+                i,
+                bcd(t.data[0]),
+                bcd(t.data[1]),
+                bcd(t.data[2]),
+                bcd(t.data[3]),
+                bcd(t.data[4]),
+                bcd(t.data[5]),
+                bcd(t.data[6]),
+                (unsigned)value,
+                (unsigned)status
+            );
+        }
+        return;
+    }
+    printValue(out, depth, "event info", c.sub(c.left()));
+}
+
+// action arguments (invoke) or results (response)
+static void dissectAction(
+    Output &out,
+    int depth,
+    bool invoke,
+    uint16_t type,
+    Cursor c
+) {
+    if(kACTION_TYPE_MDC_ACT_SEG_GET_INFO==type) {
+        if(invoke) {
+            auto choice = c.u16();
+            auto length = c.u16();
+            out.print(depth, "segment selection %u%s", (unsigned)choice, (1==choice ? " (all segments)" : ""));
+            c.sub(length);
+            return;
+        }
+        auto count = c.u16();
+        auto length = c.u16();
+        out.print(depth, "segment info: %u segments, %u bytes", (unsigned)count, (unsigned)length);
+        auto list = c.sub(length);
+        for(int i=0; i<count && list.ok; ++i) {
+            auto instance = list.u16();
+            out.print(1 + depth, "segment %u", (unsigned)instance);
+            dissectAttributes(out, 2 + depth, list);
+        }
+        return;
+    }
+    if(kACTION_TYPE_MDC_ACT_SEG_TRIG_XFER==type) {
+        auto instance = c.u16();
+        if(invoke) {
+            out.print(depth, "transfer segment %u", (unsigned)instance);
+            return;
+        }
+        static const char *kResponses[] = { "ok", "no such segment", "try later", "segment empty" };
+        auto response = c.u16();
+        out.print(
+            depth,
+            "transfer segment %u: %s (%u)",
+            (unsigned)instance,
+            (response<4 ? kResponses[response] : "?"),
+            (unsigned)response
+        );
+        return;
+    }
+    printValue(out, depth, "action info", c.sub(c.left()));
+}
+
+// what's inside a presentation APDU
+static void dissectData(
+    Output &out,
+    int depth,
+    Cursor c,
+    std::map<const char *, size_t> *counts
+) {
+    char buf[16];
+    auto length = c.u16();
+    auto invokeId = c.u16();
+    auto choice = c.u16();
+    auto choiceLength = c.u16();
+    auto body = c.sub(choiceLength);
+
+    const char *kind = "unknown data APDU";
+    switch(choice) {
+        case kDATA_ADPU_INVOKE_CONFIRMED_EVENT_REPORT:   kind = "roiv-cmip-confirmed-event-report";  break;
+        case kDATA_ADPU_INVOKE_GET:                      kind = "roiv-cmip-get";                     break;
+        case kDATA_ADPU_INVOKE_CONFIRMED_ACTION:         kind = "roiv-cmip-confirmed-action";        break;
+        case kDATA_ADPU_RESPONSE_CONFIRMED_EVENT_REPORT: kind = "rors-cmip-confirmed-event-report";  break;
+        case kDATA_ADPU_RESPONSE_GET:                    kind = "rors-cmip-get";                     break;
+        case kDATA_ADPU_RESPONSE_CONFIRMED_ACTION:       kind = "rors-cmip-confirmed-action";        break;
+    }
+    if(counts) {
+        ++(*counts)[kind];
+        return;
+    }
+    out.print(
+        depth,
+        "%s (0x%04X), invoke-id %u, octet string %u bytes, %u bytes",
+        kind,
+        (unsigned)choice,
+        (unsigned)invokeId,
+        (unsigned)length,
+        (unsigned)choiceLength
+    );
+
+    switch(choice) {
+        case kDATA_ADPU_INVOKE_CONFIRMED_EVENT_REPORT:
+        case kDATA_ADPU_RESPONSE_CONFIRMED_EVENT_REPORT: {
+            auto handle = body.u16();
+            auto time = body.u32();
+            auto type = body.u16();
+            auto infoLength = body.u16();
+            out.print(
+                1 + depth,
+                "obj-handle %u, event-time 0x%08X, event-type %s (0x%04X), %u bytes",
+                (unsigned)handle,
+                (unsigned)time,
+                named(type, buf),
+                (unsigned)type,
+                (unsigned)infoLength
+            );
+            dissectEvent(out, 2 + depth, (kDATA_ADPU_INVOKE_CONFIRMED_EVENT_REPORT==choice), type, body.sub(infoLength));
+            break;
+        }
+        case kDATA_ADPU_INVOKE_GET: {
+            auto handle = body.u16();
+            auto count = body.u16();
+            auto idsLength = body.u16();
+            out.print(1 + depth, "obj-handle %u, %u attribute ids (%s)", (unsigned)handle, (unsigned)count, (0==count ? "all" : "listed"));
+            auto ids = body.sub(idsLength);
+            for(int i=0; i<count && ids.ok; ++i) {
+                auto id = ids.u16();
+                out.print(2 + depth, "%s (%u)", named(id, buf), (unsigned)id);
+            }
+            break;
+        }
+        case kDATA_ADPU_RESPONSE_GET: {
+            auto handle = body.u16();
+            out.print(1 + depth, "obj-handle %u", (unsigned)handle);
+            dissectAttributes(out, 2 + depth, body);
+            break;
+        }
+        case kDATA_ADPU_INVOKE_CONFIRMED_ACTION:
+        case kDATA_ADPU_RESPONSE_CONFIRMED_ACTION: {
+            auto handle = body.u16();
+            auto type = body.u16();
+            auto argsLength = body.u16();
+            out.print(
+                1 + depth,
+                "obj-handle %u, action-type %s (0x%04X), %u bytes",
+                (unsigned)handle,
+                named(type, buf),
+                (unsigned)type,
+                (unsigned)argsLength
+            );
+            dissectAction(out, 2 + depth, (kDATA_ADPU_INVOKE_CONFIRMED_ACTION==choice), type, body.sub(argsLength));
+            break;
+        }
+        default:
+            printValue(out, 1 + depth, "payload", body);
+            break;
+    }
+    if(false==body.ok || false==c.ok) {
+        out.print(1 + depth, "!! packet shorter than its lengths say");
+    }
+}
+
+// association request or response: protocol and system details
+static void dissectAssociation(
+    Output &out,
+    int depth,
+    bool request,
+    Cursor c
+) {
+    if(request) {
+        auto version = c.u32();
+        auto count = c.u16();
+        auto listLength = c.u16();
+        out.print(depth, "assoc-version 0x%08X, %u data protocols, %u bytes", (unsigned)version, (unsigned)count, (unsigned)listLength);
+    } else {
+        auto result = c.u16();
+        out.print(depth, "result %u%s", (unsigned)result, (3==result ? " (accepted-unknown-config)" : (0==result ? " (accepted)" : "")));
+    }
+    auto protoId = c.u16();
+    auto infoLength = c.u16();
+    auto info = c.sub(infoLength);
+    out.print(depth, "data-proto-id %u, %u bytes", (unsigned)protoId, (unsigned)infoLength);
+    auto protocolVersion = info.u32();
+    auto encodingRules = info.u16();
+    auto nomenclatureVersion = info.u32();
+    auto functionalUnits = info.u32();
+    auto systemType = info.u32();
+    auto idLength = info.u16();
+    auto id = info.sub(idLength);
+    uint64_t systemId = 0;
+    for(size_t i=0; i<id.size; ++i) {
+        systemId = ((systemId << 8) | id.data[i]);
+    }
+    out.print(1 + depth, "protocol-version 0x%08X, encoding-rules 0x%04X, nomenclature-version 0x%08X", (unsigned)protocolVersion, (unsigned)encodingRules, (unsigned)nomenclatureVersion);
+    out.print(1 + depth, "functional-units 0x%08X, system-type 0x%08X", (unsigned)functionalUnits, (unsigned)systemType);
+    out.print(1 + depth, "system-id %016" PRIx64, systemId);
+    if(info.has(2)) {
+        out.print(1 + depth, "dev-config-id 0x%04X", (unsigned)info.u16());
+    }
+    if(false==info.ok || false==c.ok) {
+        out.print(1 + depth, "!! packet shorter than its lengths say");
+    }
+}
+
+// one transfer
+static void dissectAPDU(
+    Output &out,
+    const uint8_t *data,
+    size_t size,
+    std::map<const char *, size_t> *counts
+) {
+    Cursor c(data, size);
+    auto type = c.u16();
+    auto length = c.u16();
+    auto body = c.sub(length);
+    const char *kind = "unknown APDU";
+    switch(type) {
+        case kAPDU_TYPE_ASSOCIATION_REQUEST:          kind = "aarq association request";      break;
+        case kAPDU_TYPE_ASSOCIATION_RESPONSE:         kind = "aare association response";     break;
+        case kAPDU_TYPE_ASSOCIATION_RELEASE_REQUEST:  kind = "rlrq release request";          break;
+        case kAPDU_TYPE_ASSOCIATION_RELEASE_RESPONSE: kind = "rlre release response";         break;
+        case kAPDU_TYPE_ASSOCIATION_ABORT:            kind = "abrt association abort";        break;
+        case kAPDU_TYPE_PRESENTATION_APDU:            kind = "prst presentation";             break;
+    }
+    if(counts && kAPDU_TYPE_PRESENTATION_APDU!=type) {
+        ++(*counts)[kind];
+        return;
+    }
+    if(0==counts) {
+        out.print(1, "%s (0x%04X), %u bytes", kind, (unsigned)type, (unsigned)length);
+    }
+    switch(type) {
+        case kAPDU_TYPE_ASSOCIATION_REQUEST:
+        case kAPDU_TYPE_ASSOCIATION_RESPONSE:
+            dissectAssociation(out, 2, (kAPDU_TYPE_ASSOCIATION_REQUEST==type), body);
+            break;
+        case kAPDU_TYPE_ASSOCIATION_RELEASE_REQUEST:
+        case kAPDU_TYPE_ASSOCIATION_RELEASE_RESPONSE:
+        case kAPDU_TYPE_ASSOCIATION_ABORT:
+            out.print(2, "reason %u", (unsigned)body.u16());
+            break;
+        case kAPDU_TYPE_PRESENTATION_APDU:
+            dissectData(out, 2, body, counts);
+            break;
+        default:
+            printValue(out, 2, "payload", body);
+            break;
+    }
+    if(0==counts && false==c.ok) {
+        out.print(2, "!! packet shorter than its length says");
+    }
+}
+
+// entry point
+int main(
+    int argc,
+    char *argv[]
+) {
+    auto hex = false;
+    auto summary = false;
+    std::vector<const char *> paths;
+    for(int i=1; i<argc; ++i) {
+        if(0==strcmp(argv[i], "--hex")) {
+            hex = true;
+        } else if(0==strcmp(argv[i], "--summary")) {
+            summary = true;
+        } else if(0==strncmp(argv[i], "--", 2)) {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if(0==paths.size()) {
+        fprintf(stderr, "usage: accuchek-dissect [--hex] [--summary] CAPTURE...\n");
+        return 1;
+    }
+    gQuiet = true;
+
+    Output out;
+    std::map<const char *, size_t> counts;
+    std::map<uint32_t, std::pair<size_t, size_t>> streams;
+    for(auto path:paths) {
+        CaptureReader reader;
+        if(false==reader.open(path)) {
+            fprintf(stderr, "failed to read capture %s\n", path);
+            return 1;
+        }
+        if(false==summary) {
+            out.print(0, "capture %s, %zu bytes", path, reader.size());
+        }
+
+        size_t n = 0;
+        int64_t t0 = 0;
+        const CaptureRecordHeader *header = 0;
+        const uint8_t *payload = 0;
+        while(reader.next(header, payload)) {
+            auto &stream = streams[header->stream];
+            stream.first += 1;
+            stream.second += header->size;
+            if(0==n++) {
+                t0 = header->usec;
+            }
+            if(summary) {
+                dissectAPDU(out, payload, header->size, &counts);
+                continue;
+            }
+            out.print(
+                0,
+                "#%zu stream %u +%.6fs %s, %u bytes",
+                (n - 1),
+                (unsigned)header->stream,
+                1e-6*(header->usec - t0),
+                (header->fromDevice ? "device -> host" : "host -> device"),
+                (unsigned)header->size
+            );
+            dissectAPDU(out, payload, header->size, 0);
+            if(hex) {
+                out.hex(payload, header->size);
+            }
+        }
+    }
+
+    // what was seen, overall
+    if(summary) {
+        for(auto &stream:streams) {
+            out.print(0, "stream %u: %zu transfers, %zu bytes", (unsigned)stream.first, stream.second.first, stream.second.second);
+        }
+        for(auto &count:counts) {
+            out.print(0, "%10zu %s", count.second, count.first);
+        }
+    }
+    return 0;
+}
@@ -3,11 +3,14 @@
 set -x
 #sudo -s << EOF
   set -x
-  ./accuchek >z.json
+  # z.json only shows up once complete, an interrupted run is picked up from journal/ next time
+  ./accuchek --journal=journal --sink=json:z.json || exit 1
   #chown -R mgix.mgix .
   mv z.json ~mgix/finance/glucose
   #chown -R mgix.mgix ~mgix/finance/glucose
   cd ~mgix/finance/glucose
   /usr/bin/python3 ./upload_glucose.py
+  # or, without the python step:
+  # ./accuchek --archive=glucose.ach --upload=http://localhost:8080/glucose >z.json
 #EOF
 
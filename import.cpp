@@ -0,0 +1,213 @@
+/*
+
+     importer for legacy samples.json files, see import.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <pool.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <import.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+// skip blanks
+static inline const char *skipSpaces(
+    const char *p,
+    const char *end
+) {
+    while(p<end && (' '==p[0] || '\t'==p[0] || '\n'==p[0] || '\r'==p[0])) {
+        ++p;
+    }
+    return p;
+}
+
+// parse a decimal integer, moving p past it
+static inline bool parseInt(
+    const char *&p,
+    const char *end,
+    int64_t &v
+) {
+    auto negative = (p<end && '-'==p[0]);
+    if(negative) {
+        ++p;
+    }
+    auto start = p;
+    v = 0;
+    while(p<end && '0'<=p[0] && p[0]<='9') {
+        v = 10*v + (p[0] - '0');
+        ++p;
+    }
+    if(negative) {
+        v = -v;
+    }
+    return (start<p);
+}
+
+size_t Importer::scan(
+    const char *p,
+    const char *end,
+    uint32_t deviceId,
+    std::vector<ArchiveRecord> &records
+) {
+    size_t found = 0;
+    while(p<end) {
+
+        // next object
+        p = (const char *)memchr(p, '{', end-p);
+        if(0==p) {
+            break;
+        }
+        ++p;
+
+        // walk its keys until the closing brace
+        int64_t epoch = 0;
+        int64_t mgdl = 0;
+        auto hasEpoch = false;
+        auto hasValue = false;
+        while(p<end && '}'!=p[0]) {
+
+            // anything but a key (numbers, commas, blanks) gets skipped
+            if('"'!=p[0]) {
+                ++p;
+                continue;
+            }
+
+            // key
+            auto key = ++p;
+            auto keyEnd = (const char *)memchr(p, '"', end-p);
+            if(0==keyEnd) {
+                return found;
+            }
+            p = skipSpaces(1 + keyEnd, end);
+            if(end<=p || ':'!=p[0]) {
+                continue;
+            }
+            p = skipSpaces(1 + p, end);
+
+            // value
+            auto keyLen = (keyEnd - key);
+            if(5==keyLen && 0==memcmp(key, "epoch", 5)) {
+                hasEpoch = parseInt(p, end, epoch);
+            } else if(5==keyLen && 0==memcmp(key, "mg/dL", 5)) {
+                hasValue = parseInt(p, end, mgdl);
+            } else if(p<end && '"'==p[0]) {
+                auto valueEnd = (const char *)memchr(1 + p, '"', end-p-1);
+                if(0==valueEnd) {
+                    return found;
+                }
+                p = (1 + valueEnd);
+            }
+        }
+
+        // objects cut short by a crash simply lack a key and get dropped
+        if(hasEpoch && hasValue && p<end) {
+            ArchiveRecord r;
+            r.epoch = epoch;
+            r.deviceId = deviceId;
+            r.mgdl = uint16_t(mgdl);
+            r.status = 0;
+            records.push_back(r);
+            ++found;
+        }
+    }
+    return found;
+}
+
+bool Importer::scanFile(
+    const char *path,
+    uint32_t deviceId,
+    std::vector<ArchiveRecord> &records
+) {
+    auto fd = open(path, O_RDONLY);
+    if(fd<0) {
+        LOG_WRN("failed to open %s", path);
+        return false;
+    }
+    struct stat st;
+    if(0!=fstat(fd, &st)) {
+        close(fd);
+        return false;
+    }
+    if(0==st.st_size) {
+        close(fd);
+        return true;
+    }
+
+    auto map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(MAP_FAILED==map) {
+        LOG_WRN("failed to mmap %s", path);
+        return false;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    // one reading takes a bit over 100 bytes of JSON
+    records.reserve(records.size() + st.st_size/100);
+    auto p = (const char *)map;
+    auto found = scan(p, st.st_size + p, deviceId, records);
+    munmap(map, st.st_size);
+
+    LOG_NFO("found %d readings in %s", (int)found, path);
+    return true;
+}
+
+bool Importer::importFiles(
+    const char *archivePath,
+    const std::vector<const char *> &paths,
+    uint32_t deviceId,
+    int nbThreads
+) {
+    struct timeval t0, t1;
+    gettimeofday(&t0, 0);
+
+    // scan files in parallel, each into its own vector
+    std::vector<std::vector<ArchiveRecord>> perFile(paths.size());
+    std::vector<char> failed(paths.size(), 0);
+    {
+        ThreadPool pool(nbThreads);
+        for(size_t i=0; i<paths.size(); ++i) {
+            pool.submit([&, i]() {
+                failed[i] = !scanFile(paths[i], deviceId, perFile[i]);
+            });
+        }
+        pool.wait();
+    }
+
+    // gather everything
+    size_t total = 0;
+    for(size_t i=0; i<paths.size(); ++i) {
+        if(failed[i]) {
+            return false;
+        }
+        total += perFile[i].size();
+    }
+    std::vector<ArchiveRecord> records;
+    records.reserve(total);
+    for(auto &file:perFile) {
+        records.insert(records.end(), file.begin(), file.end());
+        std::vector<ArchiveRecord>().swap(file);
+    }
+
+    // merge into archive, dropping duplicates
+    if(false==Archive::append(archivePath, records)) {
+        return false;
+    }
+
+    gettimeofday(&t1, 0);
+    fprintf(
+        stderr,
+        "imported %d new readings out of %d found in %d files, in %.3f s\n",
+        (int)records.size(),
+        (int)total,
+        (int)paths.size(),
+        (t1.tv_sec - t0.tv_sec) + 1e-6*(t1.tv_usec - t0.tv_usec)
+    );
+    return true;
+}
+
@@ -0,0 +1,54 @@
+#ifndef __IMPORT_H__
+    #define __IMPORT_H__
+
+    /*
+
+         importer for legacy samples.json files as written by older
+         versions of accuchek:
+
+             [
+                 { "id":     0, "epoch": 1590507300, "timestamp":"2020/05/26 15:35", "mg/dL":102, "mmol/L":  5.666667 },
+                 ...
+             ]
+
+         this is a dedicated scanner for that one fixed schema, not a
+         JSON parser: it only looks for the "epoch" and "mg/dL" keys of
+         each object, never allocates, and copes with files that were
+         cut short.
+
+     */
+
+    #include <vector>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <archive.h>
+
+    struct Importer {
+
+        // scan a buffer, appending readings found in it to records, returns number found
+        static size_t scan(
+            const char *p,
+            const char *end,
+            uint32_t deviceId,
+            std::vector<ArchiveRecord> &records
+        );
+
+        // scan one file (mmapped)
+        static bool scanFile(
+            const char *path,
+            uint32_t deviceId,
+            std::vector<ArchiveRecord> &records
+        );
+
+        // scan files in parallel and merge all their readings into an archive,
+        // dropping readings the archive already has or that appear more than once
+        static bool importFiles(
+            const char *archivePath,
+            const std::vector<const char *> &paths,
+            uint32_t deviceId,
+            int nbThreads = 0
+        );
+    };
+
+#endif // __IMPORT_H__
+
@@ -0,0 +1,275 @@
+/*
+
+     write-ahead journal of data segments, see journal.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <loop.h>
+#include <cache.h>
+#include <meter.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <string.h>
+#include <unistd.h>
+#include <journal.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+static const char kJournalMagic[8] = { 'A', 'C', 'C', 'U', 'W', 'A', 'L', '1' };
+
+SegmentJournal::SegmentJournal(
+    const char *_dir,
+    const JournalDigests *_recovered
+)
+    :   dir(_dir),
+        recoveredDigests(_recovered),
+        systemId(0),
+        fd(-1),
+        nbPending(0),
+        firstPending(0)
+{
+}
+
+SegmentJournal::~SegmentJournal() {
+    if(0<=fd) {
+        commit();
+        close(fd);
+    }
+}
+
+bool SegmentJournal::open(
+    uint64_t _systemId
+) {
+    systemId = _systemId;
+    char name[32];
+    snprintf(name, sizeof(name), "/%016" PRIx64 ".wal", systemId);
+    filePath = dir + name;
+    mkdir(dir.c_str(), 0755);
+
+    // an interrupted download's journal gets continued, minus whatever a crash tore
+    uint64_t journaled = 0;
+    auto valid = scan(filePath, journaled, [](const JournalRecord &, const uint8_t *) {});
+    if(journaled!=systemId) {
+        valid = 0;
+    }
+    fd = ::open(filePath.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if(fd<0 || 0!=ftruncate(fd, valid) || off_t(valid)!=lseek(fd, valid, SEEK_SET)) {
+        LOG_WRN("failed to open journal %s, not journaling", filePath.c_str());
+        if(0<=fd) {
+            close(fd);
+            fd = -1;
+        }
+        return false;
+    }
+    if(0==valid) {
+        JournalHeader header;
+        memcpy(header.magic, kJournalMagic, sizeof(header.magic));
+        header.systemId = systemId;
+        auto p = (const uint8_t *)&header;
+        pending.insert(pending.end(), p, sizeof(header) + p);
+    }
+    LOG_NFO("journaling segments to %s from offset %d", filePath.c_str(), (int)valid);
+    return true;
+}
+
+bool SegmentJournal::recovered(
+    const uint8_t *packet,
+    size_t size
+) const {
+    if(0==recoveredDigests || size<30) {
+        return false;
+    }
+    auto digests = recoveredDigests->find(systemId);
+    if(recoveredDigests->end()==digests) {
+        return false;
+    }
+    return (0!=digests->second.count(SegmentCache::hash(30 + packet, size - 30)));
+}
+
+void SegmentJournal::append(
+    const uint8_t *packet,
+    size_t size
+) {
+    if(fd<0 || size<30) {
+        return;
+    }
+    JournalRecord record;
+    record.size = uint32_t(size);
+    record.flags = 0;
+    record.digest = SegmentCache::hash(30 + packet, size - 30);
+    record.check = SegmentCache::hash(packet, size);
+    auto p = (const uint8_t *)&record;
+    pending.insert(pending.end(), p, sizeof(record) + p);
+    pending.insert(pending.end(), packet, size + packet);
+
+    // group commit: a sync per batch of segments, or once the oldest one waited long enough
+    auto now = EventLoop::now();
+    if(1==++nbPending) {
+        firstPending = now;
+    }
+    if(kGroupSegments<=nbPending || kGroupMs<=(now - firstPending)) {
+        commit();
+    }
+}
+
+bool SegmentJournal::commit() {
+    if(fd<0 || pending.empty()) {
+        return (0<=fd);
+    }
+    size_t done = 0;
+    while(done<pending.size()) {
+        auto n = write(fd, done + pending.data(), pending.size() - done);
+        if(n<=0) {
+            break;
+        }
+        done += n;
+    }
+    auto ok = (done==pending.size() && 0==fdatasync(fd));
+    if(false==ok) {
+        LOG_WRN("failed to write journal %s", filePath.c_str());
+    }
+    pending.clear();
+    nbPending = 0;
+    return ok;
+}
+
+bool SegmentJournal::complete() {
+    if(fd<0) {
+        return false;
+    }
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.flags = kComplete;
+    record.check = SegmentCache::hash(0, 0);
+    auto p = (const uint8_t *)&record;
+    pending.insert(pending.end(), p, sizeof(record) + p);
+    return commit();
+}
+
+size_t SegmentJournal::scan(
+    const std::string &path,
+    uint64_t &systemId,
+    const std::function<void(const JournalRecord &record, const uint8_t *packet)> &fn
+) {
+    // journals are a few hundred KB at most, read whole
+    systemId = 0;
+    std::vector<uint8_t> content;
+    auto fp = fopen(path.c_str(), "rb");
+    if(0==fp) {
+        return 0;
+    }
+    uint8_t chunk[64*1024];
+    for(size_t n; 0<(n=fread(chunk, 1, sizeof(chunk), fp));) {
+        content.insert(content.end(), chunk, n + chunk);
+    }
+    fclose(fp);
+
+    JournalHeader header;
+    if(content.size()<sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, content.data(), sizeof(header));
+    if(0!=memcmp(header.magic, kJournalMagic, sizeof(header.magic))) {
+        LOG_WRN("%s is not a journal", path.c_str());
+        return 0;
+    }
+    systemId = header.systemId;
+
+    // records up to the end, or up to the first one a crash tore
+    auto offset = sizeof(header);
+    while(sizeof(JournalRecord)<=content.size() - offset) {
+        JournalRecord record;
+        memcpy(&record, offset + content.data(), sizeof(record));
+        auto packet = (offset + sizeof(record) + content.data());
+        auto fits = (record.size<=content.size() - offset - sizeof(record));
+        if(false==fits || record.check!=SegmentCache::hash(packet, record.size)) {
+            LOG_WRN("journal %s is torn at offset %d, ignoring what follows", path.c_str(), (int)offset);
+            break;
+        }
+        fn(record, packet);
+        offset += (sizeof(record) + record.size);
+    }
+    return offset;
+}
+
+size_t SegmentJournal::recover(
+    const char *dir,
+    const AccuChekCallbacks *callbacks,
+    JournalDigests &digests,
+    std::vector<std::string> &paths
+) {
+    auto d = opendir(dir);
+    if(0==d) {
+        return 0;
+    }
+    std::vector<std::string> journals;
+    while(auto entry = readdir(d)) {
+        auto len = strlen(entry->d_name);
+        if(4<len && 0==strcmp(entry->d_name + len - 4, ".wal")) {
+            journals.push_back(std::string(dir) + "/" + entry->d_name);
+        }
+    }
+    closedir(d);
+
+    size_t nbSamples = 0;
+    std::vector<AccuChekSample> batch;
+    for(auto &path:journals) {
+
+        // meter first, its segments next, each of them once
+        uint64_t systemId = 0;
+        auto announced = false;
+        auto complete = false;
+        size_t nbSegments = 0;
+        scan(
+            path,
+            systemId,
+            [&](const JournalRecord &record, const uint8_t *packet) {
+                if(record.flags & kComplete) {
+                    complete = true;
+                    return;
+                }
+                if(false==digests[systemId].insert(record.digest).second) {
+                    return;
+                }
+                if(false==announced && callbacks && callbacks->onAssociation) {
+                    callbacks->onAssociation(callbacks->user, systemId);
+                }
+                announced = true;
+                MeterSession::decodeSegment(packet, record.size, batch);
+                if(callbacks && callbacks->onSample) {
+                    for(auto &sample:batch) {
+                        callbacks->onSample(callbacks->user, &sample);
+                    }
+                }
+                if(callbacks && callbacks->onBatch && 0<batch.size()) {
+                    callbacks->onBatch(callbacks->user, batch.data(), batch.size());
+                }
+                nbSamples += batch.size();
+                ++nbSegments;
+            }
+        );
+        if(0!=systemId) {
+            paths.push_back(path);
+        }
+        LOG_NFO(
+            "recovered %d segments from %s journal %s",
+            (int)nbSegments,
+            (complete ? "complete" : "interrupted"),
+            path.c_str()
+        );
+    }
+    return nbSamples;
+}
+
+void SegmentJournal::retire(
+    const std::string &path
+) {
+    if(0!=unlink(path.c_str())) {
+        LOG_WRN("failed to remove journal %s", path.c_str());
+        return;
+    }
+    LOG_NFO("journal %s retired", path.c_str());
+}
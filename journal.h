@@ -0,0 +1,122 @@
+#ifndef __JOURNAL_H__
+    #define __JOURNAL_H__
+
+    /*
+
+         write-ahead journal of data segments, so a download cut short by a
+         crash, a kill or a yanked cable doesn't lose what already came in
+
+         every data segment a download receives goes to DIR/<system id>.wal,
+         as it came over the wire. the packet holds the segment's entries
+         and its ACK words (segment, entry range), so the journal knows both
+         what the meter sent and what it was told we got. a download that
+         went through ends its journal with a "complete" record.
+
+             JournalHeader         16 bytes: magic, meter system id
+             JournalRecord         24 bytes: size, flags, digests
+             packet                size bytes
+             ...
+
+         records are buffered and written in group commits: one write() and
+         one fdatasync() per kGroupSegments segments, sooner if a segment
+         comes in once the oldest pending one waited kGroupMs, and at the
+         end of the download. a segment may thus get ACKed before it is on
+         disk, which is fine here: meters never forget what they hold, so
+         whatever a crash loses comes back with the next download.
+
+         recover() replays the journals left in DIR through callbacks, as if
+         their segments had just been downloaded, and notes their digests
+         (see SegmentCache::hash) so downloads in the same process skip
+         those segments instead of handing them out twice. a record that
+         doesn't check out (a write torn by the crash) ends its journal, and
+         gets cut off before anything is appended behind it.
+
+         journals are only ever removed by retire(), once whatever was
+         handed out of them has been published, so a crash at any point
+         leaves them in place for the next run to recover from.
+
+     */
+
+    #include <string>
+    #include <vector>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <accuchek.h>
+    #include <functional>
+    #include <unordered_map>
+    #include <unordered_set>
+
+    struct __attribute__((packed)) JournalHeader {
+        char     magic[8];      // "ACCUWAL1"
+        uint64_t systemId;
+    };
+
+    struct __attribute__((packed)) JournalRecord {
+        uint32_t size;          // packet bytes that follow
+        uint32_t flags;         // kComplete
+        uint64_t digest;        // SegmentCache::hash of the segment's entries
+        uint64_t check;         // SegmentCache::hash of the whole packet
+    };
+
+    // digests of recovered segments, per meter system id
+    using JournalDigests = std::unordered_map<uint64_t, std::unordered_set<uint64_t>>;
+
+    struct SegmentJournal {
+
+        static constexpr uint32_t kComplete = 1;
+        static constexpr size_t kGroupSegments = 16;
+        static constexpr int64_t kGroupMs = 250;
+
+        // journal into dir, skipping segments in recovered (may be null)
+        SegmentJournal(const char *dir, const JournalDigests *recovered);
+        ~SegmentJournal();
+
+        // meter systemId is talking: open (or go on with) its journal
+        bool open(uint64_t systemId);
+
+        // true if the segment in packet was recovered already, and should not be handed out again
+        bool recovered(const uint8_t *packet, size_t size) const;
+
+        // journal a data segment packet as received
+        void append(const uint8_t *packet, size_t size);
+
+        // write and sync what's pending
+        bool commit();
+
+        // download went through: say so, and commit
+        bool complete();
+
+        // journal file, empty until open()
+        const std::string &path() const { return filePath; }
+
+        // replay every journal in dir through callbacks, noting segment digests in digests and
+        // journal paths in paths. returns samples handed out
+        static size_t recover(
+            const char *dir,
+            const AccuChekCallbacks *callbacks,
+            JournalDigests &digests,
+            std::vector<std::string> &paths
+        );
+
+        // remove a journal, its content being safe elsewhere
+        static void retire(const std::string &path);
+
+    private:
+        // walk path's records, returns bytes of it that check out, 0 if it's not a journal
+        static size_t scan(
+            const std::string &path,
+            uint64_t &systemId,
+            const std::function<void(const JournalRecord &record, const uint8_t *packet)> &fn
+        );
+
+        std::string dir;
+        const JournalDigests *recoveredDigests;
+        uint64_t systemId;
+        std::string filePath;
+        int fd;
+        std::vector<uint8_t> pending;
+        size_t nbPending;
+        int64_t firstPending;
+    };
+
+#endif // __JOURNAL_H__
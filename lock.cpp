@@ -0,0 +1,86 @@
+/*
+
+     per-device advisory locks, see lock.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <lock.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+DeviceLock::DeviceLock()
+    :   fd(-1),
+        wasBusy(false)
+{
+}
+
+DeviceLock::~DeviceLock() {
+    release();
+}
+
+std::string DeviceLock::busPath(
+    uint8_t bus,
+    const uint8_t *ports,
+    int nbPorts
+) {
+    // 3-1.2: bus 3, port 1 of the root hub, port 2 of the hub behind it
+    auto path = std::to_string(bus);
+    for(int i=0; i<nbPorts; ++i) {
+        path += (0==i ? '-' : '.');
+        path += std::to_string(ports[i]);
+    }
+    return path;
+}
+
+const char *DeviceLock::defaultDir() {
+    return (0==access(ACCUCHEK_LOCK_DIR, W_OK) ? ACCUCHEK_LOCK_DIR : "/tmp");
+}
+
+bool DeviceLock::acquire(
+    const char *dir,
+    const char *busPath
+) {
+    release();
+    wasBusy = false;
+
+    // no following symlinks, lock dirs tend to be world writable
+    char path[512];
+    snprintf(path, sizeof(path), "%s/accuchek-%s.lock", dir, busPath);
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0644);
+    if(fd<0) {
+        LOG_WRN("failed to create lock file %s", path);
+        return false;
+    }
+
+    // never wait: whoever has it may well keep it for minutes
+    if(0!=flock(fd, LOCK_EX | LOCK_NB)) {
+        wasBusy = (EWOULDBLOCK==errno);
+        if(wasBusy) {
+            LOG_WRN("device %s is in use by another process (see %s)", busPath, path);
+        } else {
+            LOG_WRN("failed to lock %s", path);
+        }
+        close(fd);
+        fd = -1;
+        return false;
+    }
+
+    // who has it, for whoever wonders
+    if(0==ftruncate(fd, 0)) {
+        dprintf(fd, "%d\n", (int)getpid());
+    }
+    LOG_NFO("locked device %s through %s", busPath, path);
+    return true;
+}
+
+void DeviceLock::release() {
+    if(0<=fd) {
+        close(fd);
+        fd = -1;
+    }
+}
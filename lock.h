@@ -0,0 +1,53 @@
+#ifndef __LOCK_H__
+    #define __LOCK_H__
+
+    /*
+
+         per-device advisory locks, so several processes (say one per
+         station port, started by udev) can download from different meters
+         at once without fighting over the same one
+
+         a device is known by where it is plugged in, its bus path: bus
+         number and port chain, the way the kernel names it ("3-1.2"). that
+         stays put while the device address changes on every replug. the
+         lock is a flock() on DIR/accuchek-<bus path>.lock, taken before
+         the kernel driver gets detached and the interface claimed, and
+         never waited for: a second claimant gets told right away. the
+         kernel drops it when its holder exits, however that happens, so
+         there's nothing stale to clean up. files are left in place, only
+         the lock on them matters.
+
+     */
+
+    #include <string>
+    #include <stdint.h>
+
+    // default directory for lock files, /tmp where it's missing or not writable
+    #define ACCUCHEK_LOCK_DIR "/run/lock"
+
+    struct DeviceLock {
+
+        DeviceLock();
+        ~DeviceLock();
+        DeviceLock(const DeviceLock &) = delete;
+        DeviceLock &operator=(const DeviceLock &) = delete;
+
+        // kernel style bus path ("3-1.2") from a bus number and port chain
+        static std::string busPath(uint8_t bus, const uint8_t *ports, int nbPorts);
+
+        // lock directory to use when none was asked for
+        static const char *defaultDir();
+
+        // lock busPath under dir without waiting: false if another process holds it
+        // (busy() then says so) or the lock file can't be created
+        bool acquire(const char *dir, const char *busPath);
+        void release();
+        bool held() const { return 0<=fd; }
+        bool busy() const { return wasBusy; }
+
+    private:
+        int fd;
+        bool wasBusy;
+    };
+
+#endif // __LOCK_H__
@@ -46,6 +46,9 @@
         static int threadId();
     };
 
+    // set to silence all log messages
+    extern bool gQuiet;
+
     #if defined(LOG_OFF)
 
         #define LOG_MSG(x, ...)
@@ -0,0 +1,180 @@
+/*
+
+     single threaded event loop, see loop.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <loop.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+EventLoop::EventLoop()
+    :   epollFd(epoll_create1(EPOLL_CLOEXEC)),
+        stopping(false),
+        generation(0),
+        nextTimerId(1),
+        ready(64)
+{
+    LOG_FTL(epollFd<0, "epoll_create1 failed: %s", strerror(errno));
+}
+
+EventLoop::~EventLoop() {
+    close(epollFd);
+}
+
+int64_t EventLoop::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000ll + ts.tv_nsec/1000000;
+}
+
+bool EventLoop::watch(
+    int fd,
+    uint32_t events,
+    Handler handler
+) {
+    // the generation tells a stale event from one for a new watch on a reused fd
+    auto watch = std::make_shared<Watch>();
+    watch->generation = ++generation;
+    watch->events = events;
+    watch->handler = std::move(handler);
+
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.u64 = ((uint64_t(watch->generation) << 32) | uint32_t(fd));
+    // an fd closed without unwatch() left epoll on its own, add it back then
+    auto known = (0!=watches.count(fd));
+    auto fail = epoll_ctl(epollFd, (known ? EPOLL_CTL_MOD : EPOLL_CTL_ADD), fd, &ev);
+    if(0!=fail && known && ENOENT==errno) {
+        fail = epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+    }
+    if(0!=fail) {
+        LOG_WRN("failed to watch fd %d: %s", fd, strerror(errno));
+        return false;
+    }
+    watches[fd] = std::move(watch);
+    return true;
+}
+
+bool EventLoop::modify(
+    int fd,
+    uint32_t events
+) {
+    auto it = watches.find(fd);
+    if(watches.end()==it) {
+        return false;
+    }
+    auto &watch = *it->second;
+    if(watch.events==events) {
+        return true;
+    }
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.u64 = ((uint64_t(watch.generation) << 32) | uint32_t(fd));
+    if(0!=epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev)) {
+        LOG_WRN("failed to modify watch on fd %d: %s", fd, strerror(errno));
+        return false;
+    }
+    watch.events = events;
+    return true;
+}
+
+void EventLoop::unwatch(
+    int fd
+) {
+    auto it = watches.find(fd);
+    if(watches.end()==it) {
+        return;
+    }
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, 0);
+    watches.erase(it);
+}
+
+uint64_t EventLoop::after(
+    int64_t ms,
+    Timer timer
+) {
+    auto id = nextTimerId++;
+    timers.emplace(id, std::move(timer));
+    deadlines.push({ now() + std::max(int64_t(0), ms), id });
+    return id;
+}
+
+void EventLoop::cancel(
+    uint64_t id
+) {
+    // the deadline stays in the heap until it comes up, and is skipped then
+    timers.erase(id);
+}
+
+void EventLoop::run() {
+    stopping = false;
+    while(false==stopping) {
+        runOnce(-1);
+    }
+}
+
+void EventLoop::runOnce(
+    int timeoutMs
+) {
+    // sleep no longer than the next live timer allows
+    while(0<deadlines.size() && 0==timers.count(deadlines.top().id)) {
+        deadlines.pop();
+    }
+    if(0<deadlines.size()) {
+        auto untilNext = std::max(int64_t(0), deadlines.top().at - now());
+        if(timeoutMs<0 || untilNext<timeoutMs) {
+            timeoutMs = int(std::min(untilNext, int64_t(INT32_MAX)));
+        }
+    }
+
+    auto n = epoll_wait(epollFd, ready.data(), int(ready.size()), timeoutMs);
+    if(n<0 && EINTR!=errno) {
+        LOG_WRN("epoll_wait failed: %s", strerror(errno));
+    }
+    for(int i=0; i<n; ++i) {
+
+        // a handler earlier in this batch may have dropped or replaced this watch
+        auto fd = int(uint32_t(ready[i].data.u64));
+        auto gen = uint32_t(ready[i].data.u64 >> 32);
+        auto it = watches.find(fd);
+        if(watches.end()==it || gen!=it->second->generation) {
+            continue;
+        }
+
+        // hold on to it, the handler may unwatch its own fd
+        auto watch = it->second;
+        watch->handler(ready[i].events);
+    }
+
+    // busy: make room for more events next time
+    if(n==int(ready.size())) {
+        ready.resize(2*ready.size());
+    }
+    runTimers();
+}
+
+void EventLoop::runTimers() {
+    // only what was due when we started, timers added on the way wait for the next round
+    auto t = now();
+    auto last = nextTimerId;
+    while(0<deadlines.size() && deadlines.top().at<=t && deadlines.top().id<last) {
+        auto id = deadlines.top().id;
+        deadlines.pop();
+        auto it = timers.find(id);
+        if(timers.end()==it) {
+            continue;
+        }
+        auto timer = std::move(it->second);
+        timers.erase(it);
+        timer();
+    }
+}
+
@@ -0,0 +1,86 @@
+#ifndef __LOOP_H__
+    #define __LOOP_H__
+
+    /*
+
+         single threaded event loop: file descriptors, timers, and through
+         them libusb (see accuchek_download_start in accuchek.h)
+
+         fds are watched with epoll, handlers get the epoll events that
+         fired (EPOLLIN, EPOLLOUT, EPOLLERR, EPOLLHUP). timers are one-shot,
+         kept in a heap, and set how long epoll_wait may sleep. everything
+         runs on the thread that calls run(), so handlers never need a lock
+         and must never block.
+
+         handlers may watch, unwatch, add and cancel anything, their own fd
+         or timer included, while running.
+
+     */
+
+    #include <queue>
+    #include <memory>
+    #include <vector>
+    #include <stdint.h>
+    #include <functional>
+    #include <sys/epoll.h>
+    #include <unordered_map>
+
+    struct EventLoop {
+
+        using Handler = std::function<void(uint32_t events)>;
+        using Timer = std::function<void()>;
+
+        EventLoop();
+        ~EventLoop();
+
+        // call handler when fd gets any of events, replaces an existing watch on fd
+        bool watch(int fd, uint32_t events, Handler handler);
+
+        // change the events fd is watched for
+        bool modify(int fd, uint32_t events);
+
+        // stop watching fd, before closing it
+        void unwatch(int fd);
+
+        // call timer once, ms milliseconds from now, returns an id for cancel()
+        uint64_t after(int64_t ms, Timer timer);
+        void cancel(uint64_t id);
+
+        // dispatch events until stop()
+        void run();
+
+        // wait up to timeoutMs (<0: until something happens) and dispatch what's ready
+        void runOnce(int timeoutMs);
+
+        // make run() return, from a handler
+        void stop() { stopping = true; }
+
+        // monotonic clock in milliseconds
+        static int64_t now();
+
+    private:
+        struct Watch {
+            uint32_t generation;
+            uint32_t events;
+            Handler handler;
+        };
+        struct Deadline {
+            int64_t at;
+            uint64_t id;
+            bool operator<(const Deadline &rhs) const { return rhs.at<at || (rhs.at==at && rhs.id<id); }
+        };
+
+        void runTimers();
+
+        int epollFd;
+        bool stopping;
+        uint32_t generation;
+        uint64_t nextTimerId;
+        std::unordered_map<int, std::shared_ptr<Watch>> watches;
+        std::unordered_map<uint64_t, Timer> timers;
+        std::priority_queue<Deadline> deadlines;
+        std::vector<epoll_event> ready;
+    };
+
+#endif // __LOOP_H__
+
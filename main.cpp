@@ -4,1576 +4,1062 @@
 
      compile with something along the lines of:
 
-         c++ -std=c++17 -I. -o accuchek main.cpp log.cpp -lusb-1.0
+         c++ -std=c++20 -I. -o accuchek main.cpp accuchek.cpp archive.cpp codec.cpp import.cpp merge.cpp pool.cpp rollup.cpp sketch.cpp query.cpp chart.cpp server.cpp ring.cpp upload.cpp alert.cpp sink.cpp apdu.cpp capture.cpp buffers.cpp cache.cpp journal.cpp lock.cpp devcache.cpp schedule.cpp meter.cpp pipeline.cpp loop.cpp log.cpp -lusb-1.0 -lz -lpthread
+
+     usage:
+
+         accuchek [options] [device index]
+         accuchek pack ARCHIVE PACKED
+         accuchek unpack PACKED ARCHIVE
+         accuchek import [--device=ID] [--threads=N] ARCHIVE FILE...
+         accuchek merge [--threads=N] OUTPUT INPUT... [: OUTPUT INPUT...]...
+         accuchek report [--by=hour|day|week] [--device=ID] ARCHIVE
+         accuchek agp [--from=YYYY-MM] [--to=YYYY-MM] [--device=ID] ARCHIVE...
+         accuchek query [--device=ID] [--from=TIME] [--to=TIME] [--days=N] [--below=MGDL] [--above=MGDL]
+                        [--all] [--threads=N] [--sink=FORMAT:PATH ...] [--stats] ARCHIVE
+         accuchek chart [--device=ID] [--from=TIME] [--to=TIME] [--points=N] ARCHIVE
+         accuchek serve [--every=SECONDS] [--cache=DIR] [--descriptors=FILE] [--lock-dir=DIR] [--per-hub=N] [--durations=FILE]
+                        [--journal=DIR] [--ring=FILE] [--upload=URL ...] [--alerts=FILE ...] ARCHIVE SOCKET
+
+     options:
+
+         --archive=FILE     also append downloaded samples to native archive FILE
+         --packed=FILE      also write downloaded samples to compressed file FILE
+         --ring=FILE        also publish downloaded samples to shared memory ring FILE
+                            (e.g. /dev/shm/accuchek, see ring.h)
+         --upload=URL       also POST readings new to the archive to http:// URL, in batches,
+                            queued in ARCHIVE.upload until they make it (see upload.h)
+         --upload-batch=N   at most N readings per POST (default 500)
+         --upload-linger=MS wait up to MS for a batch to fill up (default 1000)
+         --alerts=FILE      append alerts raised by fresh readings to FILE as JSON lines (see alert.h)
+         --alert-rules=FILE alert rules to use instead of the built-in ones
+         --sink=FORMAT:PATH write samples as json, ndjson, csv or bin to PATH ("-" for
+                            stdout, ".gz" to compress), may be repeated (default json:-)
+         --progress=FILE    report transfer progress to FILE (e.g. /dev/fd/3) as JSON lines
+         --pipeline=DEPTH   decode and write samples on threads of their own, up to DEPTH
+                            raw segments queued behind USB, stage stats go to --progress
+         --capture=FILE     record every USB transfer to FILE, for accuchek-dissect
+         --cache=DIR        remember each meter's data segments in DIR, and only decode and
+                            output segments that changed since its last download (see cache.h)
+         --port=BUSPATH     download from the meter plugged in at BUSPATH, kernel style
+                            (e.g. 3-1.2, what udev calls KERNEL), instead of by index
+         --lock-dir=DIR     where per-device lock files go (default /run/lock): a meter
+                            another process is downloading from is skipped, or the download
+                            fails right away if it was asked for (see lock.h)
+         --descriptors=FILE remember the descriptors of meters found in FILE, so known
+                            meters get found without reading them off the bus (see devcache.h)
+         --all              download from every meter plugged in, several at once
+         --per-hub=N        with --all, at most N downloads at once behind any one USB hub
+                            (default 2, 0: no limit), see schedule.h
+         --durations=FILE   remember how long each meter's downloads take in FILE, so --all
+                            starts the longest ones first
+         --journal=DIR      journal every data segment received to DIR, synced in batches: a
+                            run that gets interrupted leaves it there, and the next run outputs
+                            what it holds, then skips those segments (see journal.h). files
+                            written by --sink only show up at PATH once complete
+
+     TIME is YYYY-MM-DD[THH:MM[:SS]] local time, or seconds since 1970. both ends are
+     inclusive: a --from date alone starts at 00:00:00, a --to date alone ends at 23:59:59
 
  */
 
 // stuff we need
 #include <log.h>
+#include <loop.h>
+#include <memory>
 #include <string>
-#include <thread>
-#include <time.h>
 #include <vector>
+#include <codec.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <algorithm>
+#include <merge.h>
+#include <time.h>
+#include <import.h>
+#include <query.h>
+#include <chart.h>
+#include <rollup.h>
+#include <sketch.h>
+#include <server.h>
+#include <ring.h>
+#include <upload.h>
+#include <alert.h>
+#include <sink.h>
+#include <archive.h>
+#include <accuchek.h>
 #include <inttypes.h>
 #include <unordered_map>
-#include <libusb-1.0/libusb.h>
-
-// config key value pair map
-using Config = std::unordered_map<
-    std::string,
-    std::string
->;
 
 // globals
-static Config g_config;
 static FILE *g_output = 0;
-static auto g_lineCount = 0;
-static auto g_firstLine = true;
-
-/*
-    proprietary roche protocol constants, copied from:
-
-        https://github.com/tidepool-org/uploader/tree/master/lib/drivers/roche
-
-    these seem to be from the "Continua Health Alliance standard (ISO/IEEE 11073)"
-
-    for the morbidly curious, see:
-        https://en.wikipedia.org/wiki/Continua_Health_Alliance
-        https://github.com/signove/antidote
-        http://11073.org
-
- */
-
-static constexpr uint16_t kAPDU_TYPE_ASSOCIATION_REQUEST =             0xE200;
-static constexpr uint16_t kAPDU_TYPE_ASSOCIATION_RESPONSE =            0xE300;
-static constexpr uint16_t kAPDU_TYPE_ASSOCIATION_RELEASE_REQUEST =     0xE400;
-static constexpr uint16_t kAPDU_TYPE_ASSOCIATION_RELEASE_RESPONSE =    0xE500;
-static constexpr uint16_t kAPDU_TYPE_ASSOCIATION_ABORT =               0xE600;
-static constexpr uint16_t kAPDU_TYPE_PRESENTATION_APDU =               0xE700;
-
-static constexpr uint16_t kDATA_ADPU_INVOKE_GET =                      0x0103;
-static constexpr uint16_t kDATA_ADPU_INVOKE_CONFIRMED_ACTION =         0x0107;
-static constexpr uint16_t kDATA_ADPU_RESPONSE_CONFIRMED_EVENT_REPORT = 0x0201;
-static constexpr uint16_t kDATA_ADPU_RESPONSE_GET =                    0x0203;
-static constexpr uint16_t kDATA_ADPU_RESPONSE_CONFIRMED_ACTION =       0x0207;
-
-static constexpr uint16_t kEVENT_TYPE_MDC_NOTI_CONFIG =                0x0D1C;
-static constexpr uint16_t kEVENT_TYPE_MDC_NOTI_SEGMENT_DATA =          0x0D21;
-
-static constexpr uint16_t kACTION_TYPE_MDC_ACT_SEG_GET_INFO =          0x0C0D;
-static constexpr uint16_t kACTION_TYPE_MDC_ACT_SEG_GET_ID_LIST =       0x0C1E;
-static constexpr uint16_t kACTION_TYPE_MDC_ACT_SEG_TRIG_XFER =         0x0C1C;
-static constexpr uint16_t kACTION_TYPE_MDC_ACT_SEG_SET_TIME =          0x0C17;
-
-#define MDC_LIST                                \
-  x(MDC_MOC_VMO_METRIC, 4)                      \
-  x(MDC_MOC_VMO_METRIC_ENUM, 5)                 \
-  x(MDC_MOC_VMO_METRIC_NU, 6)                   \
-  x(MDC_MOC_VMO_METRIC_SA_RT, 9)                \
-  x(MDC_MOC_SCAN, 16)                           \
-  x(MDC_MOC_SCAN_CFG, 17)                       \
-  x(MDC_MOC_SCAN_CFG_EPI, 18)                   \
-  x(MDC_MOC_SCAN_CFG_PERI, 19)                  \
-  x(MDC_MOC_VMS_MDS_SIMP, 37)                   \
-  x(MDC_MOC_VMO_PMSTORE, 61)                    \
-  x(MDC_MOC_PM_SEGMENT, 62)                     \
-  x(MDC_ATTR_CONFIRM_MODE, 2323)                \
-  x(MDC_ATTR_CONFIRM_TIMEOUT, 2324)             \
-  x(MDC_ATTR_TRANSPORT_TIMEOUT, 2694)           \
-  x(MDC_ATTR_ID_HANDLE, 2337)                   \
-  x(MDC_ATTR_ID_INSTNO, 2338)                   \
-  x(MDC_ATTR_ID_LABEL_STRING, 2343)             \
-  x(MDC_ATTR_ID_MODEL, 2344)                    \
-  x(MDC_ATTR_ID_PHYSIO, 2347)                   \
-  x(MDC_ATTR_ID_PROD_SPECN, 2349)               \
-  x(MDC_ATTR_ID_TYPE, 2351)                     \
-  x(MDC_ATTR_METRIC_STORE_CAPAC_CNT, 2369)      \
-  x(MDC_ATTR_METRIC_STORE_SAMPLE_ALG, 2371)     \
-  x(MDC_ATTR_METRIC_STORE_USAGE_CNT, 2372)      \
-  x(MDC_ATTR_MSMT_STAT, 2375)                   \
-  x(MDC_ATTR_NU_ACCUR_MSMT, 2378)               \
-  x(MDC_ATTR_NU_CMPD_VAL_OBS, 2379)             \
-  x(MDC_ATTR_NU_VAL_OBS, 2384)                  \
-  x(MDC_ATTR_NUM_SEG, 2385)                     \
-  x(MDC_ATTR_OP_STAT, 2387)                     \
-  x(MDC_ATTR_POWER_STAT, 2389)                  \
-  x(MDC_ATTR_SA_SPECN, 2413)                    \
-  x(MDC_ATTR_SCALE_SPECN_I16, 2415)             \
-  x(MDC_ATTR_SCALE_SPECN_I32, 2416)             \
-  x(MDC_ATTR_SCALE_SPECN_I8, 2417)              \
-  x(MDC_ATTR_SCAN_REP_PD, 2421)                 \
-  x(MDC_ATTR_SEG_USAGE_CNT, 2427)               \
-  x(MDC_ATTR_SYS_ID, 2436)                      \
-  x(MDC_ATTR_SYS_TYPE, 2438)                    \
-  x(MDC_ATTR_TIME_ABS, 2439)                    \
-  x(MDC_ATTR_TIME_BATT_REMAIN, 2440)            \
-  x(MDC_ATTR_TIME_END_SEG, 2442)                \
-  x(MDC_ATTR_TIME_PD_SAMP, 2445)                \
-  x(MDC_ATTR_TIME_REL, 2447)                    \
-  x(MDC_ATTR_TIME_STAMP_ABS, 2448)              \
-  x(MDC_ATTR_TIME_STAMP_REL, 2449)              \
-  x(MDC_ATTR_TIME_START_SEG, 2450)              \
-  x(MDC_ATTR_TX_WIND, 2453)                     \
-  x(MDC_ATTR_UNIT_CODE, 2454)                   \
-  x(MDC_ATTR_UNIT_LABEL_STRING, 2457)           \
-  x(MDC_ATTR_VAL_BATT_CHARGE, 2460)             \
-  x(MDC_ATTR_VAL_ENUM_OBS, 2462)                \
-  x(MDC_ATTR_TIME_REL_HI_RES, 2536)             \
-  x(MDC_ATTR_TIME_STAMP_REL_HI_RES, 2537)       \
-  x(MDC_ATTR_DEV_CONFIG_ID, 2628)               \
-  x(MDC_ATTR_MDS_TIME_INFO, 2629)               \
-  x(MDC_ATTR_METRIC_SPEC_SMALL, 2630)           \
-  x(MDC_ATTR_SOURCE_HANDLE_REF, 2631)           \
-  x(MDC_ATTR_SIMP_SA_OBS_VAL, 2632)             \
-  x(MDC_ATTR_ENUM_OBS_VAL_SIMP_OID, 2633)       \
-  x(MDC_ATTR_ENUM_OBS_VAL_SIMP_STR, 2634)       \
-  x(MDC_REG_CERT_DATA_LIST, 2635)               \
-  x(MDC_ATTR_NU_VAL_OBS_BASIC, 2636)            \
-  x(MDC_ATTR_PM_STORE_CAPAB, 2637)              \
-  x(MDC_ATTR_PM_SEG_MAP, 2638)                  \
-  x(MDC_ATTR_PM_SEG_PERSON_ID, 2639)            \
-  x(MDC_ATTR_SEG_STATS, 2640)                   \
-  x(MDC_ATTR_SEG_FIXED_DATA, 2641)              \
-  x(MDC_ATTR_SCAN_HANDLE_ATTR_VAL_MAP, 2643)    \
-  x(MDC_ATTR_SCAN_REP_PD_MIN, 2644)             \
-  x(MDC_ATTR_ATTRIBUTE_VAL_MAP, 2645)           \
-  x(MDC_ATTR_NU_VAL_OBS_SIMP, 2646)             \
-  x(MDC_ATTR_PM_STORE_LABEL_STRING, 2647)       \
-  x(MDC_ATTR_PM_SEG_LABEL_STRING, 2648)         \
-  x(MDC_ATTR_TIME_PD_MSMT_ACTIVE, 2649)         \
-  x(MDC_ATTR_SYS_TYPE_SPEC_LIST, 2650)          \
-  x(MDC_ATTR_METRIC_ID_PART, 2655)              \
-  x(MDC_ATTR_ENUM_OBS_VAL_PART, 2656)           \
-  x(MDC_ATTR_SUPPLEMENTAL_TYPES, 2657)          \
-  x(MDC_ATTR_TIME_ABS_ADJUST, 2658)             \
-  x(MDC_ATTR_CLEAR_TIMEOUT, 2659)               \
-  x(MDC_ATTR_TRANSFER_TIMEOUT, 2660)            \
-  x(MDC_ATTR_ENUM_OBS_VAL_SIMP_BIT_STR, 2661)   \
-  x(MDC_ATTR_ENUM_OBS_VAL_BASIC_BIT_STR, 2662)  \
-  x(MDC_ATTR_METRIC_STRUCT_SMALL, 2675)         \
-  x(MDC_ATTR_NU_CMPD_VAL_OBS_SIMP, 2676)        \
-  x(MDC_ATTR_NU_CMPD_VAL_OBS_BASIC, 2677)       \
-  x(MDC_ATTR_ID_PHYSIO_LIST, 2678)              \
-  x(MDC_ATTR_SCAN_HANDLE_LIST, 2679)            \
-  x(MDC_ATTR_TIME_BO, 2689)                     \
-  x(MDC_ATTR_TIME_STAMP_BO, 2690)               \
-  x(MDC_ATTR_TIME_START_SEG_BO, 2691)           \
-  x(MDC_ATTR_TIME_END_SEG_BO, 2692)             \
-
-// all the MDC_* constants in one big enum
-enum MDC_ENUM {
-    #define x(a, b) k##a = b,
-        MDC_LIST
-    #undef x
+static std::vector<const char *> g_sinkSpecs;
+static std::vector<std::unique_ptr<SampleSink>> g_sinks;
+static FILE *g_progress = 0;
+static int g_pipelineDepth = 0;
+static const char *g_cacheDir = 0;
+static const char *g_capturePath = 0;
+static const char *g_port = 0;
+static const char *g_lockDir = 0;
+static const char *g_descriptorsPath = 0;
+static const char *g_durationsPath = 0;
+static const char *g_journalDir = 0;
+static bool g_all = false;
+static int g_perHub = 2;
+static const char *g_archivePath = 0;
+static const char *g_packedPath = 0;
+static const char *g_ringPath = 0;
+static RingWriter g_ring;
+static bool g_serving = false;
+static const char *g_uploadUrl = 0;
+static size_t g_uploadBatch = 500;
+static int g_uploadLinger = 1000;
+static Uploader g_uploader;
+static const char *g_alertsPath = 0;
+static const char *g_alertRulesPath = 0;
+static AlertEngine g_alertEngine;
+static std::unordered_map<uint32_t, AlertEngine> g_alertEngines;
+static AlertSink g_alertSink;
+
+// one meter's download: which device it is and what it sent
+struct Download {
+    uint32_t deviceId;
+    std::vector<ArchiveRecord> records;
 };
 
-// load config file
-static auto loadConfig() {
-auto fp = fopen("config.txt", "r");
-  if(0!=fp) {
-    size_t len = 0;
-    char *line = 0;
-    while(1) {
-
-      auto nbRead = getline(&line, &len, fp);
-      if(nbRead<0) {
-        break;
-      }
-      if(0==nbRead) {
-        continue;
-      }
-
-      auto p = line;
-      char *firstSep = 0;
-      char *secondSep = 0;
-      char *secondFirst = 0;
-      auto end = (nbRead + p);
-      while(p<end) {
-        auto c = p[0];
-        auto validChar = (
-          ('0'<=c && c<='9')  ||
-          ('A'<=c && c<='Z')  ||
-          ('a'<=c && c<='z')  ||
-          ('_'==c)
-        );
-        if(false==validChar) {
-          if(0==firstSep) {
-            firstSep = p;
-          } else {
-            if(0==secondSep && 0!=secondFirst) {
-              secondSep = p;
-            }
-          }
-        } else {
-          if(0!=firstSep) {
-            if(0==secondFirst) {
-              secondFirst = p;
-            }
-          }
-        }
-        ++p;
-      }
-      if(0==firstSep || 0==secondFirst || 0==secondSep) {
-        continue;
-      }
-
-      auto key = std::string(line, firstSep);
-      auto val = std::string(secondFirst, secondSep);
-      g_config[key] = val;
-    }
-    if(0!=line) {
-      free(line);
+// each meter gets its own copy of the rules, so interleaved downloads keep their own windows
+static AlertEngine &alertEngine(
+    uint32_t deviceId
+) {
+    auto it = g_alertEngines.find(deviceId);
+    if(g_alertEngines.end()==it) {
+        it = g_alertEngines.emplace(deviceId, g_alertEngine).first;
     }
-    fclose(fp);
-  }
+    return it->second;
 }
 
-// get the name of a specific MDC_* constant as a string
-static auto findKeyByValue(
-    uint16_t value
-) {
-    #define x(a, b) if((b)==value) return #a;
-        MDC_LIST
-    #undef x
-    return (const char *)0;
-};
-
-// canonical hexdump of a buffer
-static auto hexDump(
-    const uint8_t *buffer,
-    uint32_t size
+// remember which device the samples come from
+static void setDevice(
+    void *user,
+    uint64_t systemId
 ) {
-    auto i = 0;
-    while(i<size) {
-        auto e = (16 +i );
-        for(int j=i; j<e; ++j) {
-            if(j<size) {
-                printf("%02X ", buffer[j]);
-            } else {
-                putchar(' ');
-                putchar(' ');
-                putchar(' ');
-            }
-        }
-        putchar(' ');
-        putchar(' ');
-        putchar(' ');
-        for(int j=i; j<e; ++j) {
-            if(j<size) {
-                auto c = buffer[j];
-                putchar(isprint(c) ? c : '.');
-            }
-        }
-        putchar('\n');
-        i = e;
-    }
+    auto download = (Download *)user;
+    download->deviceId = Archive::deviceId(systemId);
 }
 
-// canonical hexdump of a buffer with header
-static auto hexDumpWithHeader(
-    const char *bufferName,
-    const uint8_t *buffer,
-    uint32_t size
+// size buffers from what the device announced, and tell whoever listens how far along we are
+static void reportProgress(
+    void *user,
+    const AccuChekProgress *progress
 ) {
-    LOG_NFO(
-        "hexdump of buffer:\n\nBUFFER START \"%s\" size=%d (0x%x) ===============================================",
-        bufferName,
-        (int)size,
-        (int)size
+    auto download = (Download *)user;
+    if(0==progress->received) {
+        download->records.reserve(download->records.size() + progress->expected);
+    }
+    if(0==g_progress) {
+        return;
+    }
+    fprintf(
+        g_progress,
+        "{ \"device\":\"0x%08x\", \"received\":%u, \"skipped\":%u, \"expected\":%u, \"capacity\":%u, \"segments\":%u, \"elapsed\":%.3f, \"rate\":%.1f, \"eta\":%.3f }\n",
+        download->deviceId,
+        progress->received,
+        progress->skipped,
+        progress->expected,
+        progress->capacity,
+        progress->segments,
+        progress->elapsed,
+        progress->rate,
+        progress->eta
     );
-    hexDump(buffer, size);
-    printf("BUFFER END ============================================================================================\n\n");
+    fflush(g_progress);
 }
 
-// write big endian 16bit int to buffer and shift ptr
-static auto be16(
-    uint8_t *&p,
-    uint16_t v
+// where a pipelined download spent its time, stage by stage
+static void reportPipeline(
+    const AccuChekSession *session
 ) {
-    p[0] = (v >> 8) & 0xFF;
-    p[1] = (v >> 0) & 0xFF;
-    p += 2;
+    AccuChekPipelineStats stats;
+    if(0==g_progress || ACCUCHEK_OK!=accuchek_pipeline_stats(session, &stats)) {
+        return;
+    }
+    const struct {
+        const char *name;
+        const AccuChekStageStats &stage;
+    } stages[] = {
+        { "usb",    stats.usb    },
+        { "decode", stats.decode },
+        { "sink",   stats.sink   },
+    };
+    fprintf(g_progress, "{ \"pipeline\":{");
+    for(auto &s:stages) {
+        fprintf(
+            g_progress,
+            "%s \"%s\":{ \"segments\":%" PRIu64 ", \"queued\":%u, \"maxQueued\":%u, \"idle\":%.6f, \"stalled\":%.6f }",
+            (&s==stages ? "" : ","),
+            s.name,
+            s.stage.segments,
+            s.stage.queued,
+            s.stage.maxQueued,
+            s.stage.idle,
+            s.stage.stalled
+        );
+    }
+    fprintf(g_progress, " } }\n");
+    fflush(g_progress);
 }
 
-// read big endian 16bit int to buffer and shift ptr
-static auto be16r(
-    const uint8_t *p,
-    size_t &offset
+// collect a segment worth of samples for sinks, archive and friends
+static void collectSamples(
+    void *user,
+    const AccuChekSample *samples,
+    size_t count
 ) {
-    auto hi = p[0 + offset];
-    auto lo = p[1 + offset];
-    offset += 2;
-    return (((uint16_t)hi)<<8) | lo;
-}
+    auto download = (Download *)user;
+    for(auto &sink:g_sinks) {
+        if(false==sink->write(samples, count, download->deviceId)) {
+            LOG_WRN("failed to write to sink");
+        }
+    }
 
-// write big endian 32bit int to buffer and shift ptr
-static auto be32(
-    uint8_t *&p,
-    uint32_t v
-) {
-    p[0] = (v >> 24) & 0xFF;
-    p[1] = (v >> 16) & 0xFF;
-    p[2] = (v >>  8) & 0xFF;
-    p[3] = (v >>  0) & 0xFF;
-    p += 4;
+    auto &records = download->records;
+    auto first = records.size();
+    for(size_t i=0; i<count; ++i) {
+        ArchiveRecord r;
+        r.epoch = samples[i].epoch;
+        r.deviceId = download->deviceId;
+        r.mgdl = samples[i].mgdl;
+        r.status = samples[i].status;
+        records.push_back(r);
+    }
+
+    // hand the segment straight to shared memory readers, unless serving:
+    // only what the archive didn't know yet gets published then
+    if(false==g_serving) {
+        g_ring.publish(first + records.data(), count);
+    }
+
+    // run alert rules right away, oldest first
+    if(0!=g_alertsPath) {
+        std::vector<ArchiveRecord> segment(first + records.begin(), records.end());
+        std::sort(segment.begin(), segment.end());
+        std::vector<AlertEvent> events;
+        auto &engine = alertEngine(download->deviceId);
+        for(auto &r:segment) {
+            engine.feed(r, events);
+        }
+        for(auto &event:events) {
+            g_alertSink.write(event);
+        }
+    }
 }
 
-// read big endian 32bit int to buffer and shift ptr
-static auto be32r(
-    const uint8_t *p,
-    size_t &offset
+// handle --upload options, returns false if arg is something else
+static auto parseUploadOption(
+    const char *arg
 ) {
-    uint32_t p0 = p[0 + offset];
-    uint32_t p1 = p[1 + offset];
-    uint32_t p2 = p[2 + offset];
-    uint32_t p3 = p[3 + offset];
-    offset += 4;
-
-    return (
-        (p0 << 24)  |
-        (p1 << 16)  |
-        (p2 <<  8)  |
-        (p3 <<  0)
-    );
+    if(0==strncmp(arg, "--upload=", 9)) {
+        g_uploadUrl = (9 + arg);
+    } else if(0==strncmp(arg, "--upload-batch=", 15)) {
+        g_uploadBatch = std::max(1, atoi(15 + arg));
+    } else if(0==strncmp(arg, "--upload-linger=", 16)) {
+        g_uploadLinger = std::max(0, atoi(16 + arg));
+    } else {
+        return false;
+    }
+    return true;
 }
 
-// a usb device (only things about the device we actually need)
-struct USBDevice {
-
-    // data
-    libusb_device *dev;
-    uint16_t vendorId;
-    uint16_t productId;
-    std::string vendor;
-    std::string product;
-    uint8_t sndEndPoint;
-    uint8_t rcvEndPoint;
-    uint8_t configValue;
-    uint8_t interfaceNumber;
-    uint8_t alternateSetting;
-    libusb_device_handle *devHandle;
-
-    // constructor
-    USBDevice(
-        libusb_device *_dev,
-        uint16_t _vendorId,
-        uint16_t _productId,
-        const char *_vendor,
-        const char *_product,
-        uint8_t _sndEndPoint,   // NB: used to write _to_ device _from_ host
-        uint8_t _rcvEndPoint,   // NB: used to read _from_ device _to_ host
-        const libusb_config_descriptor *cfg,
-        const libusb_interface_descriptor *altSetting
-    )
-        :   dev(_dev),
-            vendorId(_vendorId),
-            productId(_productId),
-            vendor(_vendor),
-            product(_product),
-            sndEndPoint(_sndEndPoint),
-            rcvEndPoint(_rcvEndPoint),
-            configValue(cfg->bConfigurationValue),
-            interfaceNumber(altSetting->bInterfaceNumber),
-            alternateSetting(altSetting->bAlternateSetting),
-            devHandle(0)
-    {
-        // increase refcount on libusb device handle
-        libusb_ref_device(dev);
-    }
-
-    // copy constructor
-    USBDevice(
-        const USBDevice &rhs
-    )
-        :   dev(rhs.dev),
-            vendorId(rhs.vendorId),
-            productId(rhs.productId),
-            vendor(rhs.vendor),
-            product(rhs.product),
-            sndEndPoint(rhs.sndEndPoint),
-            rcvEndPoint(rhs.rcvEndPoint),
-            configValue(rhs.configValue),
-            interfaceNumber(rhs.interfaceNumber),
-            alternateSetting(rhs.alternateSetting),
-            devHandle(rhs.devHandle)
-    {
-        // increase refcount on libusb device handle
-        libusb_ref_device(dev);
-    }
-
-    // destructor
-    ~USBDevice() {
-        // decrease refcount on libusb device handle
-        libusb_unref_device(dev);
-    }
-
-    // show device specs
-    auto show(
-        const char *msg
-    ) {
-        LOG_NFO(
-            "%s:\n"
-            "\n"
-            "    bus number:    %d\n"
-            "    dev address:   %d\n"
-            "    cfg value:     %d\n"
-            "    alt setting:   %d\n"
-            "    alt interface number: %d\n"
-            "    vendor:        (0x%04x) %s\n"
-            "    product:       (0x%04x) %s\n"
-            "    sndEndPnt:     %d\n"
-            "    rcvEndPnt:     %d\n"
-            ,
-            msg,
-            libusb_get_bus_number(dev),
-            libusb_get_device_address(dev),
-            (int)configValue,
-            (int)alternateSetting,
-            (int)interfaceNumber,
-            (int)vendorId,
-            vendor.c_str(),
-            (int)productId,
-            product.c_str(),
-            sndEndPoint,
-            rcvEndPoint
-        );
+// start uploader if asked to, the archive tells what is new and holds the queue
+static auto openUploader() {
+    if(0==g_uploadUrl) {
+        return true;
     }
-};
-
-/*
-
+    if(0==g_archivePath) {
+        LOG_WRN("--upload needs --archive to know which readings are new");
+        return false;
+    }
+    auto queuePath = std::string(g_archivePath) + ".upload";
+    return g_uploader.open(g_uploadUrl, queuePath.c_str(), g_uploadBatch, g_uploadLinger);
+}
 
-    syslog excerpt from an actual accuchek connecting:
-
-        May 26 14:35:34 machine kernel: [598051.987118] usb 3-1: new full-speed USB device number 59 using xhci_hcd
-        May 26 14:35:34 machine kernel: [598052.141001] usb 3-1: New USB device found, idVendor=173a, idProduct=21d5, bcdDevice= 1.00
-        May 26 14:35:34 machine kernel: [598052.141005] usb 3-1: New USB device strings: Mfr=1, Product=2, SerialNumber=0
-        May 26 14:35:34 machine kernel: [598052.141007] usb 3-1: Product: ACCU-CHEK Guide
-        May 26 14:35:34 machine kernel: [598052.141008] usb 3-1: Manufacturer: Roche
-        May 26 14:35:34 machine mtp-probe: checking bus 3, device 59: "/sys/devices/pci0000:00/0000:00:14.0/usb3/3-1"
-        May 26 14:35:34 machine mtp-probe: bus: 3, device: 59 was not an MTP device
-        May 26 14:35:34 machine mtp-probe: checking bus 3, device 59: "/sys/devices/pci0000:00/0000:00:14.0/usb3/3-1"
-        May 26 14:35:34 machine mtp-probe: bus: 3, device: 59 was not an MTP device
-
-    dump from a generic usb prober on the accuchek:
-
-        /dev/char/189:314
-        /dev/bus/usb/003/059
-        idVendor=173a
-        idProduct=21d5
-
-        examining USB device
-            device has 1 configs
-                examining config 0
-                config has 1 interfaces
-                    examining interface 0
-                    interface has 1 altSettings
-                        examining altsetting 0
-                        altSetting has 2 endpoints
-                            examining endpoint 0
-                            endpoint has packet size 64
-                            endpoint isInterruptType=0
-                            examining endpoint 1
-                            endpoint has packet size 64
-                            endpoint isInterruptType=0
-
-        ==> found valid accuchek device:
-            bus number:    3
-            dev address:   60
-            cfg value:     1
-            alt setting:   0
-            alt interface number: 0
-            vendor:        (0x173a) Roche
-            product:       (0x21d5) ACCU-CHEK Guide
-            sndEndPnt:     1
-            rcvEndPnt:     129
-
-    lsusb -v excerpt:
-
-        Bus 003Device 118: ID 173a:21d5 Roche
-        Device Descriptor:
-          bLength                18
-          bDescriptorType         1
-          bcdUSB               2.00
-          bDeviceClass            0
-          bDeviceSubClass         0
-          bDeviceProtocol         0
-          bMaxPacketSize0        64
-          idVendor           0x173a Roche
-          idProduct          0x21d5
-          bcdDevice            1.00
-          iManufacturer           1 Roche
-          iProduct                2 ACCU-CHEK Guide
-          iSerial                 0
-          bNumConfigurations      1
-          Configuration Descriptor:
-            bLength                 9
-            bDescriptorType         2
-            wTotalLength       0x0052
-            bNumInterfaces          1
-            bConfigurationValue     1
-            iConfiguration          3 FS configuration
-            bmAttributes         0x80
-              (Bus Powered)
-            MaxPower              100mA
-            Interface Descriptor:
-              bLength                 9
-              bDescriptorType         4
-              bInterfaceNumber        0
-              bAlternateSetting       0
-              bNumEndpoints           2
-              bInterfaceClass        15
-              bInterfaceSubClass      0
-              bInterfaceProtocol      0
-              iInterface              4 Personal Healthcare Device Class
-              ** UNRECOGNIZED:  04 20 02 00
-              ** UNRECOGNIZED:  06 30 00 01 11 10
-              Endpoint Descriptor:
-                bLength                 7
-                bDescriptorType         5
-                bEndpointAddress     0x81  EP 1 IN
-                bmAttributes            2
-                  Transfer Type            Bulk
-                  Synch Type               None
-                  Usage Type               Data
-                wMaxPacketSize     0x0040  1x 64 bytes
-                bInterval               0
-                DEVICE CLASS:  04 21 01 08
-                ** UNRECOGNIZED:  10 22 52 6f 63 68 65 20 50 48 44 43 20 54 78 00
-              Endpoint Descriptor:
-                bLength                 7
-                bDescriptorType         5
-                bEndpointAddress     0x01  EP 1 OUT
-                bmAttributes            2
-                  Transfer Type            Bulk
-                  Synch Type               None
-                  Usage Type               Data
-                wMaxPacketSize     0x0040  1x 64 bytes
-                bInterval               0
-                DEVICE CLASS:  04 21 01 08
-                ** UNRECOGNIZED:  10 22 52 6f 63 68 65 20 50 48 44 43 20 52 78 00
-
-    endpoints:
-
-        bEndpointAddress     0x81  EP 1 IN      (device to host)
-        bEndpointAddress     0x01  EP 1 OUT     (host to device)
-        rcvEndPnt:     129
-        sndEndPnt:     1
-
-
-*/
-
-// open an accuchek USB device and download data from it
-static auto operateDevice(
-    USBDevice &usbDevice
+// queue readings new to the archive for upload, before the archive has them: a crash or a
+// failed append in between then means sending them twice, never not at all
+static bool queueUpload(
+    const std::vector<ArchiveRecord> &records
 ) {
-    /*
-       much of what follows was directly reverse-engineered from the highly
-       unportable (only works in effing Chrome) javascript code found here:
-
-           https://github.com/tidepool-org/uploader/tree/master/lib/drivers/roche
-
-       and backported to raw libusb. The original author of the tidepool code
-       likely had access to a manual documenting the protocol.
-
-    */
+    return g_uploader.add(records.data(), records.size());
+}
 
-    // open device
-    auto dev = usbDevice.dev;
-    libusb_device_handle *devHandle = 0;
-    auto fail0 = libusb_open(dev, &devHandle);
-    if(fail0) {
-        LOG_WRN("libusb_open failed on selected device -- giving up");
-        exit(1);
+// handle --alert options, returns false if arg is something else
+static auto parseAlertOption(
+    const char *arg
+) {
+    if(0==strncmp(arg, "--alerts=", 9)) {
+        g_alertsPath = (9 + arg);
+    } else if(0==strncmp(arg, "--alert-rules=", 14)) {
+        g_alertRulesPath = (14 + arg);
+    } else {
+        return false;
     }
-    usbDevice.devHandle = devHandle;
-
-    // detach whatever kernel driver may have been attached to it
-    libusb_detach_kernel_driver(
-        devHandle,
-        usbDevice.interfaceNumber
-    );
+    return true;
+}
 
-    // load the configuration chosen during detection phase
-    {
-        auto fail =libusb_set_configuration(
-            devHandle,
-            usbDevice.configValue
-        );
-        if(fail<0) {
-            LOG_WRN("failed to configure selected device -- giving up");
-            exit(1);
-        }
+// compile alert rules and open sink if asked to
+static auto openAlerts() {
+    if(0==g_alertsPath) {
+        return true;
     }
-
-    // claim interface
-    {
-        auto fail = libusb_claim_interface(
-            devHandle,
-            usbDevice.interfaceNumber
-        );
-        if(fail<0) {
-            LOG_WRN("failed to claim interface -- giving up");
-            exit(1);
-        }
+    if(false==g_alertEngine.load(g_alertRulesPath) || false==g_alertSink.open(g_alertsPath)) {
+        return false;
     }
 
-    // set alt setting chosen during detection phase on interface
-    {
-        auto fail = libusb_set_interface_alt_setting(
-            devHandle,
-            usbDevice.interfaceNumber,
-            usbDevice.alternateSetting
-        );
-        if(fail<0) {
-            LOG_WRN("failed to set alt setting -- giving up");
-            exit(1);
+    // whatever the archive already holds was seen (and alerted on) by an earlier run, as of
+    // each meter's own latest reading: meters get downloaded at different times
+    ArchiveReader reader;
+    if(0!=g_archivePath && reader.open(g_archivePath)) {
+        std::unordered_map<uint32_t, int64_t> latest;
+        for(auto &block:reader.blocks()) {
+            for(uint32_t i=0; i<block.count; ++i) {
+                auto &r = block.records[i];
+                auto it = latest.emplace(r.deviceId, r.epoch).first;
+                it->second = std::max(it->second, r.epoch);
+            }
+        }
+        for(auto &device:latest) {
+            alertEngine(device.first).silence(device.second);
         }
     }
+    return true;
+}
 
-    // make some noise
-    LOG_NFO("using device snd endpoint = %d", usbDevice.sndEndPoint);
-    LOG_NFO("using device rcv endpoint = %d\n", usbDevice.rcvEndPoint);
-
-    // things we're going to need whole talking to the device
-    #define BUFFER_SIZE size_t(1024)
-    uint8_t buffer[BUFFER_SIZE];
-    uint16_t invokeId = -1;
-    int phaseIndex = 1;
-
-    // lambda to send out a message via bulk transfer
-    auto bulkOut = [&](
-        const char *msgName,
-        size_t len
-    ) {
-
-        // make some noise
-        printf("\n");
-        LOG_NFO(
-            "phase %d: sending message %s",
-            (int)phaseIndex,
-            msgName
-        );
-
-        // show hex dump of the outgoing message content
-        hexDumpWithHeader(
-            msgName,
-            buffer,
-            len
-        );
+// find all possible accuchek devices, pick one and download data from it
+static auto findAndOperateAccuChek(
+    AccuChekSession *session,
+    int ix = -1
+) {
 
-        // send the message via a bulk transfer on the send endpoint
-        int bytesWritten = -1;
-        auto fail = libusb_bulk_transfer(
-            devHandle,              // device
-            usbDevice.sndEndPoint,  // endpoint
-            buffer,                 // content
-            len,                    // content size
-            &bytesWritten,          // actual number of bytes written out
-            5000                    // timeout in ms
-        );
-        if(0!=fail || len!=bytesWritten) {
-            LOG_WRN("failed to send message %s -- giving up", msgName);
-            LOG_WRN("libusb error was :%s", libusb_strerror(fail));
-            exit(1);
-        }
-        LOG_NFO(
-            "successfully wrote message %s, size=%d (0x%x):",
-            msgName,
-            (int)len,
-            (int)len
-        );
+    // what an interrupted run left in the journal comes first
+    Download recovered{ 0, {} };
+    AccuChekCallbacks recovery = { &recovered, 0, collectSamples, setDevice, 0 };
+    auto nbRecovered = accuchek_recover(session, &recovery);
+    if(0<nbRecovered) {
+        LOG_NFO("recovered %d samples from journals", nbRecovered);
+    }
 
-        // move on to next phase
-        ++phaseIndex;
-    };
+    // if no devices found, bail, unless there's something recovered to publish
+    auto count = accuchek_device_count(session);
+    if(0==count && 0==nbRecovered) {
+        LOG_WRN("found no accuchek device whatsoever -- giving up");
+        exit(1);
+    }
 
-    // lambda to receive a message via bulk transfer
-    auto bulkIn = [&](
-        const char *msgName,
-        size_t maxLen = BUFFER_SIZE
-    ) {
-        // make some noise
-        printf("\n");
-        LOG_NFO(
-            "phase %d: receiving message %s",
-            (int)phaseIndex,
-            msgName
+    // make sure we user referes to a valid device
+    if(count<=ix) {
+        LOG_WRN(
+            "user selected device %d but only %d devices were found -- aborting",
+            ix,
+            count
         );
+        exit(1);
+    }
 
-        // read data
-        int bytesRead = 0;
-        auto fail = libusb_bulk_transfer(
-            devHandle,              // device
-            usbDevice.rcvEndPoint,  // endpoint
-            buffer,                 // content
-            maxLen,                 // max content length
-            &bytesRead,             // actual number of bytes read in
-            5000                    // timeout in ms
-        );
-        if(0!=fail) {
-            LOG_WRN("failed to receive message %s -- giving up", msgName);
-            LOG_WRN("libusb error was :%s", libusb_strerror(fail));
-            exit(1);
+    // or the one plugged in where the user said
+    if(0!=g_port) {
+        for(int i=0; i<count && ix<0; ++i) {
+            AccuChekDeviceInfo info;
+            if(ACCUCHEK_OK==accuchek_device_info(session, i, &info) && 0==strcmp(g_port, info.busPath)) {
+                ix = i;
+            }
         }
-
-        // we don't care about the content, but dump it anyways
-        LOG_NFO(
-            "successfully read message \"%s\" from device",
-            msgName
-        );
-
-        // show hex dump of the message content
-        hexDumpWithHeader(
-            msgName,
-            buffer,
-            bytesRead
-        );
-
-        // move on to next phase
-        ++phaseIndex;
-
-        // return number of bytes read
-        return bytesRead;
-    };
-
-    // read and update invokeId from response buffer
-    auto updateInvokeId = [&](
-        size_t offset = 6
-    ) {
-        invokeId = be16r(buffer, offset);
-        LOG_NFO(
-            "invokeId after phase %d is: %d",
-            (int)phaseIndex,
-            (int)invokeId
-        );
-    };
-
-    // protocol step: do a control transfer in
-    {
-        #define PHASE_1 "initial control transfer in"
-        LOG_NFO("phase 1: " PHASE_1);
-
-        auto bytesRead = libusb_control_transfer(
-            devHandle,
-            (
-                LIBUSB_REQUEST_TYPE_STANDARD |
-                LIBUSB_RECIPIENT_DEVICE      |
-                LIBUSB_ENDPOINT_IN
-            ),
-            LIBUSB_REQUEST_GET_STATUS,
-            0,
-            0,
-            buffer,
-            2,
-            5000
-        );
-        if(bytesRead<=0) {
-            LOG_WRN("failed " PHASE_1 " -- giving up");
-            LOG_WRN("libusb error was :%s", libusb_strerror(bytesRead));
+        if(ix<0) {
+            LOG_WRN("no accuchek device plugged in at %s -- giving up", g_port);
             exit(1);
         }
-        LOG_NFO(PHASE_1 " succeeded");
-        hexDumpWithHeader(
-            PHASE_1,
-            buffer,
-            bytesRead
-        );
-        ++phaseIndex;
-    }
-
-    // protocol step: wait for pairing request from the device
-    {
-        bulkIn(
-            "pairing request",
-            64
-        );
     }
 
-    // protocol step: send a pairing confirmation to the device
-    {
-        // the message the device expects
-        auto p = buffer;
-        memset(buffer, 0, sizeof(buffer));
-        be16(p, kAPDU_TYPE_ASSOCIATION_RESPONSE); // msg type
-        be16(p,         44);                      // length (p, excludes initial 4 bytes)
-        be16(p,     0x0003);                      // accepted-unknown-config
-        be16(p,      20601);                      // data-proto-id
-        be16(p,         38);                      // data-proto-info length
-        be32(p, 0x80000002);                      // protocolVersion
-        be16(p,     0x8000);                      // encoding-rules = MDER
-        be32(p, 0x80000000);                      // nomenclatureVersion
-        be32(p,          0);                      // functionalUnits = normal association
-        be32(p, 0x80000000);                      // systemType = sys-type-manager
-        be16(p,          8);                      // system-id length
-        be32(p, 0x12345678);                      // system-id high
-        be32(p, 0x00000000);                      // zero
-        be32(p, 0x00000000);                      // zero
-        be32(p, 0x00000000);                      // zero
-        be16(p,     0x0000);                      // zero
-
-        bulkOut(
-            "pairing confirmation",
-            (p-buffer)
-        );
-    };
+    // select a specific device (as specified by user, or the first one no other process is using)
+    auto first = (ix<0 ? 0 : ix);
+    auto last = (ix<0 ? count : 1+ix);
 
-    // protocol step: wait for config info (as a response to pairing confirm)
-    {
-        auto bytesRead = bulkIn("config info");
-        updateInvokeId();
+    // talk to device to download data from it
+    std::vector<Download> downloads(g_all ? count : std::min(1, count), Download{ 0, {} });
+    std::vector<AccuChekCallbacks> callbacks;
+    for(auto &download:downloads) {
+        callbacks.push_back({ &download, 0, collectSamples, setDevice, reportProgress });
     }
-
-    // lambda: find object of a given "class" in a config info response buffer
-    auto getObj = [&](
-        const uint8_t *buffer,
-        uint16_t objRequestedClass,
-        uint16_t &_objHandle
-    ) {
-        auto offset = size_t(24);
-        auto count = be16r(buffer, offset);
-        auto dummy = be16r(buffer, offset);
-        LOG_NFO("got %d object in config info response", (int)count);
-        for(int i=0; i<count; ++i) {
-            auto objClass = be16r(buffer, offset);
-            auto objHandle = be16r(buffer, offset);
-            auto objAttrCount = be16r(buffer, offset);
-            auto objSize = be16r(buffer, offset);
-            if(0) {
-                LOG_NFO(
-                    "obj %d, size=%d, class=%d (%s), handle=%d",
-                    (int)i,
-                    (int)objSize,
-                    (int)objClass,
-                    findKeyByValue(objClass),
-                    (int)objHandle
-                );
-                hexDump((offset + buffer), objSize);
-            }
-            if(objRequestedClass==objClass) {
-                _objHandle = objHandle;
-                return std::pair(
-                    (offset + buffer),
-                    objAttrCount
-                );
-            }
-            offset += objSize;
+    auto err = int(0==count ? ACCUCHEK_OK : ACCUCHEK_ERR_BUSY);
+    if(0==count) {
+        LOG_WRN("found no accuchek device, publishing what was recovered");
+    } else if(false==g_all) {
+        for(int i=first; i<last && ACCUCHEK_ERR_BUSY==err; ++i) {
+            err = accuchek_download(session, i, callbacks.data());
         }
-        return std::pair((const uint8_t*)0, 0);
-    };
-
-    // lambda: find attribute of a given "class" in a response buffer object
-    auto getAttr = [&](
-        const uint8_t *buffer,
-        uint16_t attributeCount,
-        uint16_t attrRequestedClass
-    ) {
-
-        LOG_NFO(
-            "looking for attribute of class %d among %d attributes",
-            (int)attrRequestedClass,
-            (int)attributeCount
-        );
+    } else {
 
-        auto offset = size_t(0);
-        for(int i=0; i<attributeCount; ++i) {
-            auto attrClass = be16r(buffer, offset);
-            auto attrSize = be16r(buffer, offset);
-            if(0) {
-                LOG_NFO(
-                    "attr %d, size=%d, class=%d (%s)",
-                    (int)i,
-                    (int)attrSize,
-                    (int)attrClass,
-                    findKeyByValue(attrClass)
-                );
-                hexDump((offset + buffer), attrSize);
-            }
-            if(attrRequestedClass==attrClass) {
-                return std::pair(
-                    (offset + buffer),
-                    attrSize
-                );
+        // or from every one of them, as many at once as their hubs allow
+        std::vector<int> results(count);
+        accuchek_download_all(session, callbacks.data(), results.data());
+        auto nbDone = 0;
+        for(int i=0; i<count; ++i) {
+            nbDone += (ACCUCHEK_OK==results[i]);
+            if(ACCUCHEK_OK!=results[i] && ACCUCHEK_ERR_BUSY!=results[i]) {
+                LOG_WRN("download from device #%d failed: %s", i, accuchek_strerror(results[i]));
+                err = results[i];
             }
-            offset += attrSize;
         }
-        return std::pair((const uint8_t*)0, 0);
-    };
-
-    // get attribute list from a buffer
-    auto getAttrList = [&](
-        const uint8_t *buffer,
-        uint16_t &attrCnt,
-        uint16_t &attrLen,
-        size_t &offset
-    ) {
-
-        LOG_NFO("parsing attr list");
-
-        offset = 14;
-        attrCnt = be16r(buffer, offset);
-        attrLen = be16r(buffer, offset);
-
-        LOG_NFO(
-            "got attrcnt=%d, len=%d, offset=%d",
-            (int)attrCnt,
-            (int)attrLen,
-            (int)offset
-        );
-    };
-
-    // use lambdas to parse config and extract useful info
-    LOG_NFO("parsing config info response");
-    uint16_t pmStoreHandle = 0;
-    auto pmStore = getObj(buffer, kMDC_MOC_VMO_PMSTORE, pmStoreHandle);
-    if(0==pmStore.first) {
-        LOG_WRN("failed to parse config buffer for pmStore -- giving up");
-        exit(1);
+        err = (0<nbDone ? int(ACCUCHEK_OK) : err);
     }
-    LOG_NFO(
-        "found pmStore of size %d, handle = %d",
-        (int)pmStore.second,
-        (int)pmStoreHandle
-    );
-
-    auto nbSegments = getAttr(
-        pmStore.first,
-        pmStore.second,
-        kMDC_ATTR_NUM_SEG
-    );
-    if(0==nbSegments.first) {
-        LOG_WRN("failed to parse pmStore for nbSegments -- giving up");
+    if(ACCUCHEK_OK!=err) {
+        LOG_WRN("download failed: %s -- giving up", accuchek_strerror(err));
         exit(1);
     }
-    LOG_NFO("successfully found \"nbSegments\" oject");
-
-    uint16_t nbSegs = -1;
-    {
-        size_t o = 0;
-        nbSegs = be16r(nbSegments.first, o);
-        LOG_NFO("data is split into %d segments", (int)nbSegs);
-    }
-
-    // protocol step: send "config well received" response
-    {
-        auto p = buffer;
-        memset(buffer, 0, sizeof(buffer));
-        be16(p, kAPDU_TYPE_PRESENTATION_APDU);               // msg type
-        be16(p,     22);                                     // length
-        be16(p,     20);                                     // octet stringlength
-        be16(p, invokeId);                                   // invoke-id read from config
-        be16(p, kDATA_ADPU_RESPONSE_CONFIRMED_EVENT_REPORT); //
-        be16(p,     14);                                     // length
-        be16(p,      0);                                     // obj-handle = 0
-        be32(p,      0);                                     // currentTime = 0
-        be16(p, kEVENT_TYPE_MDC_NOTI_CONFIG);                // event-type
-        be16(p,      4);                                     // length
-        be16(p, 0x4000);                                     // config-report-id = extended-config-start
-        be16(p,      0);                                     // config-result = accepted-config
-
-        bulkOut(
-            "config received confirmation",
-            (p-buffer)
-        );
+    reportPipeline(session);
+    auto records = std::move(recovered.records);
+    for(auto &download:downloads) {
+        records.insert(records.end(), download.records.begin(), download.records.end());
     }
 
-    // protocol step: send MDS attribute request
-    {
-        auto p = buffer;
-        memset(buffer, 0, sizeof(buffer));
-        be16(p, kAPDU_TYPE_PRESENTATION_APDU); // msg type
-        be16(p,     14);                       // length
-        be16(p,     12);                       // octet stringlength
-        be16(p, (1+invokeId));                 // invoke-id from config
-        be16(p, kDATA_ADPU_INVOKE_GET);        //
-        be16(p,      6);                       // length
-        be16(p,      0);                       // obj-handle = 0
-        be32(p,      0);                       // currentTime = 0
-
-        bulkOut(
-            "MDS attribute request",
-            (p-buffer)
-        );
+    // write compressed copy, sorted so deltas stay small
+    if(0!=g_packedPath) {
+        auto sorted = records;
+        std::sort(sorted.begin(), sorted.end());
+        if(false==Codec::writeFile(g_packedPath, sorted)) {
+            LOG_WRN("failed to write %s -- giving up", g_packedPath);
+            exit(1);
+        }
     }
 
-    // protocol step: read MDS attr answer
-    {
-        auto bytesRead = bulkIn("MDS attribute answer");
-        updateInvokeId();
-
-        // check for abort
-        size_t o = 0;
-        auto retCode = be16r(buffer, o);
-        if(kAPDU_TYPE_ASSOCIATION_ABORT==retCode) {
-            LOG_WRN("received association abort request -- giving up");
+    // store whatever is new in the archive, and send it on its way
+    if(0!=g_archivePath) {
+        if(false==Archive::append(g_archivePath, records, queueUpload)) {
+            LOG_WRN("failed to update archive %s -- giving up", g_archivePath);
             exit(1);
         }
     }
+    g_uploader.close();
+}
 
-    // parse device information out of MDS attr answer
-    if(0) {
-
-        // we don't really need any of this
-        size_t offset = -1;
-        uint16_t attrLen = -1;
-        uint16_t attrCount = -1;
-        getAttrList(
-            buffer,
-            attrCount,
-            attrLen,
-            offset
-        );
-
-        // get device exact model
-        getAttr(
-            offset + buffer,
-            attrCount,
-            kMDC_ATTR_ID_MODEL
-        );
-
-        // get device productions specs
-        getAttr(
-            offset + buffer,
-            attrCount,
-            kMDC_ATTR_ID_PROD_SPECN
-        );
+// accuchek pack ARCHIVE PACKED: compress a whole archive
+static int packCommand(
+    int argc,
+    char *argv[]
+) {
+    if(argc!=4) {
+        fprintf(stderr, "usage: accuchek pack ARCHIVE PACKED\n");
+        return 1;
+    }
 
-        // get device internal time
-        getAttr(
-            offset + buffer,
-            attrCount,
-            kMDC_ATTR_TIME_ABS
-        );
+    ArchiveReader reader;
+    if(false==reader.open(argv[2])) {
+        fprintf(stderr, "failed to open archive %s\n", argv[2]);
+        return 1;
     }
 
-    // protocol step: send action request
-    {
-        LOG_NFO("8: send action request");
-        auto p = buffer;
-        memset(buffer, 0, sizeof(buffer));
-        be16(p, kAPDU_TYPE_PRESENTATION_APDU); // msg type
-        be16(p,     20);                       // length
-        be16(p,     18);                       // octet stringlength
-        be16(p, (1+invokeId));                 // invoke-id from prev answer
-        be16(p, kDATA_ADPU_INVOKE_CONFIRMED_ACTION);
-        be16(p,     12);                       // length of what follows (could also be zero)
-        be16(p, pmStoreHandle);                // store handle
-        be16(p, kACTION_TYPE_MDC_ACT_SEG_GET_INFO);
-        be16(p,      6);                       // length
-        be16(p,      1);                       // all segments
-        be16(p,      2);                       // length
-        be16(p,      0);                       // something
-
-        bulkOut(
-            "action request",
-            (p-buffer)
-        );
+    std::vector<ArchiveRecord> records;
+    records.reserve(reader.size());
+    for(auto &block:reader.blocks()) {
+        records.insert(records.end(), block.records, block.count + block.records);
     }
+    std::sort(records.begin(), records.end());
+    return Codec::writeFile(argv[3], records) ? 0 : 1;
+}
 
-    // protocol step: read action request response
-    {
-        auto bytesRead = bulkIn("action request response");
-        updateInvokeId();
-    }
-
-    // ----> here, the original js code sets the device time ... skip for now
-
-    // protocol step: start request for data segments
-    {
-        auto p = buffer;
-        memset(buffer, 0, sizeof(buffer));
-        be16(p, kAPDU_TYPE_PRESENTATION_APDU); // msg type
-        be16(p,     16);                       // length
-        be16(p,     14);                       // octet stringlength
-        be16(p, (1+invokeId));                 // invoke-id from prev answer
-        be16(p, kDATA_ADPU_INVOKE_CONFIRMED_ACTION);
-        be16(p,      8);                       // length of what follows (could also be zero)
-        be16(p, pmStoreHandle);                // store handle
-        be16(p, kACTION_TYPE_MDC_ACT_SEG_TRIG_XFER);
-        be16(p,      2);                       // length
-        be16(p,      0);                       // segment
-
-        bulkOut(
-            "request segments",
-            (p-buffer)
-        );
+// accuchek unpack PACKED ARCHIVE: merge a compressed file into an archive
+static int unpackCommand(
+    int argc,
+    char *argv[]
+) {
+    if(argc!=4) {
+        fprintf(stderr, "usage: accuchek unpack PACKED ARCHIVE\n");
+        return 1;
     }
 
-    // step: read segment stream header answer
-    {
-        auto bytesRead = bulkIn("segment headers");
-        updateInvokeId();
+    std::vector<ArchiveRecord> records;
+    if(false==Codec::readFile(argv[2], records)) {
+        fprintf(stderr, "failed to read packed file %s\n", argv[2]);
+        return 1;
+    }
+    return Archive::append(argv[3], records) ? 0 : 1;
+}
 
-        uint16_t dataResponse = 0;
-        if(22<=bytesRead) {
-            size_t o = 20;
-            dataResponse = be16r(buffer, o);
+// accuchek import ARCHIVE FILE...: merge legacy samples.json files into an archive
+static int importCommand(
+    int argc,
+    char *argv[]
+) {
+    uint32_t deviceId = 0;
+    auto nbThreads = 0;
+    const char *archivePath = 0;
+    std::vector<const char *> paths;
+    for(int i=2; i<argc; ++i) {
+        auto arg = argv[i];
+        if(0==strncmp(arg, "--device=", 9)) {
+            deviceId = strtoul(9 + arg, 0, 0);
+        } else if(0==strncmp(arg, "--threads=", 10)) {
+            nbThreads = atoi(10 + arg);
+        } else if(0==archivePath) {
+            archivePath = arg;
+        } else {
+            paths.push_back(arg);
         }
+    }
+    if(0==archivePath || 0==paths.size()) {
+        fprintf(stderr, "usage: accuchek import [--device=ID] [--threads=N] ARCHIVE FILE...\n");
+        return 1;
+    }
+    return Importer::importFiles(archivePath, paths, deviceId, nbThreads) ? 0 : 1;
+}
 
-        if(22==bytesRead && 0!=dataResponse) {
-            if(3==dataResponse) {
-                LOG_WRN("empty data segment -- giving up");
-            } else {
-                LOG_NFO(
-                    "error retrieving data, code = %d",
-                    (int)dataResponse
-                );
-            }
-            exit(1);
+// accuchek merge OUTPUT INPUT... [: OUTPUT INPUT...]: one canonical archive per patient
+static int mergeCommand(
+    int argc,
+    char *argv[]
+) {
+    auto nbThreads = 0;
+    std::vector<Merger::Job> jobs(1);
+    for(int i=2; i<argc; ++i) {
+        auto arg = argv[i];
+        if(0==strncmp(arg, "--threads=", 10)) {
+            nbThreads = atoi(10 + arg);
+        } else if(0==strcmp(arg, ":")) {
+            jobs.emplace_back();
+        } else if(0==jobs.back().output) {
+            jobs.back().output = arg;
+        } else {
+            jobs.back().inputs.push_back(arg);
         }
-
-        uint16_t headerValue = -1;
-        if(16<=bytesRead) {
-            size_t o = 14;
-            headerValue = be16r(buffer, o);
+    }
+    for(auto &job:jobs) {
+        if(0==job.output || 0==job.inputs.size()) {
+            fprintf(stderr, "usage: accuchek merge [--threads=N] OUTPUT INPUT... [: OUTPUT INPUT...]...\n");
+            return 1;
         }
+    }
+    return Merger::mergeArchives(jobs, nbThreads) ? 0 : 1;
+}
 
-        if(
-            (bytesRead < 22) ||
-            (kACTION_TYPE_MDC_ACT_SEG_TRIG_XFER!=headerValue)
-        ) {
-            LOG_WRN("unexpected / incorrect answer packet -- giving up");
-            exit(1);
+// accuchek report ARCHIVE: glycemic statistics per hour, day or week, from rollups
+static int reportCommand(
+    int argc,
+    char *argv[]
+) {
+    auto resolution = kRollupDay;
+    auto allDevices = true;
+    uint32_t deviceId = 0;
+    const char *archivePath = 0;
+    for(int i=2; i<argc; ++i) {
+        auto arg = argv[i];
+        if(0==strcmp(arg, "--by=hour")) {
+            resolution = kRollupHour;
+        } else if(0==strcmp(arg, "--by=day")) {
+            resolution = kRollupDay;
+        } else if(0==strcmp(arg, "--by=week")) {
+            resolution = kRollupWeek;
+        } else if(0==strncmp(arg, "--device=", 9)) {
+            deviceId = strtoul(9 + arg, 0, 0);
+            allDevices = false;
+        } else {
+            archivePath = arg;
         }
     }
+    if(0==archivePath) {
+        fprintf(stderr, "usage: accuchek report [--by=hour|day|week] [--device=ID] ARCHIVE\n");
+        return 1;
+    }
 
-    // step: read segments one by one
-    int segIndex = 0;
-    while(true) {
-
-        // get data and update invokeId
-        auto bytesRead = bulkIn("data segment");
-        auto status = buffer[32];
-        updateInvokeId();
-
-        // fish some data we need to send back in the "confirm" message
-        size_t o = 22;
-        auto u0 = be32r(buffer, o);
-        auto u1 = be32r(buffer, o);
-        auto u2 = be16r(buffer, o);
-
-        // lambda to parse samples out of each segment
-        auto parseData = [&]() {
-
-            size_t o = 30;
-            auto nbEntries = be16r(buffer, o);
-            LOG_NFO("segment has %d entries", (int)nbEntries);
-            o -= 2;
-
-            for(int i=0; i<nbEntries; ++i) {
-
-                // decode weird-ass encoding of datetime values
-                auto cvt = [](
-                    uint8_t x
-                ) {
-                    int v = -1;
-                    char buf[8];
-                    sprintf(buf, "%02X", x);
-                    sscanf(buf, "%d", &v);
-                    return v;
-                };
-
-                // load date
-                auto cc = cvt(buffer[ 6 + o]);
-                auto yy = cvt(buffer[ 7 + o]);
-                auto mm = cvt(buffer[ 8 + o]);
-                auto dd = cvt(buffer[ 9 + o]);
-                auto hh = cvt(buffer[10 + o]);
-                auto mn = cvt(buffer[11 + o]);
-
-                // load value and status
-                auto ro = (14 + o);
-                auto vv = be16r(buffer, ro);
-                auto ss = be16r(buffer, ro);
-                o += 12;
-
-                // dump sample
-                LOG_NFO(
-                    "sample: %02d%02d/%02d/%02d %02d:%02d => (mg/dL=%2d, mmol/L=%7.3f, status=0x%02x)",
-                    cc,
-                    yy,
-                    mm,
-                    dd,
-                    hh,
-                    mn,
-                    vv,
-                    (vv / 18.0),
-                    ss
-                );
-
-                // compute epoch
-                struct tm t;
-                memset(&t, 0, sizeof(t));
-                t.tm_min = mn;
-                t.tm_hour = hh;
-                t.tm_mday = dd;
-                t.tm_mon = (mm-1);
-                t.tm_year = ((cc*100 + yy) - 1900);
-                //auto epoch = timegm(&t);
-                auto epoch = timelocal(&t);
-
-                // write sample as JSON
-                if(0==ss) {
-                    fprintf(
-                        g_output,
-                        "%s\n    { \"id\":%6d, \"epoch\":%11" PRIu64 ", \"timestamp\":\"%02d%02d/%02d/%02d %02d:%02d\", \"mg/dL\":%3d, \"mmol/L\":%10.6f }",
-                        (g_firstLine ? "" : ","),
-                        (int)(g_lineCount++),
-                        (uint64_t)epoch,
-                        (int)cc,
-                        (int)yy,
-                        (int)mm,
-                        (int)dd,
-                        (int)hh,
-                        (int)mn,
-                        (int)vv,
-                        (vv / 18.0)
-                    );
-                    g_firstLine = false;
-                }
-            }
-        };
-
-        // parse received data segment
-        parseData();
-
-        // send "data received" ack
-        {
-            auto p = buffer;
-            memset(buffer, 0, sizeof(buffer));
-            be16(p, kAPDU_TYPE_PRESENTATION_APDU); // msg type
-            be16(p,     30);                       // length
-            be16(p,     28);                       // octet stringlength
-            be16(p, invokeId);                     // invoke-id from prev answer
-            be16(p, kDATA_ADPU_RESPONSE_CONFIRMED_EVENT_REPORT);
-            be16(p,     22);                       // length of what follows (could also be zero)
-            be16(p, pmStoreHandle);                // store handle
-            be32(p, 0xFFFFFFFF);                   // relative time
-            be16(p, kEVENT_TYPE_MDC_NOTI_SEGMENT_DATA);
-            be16(p,     12);
-            be32(p,     u0);
-            be32(p,     u1);
-            be16(p,     u2);
-            be16(p, 0x0080);
-
-            bulkOut(
-                "data segment received ACK",
-                (p-buffer)
-            );
-        }
+    Rollups rollups;
+    if(false==rollups.load(archivePath)) {
+        return 1;
+    }
 
-        // bail if segment was flagged as last one in the stream
-        if(0x40 & status) {
-            break;
+    auto first = true;
+    printf("[");
+    for(auto &bucket:rollups.buckets(resolution)) {
+        if(false==allDevices && deviceId!=bucket.deviceId) {
+            continue;
         }
+        struct tm t;
+        time_t start = bucket.start;
+        localtime_r(&start, &t);
+        auto &st = bucket.stats;
+        printf(
+            "%s\n    { \"device\":\"0x%08x\", \"epoch\":%11" PRId64 ", \"timestamp\":\"%04d/%02d/%02d %02d:%02d\", \"count\":%5u, \"mean\":%7.2f, \"sd\":%6.2f, \"cv\":%6.2f, \"gmi\":%5.2f, \"min\":%3d, \"max\":%3d, \"tir\":%6.2f, \"veryLow\":%4u, \"low\":%4u, \"inRange\":%5u, \"high\":%4u, \"veryHigh\":%4u }",
+            (first ? "" : ","),
+            bucket.deviceId,
+            bucket.start,
+            1900 + t.tm_year,
+            1 + t.tm_mon,
+            t.tm_mday,
+            t.tm_hour,
+            t.tm_min,
+            st.count,
+            st.mean(),
+            st.sd(),
+            st.cv(),
+            st.gmi(),
+            (int)st.min,
+            (int)st.max,
+            st.tir(),
+            st.veryLow,
+            st.low,
+            st.inRange,
+            st.high,
+            st.veryHigh
+        );
+        first = false;
     }
+    printf("\n]\n");
+    return 0;
+}
 
-    // protocol step: disconnect cleanly from device
-    {
-        auto p = buffer;
-        memset(buffer, 0, sizeof(buffer));
-        be16(p, kAPDU_TYPE_ASSOCIATION_RELEASE_REQUEST); // msg type
-        be16(p,      2);                       // length = 2
-        be16(p, 0x0000);                       // normal release
-        bulkOut("release request", (p-buffer));
-        bulkIn("release confirmation");
+// parse YYYY-MM-DD[THH:MM[:SS]] local time, or seconds since 1970. a date alone is its
+// first second, or its last one if it ends a range
+static auto parseTime(
+    const char *s,
+    int64_t &epoch,
+    bool last = false
+) {
+    char *end = 0;
+    auto n = strtoll(s, &end, 10);
+    if(0!=*s && 0==*end) {
+        epoch = n;
+        return true;
     }
-
-    // protocol step: close device
-    LOG_NFO("closing usb device");
-    libusb_close(devHandle);
+    struct tm t;
+    memset(&t, 0, sizeof(t));
+    auto nbFields = sscanf(s, "%d-%d-%dT%d:%d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday, &t.tm_hour, &t.tm_min, &t.tm_sec);
+    if(nbFields<3) {
+        return false;
+    }
+    t.tm_year -= 1900;
+    t.tm_mon -= 1;
+    t.tm_isdst = -1;
+    if(last && 3==nbFields) {
+        t.tm_mday += 1;
+        epoch = mktime(&t) - 1;
+        return true;
+    }
+    epoch = mktime(&t);
+    return true;
 }
 
-// process one USB device and add it to the list if it matches requirements
-static auto addDeviceIfAccuChek(
-    std::vector<USBDevice> &validDevices,
-    libusb_device *dev
+// accuchek query ARCHIVE: readings by device, time and glucose range, skipping blocks by zone map
+static int queryCommand(
+    int argc,
+    char *argv[]
 ) {
-
-    // get USB device description
-    libusb_device_descriptor dsc;
-    auto fail = libusb_get_device_descriptor(dev, &dsc);
-    if(0!=fail) {
-        LOG_WRN("libusb_get_device_descriptor failed");
-        return;
+    ArchiveQuery query;
+    query.validOnly = true;
+    auto nbThreads = 0;
+    auto showStats = false;
+    auto ok = true;
+    const char *archivePath = 0;
+    for(int i=2; i<argc; ++i) {
+        auto arg = argv[i];
+        if(0==strncmp(arg, "--device=", 9)) {
+            query.deviceId = strtoul(9 + arg, 0, 0);
+            query.allDevices = false;
+        } else if(0==strncmp(arg, "--from=", 7)) {
+            ok = parseTime(7 + arg, query.from) && ok;
+        } else if(0==strncmp(arg, "--to=", 5)) {
+            ok = parseTime(5 + arg, query.to, true) && ok;
+        } else if(0==strncmp(arg, "--days=", 7)) {
+            query.from = time(0) - 86400ll*atoi(7 + arg);
+        } else if(0==strncmp(arg, "--below=", 8)) {
+            query.maxMgdl = uint16_t(std::max(1, atoi(8 + arg)) - 1);
+        } else if(0==strncmp(arg, "--above=", 8)) {
+            query.minMgdl = uint16_t(std::min(65535, atoi(8 + arg) + 1));
+        } else if(0==strcmp(arg, "--all")) {
+            query.validOnly = false;
+        } else if(0==strncmp(arg, "--threads=", 10)) {
+            nbThreads = atoi(10 + arg);
+        } else if(0==strncmp(arg, "--sink=", 7)) {
+            g_sinkSpecs.push_back(7 + arg);
+        } else if(0==strcmp(arg, "--stats")) {
+            showStats = true;
+        } else {
+            archivePath = arg;
+        }
+    }
+    if(false==ok || 0==archivePath) {
+        fprintf(stderr, "usage: accuchek query [--device=ID] [--from=TIME] [--to=TIME] [--days=N] [--below=MGDL] [--above=MGDL] [--all] [--threads=N] [--sink=FORMAT:PATH ...] [--stats] ARCHIVE\n");
+        return 1;
     }
 
-    // ugly trick to "goto done" over declarations using a break
-    struct libusb_config_descriptor *cfg = 0;
-    do {
-
-        // accuchek has one config, anything with more or less is a bust
-        if(1!=dsc.bNumConfigurations) {
-            LOG_NFO("not a match, too many configs to be an accuchek");
-            break;
+    // outputs, JSON on stdout unless told otherwise
+    if(0==g_sinkSpecs.size()) {
+        g_sinkSpecs.push_back("json:-");
+    }
+    for(auto spec:g_sinkSpecs) {
+        auto sink = SampleSink::create(spec, stdout);
+        if(0==sink) {
+            return 1;
         }
+        g_sinks.emplace_back(sink);
+    }
 
-        // load first config
-        auto confIndex = 0;
-        auto fail0 = libusb_get_config_descriptor(dev, confIndex, &cfg);
-        if(0!=fail0) {
-            LOG_WRN("libusb_get_device_descriptor failed");
-            break;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    ArchiveQuery::Stats stats;
+    std::vector<ArchiveRecord> matches;
+    if(false==query.run(archivePath, nbThreads, matches, stats)) {
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    // out in runs of one device, as sinks want them
+    std::vector<AccuChekSample> samples;
+    for(size_t i=0; i<matches.size();) {
+        auto deviceId = matches[i].deviceId;
+        samples.clear();
+        for(; i<matches.size() && deviceId==matches[i].deviceId && samples.size()<4096; ++i) {
+            auto &r = matches[i];
+            struct tm t;
+            time_t epoch = r.epoch;
+            localtime_r(&epoch, &t);
+            AccuChekSample sample;
+            sample.epoch = r.epoch;
+            sample.mgdl = r.mgdl;
+            sample.status = r.status;
+            sample.year = uint16_t(1900 + t.tm_year);
+            sample.month = uint8_t(1 + t.tm_mon);
+            sample.day = uint8_t(t.tm_mday);
+            sample.hour = uint8_t(t.tm_hour);
+            sample.minute = uint8_t(t.tm_min);
+            samples.push_back(sample);
         }
-
-        // accuchek single config has one interface, anything with more or less is a bust
-        if(1!=cfg->bNumInterfaces) {
-            LOG_NFO("not a match, too many interfaces to be an accuchek");
-            break;
+        for(auto &sink:g_sinks) {
+            ok = sink->write(samples.data(), samples.size(), deviceId) && ok;
         }
+    }
+    for(auto &sink:g_sinks) {
+        ok = sink->finish() && ok;
+    }
+    if(showStats) {
+        fprintf(
+            stderr,
+            "%zu blocks, %zu skipped by zone maps (%zu zone maps not on disk), %zu records scanned, %zu matched, %.3f ms\n",
+            stats.blocks,
+            stats.skipped,
+            stats.computed,
+            stats.scanned,
+            stats.matched,
+            1e3*(t1.tv_sec - t0.tv_sec) + 1e-6*(t1.tv_nsec - t0.tv_nsec)
+        );
+    }
+    return ok ? 0 : 1;
+}
 
-        // look at all "alt settings" for first interface
-        auto interfaceIndex = 0;
-        auto interface = &(cfg->interface[interfaceIndex]);
-
-        // accuchek single config has one alt setting, anything with more or less is a bust
-        if(1!=interface->num_altsetting) {
-            LOG_NFO("not a match, too many alt settings to be an accuchek");
-            break;
+// accuchek chart ARCHIVE: at most N points over a time range, off the rollup pyramid
+static int chartCommand(
+    int argc,
+    char *argv[]
+) {
+    auto allDevices = true;
+    uint32_t deviceId = 0;
+    int64_t from = INT64_MIN;
+    int64_t to = INT64_MAX;
+    size_t maxPoints = 500;
+    auto ok = true;
+    const char *archivePath = 0;
+    for(int i=2; i<argc; ++i) {
+        auto arg = argv[i];
+        if(0==strncmp(arg, "--device=", 9)) {
+            deviceId = strtoul(9 + arg, 0, 0);
+            allDevices = false;
+        } else if(0==strncmp(arg, "--from=", 7)) {
+            ok = parseTime(7 + arg, from) && ok;
+        } else if(0==strncmp(arg, "--to=", 5)) {
+            ok = parseTime(5 + arg, to, true) && ok;
+        } else if(0==strncmp(arg, "--points=", 9)) {
+            maxPoints = std::max(1, atoi(9 + arg));
+        } else {
+            archivePath = arg;
         }
+    }
+    if(false==ok || 0==archivePath) {
+        fprintf(stderr, "usage: accuchek chart [--device=ID] [--from=TIME] [--to=TIME] [--points=N] ARCHIVE\n");
+        return 1;
+    }
 
-        // accuchek has two endpoints, anything with more or less is a bust
-        int altSettingIndex = 0;
-        auto altSetting = &(interface->altsetting[altSettingIndex]);
-        if(2!=altSetting->bNumEndpoints) {
-            LOG_NFO("not a match, too many endpoints to be an accuchek");
-            break;
-        }
+    ChartReader reader;
+    if(false==reader.open(archivePath)) {
+        return 1;
+    }
+    const char *level = 0;
+    std::vector<ChartPoint> points;
+    reader.points(allDevices, deviceId, from, to, maxPoints, points, level);
+
+    printf("{ \"level\":\"%s\", \"points\":[", level);
+    auto first = true;
+    for(auto &p:points) {
+        struct tm t;
+        time_t start = p.start;
+        localtime_r(&start, &t);
+        printf(
+            "%s\n    { \"start\":%11" PRId64 ", \"end\":%11" PRId64 ", \"timestamp\":\"%04d/%02d/%02d %02d:%02d\", \"count\":%5u, \"min\":%3d, \"max\":%3d, \"mean\":%7.2f }",
+            (first ? "" : ","),
+            p.start,
+            p.end,
+            1900 + t.tm_year,
+            1 + t.tm_mon,
+            t.tm_mday,
+            t.tm_hour,
+            t.tm_min,
+            p.count,
+            (int)p.min,
+            (int)p.max,
+            p.mean
+        );
+        first = false;
+    }
+    printf("\n] }\n");
+    return 0;
+}
 
-        // look for endpoints on altsetting that match our criteria
-        auto in = 0;    // 0 is an invalid endpoint
-        auto out = 0;   // 0 is an invalid endpoint
-        for(auto endPointIndex=0; endPointIndex<altSetting->bNumEndpoints; ++endPointIndex) {
-            // accuchek endpoints should both have a max packet size of 64
-            auto endPoint = &(altSetting->endpoint[endPointIndex]);
-            if(64==endPoint->wMaxPacketSize) {
-                // device must be non-interrupt type
-                auto attributes = (endPoint->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK);
-                auto isInterrupt = (LIBUSB_TRANSFER_TYPE_INTERRUPT==attributes);
-                if(false==isInterrupt) {
-                    // LIBUSB_ENDPOINT_IN means endpoint is used to transfer date from the device to the host
-                    auto isInput = (LIBUSB_ENDPOINT_IN & endPoint->bEndpointAddress);
-                    if(isInput) {
-                        in = endPoint->bEndpointAddress;
-                    } else {
-                        out = endPoint->bEndpointAddress;
-                    }
-                }
-            }
-        }
+// parse YYYY-MM into a month index
+static auto parseMonth(
+    const char *s,
+    int32_t &month
+) {
+    int y = 0, m = 0;
+    if(2!=sscanf(s, "%d-%d", &y, &m) || m<1 || 12<m) {
+        return false;
+    }
+    month = QuantileSketches::monthIndex(y, m);
+    return true;
+}
 
-        // skip devices that dont have at least one input and one output
-        auto ok = (0!=in && 0!=out);
-        if(false==ok) {
-            LOG_NFO("not a match, need at least one input endpoint and one output endpoint");
-            break;
+// accuchek agp ARCHIVE...: glucose percentiles by time of day, from quantile sketches
+static int agpCommand(
+    int argc,
+    char *argv[]
+) {
+    auto allDevices = true;
+    uint32_t deviceId = 0;
+    int32_t fromMonth = INT32_MIN;
+    int32_t toMonth = INT32_MAX;
+    auto ok = true;
+    std::vector<const char *> archivePaths;
+    for(int i=2; i<argc; ++i) {
+        auto arg = argv[i];
+        if(0==strncmp(arg, "--from=", 7)) {
+            ok = parseMonth(7 + arg, fromMonth) && ok;
+        } else if(0==strncmp(arg, "--to=", 5)) {
+            ok = parseMonth(5 + arg, toMonth) && ok;
+        } else if(0==strncmp(arg, "--device=", 9)) {
+            deviceId = strtoul(9 + arg, 0, 0);
+            allDevices = false;
+        } else {
+            archivePaths.push_back(arg);
         }
+    }
+    if(false==ok || 0==archivePaths.size()) {
+        fprintf(stderr, "usage: accuchek agp [--from=YYYY-MM] [--to=YYYY-MM] [--device=ID] ARCHIVE...\n");
+        return 1;
+    }
 
-        // we found a device seems to fit the bill, open it
-        LOG_NFO("found a usb device that looks good, checking further by opening it");
-        libusb_device_handle *devHandle = 0;
-        auto fail1 = libusb_open(dev, &devHandle);
-        if(fail1) {
-            LOG_WRN("libusb_open failed, giving up");
-            break;
+    // merge matching sketches of all archives, slot by slot
+    std::vector<TDigest> slots;
+    for(auto path:archivePaths) {
+        QuantileSketches sketches;
+        if(false==sketches.load(path)) {
+            return 1;
         }
+        sketches.slots(allDevices, deviceId, fromMonth, toMonth, slots);
+    }
 
-        // get device vendor
-        char vendor[512];
-        memset(vendor, 0, sizeof(vendor));
-        auto r0 = libusb_get_string_descriptor_ascii(
-            devHandle,
-            dsc.iManufacturer,
-            (uint8_t*)vendor,
-            (-1+sizeof(vendor))
-        );
-        if(r0<0) {
-            LOG_NFO("not a match, vendorId unreadable");
-            libusb_close(devHandle);
-            break;
+    auto first = true;
+    printf("[");
+    for(int i=0; i<QuantileSketches::kNbSlots; ++i) {
+        auto &digest = slots[i];
+        if(0==digest.count()) {
+            continue;
         }
-
-        // get product id
-        char product[512];
-        memset(product, 0, sizeof(product));
-        auto r1 = libusb_get_string_descriptor_ascii(
-            devHandle,
-            dsc.iProduct,
-            (uint8_t*)product,
-            (-1+sizeof(product))
+        auto minutes = (i * QuantileSketches::kSlotMinutes);
+        printf(
+            "%s\n    { \"time\":\"%02d:%02d\", \"count\":%7.0f, \"p5\":%6.1f, \"p25\":%6.1f, \"p50\":%6.1f, \"p75\":%6.1f, \"p95\":%6.1f }",
+            (first ? "" : ","),
+            minutes / 60,
+            minutes % 60,
+            digest.count(),
+            digest.quantile(0.05),
+            digest.quantile(0.25),
+            digest.quantile(0.50),
+            digest.quantile(0.75),
+            digest.quantile(0.95)
         );
-        if(r1<0) {
-            LOG_NFO("not a match, productId unreadable");
-            libusb_close(devHandle);
-            break;
-        }
-
-        auto isKeyValid = [&](
-          const std::string &key
-        ) {
-            static const auto valid = std::string("1");
-            return (0!=g_config.count(key) && valid==g_config[key]);
-        };
-
-        auto isDeviceValid = [&](
-          uint32_t vendorId,
-          uint32_t deviceId
-        ) {
-          char buffer[1024];
-          snprintf(
-            buffer,
-            sizeof(buffer),
-            "vendor_0x%04x_device_0x%04x",
-            vendorId,
-            deviceId
-          );
-          return isKeyValid(buffer);
-        };
-
-        // check that device and vendor is in list of known devices
-        if(isDeviceValid(dsc.idVendor, dsc.idProduct)) {
-            // we have a new valid device, add it to the list
-            LOG_NFO("========> found a matching USB device");
-            validDevices.emplace_back(
-                dev,
-                dsc.idVendor,
-                dsc.idProduct,
-                vendor,
-                product,
-                out,
-                in,
-                cfg,
-                altSetting
-            );
-        } else {
-            LOG_NFO(
-                "nope: looks like it, but thats not the one. this device has mfgr=%s device=%s\n",
-                vendor,
-                product
-            );
-        }
-        libusb_close(devHandle);
-    } while(0);
-
-    // free config data structure
-done:
-    libusb_free_config_descriptor(cfg);
+        first = false;
+    }
+    printf("\n]\n");
+    return 0;
 }
 
-// find all possible accuchek devices, pick one and download data from it
-static auto findAndOperateAccuChek(
-    libusb_context *libUSBContext,
-    int ix = -1
+// accuchek serve ARCHIVE SOCKET: download periodically, stream new readings to local subscribers
+static int serveCommand(
+    int argc,
+    char *argv[]
 ) {
-
-    // obtain a list of all USB devices in the system
-    libusb_device **devices = 0;
-    LOG_NFO("getting list of all USB devices in system from libusb");
-    auto count = libusb_get_device_list(libUSBContext, &devices);
-    LOG_NFO("found %d USB devices in system", (int)count);
-
-    // check them one by one and add to the list if specs are a match
-    std::vector<USBDevice> validDevices;
-    LOG_NFO("searching for valid accuchek devices");
-    for(int i=0; i<count; ++i) {
-        LOG_NFO("checking if device %d is an accuchek", (int)i);
-        addDeviceIfAccuChek(validDevices, devices[i]);
+    auto every = 60;
+    const char *socketPath = 0;
+    for(int i=2; i<argc; ++i) {
+        auto arg = argv[i];
+        if(0==strncmp(arg, "--every=", 8)) {
+            every = std::max(1, atoi(8 + arg));
+        } else if(0==strncmp(arg, "--ring=", 7)) {
+            g_ringPath = (7 + arg);
+        } else if(0==strncmp(arg, "--cache=", 8)) {
+            g_cacheDir = (8 + arg);
+        } else if(0==strncmp(arg, "--lock-dir=", 11)) {
+            g_lockDir = (11 + arg);
+        } else if(0==strncmp(arg, "--descriptors=", 14)) {
+            g_descriptorsPath = (14 + arg);
+        } else if(0==strncmp(arg, "--per-hub=", 10)) {
+            g_perHub = std::max(0, atoi(10 + arg));
+        } else if(0==strncmp(arg, "--durations=", 12)) {
+            g_durationsPath = (12 + arg);
+        } else if(0==strncmp(arg, "--journal=", 10)) {
+            g_journalDir = (10 + arg);
+        } else if(parseUploadOption(arg) || parseAlertOption(arg)) {
+            continue;
+        } else if(0==g_archivePath) {
+            g_archivePath = arg;
+        } else {
+            socketPath = arg;
+        }
     }
-
-    // clean up device list
-    libusb_free_device_list(devices, 1);
-
-    // if no devices found, bail
-    if(0==validDevices.size()) {
-        LOG_WRN("found no accuchek device whatsoever -- giving up");
-        exit(1);
+    if(0==g_archivePath || 0==socketPath) {
+        fprintf(stderr, "usage: accuchek serve [--every=SECONDS] [--cache=DIR] [--descriptors=FILE] [--lock-dir=DIR] [--per-hub=N] [--durations=FILE] [--journal=DIR] [--ring=FILE] [--upload=URL ...] [--alerts=FILE ...] ARCHIVE SOCKET\n");
+        return 1;
     }
 
-    // make some noise
-    LOG_NFO(
-        "found altogether %d accuchek devices",
-        (int)validDevices.size()
-    );
+    // must be root
+    auto euid = geteuid();
+    LOG_FTL(0!=euid, "must be root, euid is %d, bailing", euid);
 
-    // make sure we user referes to a valid device
-    if(int(validDevices.size())<=int(ix)) {
-        LOG_WRN(
-            "user selected device %d but only %d devices were found -- aborting",
-            ix,
-            (int)validDevices.size()
+    // one loop runs it all: subscribers, meters and the polling timer
+    EventLoop loop;
+
+    // subscribers can ask for anything already in the archive
+    SampleServer server;
+    std::vector<ArchiveRecord> history;
+    ArchiveReader reader;
+    if(reader.open(g_archivePath)) {
+        reader.query(
+            INT64_MIN,
+            INT64_MAX,
+            [&](const ArchiveRecord *r, size_t n) {
+                history.insert(history.end(), r, n + r);
+            }
         );
-        exit(1);
+        reader.close();
+    }
+    server.preload(std::move(history));
+    if(false==server.start(socketPath, &loop)) {
+        return 1;
+    }
+    g_serving = true;
+    if(0!=g_ringPath && false==g_ring.open(g_ringPath)) {
+        return 1;
+    }
+    if(false==openUploader() || false==openAlerts()) {
+        return 1;
     }
 
-    // select a specific device (first seen or as specified by user)
-    auto selectedIndex = std::max(0, ix);
-    auto &selectedDevice = validDevices[selectedIndex];
-
-    // show details of selected device as gathered from libusb
-    char buf[256];
-    sprintf(
-        buf,
-        "selecting accuchek device #%d:",
-        (int)selectedIndex
-    );
-    selectedDevice.show(buf);
-
-    // talk to device to download data from it
-    operateDevice(selectedDevice);
-}
-
-// open libusb, return handle
-static auto openLibUSB() {
+    // what the archive didn't know yet is news
+    auto verbose = (0!=getenv("ACCUCHEK_DBG"));
+    auto finish = [&](
+        Download &download,
+        int err
+    ) {
+        if(ACCUCHEK_OK!=err) {
+            LOG_WRN("download failed: %s", accuchek_strerror(err));
+            return false;
+        }
+        if(false==Archive::append(g_archivePath, download.records, queueUpload)) {
+            LOG_WRN("failed to update archive %s", g_archivePath);
+            return false;
+        }
+        server.publish(download.records.data(), download.records.size());
+        g_ring.publish(download.records.data(), download.records.size());
+        for(auto &r:download.records) {
+            alertEngine(r.deviceId).silence(r.epoch);
+        }
+        return true;
+    };
 
-    LOG_NFO("opening libusb");
+    // meters found once get found again without reading their descriptors, and scheduled by how long they took
+    accuchek_set_descriptor_cache(g_descriptorsPath);
+    accuchek_set_durations(g_durationsPath);
+
+    // poll for meters, downloading from all of them as hubs allow, then wait for the next round
+    struct {
+        AccuChekSession *session;
+        std::vector<Download> downloads;
+        std::vector<AccuChekCallbacks> callbacks;
+    } round = { 0, {}, {} };
+    std::function<void()> poll = [&]() {
+        round.session = accuchek_open("config.txt", verbose);
+        if(0==round.session) {
+            loop.after(1000ll*every, poll);
+            return;
+        }
+        accuchek_set_segment_cache(round.session, g_cacheDir);
+        accuchek_set_lock_dir(round.session, g_lockDir);
+        accuchek_set_per_hub(round.session, g_perHub);
+        accuchek_set_journal(round.session, g_journalDir);
+
+        // whatever a previous process got but never archived, the archive keeps what's new of it
+        Download recovered{ 0, {} };
+        AccuChekCallbacks recovery = { &recovered, 0, collectSamples, setDevice, 0 };
+        if(0<accuchek_recover(round.session, &recovery)) {
+            finish(recovered, ACCUCHEK_OK);
+        }
+        round.downloads.assign(accuchek_device_count(round.session), Download{ 0, {} });
+        round.callbacks.clear();
+        for(auto &download:round.downloads) {
+            round.callbacks.push_back({ &download, 0, collectSamples, setDevice, reportProgress });
+        }
 
-    // init libusb
-    libusb_context *libUSBContext = 0;
-    auto fail = libusb_init(&libUSBContext);
-    if(0!=fail || 0==libUSBContext) {
-        LOG_WRN("libusb init failure");
-        exit (1);
-    }
-
-    // turn libusb debug on
-    #if 0
-        #if 0
-            enum libusb_log_level {
-                LIBUSB_LOG_LEVEL_NONE = 0,
-                LIBUSB_LOG_LEVEL_ERROR = 1,
-                LIBUSB_LOG_LEVEL_WARNING = 2,
-                LIBUSB_LOG_LEVEL_INFO = 3,
-                LIBUSB_LOG_LEVEL_DEBUG = 4,
-            };
-            enum libusb_option {
-                    LIBUSB_OPTION_LOG_LEVEL = 0,
-                    LIBUSB_OPTION_USE_USBDK = 1,
-            };
-        #endif
-        libusb_set_option(
-            libUSBContext,
-            LIBUSB_OPTION_LOG_LEVEL,
-            LIBUSB_LOG_LEVEL_DEBUG
+        // the round is over once every download is
+        accuchek_download_all_start(
+            round.session,
+            round.callbacks.data(),
+            loop,
+            [&](int index, int err) {
+                if(finish(round.downloads[index], err)) {
+                    accuchek_commit_segment_cache(round.session, index);
+                }
+            },
+            [&]() {
+                accuchek_close(round.session);
+                round.session = 0;
+                loop.after(1000ll*every, poll);
+            }
         );
-    #endif
-
-    LOG_NFO("libusb opened OK");
-    return libUSBContext;
+    };
+    poll();
+    loop.run();
+    return 0;
 }
 
-// close libusb
-static auto closeLibUSB(
-    libusb_context *libUSBContext
-) {
-    LOG_NFO("closing libusb");
-    libusb_exit(libUSBContext);
-}
+// subcommands, anything else on the command line means "download"
+static const struct {
+    const char *name;
+    int (*fn)(int argc, char *argv[]);
+} kCommands[] = {
+    { "pack",   packCommand   },
+    { "unpack", unpackCommand },
+    { "import", importCommand },
+    { "merge",  mergeCommand  },
+    { "report", reportCommand },
+    { "agp",    agpCommand    },
+    { "query",  queryCommand  },
+    { "chart",  chartCommand  },
+    { "serve",  serveCommand  },
+};
 
 // entry point
 int main(
@@ -1581,15 +1067,71 @@ int main(
     char *argv[]
 ) {
 
+    // run subcommand if asked to
+    if(1<argc) {
+        for(auto &command:kCommands) {
+            if(0==strcmp(argv[1], command.name)) {
+                gQuiet = (0==getenv("ACCUCHEK_DBG"));
+                return command.fn(argc, argv);
+            }
+        }
+    }
+
+    // parse command line: options, then optional device index
+    auto ix = -1;
+    for(int i=1; i<argc; ++i) {
+        auto arg = argv[i];
+        if(0==strncmp(arg, "--archive=", 10)) {
+            g_archivePath = (10 + arg);
+        } else if(0==strncmp(arg, "--packed=", 9)) {
+            g_packedPath = (9 + arg);
+        } else if(0==strncmp(arg, "--ring=", 7)) {
+            g_ringPath = (7 + arg);
+        } else if(0==strncmp(arg, "--sink=", 7)) {
+            g_sinkSpecs.push_back(7 + arg);
+        } else if(0==strncmp(arg, "--progress=", 11)) {
+            g_progress = fopen(11 + arg, "w");
+            if(0==g_progress) {
+                fprintf(stderr, "failed to open %s\n", 11 + arg);
+                exit(1);
+            }
+        } else if(0==strncmp(arg, "--capture=", 10)) {
+            g_capturePath = (10 + arg);
+        } else if(0==strncmp(arg, "--port=", 7)) {
+            g_port = (7 + arg);
+        } else if(0==strncmp(arg, "--lock-dir=", 11)) {
+            g_lockDir = (11 + arg);
+        } else if(0==strncmp(arg, "--descriptors=", 14)) {
+            g_descriptorsPath = (14 + arg);
+        } else if(0==strcmp(arg, "--all")) {
+            g_all = true;
+        } else if(0==strncmp(arg, "--per-hub=", 10)) {
+            g_perHub = std::max(0, atoi(10 + arg));
+        } else if(0==strncmp(arg, "--durations=", 12)) {
+            g_durationsPath = (12 + arg);
+        } else if(0==strncmp(arg, "--journal=", 10)) {
+            g_journalDir = (10 + arg);
+        } else if(0==strncmp(arg, "--pipeline=", 11)) {
+            g_pipelineDepth = std::max(1, atoi(11 + arg));
+        } else if(0==strncmp(arg, "--cache=", 8)) {
+            g_cacheDir = (8 + arg);
+        } else if(parseUploadOption(arg) || parseAlertOption(arg)) {
+            continue;
+        } else if(0==strncmp(arg, "--", 2)) {
+            fprintf(stderr, "unknown option %s\n", arg);
+            exit(1);
+        } else {
+            ix = atoi(arg);
+        }
+    }
+
     // must be root
     auto euid = geteuid();
     LOG_FTL(0!=euid, "must be root, euid is %d, bailing", euid);
 
-    // load config file
-    loadConfig();
-
     // be silent unless asked to talk
-    if(0!=getenv("ACCUCHEK_DBG")) {
+    auto verbose = (0!=getenv("ACCUCHEK_DBG"));
+    if(verbose) {
         // unbuffer stdout/stderr
         setvbuf(stdout, 0, _IONBF, 0);
         setvbuf(stderr, 0, _IONBF, 0);
@@ -1605,25 +1147,80 @@ int main(
 
         // fdopen dup'd stdout
         g_output = fdopen(newFD, "wb");
-        fprintf(g_output, "[");
+    }
+
+    // outputs, the classic JSON on stdout unless told otherwise
+    if(0==g_sinkSpecs.size()) {
+        g_sinkSpecs.push_back("json:-");
+    }
+    for(auto spec:g_sinkSpecs) {
+        auto sink = SampleSink::create(spec, g_output);
+        if(0==sink) {
+            exit(1);
+        }
+        g_sinks.emplace_back(sink);
     }
 
     // make some noise
     LOG_NFO("starting");
 
-    // open libusb
-    auto libUSBContext = openLibUSB();
+    // shared memory readers, if any
+    if(0!=g_ringPath && false==g_ring.open(g_ringPath)) {
+        LOG_WRN("failed to open ring %s -- giving up", g_ringPath);
+        exit(1);
+    }
+    if(false==openUploader()) {
+        LOG_WRN("failed to start uploader -- giving up");
+        exit(1);
+    }
+    if(false==openAlerts()) {
+        LOG_WRN("failed to set up alerts -- giving up");
+        exit(1);
+    }
+
+    // open libusb, load config file and scan for devices
+    accuchek_set_descriptor_cache(g_descriptorsPath);
+    accuchek_set_durations(g_durationsPath);
+    auto session = accuchek_open("config.txt", verbose);
+    if(0==session) {
+        LOG_WRN("libusb init failure");
+        exit(1);
+    }
+
+    accuchek_set_pipeline(session, g_pipelineDepth);
+    accuchek_set_segment_cache(session, g_cacheDir);
+    accuchek_set_lock_dir(session, g_lockDir);
+    accuchek_set_per_hub(session, g_perHub);
+    accuchek_set_journal(session, g_journalDir);
+    if(0!=g_capturePath && ACCUCHEK_OK!=accuchek_set_capture(session, g_capturePath)) {
+        LOG_WRN("failed to create capture %s -- giving up", g_capturePath);
+        exit(1);
+    }
 
     // find and talk to one accuchek device
     findAndOperateAccuChek(
-        libUSBContext,
-        (1<argc ? atoi(argv[1]) : -1)
+        session,
+        ix
     );
 
-    // clean up and bail
-    fprintf(g_output, "\n]\n");
-    closeLibUSB(libUSBContext);
+    // publish outputs, journals can go once they're out
+    auto published = true;
+    for(auto &sink:g_sinks) {
+        if(false==sink->finish()) {
+            LOG_WRN("failed to finish writing a sink");
+            published = false;
+        }
+    }
+    if(false==published) {
+        LOG_WRN("keeping journals and segment caches for the next run -- giving up");
+        exit(1);
+    }
+
+    // everything downloaded is out: next time, segments seen this time can be skipped
+    if(ACCUCHEK_OK!=accuchek_commit_segment_cache(session, -1)) {
+        LOG_WRN("failed to update segment cache, next download will be in full");
+    }
+    accuchek_close(session);
     LOG_NFO("done");
     return 0;
 }
-
@@ -0,0 +1,168 @@
+/*
+
+     k-way merge of sorted sample streams, see merge.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <pool.h>
+#include <merge.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+LoserTree::LoserTree(
+    const std::vector<SampleRun> &_runs
+)
+    :   runs(_runs),
+        tree(std::max(size_t(1), _runs.size()), -1)
+{
+    // empty runs still get a leaf, they just always lose
+    if(0==runs.size()) {
+        runs.push_back({ 0, 0 });
+    }
+
+    // feed leaves in one by one: each parks at the first free node on
+    // its way up, the last one to arrive makes it all the way to the top
+    auto k = int(runs.size());
+    for(int leaf=k-1; 0<=leaf; --leaf) {
+        auto winner = leaf;
+        auto node = ((leaf + k) >> 1);
+        for(; 0<node; node>>=1) {
+            if(tree[node]<0) {
+                tree[node] = winner;
+                break;
+            }
+            if(beats(tree[node], winner)) {
+                std::swap(tree[node], winner);
+            }
+        }
+        if(0==node) {
+            tree[0] = winner;
+        }
+    }
+}
+
+bool LoserTree::beats(
+    int a,
+    int b
+) const {
+    // exhausted runs lose against everything, ties go to the lower run index
+    auto &ra = runs[a];
+    auto &rb = runs[b];
+    if(0==ra.count) return false;
+    if(0==rb.count) return true;
+    if(*ra.first<*rb.first) return true;
+    if(*rb.first<*ra.first) return false;
+    return (a<b);
+}
+
+void LoserTree::replay(
+    int leaf
+) {
+    auto k = int(runs.size());
+    auto winner = leaf;
+    for(auto node=((leaf + k) >> 1); 0<node; node>>=1) {
+        if(beats(tree[node], winner)) {
+            std::swap(tree[node], winner);
+        }
+    }
+    tree[0] = winner;
+}
+
+const ArchiveRecord *LoserTree::top() const {
+    auto &run = runs[tree[0]];
+    return (0<run.count ? run.first : 0);
+}
+
+void LoserTree::pop() {
+    auto leaf = tree[0];
+    auto &run = runs[leaf];
+    if(0<run.count) {
+        ++run.first;
+        --run.count;
+    }
+    replay(leaf);
+}
+
+size_t Merger::merge(
+    const std::vector<SampleRun> &runs,
+    std::vector<ArchiveRecord> &out
+) {
+    size_t total = 0;
+    for(auto &run:runs) {
+        total += run.count;
+    }
+    out.reserve(out.size() + total);
+
+    // pop records in order, skipping exact repeats of the last one out
+    auto base = out.size();
+    LoserTree tree(runs);
+    while(auto r = tree.top()) {
+        if(base==out.size() || !(out.back()==*r)) {
+            out.push_back(*r);
+        }
+        tree.pop();
+    }
+    return (total - (out.size() - base));
+}
+
+bool Merger::mergeArchives(
+    const std::vector<Job> &jobs,
+    int nbThreads
+) {
+    struct timeval t0, t1;
+    gettimeofday(&t0, 0);
+
+    // one task per patient
+    std::vector<char> failed(jobs.size(), 0);
+    ThreadPool pool(nbThreads);
+    for(size_t i=0; i<jobs.size(); ++i) {
+        pool.submit([&, i]() {
+            auto &job = jobs[i];
+
+            // every block of every input is a sorted run
+            std::vector<ArchiveReader> readers(job.inputs.size());
+            std::vector<SampleRun> runs;
+            for(size_t j=0; j<job.inputs.size(); ++j) {
+                if(false==readers[j].open(job.inputs[j])) {
+                    LOG_WRN("failed to open archive %s", job.inputs[j]);
+                    failed[i] = 1;
+                    return;
+                }
+                for(auto &block:readers[j].blocks()) {
+                    runs.push_back({ block.records, block.count });
+                }
+            }
+
+            // merge, then write out canonical archive
+            std::vector<ArchiveRecord> merged;
+            auto duplicates = merge(runs, merged);
+            failed[i] = !Archive::write(job.output, merged);
+            LOG_NFO(
+                "merged %d runs into %s: %d records, %d duplicates dropped",
+                (int)runs.size(),
+                job.output,
+                (int)merged.size(),
+                (int)duplicates
+            );
+        });
+    }
+    pool.wait();
+
+    gettimeofday(&t1, 0);
+    fprintf(
+        stderr,
+        "merged %d archives in %.3f s\n",
+        (int)jobs.size(),
+        (t1.tv_sec - t0.tv_sec) + 1e-6*(t1.tv_usec - t0.tv_usec)
+    );
+
+    for(auto f:failed) {
+        if(f) {
+            return false;
+        }
+    }
+    return true;
+}
+
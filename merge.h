@@ -0,0 +1,68 @@
+#ifndef __MERGE_H__
+    #define __MERGE_H__
+
+    /*
+
+         k-way merge of sorted sample streams
+
+         every run of a download, every device and every block of an
+         archive is a sorted run of records. merging them with a loser
+         tree costs log2(k) comparisons per record, and exact duplicates
+         (the same reading downloaded twice) come out next to each
+         other, so they are dropped on the fly.
+
+     */
+
+    #include <vector>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <archive.h>
+
+    // a sorted run of records
+    struct SampleRun {
+        const ArchiveRecord *first;
+        size_t              count;
+    };
+
+    // loser tree over k sorted runs
+    struct LoserTree {
+
+        LoserTree(const std::vector<SampleRun> &runs);
+
+        // smallest record not yet popped, 0 when all runs are exhausted
+        const ArchiveRecord *top() const;
+
+        // move past top()
+        void pop();
+
+    private:
+        bool beats(int a, int b) const;
+        void replay(int leaf);
+
+        std::vector<SampleRun> runs;
+        std::vector<int> tree;  // tree[0] is the winner, tree[1..k-1] the losers
+    };
+
+    struct Merger {
+
+        // merge sorted runs into out, dropping exact duplicates, returns number of duplicates dropped
+        static size_t merge(
+            const std::vector<SampleRun> &runs,
+            std::vector<ArchiveRecord> &out
+        );
+
+        // one merge job: several archives (runs, devices, ...) of one patient into one
+        struct Job {
+            const char *output = 0;
+            std::vector<const char *> inputs;
+        };
+
+        // run merge jobs in parallel, each output archive is written atomically
+        static bool mergeArchives(
+            const std::vector<Job> &jobs,
+            int nbThreads = 0
+        );
+    };
+
+#endif // __MERGE_H__
+
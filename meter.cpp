@@ -0,0 +1,934 @@
+/*
+
+     accuchek protocol as a coroutine, and simulated meter, see meter.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <apdu.h>
+#include <time.h>
+#include <cache.h>
+#include <journal.h>
+#include <meter.h>
+#include <pipeline.h>
+#include <stdio.h>
+#include <string.h>
+#include <utility>
+#include <algorithm>
+#include <inttypes.h>
+
+// canonical hexdump of a buffer with header
+static auto hexDumpWithHeader(
+    const char *bufferName,
+    const uint8_t *buffer,
+    uint32_t size
+) {
+    if(gQuiet) {
+        return;
+    }
+    LOG_NFO(
+        "hexdump of buffer:\n\nBUFFER START \"%s\" size=%d (0x%x) ===============================================",
+        bufferName,
+        (int)size,
+        (int)size
+    );
+    hexDump(stdout, buffer, size);
+    printf("BUFFER END ============================================================================================\n\n");
+}
+
+/*
+   much of what follows was directly reverse-engineered from the highly
+   unportable (only works in effing Chrome) javascript code found here:
+
+       https://github.com/tidepool-org/uploader/tree/master/lib/drivers/roche
+
+   and backported to raw libusb. The original author of the tidepool code
+   likely had access to a manual documenting the protocol.
+
+*/
+
+// find object of a given "class" in a config info response buffer
+static std::pair<const uint8_t *, uint16_t> getObj(
+    const uint8_t *buffer,
+    uint16_t objRequestedClass,
+    uint16_t &_objHandle
+) {
+    auto offset = size_t(24);
+    auto count = be16r(buffer, offset);
+    auto dummy = be16r(buffer, offset);
+    (void)dummy;
+    LOG_NFO("got %d object in config info response", (int)count);
+    for(int i=0; i<count; ++i) {
+        auto objClass = be16r(buffer, offset);
+        auto objHandle = be16r(buffer, offset);
+        auto objAttrCount = be16r(buffer, offset);
+        auto objSize = be16r(buffer, offset);
+        if(0) {
+            LOG_NFO(
+                "obj %d, size=%d, class=%d (%s), handle=%d",
+                (int)i,
+                (int)objSize,
+                (int)objClass,
+                mdcName(objClass),
+                (int)objHandle
+            );
+            hexDump(stdout, (offset + buffer), objSize);
+        }
+        if(objRequestedClass==objClass) {
+            _objHandle = objHandle;
+            return std::pair(
+                (offset + buffer),
+                objAttrCount
+            );
+        }
+        offset += objSize;
+    }
+    return std::pair((const uint8_t*)0, 0);
+}
+
+// find attribute of a given "class" in a response buffer object
+static std::pair<const uint8_t *, uint16_t> getAttr(
+    const uint8_t *buffer,
+    uint16_t attributeCount,
+    uint16_t attrRequestedClass
+) {
+
+    LOG_NFO(
+        "looking for attribute of class %d among %d attributes",
+        (int)attrRequestedClass,
+        (int)attributeCount
+    );
+
+    auto offset = size_t(0);
+    for(int i=0; i<attributeCount; ++i) {
+        auto attrClass = be16r(buffer, offset);
+        auto attrSize = be16r(buffer, offset);
+        if(0) {
+            LOG_NFO(
+                "attr %d, size=%d, class=%d (%s)",
+                (int)i,
+                (int)attrSize,
+                (int)attrClass,
+                mdcName(attrClass)
+            );
+            hexDump(stdout, (offset + buffer), attrSize);
+        }
+        if(attrRequestedClass==attrClass) {
+            return std::pair(
+                (offset + buffer),
+                attrSize
+            );
+        }
+        offset += attrSize;
+    }
+    return std::pair((const uint8_t*)0, 0);
+}
+
+MeterSession::MeterSession(
+    const AccuChekCallbacks *_callbacks,
+    SegmentPipeline *_pipeline,
+    SegmentCache *_cache,
+    TransferBuffers *_buffers,
+    SegmentJournal *_journal
+)
+    :   callbacks(_callbacks),
+        pipeline(_pipeline),
+        cache(_cache),
+        buffers(_buffers ? _buffers : &TransferBuffers::heap()),
+        journal(_journal),
+        phase(2),   // phase 1 is the control transfer, up to the driver
+        error(ACCUCHEK_OK),
+        transferred(0),
+        length(0),
+        direction(kReceive),
+        name("none"),
+        data(buffers->get()),
+        protocol(run())
+{
+    memset(&progress, 0, sizeof(progress));
+    memset(&t0, 0, sizeof(t0));
+    progress.eta = -1;
+
+    // runs up to the first transfer
+    protocol.handle.resume();
+}
+
+MeterSession::~MeterSession() {
+    buffers->put(data);
+}
+
+MeterSession::Step MeterSession::step() const {
+    return (protocol.handle.done() ? kDone : direction);
+}
+
+const char *MeterSession::message() const {
+    return (protocol.handle.done() ? "done" : name);
+}
+
+void MeterSession::advance(
+    int n
+) {
+    if(protocol.handle.done()) {
+        return;
+    }
+
+    // transfer went wrong
+    auto receiving = (kReceive==direction);
+    if(n<0 || (false==receiving && size_t(n)!=length)) {
+        LOG_WRN("failed to %s message %s -- giving up", (receiving ? "receive" : "send"), name);
+        error = ACCUCHEK_ERR_TRANSFER;
+        n = -1;
+    } else if(receiving) {
+        LOG_NFO("successfully read message \"%s\" from device", name);
+        hexDumpWithHeader(name, data, n);
+        ++phase;
+    } else {
+        LOG_NFO("successfully wrote message %s, size=%d (0x%x):", name, n, n);
+        ++phase;
+    }
+
+    // back into the protocol, right after the co_await that waited for this
+    transferred = n;
+    protocol.handle.resume();
+}
+
+MeterSession::Transfer MeterSession::receive(
+    const char *message,
+    size_t capacity
+) {
+    name = message;
+    direction = kReceive;
+    length = capacity;
+    if(false==gQuiet) {
+        printf("\n");
+    }
+    LOG_NFO("phase %d: receiving message %s", phase, name);
+    return Transfer{ *this };
+}
+
+MeterSession::Transfer MeterSession::send(
+    const char *message,
+    const uint8_t *end
+) {
+    name = message;
+    direction = kSend;
+    length = (end - data);
+    if(false==gQuiet) {
+        printf("\n");
+    }
+    LOG_NFO("phase %d: sending message %s", phase, name);
+    hexDumpWithHeader(name, data, length);
+    return Transfer{ *this };
+}
+
+uint8_t *MeterSession::packet() {
+    memset(data, 0, kBufferSize);
+    return data;
+}
+
+uint16_t MeterSession::invokeId() const {
+    size_t offset = 6;
+    auto id = be16r(data, offset);
+    LOG_NFO(
+        "invokeId after phase %d is: %d",
+        (int)phase,
+        (int)id
+    );
+    return id;
+}
+
+MeterSession::Protocol MeterSession::run() {
+
+    // the device speaks first: fish out its system id (EUI-64) from the association request
+    auto n = co_await receive("pairing request", 64);
+    if(n<0) {
+        co_return;
+    }
+    {
+        uint64_t systemId = 0;
+        size_t o = 34;
+        if(44<=n && 8==be16r(data, o)) {
+            auto hi = be32r(data, o);
+            auto lo = be32r(data, o);
+            systemId = ((uint64_t(hi) << 32) | lo);
+        }
+        LOG_NFO("device system id is 0x%016" PRIx64, systemId);
+        if(callbacks && callbacks->onAssociation) {
+            callbacks->onAssociation(callbacks->user, systemId);
+        }
+        if(0!=cache) {
+            cache->open(systemId);
+        }
+        if(0!=journal) {
+            journal->open(systemId);
+        }
+    }
+
+    // the message the device expects
+    auto p = packet();
+    be16(p, kAPDU_TYPE_ASSOCIATION_RESPONSE); // msg type
+    be16(p,         44);                      // length (p, excludes initial 4 bytes)
+    be16(p,     0x0003);                      // accepted-unknown-config
+    be16(p,      20601);                      // data-proto-id
+    be16(p,         38);                      // data-proto-info length
+    be32(p, 0x80000002);                      // protocolVersion
+    be16(p,     0x8000);                      // encoding-rules = MDER
+    be32(p, 0x80000000);                      // nomenclatureVersion
+    be32(p,          0);                      // functionalUnits = normal association
+    be32(p, 0x80000000);                      // systemType = sys-type-manager
+    be16(p,          8);                      // system-id length
+    be32(p, 0x12345678);                      // system-id high
+    be32(p, 0x00000000);                      // zero
+    be32(p, 0x00000000);                      // zero
+    be32(p, 0x00000000);                      // zero
+    be16(p,     0x0000);                      // zero
+    if(co_await send("pairing confirmation", p)<0) {
+        co_return;
+    }
+
+    // where the samples are, and how many there are
+    if(co_await receive("config info", kBufferSize)<0) {
+        co_return;
+    }
+    auto invoke = invokeId();
+    uint16_t pmStoreHandle = 0;
+    error = parseConfig(pmStoreHandle);
+    if(ACCUCHEK_OK!=error) {
+        co_return;
+    }
+
+    // config well received
+    p = packet();
+    be16(p, kAPDU_TYPE_PRESENTATION_APDU);               // msg type
+    be16(p,     22);                                     // length
+    be16(p,     20);                                     // octet stringlength
+    be16(p, invoke);                                     // invoke-id read from config
+    be16(p, kDATA_ADPU_RESPONSE_CONFIRMED_EVENT_REPORT); //
+    be16(p,     14);                                     // length
+    be16(p,      0);                                     // obj-handle = 0
+    be32(p,      0);                                     // currentTime = 0
+    be16(p, kEVENT_TYPE_MDC_NOTI_CONFIG);                // event-type
+    be16(p,      4);                                     // length
+    be16(p, 0x4000);                                     // config-report-id = extended-config-start
+    be16(p,      0);                                     // config-result = accepted-config
+    if(co_await send("config received confirmation", p)<0) {
+        co_return;
+    }
+
+    // MDS attributes
+    p = packet();
+    be16(p, kAPDU_TYPE_PRESENTATION_APDU); // msg type
+    be16(p,     14);                       // length
+    be16(p,     12);                       // octet stringlength
+    be16(p, (1+invoke));                   // invoke-id from config
+    be16(p, kDATA_ADPU_INVOKE_GET);        //
+    be16(p,      6);                       // length
+    be16(p,      0);                       // obj-handle = 0
+    be32(p,      0);                       // currentTime = 0
+    if(co_await send("MDS attribute request", p)<0) {
+        co_return;
+    }
+
+    // check for abort
+    if(co_await receive("MDS attribute answer", kBufferSize)<0) {
+        co_return;
+    }
+    invoke = invokeId();
+    {
+        size_t o = 0;
+        auto retCode = be16r(data, o);
+        if(kAPDU_TYPE_ASSOCIATION_ABORT==retCode) {
+            LOG_WRN("received association abort request -- giving up");
+            error = ACCUCHEK_ERR_ABORTED;
+            co_return;
+        }
+    }
+
+    // segment info
+    p = packet();
+    be16(p, kAPDU_TYPE_PRESENTATION_APDU); // msg type
+    be16(p,     20);                       // length
+    be16(p,     18);                       // octet stringlength
+    be16(p, (1+invoke));                   // invoke-id from prev answer
+    be16(p, kDATA_ADPU_INVOKE_CONFIRMED_ACTION);
+    be16(p,     12);                       // length of what follows (could also be zero)
+    be16(p, pmStoreHandle);                // store handle
+    be16(p, kACTION_TYPE_MDC_ACT_SEG_GET_INFO);
+    be16(p,      6);                       // length
+    be16(p,      1);                       // all segments
+    be16(p,      2);                       // length
+    be16(p,      0);                       // something
+    if(co_await send("action request", p)<0) {
+        co_return;
+    }
+    if(co_await receive("action request response", kBufferSize)<0) {
+        co_return;
+    }
+    invoke = invokeId();
+
+    // ----> here, the original js code sets the device time ... skip for now
+
+    // start sending data segments
+    p = packet();
+    be16(p, kAPDU_TYPE_PRESENTATION_APDU); // msg type
+    be16(p,     16);                       // length
+    be16(p,     14);                       // octet stringlength
+    be16(p, (1+invoke));                   // invoke-id from prev answer
+    be16(p, kDATA_ADPU_INVOKE_CONFIRMED_ACTION);
+    be16(p,      8);                       // length of what follows (could also be zero)
+    be16(p, pmStoreHandle);                // store handle
+    be16(p, kACTION_TYPE_MDC_ACT_SEG_TRIG_XFER);
+    be16(p,      2);                       // length
+    be16(p,      0);                       // segment
+    if(co_await send("request segments", p)<0) {
+        co_return;
+    }
+
+    // segment stream header answer
+    n = co_await receive("segment headers", kBufferSize);
+    if(n<0) {
+        co_return;
+    }
+    invoke = invokeId();
+    error = parseSegmentHeaders(n);
+    if(ACCUCHEK_OK!=error) {
+        co_return;
+    }
+
+    // segments come next: sized up front from the usage count so
+    // nothing reallocates mid-transfer
+    batch.reserve(progress.expected);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    reportProgress();
+
+    // data segments, each one acknowledged, until the device flags the last one
+    auto lastSegment = false;
+    while(false==lastSegment) {
+        n = co_await receive("data segment", kBufferSize);
+        if(n<0) {
+            co_return;
+        }
+
+        // what we need to send back in the "confirm" message
+        lastSegment = (0!=(0x40 & data[32]));
+        invoke = invokeId();
+        size_t o = 22;
+        auto ackHi = be32r(data, o);
+        auto ackLo = be32r(data, o);
+        auto ackCount = be16r(data, o);
+        parseSegment(n);
+
+        // data segment received
+        p = packet();
+        be16(p, kAPDU_TYPE_PRESENTATION_APDU); // msg type
+        be16(p,     30);                       // length
+        be16(p,     28);                       // octet stringlength
+        be16(p, invoke);                       // invoke-id from prev answer
+        be16(p, kDATA_ADPU_RESPONSE_CONFIRMED_EVENT_REPORT);
+        be16(p,     22);                       // length of what follows (could also be zero)
+        be16(p, pmStoreHandle);                // store handle
+        be32(p, 0xFFFFFFFF);                   // relative time
+        be16(p, kEVENT_TYPE_MDC_NOTI_SEGMENT_DATA);
+        be16(p,     12);
+        be32(p, ackHi);
+        be32(p, ackLo);
+        be16(p, ackCount);
+        be16(p, 0x0080);
+        if(co_await send("data segment received ACK", p)<0) {
+            co_return;
+        }
+    }
+
+    // disconnect cleanly from device
+    p = packet();
+    be16(p, kAPDU_TYPE_ASSOCIATION_RELEASE_REQUEST); // msg type
+    be16(p,      2);                       // length = 2
+    be16(p, 0x0000);                       // normal release
+    if(co_await send("release request", p)<0) {
+        co_return;
+    }
+    co_await receive("release confirmation", kBufferSize);
+}
+
+int MeterSession::parseConfig(
+    uint16_t &pmStoreHandle
+) {
+    LOG_NFO("parsing config info response");
+    auto pmStore = getObj(data, kMDC_MOC_VMO_PMSTORE, pmStoreHandle);
+    if(0==pmStore.first) {
+        LOG_WRN("failed to parse config buffer for pmStore -- giving up");
+        return ACCUCHEK_ERR_PROTOCOL;
+    }
+    LOG_NFO(
+        "found pmStore of size %d, handle = %d",
+        (int)pmStore.second,
+        (int)pmStoreHandle
+    );
+
+    auto nbSegments = getAttr(
+        pmStore.first,
+        pmStore.second,
+        kMDC_ATTR_NUM_SEG
+    );
+    if(0==nbSegments.first) {
+        LOG_WRN("failed to parse pmStore for nbSegments -- giving up");
+        return ACCUCHEK_ERR_PROTOCOL;
+    }
+    LOG_NFO("successfully found \"nbSegments\" oject");
+    size_t o = 0;
+    auto nbSegs = be16r(nbSegments.first, o);
+    LOG_NFO("data is split into %d segments", (int)nbSegs);
+
+    // how many samples the store holds and can hold, so we know what to expect
+    auto getCount = [&](
+        uint16_t attrClass
+    ) {
+        auto attr = getAttr(pmStore.first, pmStore.second, attrClass);
+        size_t o = 0;
+        if(0==attr.first || attr.second<2) {
+            return uint32_t(0);
+        }
+        return (4<=attr.second ? be32r(attr.first, o) : uint32_t(be16r(attr.first, o)));
+    };
+    progress.expected = getCount(kMDC_ATTR_METRIC_STORE_USAGE_CNT);
+    progress.capacity = getCount(kMDC_ATTR_METRIC_STORE_CAPAC_CNT);
+    LOG_NFO(
+        "store holds %d samples, room for %d",
+        (int)progress.expected,
+        (int)progress.capacity
+    );
+    return ACCUCHEK_OK;
+}
+
+int MeterSession::parseSegmentHeaders(
+    size_t bytesRead
+) {
+    uint16_t dataResponse = 0;
+    if(22<=bytesRead) {
+        size_t o = 20;
+        dataResponse = be16r(data, o);
+    }
+
+    if(22==bytesRead && 0!=dataResponse) {
+        if(3==dataResponse) {
+            LOG_WRN("empty data segment -- giving up");
+            return ACCUCHEK_ERR_EMPTY;
+        }
+        LOG_NFO(
+            "error retrieving data, code = %d",
+            (int)dataResponse
+        );
+        return ACCUCHEK_ERR_PROTOCOL;
+    }
+
+    uint16_t headerValue = -1;
+    if(16<=bytesRead) {
+        size_t o = 14;
+        headerValue = be16r(data, o);
+    }
+
+    if(
+        (bytesRead < 22) ||
+        (kACTION_TYPE_MDC_ACT_SEG_TRIG_XFER!=headerValue)
+    ) {
+        LOG_WRN("unexpected / incorrect answer packet -- giving up");
+        return ACCUCHEK_ERR_PROTOCOL;
+    }
+    return ACCUCHEK_OK;
+}
+
+void MeterSession::parseSegment(
+    size_t bytesRead
+) {
+    // sent last time already, or recovered from the journal: ACK it, but don't decode it nor hand it out again
+    size_t o = 30;
+    auto nbEntries = be16r(data, o);
+    auto skip = (0!=cache && o<=bytesRead && cache->seen(30 + data, bytesRead - 30));
+    skip = skip || (0!=journal && journal->recovered(data, bytesRead));
+    if(skip) {
+        LOG_NFO("segment of %d entries seen before, skipping it", (int)nbEntries);
+        progress.skipped += nbEntries;
+        progress.segments += 1;
+        reportProgress();
+        return;
+    }
+
+    // on disk before anyone gets to see it, give or take a group commit
+    if(0!=journal) {
+        journal->append(data, bytesRead);
+    }
+
+    // pipelined: only count what's in there, the buffer goes down the pipe
+    // as is to be decoded in place, and the next transfer gets another one
+    if(0!=pipeline) {
+        progress.received += nbEntries;
+        progress.segments += 1;
+        updateProgress();
+        pipeline->push(data, bytesRead, progress, buffers);
+        data = buffers->get();
+        return;
+    }
+
+    decodeSegment(data, bytesRead, batch);
+
+    // hand samples to caller, one by one and as a whole segment
+    if(callbacks && callbacks->onSample) {
+        for(auto &sample:batch) {
+            callbacks->onSample(callbacks->user, &sample);
+        }
+    }
+    if(callbacks && callbacks->onBatch && 0<batch.size()) {
+        callbacks->onBatch(callbacks->user, batch.data(), batch.size());
+    }
+    progress.received += batch.size();
+    progress.segments += 1;
+    reportProgress();
+}
+
+void MeterSession::decodeSegment(
+    const uint8_t *data,
+    size_t size,
+    std::vector<AccuChekSample> &samples
+) {
+
+    size_t o = 30;
+    auto nbEntries = be16r(data, o);
+    LOG_NFO("segment has %d entries", (int)nbEntries);
+    o -= 2;
+    samples.clear();
+
+    // decode weird-ass encoding of datetime values
+    auto cvt = [](
+        uint8_t x
+    ) {
+        int v = -1;
+        char buf[8];
+        sprintf(buf, "%02X", x);
+        sscanf(buf, "%d", &v);
+        return v;
+    };
+
+    for(int i=0; i<nbEntries && 18 + o<=size; ++i) {
+
+        // load date
+        auto cc = cvt(data[ 6 + o]);
+        auto yy = cvt(data[ 7 + o]);
+        auto mm = cvt(data[ 8 + o]);
+        auto dd = cvt(data[ 9 + o]);
+        auto hh = cvt(data[10 + o]);
+        auto mn = cvt(data[11 + o]);
+
+        // load value and status
+        auto ro = (14 + o);
+        auto vv = be16r(data, ro);
+        auto ss = be16r(data, ro);
+        o += 12;
+
+        // dump sample
+        LOG_NFO(
+            "sample: %02d%02d/%02d/%02d %02d:%02d => (mg/dL=%2d, mmol/L=%7.3f, status=0x%02x)",
+            cc,
+            yy,
+            mm,
+            dd,
+            hh,
+            mn,
+            vv,
+            (vv / 18.0),
+            ss
+        );
+
+        // compute epoch
+        struct tm t;
+        memset(&t, 0, sizeof(t));
+        t.tm_min = mn;
+        t.tm_hour = hh;
+        t.tm_mday = dd;
+        t.tm_mon = (mm-1);
+        t.tm_year = ((cc*100 + yy) - 1900);
+        //auto epoch = timegm(&t);
+        auto epoch = timelocal(&t);
+
+        // keep sample
+        AccuChekSample sample;
+        sample.epoch = epoch;
+        sample.mgdl = vv;
+        sample.status = ss;
+        sample.year = (cc*100 + yy);
+        sample.month = mm;
+        sample.day = dd;
+        sample.hour = hh;
+        sample.minute = mn;
+        samples.push_back(sample);
+    }
+}
+
+void MeterSession::updateProgress() {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    progress.elapsed = (t1.tv_sec - t0.tv_sec) + 1e-9*(t1.tv_nsec - t0.tv_nsec);
+    auto done = (progress.received + progress.skipped);
+    progress.rate = (0<progress.elapsed ? done / progress.elapsed : 0);
+    progress.eta = -1;
+    if(0<progress.rate && done<=progress.expected) {
+        progress.eta = (progress.expected - done) / progress.rate;
+    }
+}
+
+void MeterSession::reportProgress() {
+    // pipelined: behind the segments still on their way
+    if(0!=pipeline) {
+        updateProgress();
+        pipeline->push(0, 0, progress, 0);
+        return;
+    }
+    if(0==callbacks || 0==callbacks->onProgress) {
+        return;
+    }
+    updateProgress();
+    callbacks->onProgress(callbacks->user, &progress);
+}
+
+// fill in the length fields of a presentation APDU once its size is known
+static void setLengths(
+    std::vector<uint8_t> &packet
+) {
+    auto size = packet.size();
+    auto p = (2 + packet.data());
+    be16(p, size - 4);      // APDU length
+    be16(p, size - 6);      // octet string length
+    p = (10 + packet.data());
+    be16(p, size - 12);     // length of what follows the data APDU choice
+}
+
+// BCD, the way the meter encodes dates
+static uint8_t bcd(
+    int v
+) {
+    return uint8_t(((v / 10) << 4) | (v % 10));
+}
+
+SimulatedMeter::SimulatedMeter(
+    uint64_t _systemId,
+    uint32_t _nbSamples,
+    int64_t _firstEpoch
+)
+    :   systemId(_systemId),
+        nbSamples(_nbSamples),
+        nbSent(0),
+        firstEpoch(_firstEpoch),
+        invokeId(0),
+        released(false)
+{
+    // the meter speaks first: association request, announcing its system id
+    std::vector<uint8_t> packet(54, 0);
+    auto p = packet.data();
+    be16(p, kAPDU_TYPE_ASSOCIATION_REQUEST);   // msg type
+    be16(p,         50);                       // length
+    be32(p, 0x80000000);                       // assoc-version
+    be16(p,          1);                       // data-proto-list count
+    be16(p,         42);                       // length
+    be16(p,      20601);                       // data-proto-id
+    be16(p,         38);                       // data-proto-info length
+    be32(p, 0x80000000);                       // protocolVersion
+    be16(p,     0xA000);                       // encoding-rules = MDER or PER
+    be32(p, 0x80000000);                       // nomenclatureVersion
+    be32(p,          0);                       // functionalUnits
+    be32(p, 0x00800000);                       // systemType = sys-type-agent
+    be16(p,          8);                       // system-id length
+    be32(p, uint32_t(systemId >> 32));         // system-id
+    be32(p, uint32_t(systemId));
+    be16(p,     0x0000);                       // dev-config-id
+    outgoing.push_back(std::move(packet));
+}
+
+size_t SimulatedMeter::send(
+    uint8_t *buffer,
+    size_t capacity
+) {
+    if(0==outgoing.size()) {
+        return 0;
+    }
+    auto &packet = outgoing.front();
+    auto size = std::min(capacity, packet.size());
+    memcpy(buffer, packet.data(), size);
+    outgoing.pop_front();
+    return size;
+}
+
+void SimulatedMeter::receive(
+    const uint8_t *buffer,
+    size_t size
+) {
+    if(size<2) {
+        return;
+    }
+    size_t o = 0;
+    auto type = be16r(buffer, o);
+
+    // association accepted: config, a pm-store holding our readings
+    if(kAPDU_TYPE_ASSOCIATION_RESPONSE==type) {
+        std::vector<uint8_t> packet(58, 0);
+        auto p = packet.data();
+        be16(p, kAPDU_TYPE_PRESENTATION_APDU);
+        p += 4;                                         // lengths
+        be16(p, ++invokeId);
+        be16(p, kDATA_ADPU_INVOKE_CONFIRMED_EVENT_REPORT);
+        p += 2;                                         // length
+        be16(p,      0);                                // obj-handle
+        be32(p, 0xFFFFFFFF);                            // event-time
+        be16(p, kEVENT_TYPE_MDC_NOTI_CONFIG);
+        be16(p,     36);                                // length
+        be16(p, 0x4000);                                // config-report-id
+        be16(p,      1);                                // object count
+        be16(p,     30);                                // length
+        be16(p, kMDC_MOC_VMO_PMSTORE);                  // object class
+        be16(p,      1);                                // handle
+        be16(p,      3);                                // attribute count
+        be16(p,     22);                                // attributes size
+        be16(p, kMDC_ATTR_NUM_SEG);
+        be16(p,      2);
+        be16(p,      1);
+        be16(p, kMDC_ATTR_METRIC_STORE_USAGE_CNT);
+        be16(p,      4);
+        be32(p, nbSamples);
+        be16(p, kMDC_ATTR_METRIC_STORE_CAPAC_CNT);
+        be16(p,      4);
+        be32(p, std::max(nbSamples, uint32_t(1000)));
+        setLengths(packet);
+        outgoing.push_back(std::move(packet));
+        return;
+    }
+
+    // released
+    if(kAPDU_TYPE_ASSOCIATION_RELEASE_REQUEST==type) {
+        std::vector<uint8_t> packet(6, 0);
+        auto p = packet.data();
+        be16(p, kAPDU_TYPE_ASSOCIATION_RELEASE_RESPONSE);
+        be16(p,      2);
+        be16(p, 0x0000);                                // normal
+        outgoing.push_back(std::move(packet));
+        released = true;
+        return;
+    }
+    if(kAPDU_TYPE_PRESENTATION_APDU!=type || size<16) {
+        return;
+    }
+
+    // requests: answers carry the next invoke id, the host adds one to it for its own
+    o = 8;
+    auto choice = be16r(buffer, o);
+    o = 14;
+    auto action = be16r(buffer, o);
+    auto event = uint16_t(0);
+    if(20<=size) {
+        o = 18;
+        event = be16r(buffer, o);
+    }
+    if(kDATA_ADPU_INVOKE_GET==choice) {
+
+        // MDS attributes: nothing the host looks at
+        std::vector<uint8_t> packet(20, 0);
+        auto p = packet.data();
+        be16(p, kAPDU_TYPE_PRESENTATION_APDU);
+        p += 4;
+        be16(p, ++invokeId);
+        be16(p, kDATA_ADPU_RESPONSE_GET);
+        p += 2;
+        be16(p,      0);                                // obj-handle
+        be16(p,      0);                                // attribute count
+        be16(p,      0);                                // length
+        setLengths(packet);
+        outgoing.push_back(std::move(packet));
+    } else if(kDATA_ADPU_INVOKE_CONFIRMED_ACTION==choice && kACTION_TYPE_MDC_ACT_SEG_GET_INFO==action) {
+
+        // segment info: nothing the host looks at either
+        std::vector<uint8_t> packet(20, 0);
+        auto p = packet.data();
+        be16(p, kAPDU_TYPE_PRESENTATION_APDU);
+        p += 4;
+        be16(p, ++invokeId);
+        be16(p, kDATA_ADPU_RESPONSE_CONFIRMED_ACTION);
+        p += 2;
+        be16(p,      1);                                // store handle
+        be16(p, kACTION_TYPE_MDC_ACT_SEG_GET_INFO);
+        be16(p,      0);                                // length
+        setLengths(packet);
+        outgoing.push_back(std::move(packet));
+    } else if(kDATA_ADPU_INVOKE_CONFIRMED_ACTION==choice && kACTION_TYPE_MDC_ACT_SEG_TRIG_XFER==action) {
+
+        // transfer accepted (or nothing to transfer), first segment right behind
+        std::vector<uint8_t> packet(22, 0);
+        auto p = packet.data();
+        be16(p, kAPDU_TYPE_PRESENTATION_APDU);
+        p += 4;
+        be16(p, ++invokeId);
+        be16(p, kDATA_ADPU_RESPONSE_CONFIRMED_ACTION);
+        p += 2;
+        be16(p,      1);                                // store handle
+        be16(p, kACTION_TYPE_MDC_ACT_SEG_TRIG_XFER);
+        be16(p,      4);                                // length
+        be16(p,      0);                                // segment
+        be16(p, (0==nbSamples ? 3 : 0));                // 3 = empty
+        setLengths(packet);
+        outgoing.push_back(std::move(packet));
+        queueSegment();
+    } else if(kDATA_ADPU_RESPONSE_CONFIRMED_EVENT_REPORT==choice && kEVENT_TYPE_MDC_NOTI_SEGMENT_DATA==event) {
+        queueSegment();
+    }
+}
+
+void SimulatedMeter::queueSegment() {
+    if(nbSamples<=nbSent) {
+        return;
+    }
+
+    // as many entries as fit in a packet
+    auto count = std::min(
+        nbSamples - nbSent,
+        uint32_t((MeterSession::kBufferSize - 36) / 12)
+    );
+    std::vector<uint8_t> packet(36 + 12*count, 0);
+    auto p = packet.data();
+    be16(p, kAPDU_TYPE_PRESENTATION_APDU);
+    p += 4;
+    be16(p, ++invokeId);
+    be16(p, kDATA_ADPU_INVOKE_CONFIRMED_EVENT_REPORT);
+    p += 2;
+    be16(p,      1);                                    // store handle
+    be32(p, 0xFFFFFFFF);                                // relative time
+    be16(p, kEVENT_TYPE_MDC_NOTI_SEGMENT_DATA);
+    be16(p, 14 + 12*count);                             // length
+    be16(p,      0);                                    // segment instance
+    be32(p, nbSent);                                    // first entry index
+    be32(p, count);                                     // entry count
+    be16(p, (                                           // status: first / last entries
+        (0==nbSent ? 0x8000 : 0)                    |
+        (nbSamples==nbSent + count ? 0x4000 : 0)
+    ));
+    be16(p, 12*count);                                  // entries length
+
+    // readings: local time in BCD, then mg/dL and status
+    for(uint32_t i=0; i<count; ++i) {
+        auto n = (nbSent + i);
+        struct tm t;
+        time_t epoch = (firstEpoch + 300*int64_t(n));
+        localtime_r(&epoch, &t);
+        auto year = (1900 + t.tm_year);
+        *(p++) = bcd(year / 100);
+        *(p++) = bcd(year % 100);
+        *(p++) = bcd(1 + t.tm_mon);
+        *(p++) = bcd(t.tm_mday);
+        *(p++) = bcd(t.tm_hour);
+        *(p++) = bcd(t.tm_min);
+        p += 2;
+        auto x = ((systemId + n) * 0x9E3779B97F4A7C15ull);
+        be16(p, uint16_t(70 + (x >> 56) % 180));
+        be16(p,      0);
+    }
+    nbSent += count;
+    setLengths(packet);
+    outgoing.push_back(std::move(packet));
+}
+
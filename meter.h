@@ -0,0 +1,182 @@
+#ifndef __METER_H__
+    #define __METER_H__
+
+    /*
+
+         the accuchek protocol as a coroutine, and a simulated meter to talk to
+
+         MeterSession is the host side of a download, everything from the
+         pairing request to the release confirmation, cut at each bulk
+         transfer. it never does any I/O itself: whoever drives it moves
+         bytes in or out of buffer() and tells it how that went:
+
+             MeterSession meter(callbacks);
+             while(MeterSession::kDone!=meter.step()) {
+                 auto n = (
+                     MeterSession::kReceive==meter.step() ?
+                     receive(meter.buffer(), meter.size()) :
+                     send(meter.buffer(), meter.size())
+                 );
+                 meter.advance(n);     // n<0: transfer failed
+             }
+             return meter.result();
+
+         so the same code runs on blocking libusb transfers, on asynchronous
+         ones driven by an event loop (see loop.h), or on anything else that
+         carries packets.
+
+         inside, the protocol is one C++20 coroutine, run(), written front to
+         back the way the device expects it: each transfer is a co_await,
+         advance() resumes it. invoke ids, store handle and segment ACK words
+         live in the coroutine's heap frame, so a session holds no thread and
+         no stack of its own, and thousands of them fit on one event loop. a
+         session may move between threads in between transfers, as long as
+         only one drives it at a time.
+
+         SimulatedMeter is the device side, just enough of it to produce what
+         MeterSession parses: an association request, a config holding a
+         pm-store, and a store of synthetic readings sent segment by segment.
+         it's for benchmarks, and for exercising drivers with no meter at hand.
+
+     */
+
+    #include <deque>
+    #include <time.h>
+    #include <vector>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <coroutine>
+    #include <exception>
+    #include <buffers.h>
+    #include <accuchek.h>
+
+
+    struct SegmentCache;
+    struct SegmentJournal;
+    struct SegmentPipeline;
+
+    struct MeterSession {
+
+        static constexpr size_t kBufferSize = TransferBuffers::kSize;
+
+        // what the session waits for
+        enum Step {
+            kReceive,   // a packet of at most size() bytes into buffer()
+            kSend,      // size() bytes from buffer()
+            kDone       // nothing, see result()
+        };
+
+        // with a pipeline (see pipeline.h), segments are queued raw and callbacks run down there.
+        // with a cache (see cache.h), segments seen in the previous download are skipped.
+        // transfers go through buffers (see buffers.h), TransferBuffers::heap() if null.
+        // with a journal (see journal.h), segments get journaled before being handed out,
+        // and those it recovered already are skipped
+        MeterSession(
+            const AccuChekCallbacks *callbacks,
+            SegmentPipeline *pipeline = 0,
+            SegmentCache *cache = 0,
+            TransferBuffers *buffers = 0,
+            SegmentJournal *journal = 0
+        );
+        ~MeterSession();
+
+        Step step() const;
+        uint8_t *buffer() { return data; }
+        size_t size() const { return length; }
+
+        // name of the message in flight, for logs
+        const char *message() const;
+
+        // the transfer for the current step moved n bytes, or failed if n<0
+        void advance(int n);
+
+        // ACCUCHEK_OK or the error that ended the session, once done
+        int result() const { return error; }
+
+        // samples in a raw data segment of size bytes, read in place
+        static void decodeSegment(const uint8_t *data, size_t size, std::vector<AccuChekSample> &samples);
+
+        MeterSession(const MeterSession &) = delete;
+        MeterSession &operator=(const MeterSession &) = delete;
+
+    private:
+        // the coroutine run() returns: starts suspended, stays suspended once over
+        struct Protocol {
+            struct promise_type {
+                Protocol get_return_object() { return Protocol(std::coroutine_handle<promise_type>::from_promise(*this)); }
+                std::suspend_always initial_suspend() noexcept { return {}; }
+                std::suspend_always final_suspend() noexcept { return {}; }
+                void return_void() {}
+                void unhandled_exception() { std::terminate(); }
+            };
+            explicit Protocol(std::coroutine_handle<promise_type> _handle) : handle(_handle) {}
+            Protocol(const Protocol &) = delete;
+            ~Protocol() { handle.destroy(); }
+            std::coroutine_handle<promise_type> handle;
+        };
+
+        // what run() co_awaits: the transfer set up by receive() or send(), its byte count or <0
+        struct Transfer {
+            MeterSession &session;
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<>) const noexcept {}
+            int await_resume() const noexcept { return session.transferred; }
+        };
+
+        Protocol run();
+        Transfer receive(const char *message, size_t capacity);
+        Transfer send(const char *message, const uint8_t *end);
+        uint8_t *packet();
+        uint16_t invokeId() const;
+        int parseConfig(uint16_t &pmStoreHandle);
+        int parseSegmentHeaders(size_t bytesRead);
+        void parseSegment(size_t bytesRead);
+        void updateProgress();
+        void reportProgress();
+
+        const AccuChekCallbacks *callbacks;
+        SegmentPipeline *pipeline;
+        SegmentCache *cache;
+        TransferBuffers *buffers;
+        SegmentJournal *journal;
+        int phase;
+        int error;
+        int transferred;
+        size_t length;
+        Step direction;
+        const char *name;
+        AccuChekProgress progress;
+        struct timespec t0;
+        std::vector<AccuChekSample> batch;
+        uint8_t *data;
+        Protocol protocol;
+    };
+
+    struct SimulatedMeter {
+
+        // nbSamples readings, 5 minutes apart from firstEpoch on
+        SimulatedMeter(uint64_t systemId, uint32_t nbSamples, int64_t firstEpoch);
+
+        // next packet the meter has to say, returns its size or 0 while it waits for the host
+        size_t send(uint8_t *buffer, size_t capacity);
+
+        // packet from the host
+        void receive(const uint8_t *buffer, size_t size);
+
+        // host released the association
+        bool done() const { return released; }
+
+    private:
+        void queueSegment();
+
+        uint64_t systemId;
+        uint32_t nbSamples;
+        uint32_t nbSent;
+        int64_t firstEpoch;
+        uint16_t invokeId;
+        bool released;
+        std::deque<std::vector<uint8_t>> outgoing;
+    };
+
+#endif // __METER_H__
+
@@ -0,0 +1,140 @@
+/*
+
+     staged download, see pipeline.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <string.h>
+#include <algorithm>
+#include <pipeline.h>
+
+SegmentPipeline::SegmentPipeline(
+    const AccuChekCallbacks *_callbacks,
+    size_t depth
+)
+    :   callbacks(_callbacks),
+        raw(depth),
+        decoded(depth),
+        nbPushed(0),
+        nbDecoded(0),
+        nbDelivered(0),
+        finished(false)
+{
+    decoder = std::thread([this]() { decode(); });
+    sinker = std::thread([this]() { sink(); });
+}
+
+SegmentPipeline::~SegmentPipeline() {
+    finish();
+}
+
+void SegmentPipeline::push(
+    uint8_t *data,
+    size_t size,
+    const AccuChekProgress &progress,
+    TransferBuffers *buffers
+) {
+    auto item = raw.claim();
+    item->size = uint32_t(std::min(size, MeterSession::kBufferSize));
+    item->last = false;
+    item->progress = progress;
+    item->data = data;
+    item->buffers = buffers;
+    raw.publish();
+    if(0<size) {
+        nbPushed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void SegmentPipeline::finish() {
+    if(finished) {
+        return;
+    }
+    finished = true;
+
+    // the end marker flushes both stages on its way down
+    auto item = raw.claim();
+    item->size = 0;
+    item->last = true;
+    item->data = 0;
+    item->buffers = 0;
+    raw.publish();
+    decoder.join();
+    sinker.join();
+}
+
+void SegmentPipeline::decode() {
+    while(true) {
+        auto in = raw.front();
+        auto out = decoded.claim();
+        out->segment = (0<in->size);
+        out->last = in->last;
+        out->progress = in->progress;
+        out->samples.clear();
+        if(out->segment) {
+            MeterSession::decodeSegment(in->data, in->size, out->samples);
+            nbDecoded.fetch_add(1, std::memory_order_relaxed);
+        }
+        if(0!=in->buffers) {
+            in->buffers->put(in->data);
+        }
+        auto last = in->last;
+        raw.release();
+        decoded.publish();
+        if(last) {
+            return;
+        }
+    }
+}
+
+void SegmentPipeline::sink() {
+    while(true) {
+        auto in = decoded.front();
+        if(in->last) {
+            decoded.release();
+            return;
+        }
+        if(0!=callbacks && in->segment) {
+            auto &samples = in->samples;
+            if(callbacks->onSample) {
+                for(auto &sample:samples) {
+                    callbacks->onSample(callbacks->user, &sample);
+                }
+            }
+            if(callbacks->onBatch && 0<samples.size()) {
+                callbacks->onBatch(callbacks->user, samples.data(), samples.size());
+            }
+        }
+        if(0!=callbacks && callbacks->onProgress) {
+            callbacks->onProgress(callbacks->user, &in->progress);
+        }
+        if(in->segment) {
+            nbDelivered.fetch_add(1, std::memory_order_relaxed);
+        }
+        decoded.release();
+    }
+}
+
+void SegmentPipeline::stats(
+    AccuChekPipelineStats &stats
+) const {
+    memset(&stats, 0, sizeof(stats));
+
+    // usb stage only ever waits for the decoder to make room
+    stats.usb.segments = nbPushed.load(std::memory_order_relaxed);
+    stats.usb.stalled = raw.producerStall();
+
+    stats.decode.segments = nbDecoded.load(std::memory_order_relaxed);
+    stats.decode.queued = raw.size();
+    stats.decode.maxQueued = raw.maxQueued();
+    stats.decode.idle = raw.consumerStall();
+    stats.decode.stalled = decoded.producerStall();
+
+    // sink stage runs callbacks, nothing downstream to wait for
+    stats.sink.segments = nbDelivered.load(std::memory_order_relaxed);
+    stats.sink.queued = decoded.size();
+    stats.sink.maxQueued = decoded.maxQueued();
+    stats.sink.idle = decoded.consumerStall();
+}
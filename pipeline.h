@@ -0,0 +1,79 @@
+#ifndef __PIPELINE_H__
+    #define __PIPELINE_H__
+
+    /*
+
+         staged download: USB I/O, decoding and callbacks on threads of their own
+
+             usb thread            decode thread           sink thread
+             MeterSession  --raw-->  decodeSegment  --samples-->  onSample / onBatch / onProgress
+
+         the thread driving the meter session hands each raw segment's
+         transfer buffer (see buffers.h) to a bounded SPSC queue (see spsc.h)
+         without copying it, and goes straight on to ACK it: date conversion, slow sinks (pipes, NFS), archive and alert work
+         in the callbacks no longer delay the next USB round trip. progress
+         reports travel down the same queues, so callbacks see segments and
+         progress in the order they came in. onAssociation still runs on the
+         USB thread, before anything goes down the pipe.
+
+         when a queue fills up the stage feeding it waits: memory stays
+         bounded and a stuck sink eventually holds up the download rather
+         than the other way around. stats() tells where time went.
+
+     */
+
+    #include <meter.h>
+    #include <atomic>
+    #include <thread>
+    #include <vector>
+    #include <spsc.h>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <accuchek.h>
+
+    struct SegmentPipeline {
+
+        // callbacks run on the sink thread, depth raw segments may wait for decoding
+        SegmentPipeline(const AccuChekCallbacks *callbacks, size_t depth);
+        ~SegmentPipeline();
+
+        // usb stage: queue a raw segment (size 0: nothing but progress) as of progress,
+        // data goes back to buffers once decoded
+        void push(uint8_t *data, size_t size, const AccuChekProgress &progress, TransferBuffers *buffers);
+
+        // wait until everything pushed went through, and stop the threads
+        void finish();
+
+        // segments through each stage, queue depths and stall times so far
+        void stats(AccuChekPipelineStats &stats) const;
+
+    private:
+        struct Raw {
+            uint32_t size;
+            bool last;
+            AccuChekProgress progress;
+            uint8_t *data;
+            TransferBuffers *buffers;
+        };
+        struct Decoded {
+            bool segment;
+            bool last;
+            AccuChekProgress progress;
+            std::vector<AccuChekSample> samples;
+        };
+
+        void decode();
+        void sink();
+
+        const AccuChekCallbacks *callbacks;
+        SpscQueue<Raw> raw;
+        SpscQueue<Decoded> decoded;
+        std::atomic<uint64_t> nbPushed;
+        std::atomic<uint64_t> nbDecoded;
+        std::atomic<uint64_t> nbDelivered;
+        std::thread decoder;
+        std::thread sinker;
+        bool finished;
+    };
+
+#endif // __PIPELINE_H__
@@ -0,0 +1,77 @@
+/*
+
+     fixed size thread pool, see pool.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <pool.h>
+
+ThreadPool::ThreadPool(
+    int nbThreads
+)
+    :   pending(0),
+        stopping(false)
+{
+    if(nbThreads<=0) {
+        nbThreads = std::max(1, int(std::thread::hardware_concurrency()));
+    }
+    for(int i=0; i<nbThreads; ++i) {
+        workers.emplace_back([this]() { work(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for(auto &worker:workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(
+    std::function<void()> task
+) {
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        tasks.push_back(std::move(task));
+        ++pending;
+    }
+    wakeUp.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    allDone.wait(guard, [this]() { return 0==pending; });
+}
+
+void ThreadPool::work() {
+    while(true) {
+
+        // grab next task
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wakeUp.wait(guard, [this]() { return stopping || 0<tasks.size(); });
+            if(0==tasks.size()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+
+        // run it
+        task();
+
+        // let waiters know when everything is done
+        std::unique_lock<std::mutex> guard(lock);
+        if(0==--pending) {
+            allDone.notify_all();
+        }
+    }
+}
+
@@ -0,0 +1,49 @@
+#ifndef __POOL_H__
+    #define __POOL_H__
+
+    /*
+
+         fixed size thread pool
+
+             ThreadPool pool;
+             for(...) pool.submit([&]() { ... });
+             pool.wait();
+
+     */
+
+    #include <deque>
+    #include <mutex>
+    #include <thread>
+    #include <vector>
+    #include <functional>
+    #include <condition_variable>
+
+    struct ThreadPool {
+
+        // nbThreads<=0 means one thread per core
+        ThreadPool(int nbThreads = 0);
+        ~ThreadPool();
+
+        // queue a task
+        void submit(std::function<void()> task);
+
+        // block until every submitted task has run
+        void wait();
+
+        // number of worker threads
+        int size() const { return int(workers.size()); }
+
+    private:
+        void work();
+
+        std::mutex lock;
+        std::condition_variable wakeUp;
+        std::condition_variable allDone;
+        std::deque<std::function<void()>> tasks;
+        std::vector<std::thread> workers;
+        size_t pending;
+        bool stopping;
+    };
+
+#endif // __POOL_H__
+
@@ -0,0 +1,229 @@
+/*
+
+     archive queries with zone maps, see query.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <pool.h>
+#include <thread>
+#include <merge.h>
+#include <query.h>
+#include <stdio.h>
+#include <string>
+#include <string.h>
+
+// zone map file magic
+static const char kMagic[8] = { 'A', 'C', 'C', 'U', 'Z', 'O', 'N', 'E' };
+
+ZoneMap ZoneMap::of(
+    const ArchiveBlock &block
+) {
+    ZoneMap zone;
+    zone.minEpoch = block.minEpoch;
+    zone.maxEpoch = block.maxEpoch;
+    zone.count = block.count;
+    zone.minMgdl = UINT16_MAX;
+    zone.maxMgdl = 0;
+    zone.devices = 0;
+    for(uint32_t i=0; i<block.count; ++i) {
+        auto &r = block.records[i];
+        zone.minMgdl = std::min(zone.minMgdl, r.mgdl);
+        zone.maxMgdl = std::max(zone.maxMgdl, r.mgdl);
+        zone.devices |= deviceBit(r.deviceId);
+    }
+    return zone;
+}
+
+// where the zone maps of an archive live
+static auto zonePath(
+    const char *archivePath
+) {
+    return std::string(archivePath) + ".zones";
+}
+
+size_t ZoneMaps::load(
+    const char *archivePath,
+    const ArchiveReader &reader
+) {
+    zones.clear();
+    auto path = zonePath(archivePath);
+    auto fp = fopen(path.c_str(), "rb");
+    if(0!=fp) {
+        char magic[8];
+        auto ok = (1==fread(magic, sizeof(magic), 1, fp) && 0==memcmp(magic, kMagic, sizeof(kMagic)));
+        ZoneMap zone;
+        while(ok && 1==fread(&zone, sizeof(zone), 1, fp)) {
+            zones.push_back(zone);
+        }
+        fclose(fp);
+        if(false==ok) {
+            LOG_WRN("%s is not a zone map file, ignoring it", path.c_str());
+            zones.clear();
+        }
+    }
+
+    // whatever doesn't describe its block gets recomputed
+    size_t computed = 0;
+    auto &blocks = reader.blocks();
+    zones.resize(blocks.size());
+    for(size_t i=0; i<blocks.size(); ++i) {
+        if(false==zones[i].covers(blocks[i])) {
+            zones[i] = ZoneMap::of(blocks[i]);
+            ++computed;
+        }
+    }
+    return computed;
+}
+
+bool ZoneMaps::save(
+    const char *archivePath
+) const {
+    auto path = zonePath(archivePath);
+    auto tmpPath = path + ".tmp";
+    auto fp = fopen(tmpPath.c_str(), "wb");
+    if(0==fp) {
+        LOG_WRN("failed to create %s", tmpPath.c_str());
+        return false;
+    }
+    auto ok = (
+        1==fwrite(kMagic, sizeof(kMagic), 1, fp)   &&
+        zones.size()==fwrite(zones.data(), sizeof(ZoneMap), zones.size(), fp)
+    );
+    ok = (0==fclose(fp)) && ok;
+    ok = ok && (0==rename(tmpPath.c_str(), path.c_str()));
+    if(false==ok) {
+        LOG_WRN("failed to write %s", path.c_str());
+        remove(tmpPath.c_str());
+    }
+    return ok;
+}
+
+bool ZoneMaps::update(
+    const char *archivePath
+) {
+    ArchiveReader reader;
+    if(false==reader.open(archivePath)) {
+        return false;
+    }
+    ZoneMaps maps;
+    if(0==maps.load(archivePath, reader)) {
+        return true;
+    }
+    return maps.save(archivePath);
+}
+
+ArchiveQuery::ArchiveQuery()
+    :   allDevices(true),
+        deviceId(0),
+        from(INT64_MIN),
+        to(INT64_MAX),
+        minMgdl(0),
+        maxMgdl(UINT16_MAX),
+        validOnly(false)
+{
+}
+
+bool ArchiveQuery::mayMatch(
+    const ZoneMap &zone
+) const {
+    return (
+        0<zone.count                                                    &&
+        from<=zone.maxEpoch && zone.minEpoch<=to                        &&
+        minMgdl<=zone.maxMgdl && zone.minMgdl<=maxMgdl                  &&
+        (allDevices || 0!=(zone.devices & ZoneMap::deviceBit(deviceId)))
+    );
+}
+
+bool ArchiveQuery::matches(
+    const ArchiveRecord &r
+) const {
+    return (
+        from<=r.epoch && r.epoch<=to                &&
+        minMgdl<=r.mgdl && r.mgdl<=maxMgdl          &&
+        (allDevices || deviceId==r.deviceId)        &&
+        (false==validOnly || 0==r.status)
+    );
+}
+
+bool ArchiveQuery::run(
+    const char *archivePath,
+    int nbThreads,
+    std::vector<ArchiveRecord> &results,
+    Stats &stats
+) const {
+    memset(&stats, 0, sizeof(stats));
+    results.clear();
+
+    ArchiveReader reader;
+    if(false==reader.open(archivePath)) {
+        LOG_WRN("failed to open archive %s", archivePath);
+        return false;
+    }
+    ZoneMaps zones;
+    stats.computed = zones.load(archivePath, reader);
+
+    // blocks the zone maps can't rule out
+    auto &blocks = reader.blocks();
+    std::vector<size_t> candidates;
+    for(size_t i=0; i<blocks.size(); ++i) {
+        if(mayMatch(zones.maps()[i])) {
+            candidates.push_back(i);
+        }
+    }
+    stats.blocks = blocks.size();
+    stats.skipped = (blocks.size() - candidates.size());
+
+    // scan them in parallel, each into its own sorted run
+    std::vector<std::vector<ArchiveRecord>> found(candidates.size());
+    std::vector<size_t> scanned(candidates.size(), 0);
+    {
+        auto threads = (nbThreads<=0 ? int(std::thread::hardware_concurrency()) : nbThreads);
+        ThreadPool pool(std::max(1, std::min(threads, int(candidates.size()))));
+        for(size_t c=0; c<candidates.size(); ++c) {
+            pool.submit([&, c]() {
+                auto &block = blocks[candidates[c]];
+                auto end = (block.count + block.records);
+                auto b = std::lower_bound(
+                    block.records,
+                    end,
+                    from,
+                    [](const ArchiveRecord &r, int64_t t) { return r.epoch<t; }
+                );
+                auto e = std::upper_bound(
+                    b,
+                    end,
+                    to,
+                    [](int64_t t, const ArchiveRecord &r) { return t<r.epoch; }
+                );
+                for(auto r=b; r<e; ++r) {
+                    if(matches(*r)) {
+                        found[c].push_back(*r);
+                    }
+                }
+                scanned[c] = size_t(e - b);
+            });
+        }
+        pool.wait();
+    }
+
+    // blocks may overlap in time, merge runs back into archive order
+    std::vector<SampleRun> runs;
+    size_t total = 0;
+    for(size_t c=0; c<candidates.size(); ++c) {
+        stats.scanned += scanned[c];
+        if(0<found[c].size()) {
+            runs.push_back({ found[c].data(), found[c].size() });
+            total += found[c].size();
+        }
+    }
+    results.reserve(total);
+    LoserTree tree(runs);
+    while(auto r = tree.top()) {
+        results.push_back(*r);
+        tree.pop();
+    }
+    stats.matched = results.size();
+    return true;
+}
@@ -0,0 +1,110 @@
+#ifndef __QUERY_H__
+    #define __QUERY_H__
+
+    /*
+
+         archive queries, with per-block zone maps to skip what can't match
+
+         the archive's sparse index already knows each block's time span. a
+         zone map adds, per block, the lowest and highest glucose value in
+         it and which devices it holds (one bit per device, folded into 64:
+         a clear bit means "certainly not", a set one "maybe"). a query for
+         one device between two dates, or for readings under 70 mg/dL last
+         month, then only reads the blocks whose zone map says they might
+         hold something, and scans those in parallel: within a block,
+         records are sorted by time, so the time range is two binary
+         searches and only what's in it gets looked at.
+
+         zone maps are persisted next to the archive as "<archive>.zones",
+         one ZoneMap per block in archive order, and brought up to date by
+         every write (see archive.h). an entry counts for a block only if
+         its count and time span match the block's header, anything else
+         (a file written before zone maps existed, a rewrite) gets its zone
+         map computed from the records again, in memory by readers, for
+         good by the next write.
+
+     */
+
+    #include <vector>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <archive.h>
+
+    // one block's summary, as stored on disk
+    struct ZoneMap {
+        int64_t  minEpoch;
+        int64_t  maxEpoch;
+        uint32_t count;
+        uint16_t minMgdl;
+        uint16_t maxMgdl;
+        uint64_t devices;   // deviceBit() of every device with records in the block
+
+        // which of the 64 device bits deviceId sets
+        static uint64_t deviceBit(uint32_t deviceId) {
+            return (1ull << ((deviceId * 0x9E3779B1u) >> 26));
+        }
+
+        // summarize a block
+        static ZoneMap of(const ArchiveBlock &block);
+
+        // does it describe block
+        bool covers(const ArchiveBlock &block) const {
+            return (count==block.count && minEpoch==block.minEpoch && maxEpoch==block.maxEpoch);
+        }
+    };
+    static_assert(32==sizeof(ZoneMap), "zone maps must be 32 bytes");
+
+    struct ZoneMaps {
+
+        // load the zone maps of an archive, and compute those missing or stale for reader's
+        // blocks. returns how many had to be computed
+        size_t load(const char *archivePath, const ArchiveReader &reader);
+
+        // atomically write zone maps of an archive back
+        bool save(const char *archivePath) const;
+
+        // one per block of the reader they were loaded for
+        const std::vector<ZoneMap> &maps() const { return zones; }
+
+        // bring an archive's zone maps in step with its blocks, after a write
+        static bool update(const char *archivePath);
+
+    private:
+        std::vector<ZoneMap> zones;
+    };
+
+    // what to look for: every condition holds for a record to match
+    struct ArchiveQuery {
+
+        bool     allDevices;
+        uint32_t deviceId;
+        int64_t  from;          // epoch range, inclusive
+        int64_t  to;
+        uint16_t minMgdl;       // glucose range, inclusive
+        uint16_t maxMgdl;
+        bool     validOnly;     // status 0 only
+
+        // everything
+        ArchiveQuery();
+
+        // could a block with this zone map hold a match
+        bool mayMatch(const ZoneMap &zone) const;
+
+        // is r a match
+        bool matches(const ArchiveRecord &r) const;
+
+        // what a run went through
+        struct Stats {
+            size_t blocks;      // in the archive
+            size_t skipped;     // ruled out by their zone map
+            size_t scanned;     // records looked at
+            size_t matched;
+            size_t computed;    // zone maps that weren't on disk
+        };
+
+        // every match in archive at path, in archive order (time, then device), with
+        // nbThreads scanning blocks (<=0: one per core). false if the archive can't be read
+        bool run(const char *archivePath, int nbThreads, std::vector<ArchiveRecord> &results, Stats &stats) const;
+    };
+
+#endif // __QUERY_H__
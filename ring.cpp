@@ -0,0 +1,321 @@
+/*
+
+     shared memory ring of archive records, see ring.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <algorithm>
+#include <unistd.h>
+#include <ring.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// ring file magic
+static const char kMagic[8] = { 'A', 'C', 'C', 'U', 'R', 'I', 'N', 'G' };
+static const uint32_t kVersion = 1;
+
+static_assert(64==sizeof(RingHeader), "ring header must stay one cache line");
+static_assert(2*sizeof(uint64_t)==sizeof(ArchiveRecord), "records travel as two words");
+
+// futex on a word shared between processes
+static void futexWait(
+    std::atomic<uint32_t> *word,
+    uint32_t value,
+    int timeoutMs
+) {
+    struct timespec ts;
+    ts.tv_sec = timeoutMs / 1000;
+    ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, value, (timeoutMs<0 ? 0 : &ts), 0, 0);
+}
+
+static void futexWakeAll(
+    std::atomic<uint32_t> *word
+) {
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+}
+
+// check a mapped ring header
+static auto validHeader(
+    const RingHeader *header,
+    size_t fileSize
+) {
+    auto capacity = header->capacity;
+    return (
+        0==memcmp(header->magic, kMagic, sizeof(kMagic))        &&
+        kVersion==header->version                               &&
+        sizeof(ArchiveRecord)==header->recordSize               &&
+        0<capacity                                              &&
+        0==(capacity & (capacity-1))                            &&
+        sizeof(RingHeader) + capacity*sizeof(RingSlot)==fileSize
+    );
+}
+
+// map a whole ring file read / write
+static auto mapRing(
+    int fd,
+    size_t size
+) {
+    auto p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return (MAP_FAILED==p ? (RingHeader *)0 : (RingHeader *)p);
+}
+
+RingWriter::RingWriter()
+    :   fd(-1),
+        mapSize(0),
+        header(0),
+        slots(0)
+{
+}
+
+RingWriter::~RingWriter() {
+    close();
+}
+
+void RingWriter::close() {
+    if(0!=header) {
+        munmap(header, mapSize);
+        header = 0;
+        slots = 0;
+    }
+    if(0<=fd) {
+        ::close(fd);    // also drops the writer lock
+        fd = -1;
+    }
+    mapSize = 0;
+}
+
+bool RingWriter::open(
+    const char *path,
+    size_t capacity
+) {
+    close();
+
+    // one writer at a time
+    fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd<0) {
+        LOG_WRN("failed to open ring %s", path);
+        return false;
+    }
+    if(0!=flock(fd, LOCK_EX | LOCK_NB)) {
+        LOG_WRN("ring %s already has a writer", path);
+        close();
+        return false;
+    }
+
+    // reuse a compatible ring so readers keep their place
+    size_t size = 64;
+    while(size<capacity) {
+        size <<= 1;
+    }
+    capacity = size;
+    struct stat st;
+    fstat(fd, &st);
+    if(sizeof(RingHeader)<=size_t(st.st_size)) {
+        mapSize = st.st_size;
+        header = mapRing(fd, mapSize);
+        if(0!=header && validHeader(header, mapSize) && capacity==header->capacity) {
+            slots = (RingSlot *)(1 + header);
+            return true;
+        }
+        if(0!=header) {
+            munmap(header, mapSize);
+            header = 0;
+        }
+    }
+
+    // otherwise start over with a fresh, all zero file (readers of an old
+    // one keep a stale but valid mapping), magic goes in last
+    if(0<st.st_size) {
+        ::close(fd);
+        unlink(path);
+        fd = ::open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if(fd<0 || 0!=flock(fd, LOCK_EX | LOCK_NB)) {
+            LOG_WRN("failed to recreate ring %s", path);
+            close();
+            return false;
+        }
+    }
+    mapSize = sizeof(RingHeader) + capacity*sizeof(RingSlot);
+    auto ok = (0==ftruncate(fd, mapSize));
+    header = (ok ? mapRing(fd, mapSize) : 0);
+    if(0==header) {
+        LOG_WRN("failed to create ring %s", path);
+        close();
+        return false;
+    }
+    header->version = kVersion;
+    header->recordSize = sizeof(ArchiveRecord);
+    header->capacity = capacity;
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, kMagic, sizeof(kMagic));
+    slots = (RingSlot *)(1 + header);
+    LOG_NFO("created ring %s with room for %d records", path, (int)capacity);
+    return true;
+}
+
+void RingWriter::publish(
+    const ArchiveRecord *records,
+    size_t count
+) {
+    if(0==header || 0==count) {
+        return;
+    }
+
+    // seqlock each slot: odd stamp while writing, even once done
+    auto mask = (header->capacity - 1);
+    auto head = header->head.load(std::memory_order_relaxed);
+    for(size_t i=0; i<count; ++i) {
+        auto seq = (head + i);
+        auto &slot = slots[seq & mask];
+        uint64_t words[2];
+        memcpy(words, i + records, sizeof(words));
+        slot.stamp.store(2*seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.words[0].store(words[0], std::memory_order_relaxed);
+        slot.words[1].store(words[1], std::memory_order_relaxed);
+        slot.stamp.store(2*seq + 2, std::memory_order_release);
+    }
+    header->head.store(head + count, std::memory_order_release);
+
+    // one wake up per batch, and only if someone sleeps
+    header->wakeWord.fetch_add(1);
+    if(0<header->nbWaiters.load()) {
+        futexWakeAll(&header->wakeWord);
+    }
+}
+
+RingReader::RingReader()
+    :   fd(-1),
+        mapSize(0),
+        header(0),
+        slots(0),
+        cursor(0)
+{
+}
+
+RingReader::~RingReader() {
+    close();
+}
+
+void RingReader::close() {
+    if(0!=header) {
+        munmap(header, mapSize);
+        header = 0;
+        slots = 0;
+    }
+    if(0<=fd) {
+        ::close(fd);
+        fd = -1;
+    }
+    mapSize = 0;
+}
+
+bool RingReader::open(
+    const char *path,
+    bool fromOldest
+) {
+    close();
+
+    fd = ::open(path, O_RDWR | O_CLOEXEC);
+    if(fd<0) {
+        LOG_WRN("failed to open ring %s", path);
+        return false;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    mapSize = st.st_size;
+    header = (sizeof(RingHeader)<=mapSize ? mapRing(fd, mapSize) : 0);
+    if(0==header || false==validHeader(header, mapSize)) {
+        LOG_WRN("%s is not a ring", path);
+        close();
+        return false;
+    }
+    slots = (RingSlot *)(1 + header);
+
+    auto head = header->head.load(std::memory_order_acquire);
+    cursor = head;
+    if(fromOldest) {
+        cursor = (header->capacity<head ? head - header->capacity : 0);
+    }
+    return true;
+}
+
+size_t RingReader::read(
+    ArchiveRecord *records,
+    size_t max,
+    uint64_t &lost
+) {
+    if(0==header) {
+        return 0;
+    }
+    auto capacity = header->capacity;
+    auto mask = (capacity - 1);
+    auto head = header->head.load(std::memory_order_acquire);
+
+    size_t n = 0;
+    while(n<max) {
+
+        // fell more than a whole ring behind: skip to the oldest record left
+        if(capacity<head-cursor) {
+            lost += (head - capacity - cursor);
+            cursor = (head - capacity);
+        }
+        if(head<=cursor) {
+            break;
+        }
+
+        // copy slot, then make sure the writer didn't touch it meanwhile
+        auto &slot = slots[cursor & mask];
+        auto before = slot.stamp.load(std::memory_order_acquire);
+        uint64_t words[2] = {
+            slot.words[0].load(std::memory_order_relaxed),
+            slot.words[1].load(std::memory_order_relaxed)
+        };
+        std::atomic_thread_fence(std::memory_order_acquire);
+        auto after = slot.stamp.load(std::memory_order_relaxed);
+        if(before!=after || 2*cursor + 2!=before) {
+
+            // lapped, the writer may be filling the slot past head right now
+            head = header->head.load(std::memory_order_acquire);
+            auto next = std::max(1 + cursor, capacity<=head ? 1 + head - capacity : 0);
+            lost += (next - cursor);
+            cursor = next;
+            continue;
+        }
+        memcpy(n + records, words, sizeof(words));
+        ++cursor;
+        ++n;
+    }
+    return n;
+}
+
+bool RingReader::wait(
+    int timeoutMs
+) {
+    if(0==header) {
+        return false;
+    }
+
+    // sample the wake word first: a publish after this changes it and the futex won't sleep
+    auto word = header->wakeWord.load();
+    if(cursor<header->head.load(std::memory_order_acquire)) {
+        return true;
+    }
+    header->nbWaiters.fetch_add(1);
+    if(cursor>=header->head.load(std::memory_order_acquire)) {
+        futexWait(&header->wakeWord, word, timeoutMs);
+    }
+    header->nbWaiters.fetch_sub(1);
+    return (cursor<header->head.load(std::memory_order_acquire));
+}
+
@@ -0,0 +1,100 @@
+#ifndef __RING_H__
+    #define __RING_H__
+
+    /*
+
+         shared memory ring of archive records, one writer, any number of readers
+
+         the ring is a file, normally on tmpfs (/dev/shm/...), that every
+         process maps:
+
+             RingHeader     magic, capacity (a power of two), head sequence,
+                            wake up word
+             RingSlot[]     sequence stamp and the record, as two 64bit words
+
+         record number s goes to slot s % capacity. the writer marks the
+         slot odd (2s+1) while filling it, then stamps it even (2s+2), then
+         bumps head. a reader copies a slot and checks the stamp before and
+         after: a mismatch means the writer lapped it, so it skips ahead and
+         reports how many records it lost. reading costs no syscall; wait()
+         sleeps on a futex that the writer only pokes once per published
+         batch, and only when someone is waiting.
+
+         the ring outlives the writer, so readers keep their place across
+         downloads.
+
+     */
+
+    #include <atomic>
+    #include <string>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <archive.h>
+
+    struct RingHeader {
+        char                  magic[8];
+        uint32_t              version;
+        uint32_t              recordSize;
+        uint64_t              capacity;
+        std::atomic<uint64_t> head;         // records ever published
+        std::atomic<uint32_t> wakeWord;     // bumped on every publish
+        std::atomic<uint32_t> nbWaiters;
+        uint8_t               pad[24];
+    };
+
+    struct RingSlot {
+        std::atomic<uint64_t> stamp;
+        std::atomic<uint64_t> words[2];
+    };
+
+    struct RingWriter {
+
+        RingWriter();
+        ~RingWriter();
+
+        // map ring at path, creating it with capacity records (rounded up to a
+        // power of two) unless a compatible one already exists
+        // fails if another writer has it
+        bool open(const char *path, size_t capacity = (1<<16));
+        void close();
+
+        // append records and wake up readers
+        void publish(const ArchiveRecord *records, size_t count);
+
+    private:
+        int fd;
+        size_t mapSize;
+        RingHeader *header;
+        RingSlot *slots;
+    };
+
+    struct RingReader {
+
+        RingReader();
+        ~RingReader();
+
+        // map an existing ring, starting at the oldest record still in it or at the next one published
+        bool open(const char *path, bool fromOldest = false);
+        void close();
+
+        // copy up to max records, returns how many were copied
+        // lost is incremented by whatever the writer overwrote before we got to it
+        size_t read(ArchiveRecord *records, size_t max, uint64_t &lost);
+
+        // block until something new is published or timeoutMs elapse (<0 waits forever)
+        // returns true if there is something to read
+        bool wait(int timeoutMs);
+
+        // next sequence number to be read
+        uint64_t position() const { return cursor; }
+
+    private:
+        int fd;
+        size_t mapSize;
+        RingHeader *header;
+        RingSlot *slots;
+        uint64_t cursor;
+    };
+
+#endif // __RING_H__
+
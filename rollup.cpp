@@ -0,0 +1,319 @@
+/*
+
+     incremental glycemic statistics, see rollup.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <math.h>
+#include <time.h>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include <rollup.h>
+
+// rollup file magic
+static const char kMagic[8] = { 'A', 'C', 'C', 'U', 'R', 'O', 'L', '3' };
+
+void GlucoseStats::clear() {
+    memset(this, 0, sizeof(*this));
+}
+
+void GlucoseStats::add(
+    uint16_t mgdl
+) {
+    if(0==count || mgdl<min) min = mgdl;
+    if(0==count || max<mgdl) max = mgdl;
+    ++count;
+    sum += mgdl;
+    sumSq += double(mgdl)*mgdl;
+    if(mgdl<54)         ++veryLow;
+    else if(mgdl<70)    ++low;
+    else if(mgdl<=180)  ++inRange;
+    else if(mgdl<=250)  ++high;
+    else                ++veryHigh;
+}
+
+void GlucoseStats::merge(
+    const GlucoseStats &other
+) {
+    if(0==other.count) {
+        return;
+    }
+    if(0==count || other.min<min) min = other.min;
+    if(0==count || max<other.max) max = other.max;
+    count += other.count;
+    veryLow += other.veryLow;
+    low += other.low;
+    inRange += other.inRange;
+    high += other.high;
+    veryHigh += other.veryHigh;
+    sum += other.sum;
+    sumSq += other.sumSq;
+}
+
+double GlucoseStats::mean() const {
+    return (0<count ? sum/count : 0.0);
+}
+
+double GlucoseStats::sd() const {
+    if(count<2) {
+        return 0.0;
+    }
+    auto m = mean();
+    auto var = (sumSq - count*m*m) / (count - 1);
+    return sqrt(std::max(0.0, var));
+}
+
+double GlucoseStats::cv() const {
+    auto m = mean();
+    return (0.0<m ? 100.0*sd()/m : 0.0);
+}
+
+double GlucoseStats::gmi() const {
+    return (0<count ? 3.31 + 0.02392*mean() : 0.0);
+}
+
+double GlucoseStats::tir() const {
+    return (0<count ? 100.0*inRange/count : 0.0);
+}
+
+int64_t Rollups::utcOffset(
+    int64_t epoch
+) {
+    // utc offset only changes on the hour, remember the last one we looked up
+    static __thread int64_t cachedHour = INT64_MIN;
+    static __thread int64_t cachedOffset = 0;
+    auto hour = (epoch>=0 ? epoch/3600 : (epoch-3599)/3600);
+    if(hour!=cachedHour) {
+        struct tm t;
+        time_t tt = epoch;
+        localtime_r(&tt, &t);
+        cachedHour = hour;
+        cachedOffset = t.tm_gmtoff;
+    }
+    return cachedOffset;
+}
+
+int64_t Rollups::bucketStart(
+    int64_t epoch,
+    RollupResolution resolution
+) {
+    // hours round down by the utc offset in effect at epoch
+    if(kRollupHour==resolution) {
+        auto offset = utcOffset(epoch);
+        auto local = (epoch + offset);
+        auto hour = (local>=0 ? local/3600 : (local-3599)/3600);
+        return (hour*3600 - offset);
+    }
+
+    // days and weeks go by the calendar, since those spanning a DST change are an hour
+    // shorter or longer. readings come mostly in order, remember the last bucket of each
+    static __thread int64_t cachedStart[kNbRollupResolutions] = {};
+    static __thread int64_t cachedEnd[kNbRollupResolutions] = {};
+    if(cachedStart[resolution]<=epoch && epoch<cachedEnd[resolution]) {
+        return cachedStart[resolution];
+    }
+    struct tm t;
+    time_t tt = epoch;
+    localtime_r(&tt, &t);
+    t.tm_hour = t.tm_min = t.tm_sec = 0;
+    if(kRollupWeek==resolution) {
+        t.tm_mday -= ((t.tm_wday + 6) % 7);     // weeks start on monday
+    }
+    t.tm_isdst = -1;
+    auto next = t;
+    next.tm_mday += (kRollupWeek==resolution ? 7 : 1);
+    auto start = int64_t(mktime(&t));
+    cachedStart[resolution] = start;
+    cachedEnd[resolution] = int64_t(mktime(&next));
+    return start;
+}
+
+void Rollups::add(
+    const ArchiveRecord &record
+) {
+    // only valid readings count
+    if(0!=record.status) {
+        return;
+    }
+    for(int r=0; r<kNbRollupResolutions; ++r) {
+        auto resolution = RollupResolution(r);
+        Key key = { record.deviceId, uint32_t(r), bucketStart(record.epoch, resolution) };
+        auto it = stats.find(key);
+        if(stats.end()==it) {
+            it = stats.emplace(key, GlucoseStats()).first;
+            it->second.clear();
+        }
+        it->second.add(record.mgdl);
+    }
+}
+
+std::vector<RollupBucket> Rollups::buckets(
+    RollupResolution resolution
+) const {
+    std::vector<RollupBucket> result;
+    for(auto &it:stats) {
+        if(uint32_t(resolution)==it.first.resolution) {
+            result.push_back({ it.first.deviceId, it.first.resolution, it.first.start, it.second });
+        }
+    }
+    std::sort(
+        result.begin(),
+        result.end(),
+        [](const RollupBucket &a, const RollupBucket &b) {
+            if(a.deviceId!=b.deviceId) return (a.deviceId<b.deviceId);
+            return (a.start<b.start);
+        }
+    );
+    return result;
+}
+
+// where the rollups of an archive live
+static auto rollupPath(
+    const char *archivePath
+) {
+    return std::string(archivePath) + ".rollup";
+}
+
+bool Rollups::current(
+    const RollupFileHeader &header,
+    const ArchiveCoverage &coverage
+) {
+    return (0==memcmp(header.magic, kMagic, sizeof(kMagic)) && header.coverage==coverage);
+}
+
+bool Rollups::read(
+    const char *archivePath,
+    ArchiveCoverage &coverage
+) {
+    stats.clear();
+    auto path = rollupPath(archivePath);
+    auto fp = fopen(path.c_str(), "rb");
+    if(0==fp) {
+        return false;
+    }
+
+    RollupFileHeader header;
+    auto ok = (1==fread(&header, sizeof(header), 1, fp) && 0==memcmp(header.magic, kMagic, sizeof(kMagic)));
+    RollupBucket bucket;
+    while(ok && 1==fread(&bucket, sizeof(bucket), 1, fp)) {
+        Key key = { bucket.deviceId, bucket.resolution, bucket.start };
+        stats[key] = bucket.stats;
+    }
+    fclose(fp);
+    if(false==ok) {
+        LOG_WRN("%s is not a rollup file", path.c_str());
+        stats.clear();
+        return false;
+    }
+    coverage = header.coverage;
+    return true;
+}
+
+void Rollups::compute(
+    const ArchiveReader &reader
+) {
+    stats.clear();
+    for(auto &block:reader.blocks()) {
+        for(uint32_t i=0; i<block.count; ++i) {
+            add(block.records[i]);
+        }
+    }
+}
+
+bool Rollups::load(
+    const char *archivePath
+) {
+    ArchiveReader reader;
+    if(false==reader.open(archivePath)) {
+        stats.clear();
+        return false;
+    }
+    auto coverage = ArchiveCoverage::of(reader);
+    ArchiveCoverage stored;
+    if(read(archivePath, stored) && stored==coverage) {
+        return true;
+    }
+
+    // missing or behind: what the archive holds is what counts, keep it for next time if we can
+    if(0<coverage.records) {
+        LOG_WRN("rollups of %s missing or out of date, rebuilding them", archivePath);
+    }
+    compute(reader);
+    save(archivePath, coverage);
+    return true;
+}
+
+bool Rollups::save(
+    const char *archivePath,
+    const ArchiveCoverage &coverage
+) const {
+    auto path = rollupPath(archivePath);
+    auto tmpPath = path + ".tmp";
+    auto fp = fopen(tmpPath.c_str(), "wb");
+    if(0==fp) {
+        LOG_WRN("failed to create %s", tmpPath.c_str());
+        return false;
+    }
+
+    RollupFileHeader header;
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.coverage = coverage;
+    auto ok = (1==fwrite(&header, sizeof(header), 1, fp));
+    for(int r=0; ok && r<kNbRollupResolutions; ++r) {
+        auto all = buckets(RollupResolution(r));
+        ok = (all.size()==fwrite(all.data(), sizeof(RollupBucket), all.size(), fp));
+    }
+    ok = (0==fclose(fp)) && ok;
+    ok = ok && (0==rename(tmpPath.c_str(), path.c_str()));
+    if(false==ok) {
+        LOG_WRN("failed to write %s", path.c_str());
+        remove(tmpPath.c_str());
+    }
+    return ok;
+}
+
+bool Rollups::update(
+    const char *archivePath,
+    const std::vector<ArchiveRecord> &records,
+    const ArchiveCoverage &before
+) {
+    ArchiveReader reader;
+    if(false==reader.open(archivePath)) {
+        return false;
+    }
+    auto after = ArchiveCoverage::of(reader);
+
+    // in step with the archive before the append: only the new readings need adding
+    Rollups rollups;
+    ArchiveCoverage stored;
+    auto known = rollups.read(archivePath, stored);
+    if(known && stored==after) {
+        return true;
+    }
+    if(known && stored==before) {
+        for(auto &r:records) {
+            rollups.add(r);
+        }
+    } else {
+        if(0<before.records) {
+            LOG_WRN("rollups of %s missing or out of date, rebuilding them", archivePath);
+        }
+        rollups.compute(reader);
+    }
+    return rollups.save(archivePath, after);
+}
+
+bool Rollups::rebuild(
+    const char *archivePath
+) {
+    ArchiveReader reader;
+    if(false==reader.open(archivePath)) {
+        return false;
+    }
+    Rollups rollups;
+    rollups.compute(reader);
+    return rollups.save(archivePath, ArchiveCoverage::of(reader));
+}
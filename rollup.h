@@ -0,0 +1,143 @@
+#ifndef __ROLLUP_H__
+    #define __ROLLUP_H__
+
+    /*
+
+         incremental glycemic statistics
+
+         GlucoseStats keeps enough running sums to produce mean, SD, CV,
+         GMI and time-in-range for any set of readings, adding a reading
+         or merging two sets is O(1).
+
+         Rollups materializes GlucoseStats per device per hour, day and
+         week (local time), and is persisted next to the archive as
+         "<archive>.rollup". the archive feeds it the readings it
+         actually appends, so only buckets touched by new readings get
+         recomputed and reports never have to go back to the samples.
+         the file itself is read and rewritten whole (tmp + rename) on
+         every append though: new hours land in the middle of it, sorted
+         as it is, and at 64 bytes a bucket a device's year of them
+         is well under a MB, cheap next to a download.
+
+         days and weeks are calendar ones in local time: the one a DST
+         change falls in is an hour shorter or longer, and stays whole.
+
+         the file starts with the state of the archive its buckets were
+         computed from (see ArchiveCoverage in archive.h). an update that
+         doesn't find the file in step with the archive as it was before
+         the append, and a load that doesn't find it in step with the
+         archive as it is, rebuild it from the samples instead: a missing
+         file, or one a crash left behind the archive, never passes for
+         the whole history.
+
+     */
+
+    #include <vector>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <archive.h>
+    #include <unordered_map>
+
+    // running aggregate of a set of readings
+    struct GlucoseStats {
+
+        uint32_t count;
+        uint32_t veryLow;   // <54 mg/dL
+        uint32_t low;       // 54-69 mg/dL
+        uint32_t inRange;   // 70-180 mg/dL
+        uint32_t high;      // 181-250 mg/dL
+        uint32_t veryHigh;  // >250 mg/dL
+        uint16_t min;
+        uint16_t max;
+        double   sum;
+        double   sumSq;
+
+        void clear();
+        void add(uint16_t mgdl);
+        void merge(const GlucoseStats &other);
+
+        double mean() const;
+        double sd() const;
+        double cv() const;      // SD / mean, in %
+        double gmi() const;     // glucose management indicator, in %
+        double tir() const;     // time in range, in %
+    };
+
+    // bucket sizes
+    enum RollupResolution {
+        kRollupHour = 0,
+        kRollupDay,
+        kRollupWeek,
+        kNbRollupResolutions
+    };
+
+    // one materialized bucket, as stored on disk
+    struct RollupBucket {
+        uint32_t     deviceId;
+        uint32_t     resolution;
+        int64_t      start;         // epoch of the (local time) start of the bucket
+        GlucoseStats stats;
+    };
+
+    // rollup file: this, then buckets sorted by resolution, device and start
+    struct RollupFileHeader {
+        char            magic[8];   // "ACCUROL3"
+        ArchiveCoverage coverage;   // archive state the buckets were computed from
+    };
+
+    struct Rollups {
+
+        // load rollups of an archive, rebuilt (and saved, if possible) if the file is
+        // missing or not in step with the archive. false if the archive can't be read
+        bool load(const char *archivePath);
+
+        // atomically write rollups of an archive back, as computed from coverage
+        bool save(const char *archivePath, const ArchiveCoverage &coverage) const;
+
+        // account for one more reading in its hour, day and week buckets
+        void add(const ArchiveRecord &record);
+
+        // all buckets of one resolution, sorted by device then time
+        std::vector<RollupBucket> buckets(RollupResolution resolution) const;
+
+        // start of the local time bucket holding epoch
+        static int64_t bucketStart(int64_t epoch, RollupResolution resolution);
+
+        // local time minus utc at epoch, in seconds
+        static int64_t utcOffset(int64_t epoch);
+
+        // fold readings just appended to an archive, which was in state before, into its
+        // rollups. rollups not in step with before get rebuilt instead
+        static bool update(const char *archivePath, const std::vector<ArchiveRecord> &records, const ArchiveCoverage &before);
+
+        // recompute an archive's rollups from scratch
+        static bool rebuild(const char *archivePath);
+
+        // true if header is that of a rollup file in step with coverage
+        static bool current(const RollupFileHeader &header, const ArchiveCoverage &coverage);
+
+    private:
+        // buckets and coverage of the rollup file, false if missing or not a rollup file
+        bool read(const char *archivePath, ArchiveCoverage &coverage);
+
+        // buckets of every reading in the archive
+        void compute(const ArchiveReader &reader);
+
+        struct Key {
+            uint32_t deviceId;
+            uint32_t resolution;
+            int64_t  start;
+            bool operator==(const Key &o) const {
+                return (deviceId==o.deviceId && resolution==o.resolution && start==o.start);
+            }
+        };
+        struct KeyHash {
+            size_t operator()(const Key &k) const {
+                return std::hash<int64_t>()(k.start ^ (int64_t(k.deviceId) << 20) ^ k.resolution);
+            }
+        };
+        std::unordered_map<Key, GlucoseStats, KeyHash> stats;
+    };
+
+#endif // __ROLLUP_H__
+
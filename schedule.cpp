@@ -0,0 +1,177 @@
+/*
+
+     station download scheduling, see schedule.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <schedule.h>
+
+DownloadScheduler::DownloadScheduler(
+    int _perHub
+)
+    :   perHub(std::max(0, _perHub))
+{
+}
+
+void DownloadScheduler::add(
+    int index,
+    const std::string &busPath,
+    double expected
+) {
+    Job job;
+    job.index = index;
+    job.expected = expected;
+    hubsOf(busPath, job.hubs);
+
+    // keep jobs longest first, ties in the order they came
+    auto at = std::upper_bound(
+        jobs.begin(),
+        jobs.end(),
+        expected,
+        [](double e, const Job &j) {
+            return j.expected<e;
+        }
+    );
+    jobs.insert(at, std::move(job));
+}
+
+int DownloadScheduler::next() {
+    for(auto job=jobs.begin(); job!=jobs.end(); ++job) {
+
+        // longest one whose hubs all have room
+        auto fits = true;
+        for(auto &hub:job->hubs) {
+            fits = fits && (0==perHub || busy[hub]<perHub);
+        }
+        if(false==fits) {
+            continue;
+        }
+        for(auto &hub:job->hubs) {
+            ++busy[hub];
+        }
+        auto index = job->index;
+        running[index] = std::move(job->hubs);
+        jobs.erase(job);
+        return index;
+    }
+    return -1;
+}
+
+void DownloadScheduler::finish(
+    int index
+) {
+    auto job = running.find(index);
+    if(running.end()==job) {
+        return;
+    }
+    for(auto &hub:job->second) {
+        --busy[hub];
+    }
+    running.erase(job);
+}
+
+void DownloadScheduler::hubsOf(
+    const std::string &busPath,
+    std::vector<std::string> &hubs
+) {
+    hubs.clear();
+    for(auto dot=busPath.find('.'); std::string::npos!=dot; dot=busPath.find('.', 1 + dot)) {
+        hubs.push_back(busPath.substr(0, dot));
+    }
+}
+
+DurationHistory::DurationHistory() {
+}
+
+void DurationHistory::open(
+    const char *_path
+) {
+    std::lock_guard<std::mutex> guard(lock);
+    path = (0==_path ? "" : _path);
+    if(path.empty()) {
+        return;
+    }
+    auto fp = fopen(path.c_str(), "r");
+    if(0==fp) {
+        LOG_NFO("no download durations at %s yet", path.c_str());
+        return;
+    }
+
+    // busPath seconds
+    char line[256];
+    while(0!=fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = 0;
+        auto tab = strchr(line, '\t');
+        if(0==tab) {
+            LOG_WRN("ignoring malformed line in download durations %s", path.c_str());
+            continue;
+        }
+        *tab = 0;
+        durations[line] = std::max(0.0, atof(1 + tab));
+    }
+    fclose(fp);
+    LOG_NFO("download durations %s know %d meters", path.c_str(), (int)durations.size());
+}
+
+double DurationHistory::expected(
+    const std::string &busPath
+) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto i = durations.find(busPath);
+    if(durations.end()!=i) {
+        return i->second;
+    }
+
+    // never seen: as slow as the slowest we know
+    auto slowest = 0.0;
+    for(auto &d:durations) {
+        slowest = std::max(slowest, d.second);
+    }
+    return slowest;
+}
+
+void DurationHistory::record(
+    const std::string &busPath,
+    double seconds
+) {
+    // halfway between what it was and what it is, meters fill up slowly
+    std::lock_guard<std::mutex> guard(lock);
+    auto i = durations.find(busPath);
+    if(durations.end()==i) {
+        durations[busPath] = seconds;
+    } else {
+        i->second = 0.5*(i->second + seconds);
+    }
+    save();
+}
+
+void DurationHistory::save() {
+    if(path.empty()) {
+        return;
+    }
+
+    // new durations next to the old ones, and swap them in
+    auto tmpPath = path + ".tmp";
+    auto fp = fopen(tmpPath.c_str(), "w");
+    if(0==fp) {
+        LOG_WRN("failed to create download durations %s", tmpPath.c_str());
+        return;
+    }
+    for(auto &d:durations) {
+        fprintf(fp, "%s\t%.3f\n", d.first.c_str(), d.second);
+    }
+    auto ok = (0==fflush(fp) && 0==ferror(fp));
+    ok = (0==fclose(fp)) && ok;
+    ok = ok && (0==rename(tmpPath.c_str(), path.c_str()));
+    if(false==ok) {
+        LOG_WRN("failed to write download durations %s", path.c_str());
+        unlink(tmpPath.c_str());
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef __SCHEDULE_H__
+    #define __SCHEDULE_H__
+
+    /*
+
+         which meter to download from next, when a station has many of them
+
+         meters behind the same hub share its upstream link and the host
+         controller queues behind it, while meters on different buses, or
+         on root ports of their own, don't get in each other's way at all.
+         a hub is known by its bus path (see lock.h): every '.' in a
+         meter's bus path closes one, "3-1.2.4" sits behind hubs "3-1" and
+         "3-1.2". at most perHub downloads run behind any one hub at a
+         time, the rest wait for one of them to be over.
+
+         among the downloads that may start, the one expected to take the
+         longest goes first (longest processing time first), so a big meter
+         doesn't get started last and keep the whole station waiting on it.
+         how long a meter takes comes from DurationHistory: the time its
+         last downloads took, smoothed, keyed by bus path since that's all
+         there is to know before talking to it, and stations keep meters
+         in the same ports. a meter never seen before is expected to take
+         as long as the slowest one known, so it rather goes early.
+
+         history lives in memory for the whole process, and in a file if
+         given one: one line per bus path, tab separated, rewritten whole
+         (tmp + rename) on every record().
+
+     */
+
+    #include <mutex>
+    #include <string>
+    #include <vector>
+    #include <unordered_map>
+
+    struct DownloadScheduler {
+
+        // at most perHub downloads behind any one hub, 0: no limit
+        DownloadScheduler(int perHub);
+
+        // a download to schedule, from the meter plugged in at busPath
+        void add(int index, const std::string &busPath, double expected);
+
+        // download to start now, -1 if none can until another one is over
+        int next();
+
+        // download index is over, its hubs have room again
+        void finish(int index);
+
+        // downloads added but not started yet
+        size_t waiting() const { return jobs.size(); }
+
+        // hubs between busPath and its root port ("3-1.2.4": "3-1" and "3-1.2")
+        static void hubsOf(const std::string &busPath, std::vector<std::string> &hubs);
+
+    private:
+        struct Job {
+            int index;
+            double expected;
+            std::vector<std::string> hubs;
+        };
+
+        int perHub;
+        std::vector<Job> jobs;                              // longest first
+        std::unordered_map<int, std::vector<std::string>> running;
+        std::unordered_map<std::string, int> busy;          // downloads running behind each hub
+    };
+
+    struct DurationHistory {
+
+        DurationHistory();
+
+        // load durations from path, and save them there from now on (null: memory only)
+        void open(const char *path);
+
+        // seconds a download from the meter at busPath is expected to take
+        double expected(const std::string &busPath);
+
+        // a download from the meter at busPath went through in seconds
+        void record(const std::string &busPath, double seconds);
+
+    private:
+        void save();
+
+        std::mutex lock;
+        std::string path;
+        std::unordered_map<std::string, double> durations;
+    };
+
+#endif // __SCHEDULE_H__
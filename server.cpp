@@ -0,0 +1,346 @@
+/*
+
+     local unix socket sample server, see server.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <server.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <sys/socket.h>
+
+SampleServer::SampleServer()
+    :   loop(0),
+        sortedPrefix(0),
+        listenFd(-1),
+        wakeFds{ -1, -1 },
+        stopping(false)
+{
+}
+
+SampleServer::~SampleServer() {
+    stop();
+}
+
+void SampleServer::preload(
+    std::vector<ArchiveRecord> &&records
+) {
+    std::unique_lock<std::mutex> guard(lock);
+    log = std::move(records);
+    sortedPrefix = log.size();
+}
+
+bool SampleServer::start(
+    const char *socketPath,
+    EventLoop *_loop
+) {
+    // socket address
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(sizeof(addr.sun_path)<=strlen(socketPath)) {
+        LOG_WRN("socket path %s is too long", socketPath);
+        return false;
+    }
+    strcpy(addr.sun_path, socketPath);
+
+    // listen, after getting rid of whatever a previous run left behind
+    unlink(socketPath);
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    auto ok = (
+        0<=listenFd                                             &&
+        0==bind(listenFd, (sockaddr *)&addr, sizeof(addr))      &&
+        0==listen(listenFd, 16)                                 &&
+        0==pipe2(wakeFds, O_NONBLOCK | O_CLOEXEC)
+    );
+    if(false==ok) {
+        LOG_WRN("failed to listen on %s: %s", socketPath, strerror(errno));
+        stop();
+        return false;
+    }
+    path = socketPath;
+
+    // serve on the loop we're given, or on one of our own from a thread
+    stopping = false;
+    loop = _loop;
+    if(0==loop) {
+        ownLoop.reset(new EventLoop);
+        loop = ownLoop.get();
+    }
+    loop->watch(
+        listenFd,
+        EPOLLIN,
+        [this](uint32_t) {
+            accept();
+            pump();
+        }
+    );
+    loop->watch(
+        wakeFds[0],
+        EPOLLIN,
+        [this](uint32_t) {
+            char buf[256];
+            while(0<read(wakeFds[0], buf, sizeof(buf))) {
+            }
+            pump();
+        }
+    );
+    if(ownLoop) {
+        thread = std::thread([this]() { loop->run(); });
+    }
+    LOG_NFO("serving samples on %s", socketPath);
+    return true;
+}
+
+void SampleServer::stop() {
+    if(thread.joinable()) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake();
+        thread.join();
+    }
+    for(auto &it:clients) {
+        loop->unwatch(it.first);
+        close(it.first);
+    }
+    clients.clear();
+    for(auto fd:{ listenFd, wakeFds[0], wakeFds[1] }) {
+        if(0<=fd) {
+            if(loop) {
+                loop->unwatch(fd);
+            }
+            close(fd);
+        }
+    }
+    listenFd = wakeFds[0] = wakeFds[1] = -1;
+    ownLoop.reset();
+    loop = 0;
+    if(0<path.size()) {
+        unlink(path.c_str());
+        path.clear();
+    }
+}
+
+void SampleServer::publish(
+    const ArchiveRecord *records,
+    size_t count
+) {
+    if(0==count) {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        log.insert(log.end(), records, count + records);
+    }
+    wake();
+}
+
+void SampleServer::wake() {
+    char c = 0;
+    if(0<=wakeFds[1]) {
+        auto n = write(wakeFds[1], &c, 1);
+        (void)n; // pipe full means a wake up is already pending
+    }
+}
+
+void SampleServer::pump() {
+
+    // top everyone up from the log, and push out what we can right away
+    size_t logSize = 0;
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        if(stopping) {
+            loop->stop();   // only ever set when the loop is our own
+            return;
+        }
+        logSize = log.size();
+        for(auto &it:clients) {
+            fill(it.second);
+        }
+    }
+    std::vector<int> dead;
+    for(auto &it:clients) {
+        auto &client = it.second;
+        if(false==send(client)) {
+            dead.push_back(it.first);
+            continue;
+        }
+
+        // wait for requests, hang ups, and room to write (to send
+        // what's queued or catch up with the log)
+        uint32_t events = EPOLLIN;
+        auto behind = (client.subscribed && client.cursor<logSize);
+        if(behind || client.outOffset<client.out.size()) {
+            events |= EPOLLOUT;
+        }
+        loop->modify(it.first, events);
+    }
+    for(auto fd:dead) {
+        drop(fd);
+    }
+}
+
+void SampleServer::accept() {
+    while(true) {
+        auto fd = accept4(listenFd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd<0) {
+            break;
+        }
+        Client client;
+        client.fd = fd;
+        client.subscribed = false;
+        client.live = false;
+        client.since = 0;
+        client.cursor = 0;
+        client.outOffset = 0;
+        clients[fd] = std::move(client);
+        loop->watch(
+            fd,
+            EPOLLIN,
+            [this, fd](uint32_t events) {
+
+                // subscriber requests and hang ups, pump sends
+                auto it = clients.find(fd);
+                if(clients.end()==it) {
+                    return;
+                }
+                if((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && false==receive(it->second)) {
+                    drop(fd);
+                }
+                pump();
+            }
+        );
+        LOG_DBG("subscriber connected on fd %d", fd);
+    }
+}
+
+void SampleServer::drop(
+    int fd
+) {
+    loop->unwatch(fd);
+    close(fd);
+    clients.erase(fd);
+}
+
+bool SampleServer::receive(
+    Client &client
+) {
+    // read what's there
+    uint8_t buf[256];
+    while(true) {
+        auto n = recv(client.fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if(0<n) {
+            client.in.insert(client.in.end(), buf, n + buf);
+            continue;
+        }
+        if(0==n || (EAGAIN!=errno && EWOULDBLOCK!=errno)) {
+            LOG_DBG("subscriber on fd %d went away", client.fd);
+            return false;
+        }
+        break;
+    }
+
+    // handle complete frames
+    size_t offset = 0;
+    while(sizeof(ServerFrameHeader)<=client.in.size()-offset) {
+        ServerFrameHeader header;
+        memcpy(&header, offset + client.in.data(), sizeof(header));
+        if(64<header.length) {
+            LOG_WRN("subscriber on fd %d sent an oversized frame, dropping it", client.fd);
+            return false;
+        }
+        auto frameSize = (sizeof(header) + header.length);
+        if(client.in.size()-offset<frameSize) {
+            break;
+        }
+        auto payload = (offset + sizeof(header) + client.in.data());
+        if(kFrameSubscribe==header.type && sizeof(int64_t)==header.length && false==client.subscribed) {
+            memcpy(&client.since, payload, sizeof(int64_t));
+            client.subscribed = true;
+
+            // history starts sorted, skip straight to since in that part
+            std::unique_lock<std::mutex> guard(lock);
+            auto first = std::lower_bound(
+                log.begin(),
+                sortedPrefix + log.begin(),
+                client.since,
+                [](const ArchiveRecord &r, int64_t epoch) { return r.epoch<epoch; }
+            );
+            client.cursor = (first - log.begin());
+        }
+        offset += frameSize;
+    }
+    client.in.erase(client.in.begin(), offset + client.in.begin());
+    return true;
+}
+
+void SampleServer::fill(
+    Client &client
+) {
+    if(false==client.subscribed) {
+        return;
+    }
+
+    // reclaim what was already sent
+    if(client.outOffset==client.out.size()) {
+        client.out.clear();
+        client.outOffset = 0;
+    }
+
+    // batches of records, as long as the subscriber keeps up
+    auto &out = client.out;
+    while(client.cursor<log.size() && out.size()-client.outOffset<kMaxPending) {
+        auto start = out.size();
+        out.resize(start + sizeof(ServerFrameHeader));
+        size_t count = 0;
+        while(client.cursor<log.size() && count<kBatchRecords) {
+            auto &r = log[client.cursor++];
+            if(client.since<=r.epoch) {
+                auto p = (const uint8_t *)&r;
+                out.insert(out.end(), p, sizeof(r) + p);
+                ++count;
+            }
+        }
+        if(0==count) {
+            out.resize(start);
+            continue;
+        }
+        ServerFrameHeader header = { uint32_t(count*sizeof(ArchiveRecord)), kFrameSamples };
+        memcpy(start + out.data(), &header, sizeof(header));
+    }
+
+    // history done, tell subscriber what follows is live
+    if(false==client.live && client.cursor==log.size()) {
+        ServerFrameHeader header = { 0, kFrameLive };
+        auto p = (const uint8_t *)&header;
+        out.insert(out.end(), p, sizeof(header) + p);
+        client.live = true;
+    }
+}
+
+bool SampleServer::send(
+    Client &client
+) {
+    while(client.outOffset<client.out.size()) {
+        auto n = ::send(
+            client.fd,
+            client.outOffset + client.out.data(),
+            client.out.size() - client.outOffset,
+            MSG_DONTWAIT | MSG_NOSIGNAL
+        );
+        if(n<0) {
+            return (EAGAIN==errno || EWOULDBLOCK==errno);
+        }
+        client.outOffset += n;
+    }
+    return true;
+}
+
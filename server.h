@@ -0,0 +1,107 @@
+#ifndef __SERVER_H__
+    #define __SERVER_H__
+
+    /*
+
+         local unix socket server handing out archive records to live consumers
+
+         everything on the wire is a frame: a ServerFrameHeader followed by
+         length bytes of payload.
+
+             client -> server   kFrameSubscribe, payload: int64 since epoch
+             server -> client   kFrameSamples,   payload: ArchiveRecord[]
+                                kFrameLive,      empty: history sent, what
+                                                 follows is freshly published
+
+         a subscriber first gets every known record at or after its since
+         epoch, in batches of up to kBatchRecords, then each record as it is
+         published.
+
+         published records go to a single append-only log, and each
+         subscriber only holds a cursor into it. frames are built from the
+         log only while a subscriber's socket keeps up (at most kMaxPending
+         bytes queued), so a slow consumer lags behind without slowing the
+         producer, other consumers or buffering a copy of the history.
+
+         the server runs on an event loop (see loop.h): its own, on a
+         thread of its own, or one it shares with other work such as
+         meter downloads, from that loop's thread.
+
+     */
+
+    #include <loop.h>
+    #include <mutex>
+    #include <memory>
+    #include <string>
+    #include <thread>
+    #include <vector>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <archive.h>
+    #include <unordered_map>
+
+    struct ServerFrameHeader {
+        uint32_t length;    // payload bytes
+        uint32_t type;
+    } __attribute__((packed));
+
+    struct SampleServer {
+
+        static constexpr uint32_t kFrameSubscribe = 1;
+        static constexpr uint32_t kFrameSamples = 2;
+        static constexpr uint32_t kFrameLive = 3;
+
+        static constexpr size_t kBatchRecords = 1024;
+        static constexpr size_t kMaxPending = (256*1024);
+
+        SampleServer();
+        ~SampleServer();
+
+        // seed history with records (sorted by epoch), before start
+        void preload(std::vector<ArchiveRecord> &&records);
+
+        // listen on socketPath (replacing any stale socket) and serve on loop,
+        // or from a thread with a loop of its own if loop is null
+        bool start(const char *socketPath, EventLoop *loop = 0);
+
+        // disconnect everyone, remove socket (from the loop's thread if it isn't ours)
+        void stop();
+
+        // hand new records to every subscriber, from any thread
+        void publish(const ArchiveRecord *records, size_t count);
+
+    private:
+        struct Client {
+            int fd;
+            bool subscribed;
+            bool live;
+            int64_t since;
+            size_t cursor;
+            std::vector<uint8_t> in;
+            std::vector<uint8_t> out;
+            size_t outOffset;
+        };
+
+        void pump();
+        void accept();
+        void drop(int fd);
+        bool receive(Client &client);
+        bool send(Client &client);
+        void fill(Client &client);
+        void wake();
+
+        std::mutex lock;
+        std::thread thread;
+        EventLoop *loop;
+        std::unique_ptr<EventLoop> ownLoop;
+        std::vector<ArchiveRecord> log;
+        std::unordered_map<int, Client> clients;
+        std::string path;
+        size_t sortedPrefix;
+        int listenFd;
+        int wakeFds[2];
+        bool stopping;
+    };
+
+#endif // __SERVER_H__
+
@@ -0,0 +1,287 @@
+/*
+
+     output sinks for downloaded samples, see sink.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <zlib.h>
+#include <sink.h>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <archive.h>
+#include <inttypes.h>
+
+// where formatted bytes go: a FILE or a gzip stream, into path's tmp file until published
+struct SinkStream {
+
+    SinkStream(FILE *_fp, bool _owned, const std::string &_path = "") : fp(_fp), gz(0), owned(_owned), path(_path) {}
+    SinkStream(gzFile _gz, const std::string &_path) : fp(0), gz(_gz), owned(true), path(_path) {}
+
+    // never finished: whatever was at path stays there
+    ~SinkStream() {
+        close();
+        if(false==path.empty()) {
+            unlink((path + ".tmp").c_str());
+        }
+    }
+
+    bool write(const std::string &data) {
+        if(0==data.size()) {
+            return true;
+        }
+        if(gz) {
+            return int(data.size())==gzwrite(gz, data.data(), data.size());
+        }
+        return data.size()==fwrite(data.data(), 1, data.size(), fp);
+    }
+
+    bool close() {
+        auto ok = true;
+        if(gz) {
+            ok = (Z_OK==gzclose(gz));
+            gz = 0;
+        }
+        if(fp) {
+            ok = (0==(owned ? fclose(fp) : fflush(fp))) && ok;
+            fp = 0;
+        }
+        return ok;
+    }
+
+    // close, and swap the complete file in at path once it's on disk
+    bool publish() {
+        auto ok = close();
+        if(path.empty()) {
+            return ok;
+        }
+        auto tmpPath = path + ".tmp";
+        auto fd = open(tmpPath.c_str(), O_RDONLY | O_CLOEXEC);
+        ok = ok && 0<=fd && 0==fdatasync(fd);
+        if(0<=fd) {
+            ::close(fd);
+        }
+        ok = ok && (0==rename(tmpPath.c_str(), path.c_str()));
+        if(false==ok) {
+            LOG_WRN("failed to publish %s", path.c_str());
+        }
+        path.clear();
+        unlink(tmpPath.c_str());
+        return ok;
+    }
+
+    FILE *fp;
+    gzFile gz;
+    bool owned;
+    std::string path;   // empty for streams we don't own
+};
+
+// common part of all formats: one buffer per segment, one write per buffer
+struct FormattedSink:public SampleSink {
+
+    FormattedSink(SinkStream *_stream) : stream(_stream), written(true) {}
+
+    bool write(const AccuChekSample *samples, size_t count, uint32_t deviceId) override {
+        buffer.clear();
+        for(size_t i=0; i<count; ++i) {
+            format(samples[i], deviceId);
+        }
+        return put();
+    }
+
+    // a file missing any part of what went into it never gets published
+    bool finish() override {
+        buffer.clear();
+        trailer();
+        if(false==put()) {
+            LOG_WRN("output is incomplete, not publishing it");
+            stream->close();
+            return false;
+        }
+        return stream->publish();
+    }
+
+protected:
+    virtual void format(const AccuChekSample &sample, uint32_t deviceId) = 0;
+    virtual void trailer() {}
+
+    // write buffer out, false if it or anything before it didn't make it
+    bool put() {
+        written = stream->write(buffer) && written;
+        return written;
+    }
+
+    // printf to buffer
+    void print(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+        char line[256];
+        va_list args;
+        va_start(args, format);
+        auto n = vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+        buffer.append(line, std::min(n, int(sizeof(line)) - 1));
+    }
+
+    std::unique_ptr<SinkStream> stream;
+    std::string buffer;
+    bool written;       // every write so far went through
+};
+
+// the classic output
+struct JsonSink:public FormattedSink {
+
+    JsonSink(SinkStream *stream) : FormattedSink(stream), lineCount(0) {
+        buffer = "[";
+        put();
+    }
+
+    void format(const AccuChekSample &sample, uint32_t) override {
+        if(0!=sample.status) {
+            return;
+        }
+        auto vv = sample.mgdl;
+        print(
+            "%s\n    { \"id\":%6d, \"epoch\":%11" PRIu64 ", \"timestamp\":\"%04d/%02d/%02d %02d:%02d\", \"mg/dL\":%3d, \"mmol/L\":%10.6f }",
+            (0==lineCount ? "" : ","),
+            lineCount,
+            (uint64_t)sample.epoch,
+            (int)sample.year,
+            (int)sample.month,
+            (int)sample.day,
+            (int)sample.hour,
+            (int)sample.minute,
+            (int)vv,
+            (vv / 18.0)
+        );
+        ++lineCount;
+    }
+
+    void trailer() override {
+        buffer += "\n]\n";
+    }
+
+    int lineCount;
+};
+
+// one object per line
+struct NdjsonSink:public FormattedSink {
+
+    NdjsonSink(SinkStream *stream) : FormattedSink(stream) {}
+
+    void format(const AccuChekSample &sample, uint32_t deviceId) override {
+        if(0!=sample.status) {
+            return;
+        }
+        print(
+            "{\"device\":\"0x%08x\",\"epoch\":%" PRIu64 ",\"timestamp\":\"%04d/%02d/%02d %02d:%02d\",\"mg/dL\":%d,\"mmol/L\":%.6f}\n",
+            deviceId,
+            (uint64_t)sample.epoch,
+            (int)sample.year,
+            (int)sample.month,
+            (int)sample.day,
+            (int)sample.hour,
+            (int)sample.minute,
+            (int)sample.mgdl,
+            (sample.mgdl / 18.0)
+        );
+    }
+};
+
+// spreadsheet friendly
+struct CsvSink:public FormattedSink {
+
+    CsvSink(SinkStream *stream) : FormattedSink(stream) {
+        buffer = "device,epoch,timestamp,mg/dL,mmol/L\n";
+        put();
+    }
+
+    void format(const AccuChekSample &sample, uint32_t deviceId) override {
+        if(0!=sample.status) {
+            return;
+        }
+        print(
+            "0x%08x,%" PRIu64 ",%04d-%02d-%02d %02d:%02d,%d,%.6f\n",
+            deviceId,
+            (uint64_t)sample.epoch,
+            (int)sample.year,
+            (int)sample.month,
+            (int)sample.day,
+            (int)sample.hour,
+            (int)sample.minute,
+            (int)sample.mgdl,
+            (sample.mgdl / 18.0)
+        );
+    }
+};
+
+// archive records, straight
+struct BinarySink:public FormattedSink {
+
+    BinarySink(SinkStream *stream) : FormattedSink(stream) {}
+
+    void format(const AccuChekSample &sample, uint32_t deviceId) override {
+        ArchiveRecord r;
+        r.epoch = sample.epoch;
+        r.deviceId = deviceId;
+        r.mgdl = sample.mgdl;
+        r.status = sample.status;
+        buffer.append((const char *)&r, sizeof(r));
+    }
+};
+
+SampleSink *SampleSink::create(
+    const char *spec,
+    FILE *out
+) {
+    // FORMAT:PATH
+    auto colon = strchr(spec, ':');
+    if(0==colon) {
+        LOG_WRN("bad sink %s, expected FORMAT:PATH", spec);
+        return 0;
+    }
+    std::string format(spec, colon);
+    std::string path(1 + colon);
+    auto known = ("json"==format || "ndjson"==format || "csv"==format || "bin"==format);
+    if(false==known) {
+        LOG_WRN("unknown sink format %s", format.c_str());
+        return 0;
+    }
+    auto gzipped = (3<path.size() && 0==path.compare(path.size()-3, 3, ".gz"));
+
+    // stream
+    SinkStream *stream = 0;
+    if("-"==path) {
+        stream = new SinkStream(out, false);
+    } else if(gzipped) {
+        auto gz = gzopen((path + ".tmp").c_str(), "wb");
+        if(gz) {
+            gzbuffer(gz, 256*1024);
+            stream = new SinkStream(gz, path);
+        }
+    } else {
+        auto fp = fopen((path + ".tmp").c_str(), "wb");
+        if(fp) {
+            stream = new SinkStream(fp, true, path);
+        }
+    }
+    if(0==stream) {
+        LOG_WRN("failed to create sink output %s", path.c_str());
+        return 0;
+    }
+
+    // format
+    if("json"==format) {
+        return new JsonSink(stream);
+    } else if("ndjson"==format) {
+        return new NdjsonSink(stream);
+    } else if("csv"==format) {
+        return new CsvSink(stream);
+    }
+    return new BinarySink(stream);
+}
+
@@ -0,0 +1,50 @@
+#ifndef __SINK_H__
+    #define __SINK_H__
+
+    /*
+
+         output sinks for downloaded samples
+
+         a sink gets whole segments of samples at a time, formats each into
+         one buffer and hands it to its stream in a single write. any number
+         of sinks can hang off one download.
+
+         sinks are created from "FORMAT:PATH" specs:
+
+             json     the classic output, an array of { id, epoch, timestamp, mg/dL, mmol/L }
+             ndjson   one JSON object per line, with device
+             csv      device,epoch,timestamp,mg/dL,mmol/L with a header line
+             bin      raw 16 byte archive records (see archive.h), invalid readings included
+
+         PATH "-" is standard output, a PATH ending in ".gz" is gzip compressed
+         on the fly. text formats only carry valid readings, like the classic
+         output.
+
+         files get written to PATH.tmp and renamed to PATH once finished and
+         synced: PATH only ever holds a complete output, the previous one
+         until then, so nobody picks up half a download.
+
+     */
+
+    #include <stdio.h>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <accuchek.h>
+
+    struct SampleSink {
+
+        virtual ~SampleSink() {}
+
+        // one decoded segment from device deviceId
+        virtual bool write(const AccuChekSample *samples, size_t count, uint32_t deviceId) = 0;
+
+        // write trailer and flush, after the last segment, and publish the file
+        virtual bool finish() = 0;
+
+        // build sink from spec, out being what "-" stands for
+        // returns null (and says why) on a bad spec or unwritable path
+        static SampleSink *create(const char *spec, FILE *out);
+    };
+
+#endif // __SINK_H__
+
@@ -0,0 +1,406 @@
+/*
+
+     mergeable quantile sketches, see sketch.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <math.h>
+#include <algorithm>
+#include <time.h>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include <rollup.h>
+#include <sketch.h>
+
+// sketch file magic
+static const char kMagic[8] = { 'A', 'C', 'C', 'U', 'S', 'K', 'C', '2' };
+
+TDigest::TDigest(
+    double _compression
+)
+    :   compression(_compression),
+        total(0),
+        bufferedWeight(0),
+        min(0),
+        max(0)
+{
+}
+
+void TDigest::add(
+    double x,
+    double weight
+) {
+    if(0==count()) {
+        min = max = x;
+    }
+    min = std::min(min, x);
+    max = std::max(max, x);
+    buffer.push_back({ x, weight });
+    bufferedWeight += weight;
+    if(5*compression<buffer.size()) {
+        compress();
+    }
+}
+
+void TDigest::merge(
+    const TDigest &other
+) {
+    if(0==other.count()) {
+        return;
+    }
+    if(0==count()) {
+        min = other.min;
+        max = other.max;
+    }
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    buffer.insert(buffer.end(), other.centroids.begin(), other.centroids.end());
+    buffer.insert(buffer.end(), other.buffer.begin(), other.buffer.end());
+    bufferedWeight += other.count();
+    if(5*compression<buffer.size()) {
+        compress();
+    }
+}
+
+void TDigest::compress() {
+    if(0==buffer.size()) {
+        return;
+    }
+
+    // everything we have, in order
+    buffer.insert(buffer.end(), centroids.begin(), centroids.end());
+    std::sort(
+        buffer.begin(),
+        buffer.end(),
+        [](const Centroid &a, const Centroid &b) { return a.mean<b.mean; }
+    );
+    total += bufferedWeight;
+    bufferedWeight = 0;
+
+    // k1 scale function: centroids may hold more weight around the median than at the tails
+    auto k = [&](double q) { return compression / (2*M_PI) * asin(2*q - 1); };
+    auto kInverse = [&](double v) { return (sin(v * (2*M_PI) / compression) + 1) / 2; };
+
+    // greedily merge neighbours as long as they fit under the limit
+    centroids.clear();
+    auto current = buffer[0];
+    auto weightSoFar = 0.0;
+    auto limit = total * kInverse(k(0) + 1);
+    for(size_t i=1; i<buffer.size(); ++i) {
+        auto &next = buffer[i];
+        if(weightSoFar + current.weight + next.weight<=limit) {
+            auto w = (current.weight + next.weight);
+            current.mean += (next.mean - current.mean) * next.weight / w;
+            current.weight = w;
+        } else {
+            weightSoFar += current.weight;
+            centroids.push_back(current);
+            limit = total * kInverse(k(weightSoFar / total) + 1);
+            current = next;
+        }
+    }
+    centroids.push_back(current);
+    buffer.clear();
+}
+
+double TDigest::quantile(
+    double q
+) {
+    compress();
+    if(0==centroids.size()) {
+        return NAN;
+    }
+    if(1==centroids.size()) {
+        return centroids[0].mean;
+    }
+
+    // interpolate between centroid centers, and between extreme centroids and min / max
+    auto target = (q * total);
+    auto &first = centroids.front();
+    if(target<=first.weight/2) {
+        return min + (first.mean - min) * target / (first.weight/2);
+    }
+    auto cumulated = 0.0;
+    for(size_t i=0; i+1<centroids.size(); ++i) {
+        auto &c0 = centroids[i];
+        auto &c1 = centroids[i+1];
+        auto left = (cumulated + c0.weight/2);
+        auto right = (cumulated + c0.weight + c1.weight/2);
+        if(target<=right) {
+            auto fraction = (target - left) / (right - left);
+            return c0.mean + fraction * (c1.mean - c0.mean);
+        }
+        cumulated += c0.weight;
+    }
+    auto &last = centroids.back();
+    auto left = (total - last.weight/2);
+    auto fraction = std::min(1.0, (target - left) / std::max(1e-9, total - left));
+    return last.mean + fraction * (max - last.mean);
+}
+
+// raw little endian doubles / ints in and out of byte buffers
+template<typename T> static void put(
+    std::vector<uint8_t> &out,
+    T v
+) {
+    auto p = (const uint8_t *)&v;
+    out.insert(out.end(), p, sizeof(v) + p);
+}
+template<typename T> static bool get(
+    const uint8_t *&p,
+    const uint8_t *end,
+    T &v
+) {
+    if(size_t(end-p)<sizeof(v)) {
+        return false;
+    }
+    memcpy(&v, p, sizeof(v));
+    p += sizeof(v);
+    return true;
+}
+
+void TDigest::write(
+    std::vector<uint8_t> &out
+) {
+    compress();
+    put(out, compression);
+    put(out, total);
+    put(out, min);
+    put(out, max);
+    put(out, uint32_t(centroids.size()));
+    for(auto &c:centroids) {
+        put(out, c.mean);
+        put(out, c.weight);
+    }
+}
+
+bool TDigest::read(
+    const uint8_t *&p,
+    const uint8_t *end
+) {
+    uint32_t n = 0;
+    auto ok = (
+        get(p, end, compression)    &&
+        get(p, end, total)          &&
+        get(p, end, min)            &&
+        get(p, end, max)            &&
+        get(p, end, n)              &&
+        size_t(n)*16<=size_t(end-p)
+    );
+    if(false==ok) {
+        return false;
+    }
+    centroids.resize(n);
+    for(auto &c:centroids) {
+        get(p, end, c.mean);
+        get(p, end, c.weight);
+    }
+    buffer.clear();
+    bufferedWeight = 0;
+    return true;
+}
+
+void QuantileSketches::add(
+    const ArchiveRecord &record
+) {
+    // only valid readings count
+    if(0!=record.status) {
+        return;
+    }
+
+    // local month and time of day
+    time_t local = (record.epoch + Rollups::utcOffset(record.epoch));
+    struct tm t;
+    gmtime_r(&local, &t);
+    Key key = {
+        record.deviceId,
+        monthIndex(1900 + t.tm_year, 1 + t.tm_mon),
+        (t.tm_hour*60 + t.tm_min) / kSlotMinutes
+    };
+    sketches[key].add(record.mgdl);
+}
+
+void QuantileSketches::slots(
+    bool allDevices,
+    uint32_t deviceId,
+    int32_t fromMonth,
+    int32_t toMonth,
+    std::vector<TDigest> &result
+) {
+    result.resize(kNbSlots);
+    for(auto &it:sketches) {
+        auto &key = it.first;
+        auto match = (
+            (allDevices || deviceId==key.deviceId)  &&
+            fromMonth<=key.month                    &&
+            key.month<=toMonth
+        );
+        if(match) {
+            result[key.slot].merge(it.second);
+        }
+    }
+}
+
+// where the sketches of an archive live
+static auto sketchPath(
+    const char *archivePath
+) {
+    return std::string(archivePath) + ".sketch";
+}
+
+bool QuantileSketches::read(
+    const char *archivePath,
+    ArchiveCoverage &coverage
+) {
+    sketches.clear();
+
+    // slurp file
+    auto path = sketchPath(archivePath);
+    auto fp = fopen(path.c_str(), "rb");
+    if(0==fp) {
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t chunk[65536];
+    while(true) {
+        auto n = fread(chunk, 1, sizeof(chunk), fp);
+        if(0==n) {
+            break;
+        }
+        data.insert(data.end(), chunk, n + chunk);
+    }
+    fclose(fp);
+
+    // header and coverage, then (key, digest) pairs
+    const uint8_t *p = data.data();
+    auto end = (data.size() + p);
+    auto ok = (sizeof(kMagic)<=data.size() && 0==memcmp(p, kMagic, sizeof(kMagic)));
+    p += std::min(sizeof(kMagic), data.size());
+    ok = ok && get(p, end, coverage);
+    while(ok && p<end) {
+        Key key;
+        ok = (
+            get(p, end, key.deviceId)   &&
+            get(p, end, key.month)      &&
+            get(p, end, key.slot)       &&
+            0<=key.slot                 &&
+            key.slot<kNbSlots           &&
+            sketches[key].read(p, end)
+        );
+    }
+    if(false==ok) {
+        LOG_WRN("%s is not a sketch file", path.c_str());
+        sketches.clear();
+    }
+    return ok;
+}
+
+void QuantileSketches::compute(
+    const ArchiveReader &reader
+) {
+    sketches.clear();
+    for(auto &block:reader.blocks()) {
+        for(uint32_t i=0; i<block.count; ++i) {
+            add(block.records[i]);
+        }
+    }
+}
+
+bool QuantileSketches::load(
+    const char *archivePath
+) {
+    ArchiveReader reader;
+    if(false==reader.open(archivePath)) {
+        sketches.clear();
+        return false;
+    }
+    auto coverage = ArchiveCoverage::of(reader);
+    ArchiveCoverage stored;
+    if(read(archivePath, stored) && stored==coverage) {
+        return true;
+    }
+
+    // missing or behind: what the archive holds is what counts, keep it for next time if we can
+    if(0<coverage.records) {
+        LOG_WRN("sketches of %s missing or out of date, rebuilding them", archivePath);
+    }
+    compute(reader);
+    save(archivePath, coverage);
+    return true;
+}
+
+bool QuantileSketches::save(
+    const char *archivePath,
+    const ArchiveCoverage &coverage
+) {
+    std::vector<uint8_t> data(kMagic, sizeof(kMagic) + kMagic);
+    put(data, coverage);
+    for(auto &it:sketches) {
+        put(data, it.first.deviceId);
+        put(data, it.first.month);
+        put(data, it.first.slot);
+        it.second.write(data);
+    }
+
+    auto path = sketchPath(archivePath);
+    auto tmpPath = path + ".tmp";
+    auto fp = fopen(tmpPath.c_str(), "wb");
+    if(0==fp) {
+        LOG_WRN("failed to create %s", tmpPath.c_str());
+        return false;
+    }
+    auto ok = (data.size()==fwrite(data.data(), 1, data.size(), fp));
+    ok = (0==fclose(fp)) && ok;
+    ok = ok && (0==rename(tmpPath.c_str(), path.c_str()));
+    if(false==ok) {
+        LOG_WRN("failed to write %s", path.c_str());
+        remove(tmpPath.c_str());
+    }
+    return ok;
+}
+
+bool QuantileSketches::update(
+    const char *archivePath,
+    const std::vector<ArchiveRecord> &records,
+    const ArchiveCoverage &before
+) {
+    ArchiveReader reader;
+    if(false==reader.open(archivePath)) {
+        return false;
+    }
+    auto after = ArchiveCoverage::of(reader);
+
+    // in step with the archive before the append: only the new readings need adding
+    QuantileSketches sketches;
+    ArchiveCoverage stored;
+    auto known = sketches.read(archivePath, stored);
+    if(known && stored==after) {
+        return true;
+    }
+    if(known && stored==before) {
+        for(auto &r:records) {
+            sketches.add(r);
+        }
+    } else {
+        if(0<before.records) {
+            LOG_WRN("sketches of %s missing or out of date, rebuilding them", archivePath);
+        }
+        sketches.compute(reader);
+    }
+    return sketches.save(archivePath, after);
+}
+
+bool QuantileSketches::rebuild(
+    const char *archivePath
+) {
+    ArchiveReader reader;
+    if(false==reader.open(archivePath)) {
+        return false;
+    }
+    QuantileSketches sketches;
+    sketches.compute(reader);
+    return sketches.save(archivePath, ArchiveCoverage::of(reader));
+}
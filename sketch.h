@@ -0,0 +1,123 @@
+#ifndef __SKETCH_H__
+    #define __SKETCH_H__
+
+    /*
+
+         mergeable quantile sketches for AGP-style percentile reports
+
+         TDigest is a merging t-digest: a few dozen weighted centroids,
+         small at the median and tiny at the tails, summarizing any number
+         of readings with good accuracy on the 5th/95th percentiles.
+         two digests merge into one by merging their centroids.
+
+         QuantileSketches keeps one digest per device, per month and per
+         time-of-day slot, persisted next to the archive as
+         "<archive>.sketch". like rollups, the archive feeds it the
+         readings it appends. a report over any range of months, any
+         set of devices or archives, is then a merge of digests.
+
+         like rollups too, the file records the archive state it was
+         computed from (see ArchiveCoverage in archive.h), and gets
+         rebuilt from the samples when it's missing or out of step.
+
+     */
+
+    #include <map>
+    #include <vector>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <archive.h>
+
+    struct TDigest {
+
+        TDigest(double compression = 100);
+
+        void add(double x, double weight = 1);
+        void merge(const TDigest &other);
+
+        // value below which a fraction q of the readings fall
+        double quantile(double q);
+
+        // total weight seen
+        double count() const { return total + bufferedWeight; }
+
+        // (de)serialize, read returns false on garbage
+        void write(std::vector<uint8_t> &out);
+        bool read(const uint8_t *&p, const uint8_t *end);
+
+    private:
+        struct Centroid {
+            double mean;
+            double weight;
+        };
+        void compress();
+
+        double compression;
+        double total;
+        double bufferedWeight;
+        double min;
+        double max;
+        std::vector<Centroid> centroids;
+        std::vector<Centroid> buffer;
+    };
+
+    struct QuantileSketches {
+
+        // time of day slot width
+        static constexpr int kSlotMinutes = 30;
+        static constexpr int kNbSlots = (24*60) / kSlotMinutes;
+
+        // where a sketch lives: device, month (year*12 + month-1, local time), slot of day
+        struct Key {
+            uint32_t deviceId;
+            int32_t  month;
+            int32_t  slot;
+            bool operator<(const Key &o) const {
+                if(deviceId!=o.deviceId) return (deviceId<o.deviceId);
+                if(month!=o.month) return (month<o.month);
+                return (slot<o.slot);
+            }
+        };
+
+        // account for one more reading
+        void add(const ArchiveRecord &record);
+
+        // load the sketches of an archive, rebuilt (and saved, if possible) if the file is
+        // missing or not in step with the archive. false if the archive can't be read
+        bool load(const char *archivePath);
+
+        // atomically save the sketches of an archive, as computed from coverage
+        bool save(const char *archivePath, const ArchiveCoverage &coverage);
+
+        // merge every sketch matching devices / months into one digest per slot
+        // (allDevices ignores deviceId, months are inclusive)
+        void slots(
+            bool allDevices,
+            uint32_t deviceId,
+            int32_t fromMonth,
+            int32_t toMonth,
+            std::vector<TDigest> &result
+        );
+
+        // month index of a local date
+        static int32_t monthIndex(int year, int month) { return year*12 + (month - 1); }
+
+        // fold readings just appended to an archive, which was in state before, into its
+        // sketches. sketches not in step with before get rebuilt instead
+        static bool update(const char *archivePath, const std::vector<ArchiveRecord> &records, const ArchiveCoverage &before);
+
+        // recompute an archive's sketches from scratch
+        static bool rebuild(const char *archivePath);
+
+    private:
+        // sketches and coverage of the sketch file, false if missing or not a sketch file
+        bool read(const char *archivePath, ArchiveCoverage &coverage);
+
+        // sketches of every reading in the archive
+        void compute(const ArchiveReader &reader);
+
+        std::map<Key, TDigest> sketches;
+    };
+
+#endif // __SKETCH_H__
+
@@ -0,0 +1,123 @@
+#ifndef __SPSC_H__
+    #define __SPSC_H__
+
+    /*
+
+         bounded lock-free single producer / single consumer queue
+
+             SpscQueue<Item> queue(64);
+
+             // producer thread                 // consumer thread
+             auto item = queue.claim();         auto item = queue.front();
+             ... fill *item ...                 ... use *item ...
+             queue.publish();                   queue.release();
+
+         slots are allocated once, up front, and filled in place: nothing gets
+         allocated or copied twice on the way through. each side owns one
+         index and only reads the other's, so neither ever takes a lock. a
+         side that finds the queue full (producer) or empty (consumer) sleeps
+         on the other side's index with std::atomic wait, and accounts for
+         the time it spent there.
+
+     */
+
+    #include <time.h>
+    #include <atomic>
+    #include <vector>
+    #include <stddef.h>
+    #include <stdint.h>
+
+    template<typename T> struct SpscQueue {
+
+        // capacity gets rounded up to a power of two
+        SpscQueue(size_t capacity)
+            :   mask(roundUp(capacity) - 1),
+                slots(mask + 1),
+                head(0),
+                tail(0),
+                maxSize(0),
+                producerWait(0),
+                consumerWait(0)
+        {
+        }
+
+        // producer: next free slot, waits for one if the queue is full
+        T *claim() {
+            auto t = tail.load(std::memory_order_relaxed);
+            auto h = head.load(std::memory_order_acquire);
+            if(t - h > mask) {
+                auto t0 = now();
+                while(t - h > mask) {
+                    head.wait(h, std::memory_order_acquire);
+                    h = head.load(std::memory_order_acquire);
+                }
+                producerWait.fetch_add(now() - t0, std::memory_order_relaxed);
+            }
+            return &slots[t & mask];
+        }
+
+        // producer: hand the claimed slot over
+        void publish() {
+            auto t = 1 + tail.load(std::memory_order_relaxed);
+            tail.store(t, std::memory_order_release);
+            tail.notify_one();
+            auto n = t - head.load(std::memory_order_relaxed);
+            if(maxSize.load(std::memory_order_relaxed)<n) {
+                maxSize.store(n, std::memory_order_relaxed);
+            }
+        }
+
+        // consumer: oldest item, waits for one if the queue is empty
+        T *front() {
+            auto h = head.load(std::memory_order_relaxed);
+            auto t = tail.load(std::memory_order_acquire);
+            if(t==h) {
+                auto t0 = now();
+                while(t==h) {
+                    tail.wait(t, std::memory_order_acquire);
+                    t = tail.load(std::memory_order_acquire);
+                }
+                consumerWait.fetch_add(now() - t0, std::memory_order_relaxed);
+            }
+            return &slots[h & mask];
+        }
+
+        // consumer: done with the front item, its slot goes back to the producer
+        void release() {
+            head.store(1 + head.load(std::memory_order_relaxed), std::memory_order_release);
+            head.notify_one();
+        }
+
+        // items queued right now, and the most ever queued, from any thread
+        uint32_t size() const { return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_relaxed); }
+        uint32_t maxQueued() const { return maxSize.load(std::memory_order_relaxed); }
+
+        // seconds the producer spent waiting for room, and the consumer for items
+        double producerStall() const { return 1e-9 * producerWait.load(std::memory_order_relaxed); }
+        double consumerStall() const { return 1e-9 * consumerWait.load(std::memory_order_relaxed); }
+
+    private:
+        static uint32_t roundUp(size_t n) {
+            uint32_t p = 1;
+            while(p<n) {
+                p <<= 1;
+            }
+            return p;
+        }
+        static uint64_t now() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return ts.tv_sec*1000000000ull + ts.tv_nsec;
+        }
+
+        // indices run freely and wrap around, only their difference matters
+        uint32_t mask;
+        std::vector<T> slots;
+        alignas(64) std::atomic<uint32_t> head;
+        alignas(64) std::atomic<uint32_t> tail;
+        alignas(64) std::atomic<uint32_t> maxSize;
+        std::atomic<uint64_t> producerWait;
+        std::atomic<uint64_t> consumerWait;
+    };
+
+#endif // __SPSC_H__
@@ -0,0 +1,417 @@
+/*
+
+     batching HTTP uploader, see upload.h
+
+ */
+
+// stuff we need
+#include <log.h>
+#include <time.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <chrono>
+#include <string.h>
+#include <unistd.h>
+#include <upload.h>
+#include <algorithm>
+#include <inttypes.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+// queue file header
+struct UploadQueueHeader {
+    char     magic[8];
+    uint64_t nbAcked;
+};
+
+// queue file magic
+static const char kMagic[8] = { 'A', 'C', 'C', 'U', 'U', 'P', 'L', 'Q' };
+
+// monotonic clock in milliseconds
+static int64_t nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000ll + ts.tv_nsec/1000000;
+}
+
+Uploader::Uploader()
+    :   batchSize(0),
+        lingerMs(0),
+        fd(-1),
+        nbQueued(0),
+        nbAcked(0),
+        firstPending(0),
+        stopping(false)
+{
+}
+
+Uploader::~Uploader() {
+    close();
+}
+
+bool Uploader::open(
+    const char *_url,
+    const char *_queuePath,
+    size_t _batchSize,
+    int _lingerMs
+) {
+    close();
+    url = _url;
+    queuePath = _queuePath;
+    batchSize = std::max(size_t(1), _batchSize);
+    lingerMs = std::max(0, _lingerMs);
+
+    // one uploader per queue
+    fd = ::open(queuePath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd<0 || 0!=flock(fd, LOCK_EX | LOCK_NB)) {
+        LOG_WRN("failed to open upload queue %s (or it is in use)", queuePath.c_str());
+        close();
+        return false;
+    }
+
+    // resume queue, or start one
+    struct stat st;
+    fstat(fd, &st);
+    UploadQueueHeader header;
+    if(size_t(st.st_size)<sizeof(header)) {
+        memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.nbAcked = 0;
+        if(sizeof(header)!=pwrite(fd, &header, sizeof(header), 0) || 0!=ftruncate(fd, sizeof(header))) {
+            LOG_WRN("failed to initialize upload queue %s", queuePath.c_str());
+            close();
+            return false;
+        }
+        st.st_size = sizeof(header);
+    } else if(sizeof(header)!=pread(fd, &header, sizeof(header), 0) || 0!=memcmp(header.magic, kMagic, sizeof(kMagic))) {
+        LOG_WRN("%s is not an upload queue", queuePath.c_str());
+        close();
+        return false;
+    }
+    nbQueued = (st.st_size - sizeof(header)) / sizeof(ArchiveRecord);
+    nbAcked = std::min(header.nbAcked, nbQueued);
+
+    // a crash while starting the queue over leaves it acknowledging records it no longer holds:
+    // say so on disk before any new ones come in behind, or they'd be skipped
+    if(nbAcked!=header.nbAcked && false==writeAcked()) {
+        close();
+        return false;
+    }
+    if(nbAcked<nbQueued) {
+        LOG_NFO("resuming upload of %d queued readings", int(nbQueued - nbAcked));
+    }
+
+    // leftovers from a previous run are due right away
+    firstPending = (nowMs() - lingerMs);
+    stopping = false;
+    thread = std::thread([this]() { work(); });
+    return true;
+}
+
+void Uploader::close() {
+    if(thread.joinable()) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        thread.join();
+        if(nbAcked<nbQueued) {
+            LOG_WRN("%d readings left in upload queue %s for next time", int(nbQueued - nbAcked), queuePath.c_str());
+        }
+    }
+    if(0<=fd) {
+        ::close(fd);
+        fd = -1;
+    }
+    nbQueued = nbAcked = 0;
+}
+
+bool Uploader::add(
+    const ArchiveRecord *records,
+    size_t count
+) {
+    // only valid readings go out
+    std::vector<ArchiveRecord> valid;
+    valid.reserve(count);
+    for(size_t i=0; i<count; ++i) {
+        if(0==records[i].status) {
+            valid.push_back(records[i]);
+        }
+    }
+    if(0==valid.size() || fd<0) {
+        return true;
+    }
+
+    // on disk first, then in line
+    std::unique_lock<std::mutex> guard(lock);
+    auto size = valid.size() * sizeof(ArchiveRecord);
+    auto offset = (sizeof(UploadQueueHeader) + nbQueued*sizeof(ArchiveRecord));
+    auto ok = (
+        ssize_t(size)==pwrite(fd, valid.data(), size, offset)    &&
+        0==fdatasync(fd)
+    );
+    if(false==ok) {
+        LOG_WRN("failed to queue readings in %s", queuePath.c_str());
+        return false;
+    }
+    if(nbAcked==nbQueued) {
+        firstPending = nowMs();
+    }
+    nbQueued += valid.size();
+    wakeUp.notify_all();
+    return true;
+}
+
+void Uploader::work() {
+    auto backoffMs = 1000;
+    std::unique_lock<std::mutex> guard(lock);
+    while(true) {
+
+        // nothing to do
+        auto pending = (nbQueued - nbAcked);
+        if(0==pending) {
+            if(stopping) {
+                break;
+            }
+            wakeUp.wait(guard);
+            continue;
+        }
+
+        // partial batch: give it a chance to fill up, unless on the way out
+        auto due = (firstPending + lingerMs);
+        if(false==stopping && pending<batchSize && nowMs()<due) {
+            wakeUp.wait_for(guard, std::chrono::milliseconds(due - nowMs()));
+            continue;
+        }
+
+        // post a batch, without holding up add()
+        auto count = std::min(pending, uint64_t(batchSize));
+        std::vector<ArchiveRecord> records;
+        guard.unlock();
+        auto status = (batch(count, records) ? send(records) : -1);
+        guard.lock();
+        if(200<=status && status<300) {
+            acknowledge(count);
+            backoffMs = 1000;
+            continue;
+        }
+
+        // the server won't take it, ever: set it aside and move on
+        if(false==retryable(status)) {
+            LOG_WRN("%s rejected %d readings (%d), moving them to %s.rejected", url.c_str(), (int)count, status, queuePath.c_str());
+            reject(records);
+            acknowledge(count);
+            continue;
+        }
+
+        // try again later, or next run
+        if(stopping) {
+            break;
+        }
+        LOG_WRN("upload to %s failed, retrying in %d ms", url.c_str(), backoffMs);
+        wakeUp.wait_for(guard, std::chrono::milliseconds(backoffMs));
+        backoffMs = std::min(2*backoffMs, 60000);
+    }
+}
+
+bool Uploader::retryable(
+    int status
+) {
+    // no answer, server trouble, or being told to slow down
+    return (status<=0 || 500<=status || 429==status);
+}
+
+bool Uploader::batch(
+    size_t count,
+    std::vector<ArchiveRecord> &records
+) {
+    // oldest unsent records, nbAcked only moves in this thread
+    records.resize(count);
+    auto size = count * sizeof(ArchiveRecord);
+    auto offset = (sizeof(UploadQueueHeader) + nbAcked*sizeof(ArchiveRecord));
+    if(ssize_t(size)!=pread(fd, records.data(), size, offset)) {
+        LOG_WRN("failed to read upload queue %s", queuePath.c_str());
+        return false;
+    }
+    return true;
+}
+
+int Uploader::send(
+    const std::vector<ArchiveRecord> &records
+) {
+    // as JSON
+    std::string body = "[";
+    char line[256];
+    for(size_t i=0; i<records.size(); ++i) {
+        auto &r = records[i];
+        struct tm t;
+        time_t epoch = r.epoch;
+        localtime_r(&epoch, &t);
+        snprintf(
+            line,
+            sizeof(line),
+            "%s\n    { \"device\":\"0x%08x\", \"epoch\":%" PRId64 ", \"timestamp\":\"%04d/%02d/%02d %02d:%02d\", \"mg/dL\":%d, \"mmol/L\":%f }",
+            (0==i ? "" : ","),
+            r.deviceId,
+            r.epoch,
+            1900 + t.tm_year,
+            1 + t.tm_mon,
+            t.tm_mday,
+            t.tm_hour,
+            t.tm_min,
+            (int)r.mgdl,
+            r.mgdl / 18.0
+        );
+        body += line;
+    }
+    body += "\n]\n";
+    return post(url, body);
+}
+
+void Uploader::reject(
+    const std::vector<ArchiveRecord> &records
+) {
+    // same records as the queue holds, for someone to look at
+    auto path = (queuePath + ".rejected");
+    auto out = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    auto size = records.size() * sizeof(ArchiveRecord);
+    auto ok = (
+        0<=out                                              &&
+        ssize_t(size)==write(out, records.data(), size)     &&
+        0==fdatasync(out)
+    );
+    if(false==ok) {
+        LOG_WRN("failed to write rejected readings to %s, dropping them", path.c_str());
+    }
+    if(0<=out) {
+        ::close(out);
+    }
+}
+
+bool Uploader::acknowledge(
+    size_t count
+) {
+    // a crash before this sticks means the batch goes out again, never that it gets lost
+    nbAcked += count;
+    if(false==writeAcked()) {
+        return false;
+    }
+
+    // everything went out: start the queue over, the header saying so first
+    if(nbAcked==nbQueued) {
+        nbAcked = nbQueued = 0;
+        if(0!=ftruncate(fd, sizeof(UploadQueueHeader))) {
+            LOG_WRN("failed to truncate upload queue %s", queuePath.c_str());
+        }
+        return writeAcked();
+    }
+    return true;
+}
+
+bool Uploader::writeAcked() {
+    auto at = offsetof(UploadQueueHeader, nbAcked);
+    auto ok = (
+        sizeof(nbAcked)==pwrite(fd, &nbAcked, sizeof(nbAcked), at)  &&
+        0==fdatasync(fd)
+    );
+    if(false==ok) {
+        LOG_WRN("failed to update upload queue %s", queuePath.c_str());
+    }
+    return ok;
+}
+
+int Uploader::post(
+    const std::string &url,
+    const std::string &body
+) {
+    // http://host[:port][/path]
+    if(0!=url.compare(0, 7, "http://")) {
+        LOG_WRN("can only upload to http:// urls, not %s", url.c_str());
+        return -1;
+    }
+    auto rest = url.substr(7);
+    auto slash = rest.find('/');
+    auto hostPort = rest.substr(0, slash);
+    auto path = (std::string::npos==slash ? std::string("/") : rest.substr(slash));
+    auto colon = hostPort.rfind(':');
+    auto host = hostPort.substr(0, colon);
+    auto port = (std::string::npos==colon ? std::string("80") : hostPort.substr(1 + colon));
+
+    // connect
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addrs = 0;
+    if(0!=getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs)) {
+        LOG_WRN("failed to resolve %s", host.c_str());
+        return -1;
+    }
+    auto fd = -1;
+    for(auto ai=addrs; 0!=ai && fd<0; ai=ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if(fd<0) {
+            continue;
+        }
+        struct timeval timeout = { 10, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if(0!=connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+    if(fd<0) {
+        LOG_WRN("failed to connect to %s", hostPort.c_str());
+        return -1;
+    }
+
+    // request
+    auto request = (
+        "POST " + path + " HTTP/1.1\r\n"
+        "Host: " + hostPort + "\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n"
+        "\r\n" +
+        body
+    );
+    auto p = request.data();
+    auto left = request.size();
+    while(0<left) {
+        auto n = ::send(fd, p, left, MSG_NOSIGNAL);
+        if(n<=0) {
+            LOG_WRN("failed to send request to %s", hostPort.c_str());
+            ::close(fd);
+            return -1;
+        }
+        p += n;
+        left -= n;
+    }
+
+    // status line is all we care about
+    std::string response;
+    char buf[512];
+    while(std::string::npos==response.find("\r\n") && response.size()<4096) {
+        auto n = recv(fd, buf, sizeof(buf), 0);
+        if(n<=0) {
+            break;
+        }
+        response.append(buf, n);
+    }
+    ::close(fd);
+    auto space = response.find(' ');
+    auto status = (std::string::npos==space ? 0 : atoi(1 + space + response.c_str()));
+    if(status<=0) {
+        LOG_WRN("no answer from %s", url.c_str());
+        return -1;
+    }
+    if(status<200 || 300<=status) {
+        LOG_WRN("%s answered %d", url.c_str(), status);
+    }
+    return status;
+}
+
@@ -0,0 +1,85 @@
+#ifndef __UPLOAD_H__
+    #define __UPLOAD_H__
+
+    /*
+
+         batching HTTP uploader with an on-disk retry queue
+
+         readings handed to add() are appended to a queue file right away,
+         a background thread then POSTs them as JSON arrays of at most
+         batchSize readings to an http:// URL, as soon as a batch is full or
+         lingerMs after the first reading of a partial batch came in.
+
+         the queue file is a header holding how many records were
+         acknowledged (2xx) so far, followed by the records. posts that
+         got no answer, a 5xx or a 429 are retried with backoff, and
+         whatever is still queued when the process exits is sent by the
+         next run. any other answer means the server will never take that
+         batch: it is logged, appended to "<queue>.rejected" (records as in
+         the queue) and skipped, so one bad batch doesn't hold up the rest.
+         only one batch is ever in memory.
+
+         batch body, one element per reading:
+
+             { "device":"0x1234abcd", "epoch":1700000000, "timestamp":"2023/11/14 22:13", "mg/dL":104, "mmol/L":5.777778 }
+
+     */
+
+    #include <mutex>
+    #include <string>
+    #include <thread>
+    #include <vector>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <archive.h>
+    #include <condition_variable>
+
+    struct Uploader {
+
+        Uploader();
+        ~Uploader();
+
+        // open (or resume) queue file and start posting to url
+        bool open(
+            const char *url,
+            const char *queuePath,
+            size_t batchSize = 500,
+            int lingerMs = 1000
+        );
+
+        // try to send whatever is queued, then stop
+        void close();
+
+        // queue valid readings for upload
+        bool add(const ArchiveRecord *records, size_t count);
+
+        // POST body to an http:// url, HTTP status of the answer, -1 if there was none
+        static int post(const std::string &url, const std::string &body);
+
+        // true if a post that got status may go through when tried again
+        static bool retryable(int status);
+
+    private:
+        void work();
+        bool batch(size_t count, std::vector<ArchiveRecord> &records);
+        int send(const std::vector<ArchiveRecord> &records);
+        void reject(const std::vector<ArchiveRecord> &records);
+        bool acknowledge(size_t count);
+        bool writeAcked();
+
+        std::mutex lock;
+        std::condition_variable wakeUp;
+        std::thread thread;
+        std::string url;
+        std::string queuePath;
+        size_t batchSize;
+        int lingerMs;
+        int fd;
+        uint64_t nbQueued;      // records in queue file
+        uint64_t nbAcked;       // of which were sent
+        int64_t firstPending;   // when the oldest unsent record was queued (ms)
+        bool stopping;
+    };
+
+#endif // __UPLOAD_H__
+